@@ -0,0 +1,15 @@
+#include <errno.h>
+#include <time.h>
+
+#include "syscall.h"
+
+int clock_gettime(clockid_t clock_id, struct timespec *tp)
+{
+	int ret = __syscall(228, clock_id, (uint64_t)tp, 0, 0, 0, 0);
+	if (ret != 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
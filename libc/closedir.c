@@ -0,0 +1,13 @@
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dir_struct.h"
+
+int closedir(struct __dirstream *dirp)
+{
+	int ret = close(dirp->fd);
+	free(dirp);
+
+	return ret;
+}
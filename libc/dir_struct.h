@@ -0,0 +1,21 @@
+#ifndef _DIR_STRUCT
+#define _DIR_STRUCT
+
+#include <dirent.h>
+#include <stddef.h>
+
+struct __dirstream
+{
+	int fd;
+
+	// Raw records from getdents64, and our position within them.
+	char buffer[4096];
+	size_t buffer_size;
+	size_t buffer_position;
+
+	// readdir returns a pointer to this, so it's only valid until the next
+	// call.
+	struct dirent entry;
+};
+
+#endif
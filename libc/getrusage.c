@@ -0,0 +1,15 @@
+#include <errno.h>
+#include <sys/resource.h>
+
+#include "syscall.h"
+
+int getrusage(int who, struct rusage *usage)
+{
+	int ret = __syscall(98, who, (uint64_t)usage, 0, 0, 0, 0);
+	if (ret != 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
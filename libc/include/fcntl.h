@@ -8,5 +8,6 @@ int open(const char *pathname, int flags, ...);
 #define O_CREAT  00100
 #define O_EXCL   00200
 #define O_TRUNC  01000
+#define O_DIRECTORY 0200000
 
 #endif
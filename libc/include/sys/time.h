@@ -0,0 +1,14 @@
+#ifndef _SYS_TIME_H
+#define _SYS_TIME_H
+
+#include <time.h>
+
+typedef long suseconds_t;
+
+struct timeval
+{
+	time_t tv_sec;
+	suseconds_t tv_usec;
+};
+
+#endif
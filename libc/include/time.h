@@ -9,6 +9,14 @@ struct timespec
 	long tv_nsec;
 };
 
+typedef int clockid_t;
+
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+#define CLOCK_PROCESS_CPUTIME_ID 2
+#define CLOCK_THREAD_CPUTIME_ID 3
+
 time_t time(time_t *t);
+int clock_gettime(clockid_t clock_id, struct timespec *tp);
 
 #endif
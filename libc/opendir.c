@@ -0,0 +1,24 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dir_struct.h"
+
+struct __dirstream *opendir(const char *name)
+{
+	int fd = open(name, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		return NULL;
+
+	struct __dirstream *dirp = malloc(sizeof *dirp);
+	if (dirp == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	dirp->fd = fd;
+	dirp->buffer_size = 0;
+	dirp->buffer_position = 0;
+	return dirp;
+}
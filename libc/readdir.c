@@ -0,0 +1,54 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dir_struct.h"
+#include "syscall.h"
+
+// The layout of the records returned by getdents64 is:
+//   u64 d_ino; i64 d_off; u16 d_reclen; u8 d_type; char d_name[];
+#define D_INO_OFFSET 0
+#define D_OFF_OFFSET 8
+#define D_RECLEN_OFFSET 16
+#define D_TYPE_OFFSET 18
+#define D_NAME_OFFSET 19
+
+struct dirent *readdir(struct __dirstream *dirp)
+{
+	if (dirp->buffer_position >= dirp->buffer_size) {
+		char *buffer = dirp->buffer;
+		int64_t ret = __syscall(217, dirp->fd, (uint64_t)buffer,
+				sizeof dirp->buffer, 0, 0, 0);
+		if (ret < 0) {
+			errno = -ret;
+			return NULL;
+		}
+		// End of directory
+		if (ret == 0)
+			return NULL;
+
+		dirp->buffer_size = ret;
+		dirp->buffer_position = 0;
+	}
+
+	char *record = dirp->buffer + dirp->buffer_position;
+	struct dirent *entry = &dirp->entry;
+
+	unsigned short reclen;
+	memcpy(&entry->d_ino, record + D_INO_OFFSET, sizeof entry->d_ino);
+	memcpy(&entry->d_off, record + D_OFF_OFFSET, sizeof entry->d_off);
+	memcpy(&reclen, record + D_RECLEN_OFFSET, sizeof reclen);
+	entry->d_reclen = reclen;
+	entry->d_type = (unsigned char)record[D_TYPE_OFFSET];
+
+	char *name = record + D_NAME_OFFSET;
+	size_t name_length = strlen(name);
+	if (name_length >= sizeof entry->d_name)
+		name_length = sizeof entry->d_name - 1;
+	memcpy(entry->d_name, name, name_length);
+	entry->d_name[name_length] = '\0';
+
+	dirp->buffer_position += reclen;
+	return entry;
+}
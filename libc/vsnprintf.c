@@ -12,5 +12,15 @@ int vsnprintf(char *str, size_t size, const char *format, va_list ap)
 		.has_limit = true,
 	};
 
-	return printf_impl(string_sink, &string_sink_arg, format, ap);
+	// As in C99, we return the length the output would have had without the
+	// limit, not counting the null terminator, and truncate to fit.
+	int ret = printf_impl(string_sink, &string_sink_arg, format, ap);
+	if (size != 0) {
+		if ((size_t)ret < size)
+			str[ret] = '\0';
+		else
+			str[size - 1] = '\0';
+	}
+
+	return ret;
 }
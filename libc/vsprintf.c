@@ -11,5 +11,8 @@ int vsprintf(char *str, const char *format, va_list ap)
 		.has_limit = false,
 	};
 
-	return printf_impl(string_sink, &string_sink_arg, format, ap);
+	int ret = printf_impl(string_sink, &string_sink_arg, format, ap);
+	str[ret] = '\0';
+
+	return ret;
 }
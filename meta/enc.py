@@ -40,7 +40,7 @@ def generate_encoder(input_filename, output_filename):
             else:
                 arg_order = 'INVALID'
 
-            if 'rel' in args:
+            if any(arg.startswith('rel') for arg in args):
                 fixup_type = 'FIXUP_RELATIVE'
             else:
                 fixup_type = 'FIXUP_ABSOLUTE'
@@ -206,7 +206,13 @@ def arg_conditions(args):
                 '(is_const_and_fits({0}, {1}, {2}, '
                 + 'is_sign_extending_instr(instr)))')
                 .format(arg_str, ext_width, width))
-        elif arg == 'rel':
+        elif arg == 'rel8':
+            # Whether a branch fits in a rel8 is decided by branch relaxation
+            # in assemble(), as it depends on the final layout of the code.
+            conditions.append(
+                    '(instr->short_branch && {0}.t == ASM_VALUE_CONST)'
+                    .format(arg_str))
+        elif arg == 'rel32':
             conditions.append('({0}.t == ASM_VALUE_CONST)'.format(arg_str))
         elif arg in REGISTER_MAP:
             reg_class, width = REGISTER_MAP[arg]
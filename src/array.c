@@ -4,6 +4,8 @@
 #include <string.h>
 #include "array.h"
 
+THREAD_LOCAL u64 array_bytes_allocated = 0;
+
 void _array_init(Array_ *array, u32 element_size, u32 initial_capacity)
 {
 	array->capacity = initial_capacity;
@@ -13,6 +15,7 @@ void _array_init(Array_ *array, u32 element_size, u32 initial_capacity)
 		array->elements = NULL;
 	} else {
 		array->elements = malloc(element_size * initial_capacity);
+		array_bytes_allocated += element_size * initial_capacity;
 	}
 }
 
@@ -24,9 +27,11 @@ void _array_ensure_room(Array_ *array, u32 element_size, u32 count)
 			array->capacity = new_size;
 		}
 
+		u32 old_capacity = array->elements == NULL ? 0 : array->capacity;
 		while (new_size > array->capacity) {
 			array->capacity *= 2;
 		}
+		array_bytes_allocated += (array->capacity - old_capacity) * element_size;
 		array->elements = realloc(array->elements, array->capacity * element_size);
 	}
 }
@@ -44,7 +49,7 @@ void array_free(Array_ *array)
 void _array_append_elems(Array_ *array, u32 element_size, u32 size, void *elems)
 {
 	_array_ensure_room(array, element_size, size);
-	u8 *end = array->elements + array->size;
+	u8 *end = array->elements + array->size * element_size;
 	memcpy(end, elems, size * element_size);
 	array->size += size;
 }
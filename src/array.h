@@ -15,6 +15,10 @@ typedef struct Array_
 // This is just used to make types self-documenting
 #define Array(T) Array_
 
+// Total bytes ever allocated for array storage by this thread, for
+// -ftime-report.
+extern THREAD_LOCAL u64 array_bytes_allocated;
+
 void _array_init(Array_ *array, u32 element_size, u32 initial_capacity);
 void _array_ensure_room(Array_ *array, u32 element_size, u32 count);
 void _array_append_elems(Array_ *array, u32 element_size, u32 size, void *elems);
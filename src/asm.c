@@ -689,7 +689,7 @@ static void encode_instr(Array(u8) *output, AsmModule *asm_module,
 				encoded_instr.imm_fixup = fixup;
 				fixup->type = fixup_type;
 				fixup->section = TEXT_SECTION;
-				fixup->size_bytes = 4;
+				fixup->size_bytes = immediate_size;
 				fixup->symbol = constant.u.symbol;
 
 				// Dummy value, gets patched later.
@@ -729,10 +729,24 @@ static void encode_instr(Array(u8) *output, AsmModule *asm_module,
 		assert((encoded_instr.rex_prefix & REX_B) == 0);
 		encoded_instr.rex_prefix |= REX_B;
 	}
+	// Without a REX prefix, the 8-bit encodings of SP, BP, SI and DI refer to
+	// AH, CH, DH and BH instead. An empty REX prefix selects SPL, BPL, SIL and
+	// DIL.
+	bool needs_rex = encoded_instr.rex_prefix != 0;
+	for (u32 i = 0; i < instr->arity; i++) {
+		AsmValue *arg = instr->args + i;
+		if (arg->t == ASM_VALUE_REGISTER && !arg->is_deref
+				&& arg->u.reg.width == 8) {
+			u32 reg_number = encoded_register_number(get_reg_class(arg));
+			if (reg_number >= 4 && reg_number < 8)
+				needs_rex = true;
+		}
+	}
+
 	if (encoded_instr.has_oso) {
 		write_u8(output, 0x66);
 	}
-	if (encoded_instr.rex_prefix != 0) {
+	if (needs_rex) {
 		encoded_instr.rex_prefix |= REX_HIGH;
 		write_u8(output, encoded_instr.rex_prefix);
 	}
@@ -771,6 +785,102 @@ static void encode_instr(Array(u8) *output, AsmModule *asm_module,
 // This is generated from "x64.enc", and defines the function "assemble_instr".
 #include "x64.inc"
 
+static bool is_branch(AsmOp op)
+{
+	switch (op) {
+	case JMP: case JE: case JNE: case JG: case JGE: case JL: case JLE:
+	case JA: case JAE: case JB: case JBE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Returns the index of the instruction that a branch targets, or -1 if it
+// doesn't target a label in this module. Relies on the labels' offsets being
+// set to the index of the instruction they label.
+static i32 branch_target_index(Array(AsmInstr) *instrs, AsmInstr *instr)
+{
+	if (!is_branch(instr->op) || instr->arity != 1
+			|| instr->args[0].t != ASM_VALUE_CONST
+			|| instr->args[0].is_deref
+			|| instr->args[0].u.constant.t != ASM_CONST_SYMBOL) {
+		return -1;
+	}
+
+	AsmSymbol *target = instr->args[0].u.constant.u.symbol;
+	if (!target->defined || target->section != TEXT_SECTION
+			|| target->offset >= instrs->size
+			|| ARRAY_REF(instrs, AsmInstr, target->offset)->label != target) {
+		return -1;
+	}
+
+	return target->offset;
+}
+
+static void assemble_instrs(AsmModule *asm_module, u32 *instr_offsets)
+{
+	Array(AsmInstr) *instrs = &asm_module->text.instrs;
+	for (u32 i = 0; i < instrs->size; i++) {
+		AsmInstr *instr = ARRAY_REF(instrs, AsmInstr, i);
+		instr_offsets[i] = asm_module->text.bytes.size;
+		assemble_instr(&asm_module->text.bytes, asm_module, instr);
+	}
+	instr_offsets[instrs->size] = asm_module->text.bytes.size;
+}
+
+// Branch relaxation: we start out assuming every branch to a label in this
+// module fits in a rel8, and then repeatedly grow the ones whose displacement
+// doesn't fit to rel32. Growing a branch can only ever push other branches
+// further out of range, so this terminates, and usually does so after one or
+// two iterations.
+//
+// Returns whether any branch was grown, in which case the code has to be
+// reassembled.
+static bool relax_branches(Array(AsmInstr) *instrs, u32 *instr_offsets)
+{
+	u32 num_instrs = instrs->size;
+	u32 *sizes = malloc(num_instrs * sizeof *sizes);
+	for (u32 i = 0; i < num_instrs; i++)
+		sizes[i] = instr_offsets[i + 1] - instr_offsets[i];
+
+	bool grew_any = false;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+
+		u32 offset = 0;
+		for (u32 i = 0; i < num_instrs; i++) {
+			instr_offsets[i] = offset;
+			offset += sizes[i];
+		}
+		instr_offsets[num_instrs] = offset;
+
+		for (u32 i = 0; i < num_instrs; i++) {
+			AsmInstr *instr = ARRAY_REF(instrs, AsmInstr, i);
+			if (!instr->short_branch)
+				continue;
+
+			u32 target = branch_target_index(instrs, instr);
+			i64 displacement =
+				(i64)instr_offsets[target] - (i64)instr_offsets[i + 1];
+			if ((i8)displacement == displacement)
+				continue;
+
+			// JMP rel8 (EB cb) becomes JMP rel32 (E9 cd), and Jcc rel8
+			// (7x cb) becomes Jcc rel32 (0F 8x cd).
+			instr->short_branch = false;
+			sizes[i] += instr->op == JMP ? 3 : 4;
+			changed = true;
+			grew_any = true;
+		}
+	}
+
+	free(sizes);
+
+	return grew_any;
+}
+
 void assemble(AsmModule *asm_module)
 {
 	// Reserve space for 3 bytes per instruction (pulling numbers out of thin
@@ -780,19 +890,44 @@ void assemble(AsmModule *asm_module)
 	Array(AsmInstr) *instrs = &asm_module->text.instrs;
 	for (u32 i = 0; i < instrs->size; i++) {
 		AsmInstr *instr = ARRAY_REF(instrs, AsmInstr, i);
-
-		u32 instr_start = asm_module->text.bytes.size;
-		assemble_instr(&asm_module->text.bytes, asm_module, instr);
-
 		AsmSymbol *symbol = instr->label;
 		if (symbol != NULL) {
 			assert(symbol->section == TEXT_SECTION);
 			assert(symbol->defined);
 
-			symbol->offset = instr_start;
+			symbol->offset = i;
+		}
+	}
+	for (u32 i = 0; i < instrs->size; i++) {
+		AsmInstr *instr = ARRAY_REF(instrs, AsmInstr, i);
+		instr->short_branch = branch_target_index(instrs, instr) != -1;
+	}
+
+	u32 *instr_offsets = malloc((instrs->size + 1) * sizeof *instr_offsets);
+	u32 num_fixups = asm_module->fixups.size;
+	assemble_instrs(asm_module, instr_offsets);
+
+	if (relax_branches(instrs, instr_offsets)) {
+		// @NOTE: The fixups from the first pass are allocated from the pool,
+		// so we just drop them on the floor here.
+		asm_module->text.bytes.size = 0;
+		asm_module->fixups.size = num_fixups;
+		assemble_instrs(asm_module, instr_offsets);
+	}
+
+	for (u32 i = 0; i < instrs->size; i++) {
+		AsmSymbol *symbol = ARRAY_REF(instrs, AsmInstr, i)->label;
+		if (symbol != NULL) {
+			symbol->offset = instr_offsets[i];
+			if (symbol->size != 0) {
+				assert(i + symbol->size <= instrs->size);
+				symbol->size = instr_offsets[i + symbol->size] - instr_offsets[i];
+			}
 		}
 	}
 
+	free(instr_offsets);
+
 	array_free(&asm_module->text.instrs);
 	asm_module->text.instrs = EMPTY_ARRAY;
 
@@ -818,6 +953,7 @@ void assemble(AsmModule *asm_module)
 
 		// Relative accesses are relative to the start of the next instruction.
 		i32 value = (i32)symbol->offset - (i32)fixup->next_instr_offset;
+		assert(fixup->size_bytes != 1 || (i8)value == value);
 		write_int_at(&asm_module->text.bytes, fixup->offset,
 				(u64)value, fixup->size_bytes);
 	}
@@ -118,6 +118,7 @@ typedef struct AsmValue
 	X(POP), \
 	X(IMUL), \
 	X(IDIV), \
+	X(DIV), \
 	X(CDQ), \
 	X(CQO), \
 	X(CMP), \
@@ -163,6 +164,9 @@ typedef struct AsmInstr
 	u8 num_deps;
 	u32 vreg_deps[2];
 
+	// Set by branch relaxation in assemble(), selects the rel8 encoding.
+	bool short_branch;
+
 	struct AsmSymbol *label;
 } AsmInstr;
 
@@ -227,10 +231,10 @@ typedef struct AsmSymbol
 	// asm-level analysis. After assembly it stores the offset in number of
 	// bytes, for object file emission.
 	u32 offset;
+	// @NOTE: Similarly, for functions this is the number of instructions
+	// until assembly, and the number of bytes after. Labels within functions
+	// have size 0.
 	u32 size;
-
-	// Used for asm_gen
-	struct Pred *pred;
 } AsmSymbol;
 
 typedef enum FixupType
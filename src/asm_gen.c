@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "array.h"
 #include "bit_set.h"
@@ -16,6 +17,8 @@ void init_asm_builder(AsmBuilder *builder, char *input_file_name)
 	builder->local_stack_usage = 0;
 	builder->curr_sp_diff = 0;
 	builder->virtual_registers = EMPTY_ARRAY;
+	builder->total_vregs = 0;
+	ARRAY_INIT(&builder->jump_tables, AsmJumpTable, 4);
 }
 
 void free_asm_builder(AsmBuilder *builder)
@@ -24,6 +27,7 @@ void free_asm_builder(AsmBuilder *builder)
 
 	if (ARRAY_IS_VALID(&builder->virtual_registers))
 		array_free(&builder->virtual_registers);
+	array_free(&builder->jump_tables);
 }
 
 AsmInstr *emit_instr0(AsmBuilder *builder, AsmOp op)
@@ -101,6 +105,7 @@ static u32 new_vreg(AsmBuilder *builder)
 	vreg->t = UNASSIGNED;
 	vreg->live_range_start = vreg->live_range_end = -1;
 	vreg->pre_alloced = false;
+	builder->total_vregs++;
 
 	return builder->virtual_registers.size - 1;
 }
@@ -283,9 +288,33 @@ static AsmValue maybe_move_const_to_reg(AsmBuilder *builder,
 		return const_spill;
 	}
 
+	// Symbols are only encodable as imm64, which only MOV supports.
+	if (asm_value.t == ASM_VALUE_CONST
+			&& asm_value.u.constant.t == ASM_CONST_SYMBOL) {
+		AsmValue symbol_spill = asm_vreg(new_vreg(builder), 64);
+		emit_instr2(builder, MOV, symbol_spill, asm_value);
+
+		return symbol_spill;
+	}
+
 	return asm_value;
 }
 
+// Most instructions need at least one operand in a register. After mem2reg
+// constants and globals can turn up in operand positions that used to always
+// be loads, so this moves them into a fresh vreg when necessary.
+static AsmValue move_to_reg(AsmBuilder *builder, AsmValue value, u8 width)
+{
+	if (value.t == ASM_VALUE_REGISTER)
+		return value;
+
+	AsmValue vreg = asm_vreg(new_vreg(builder), 64);
+	emit_instr2(builder, MOV, vreg, value);
+	vreg.u.reg.width = width;
+
+	return vreg;
+}
+
 static IrCmp maybe_flip_conditional(IrCmp cmp, IrValue *arg1, IrValue *arg2)
 {
 	if (arg1->t != IR_VALUE_CONST)
@@ -331,12 +360,13 @@ static bool get_inner_cmp(AsmBuilder *builder, IrInstr *instr, IrInstr **out)
 
 	u64 c;
 	IrValue non_const_arg;
-	if (arg1.t == IR_VALUE_CONST) {
-		assert(arg2.t != IR_VALUE_CONST);
+	if (arg1.t == IR_VALUE_CONST && arg2.t == IR_VALUE_CONST) {
+		*out = instr;
+		return false;
+	} else if (arg1.t == IR_VALUE_CONST) {
 		c = arg1.u.constant;
 		non_const_arg = arg2;
 	} else if (arg2.t == IR_VALUE_CONST) {
-		assert(arg1.t != IR_VALUE_CONST);
 		c = arg2.u.constant;
 		non_const_arg = arg1;
 	} else {
@@ -413,13 +443,12 @@ static AsmValue asm_gen_relational_instr(AsmBuilder *builder, IrInstr *instr)
 	case CMP_ULTE: op = SETBE; break;
 	}
 
-	AsmValue asm_arg1 = asm_value(builder, arg1);
+	AsmValue asm_arg1 = move_to_reg(builder, asm_value(builder, arg1),
+			size_of_ir_type(arg1.type) * 8);
 	AsmValue asm_arg2 = asm_value(builder, arg2);
 
 	u32 vreg = new_vreg(builder);
 
-	assert(asm_arg1.t == ASM_VALUE_REGISTER);
-
 	emit_instr2(builder, XOR, asm_vreg(vreg, 32), asm_vreg(vreg, 32));
 	emit_instr2(builder, CMP, asm_arg1,
 			maybe_move_const_to_reg(builder, asm_arg2, asm_arg1.u.reg.width, true));
@@ -443,10 +472,36 @@ static void asm_gen_binary_instr(AsmBuilder *builder, IrInstr *instr, AsmOp op)
 				arg2, instr->type.u.bit_width, is_sign_extending_op(op)));
 }
 
+bool references_vreg(AsmValue value, u32 vreg);
+
+static Register *arg_reg(AsmValue *arg)
+{
+	if (arg->t == ASM_VALUE_REGISTER)
+		return &arg->u.reg;
+	if (arg->t == ASM_VALUE_OFFSET_REGISTER)
+		return &arg->u.offset_register.reg;
+	return NULL;
+}
+
+typedef struct PhiMove
+{
+	AsmValue dest;
+	AsmValue src;
+} PhiMove;
+
+// All phis at the start of a block are conceptually evaluated at once, so the
+// moves into them form a parallel copy: a phi may read the value of another
+// phi in the same block from the previous iteration, e.g. when swapping two
+// variables in a loop. We sequentialise them by emitting moves whose
+// destination isn't read by any other pending move first, and breaking any
+// remaining cycles with a temporary.
 static void handle_phi_nodes(AsmBuilder *builder, IrBlock *src_block,
 		IrBlock *dest_block)
 {
 	Array(IrInstr *) *dest_instrs = &dest_block->instrs;
+	Array(PhiMove) moves;
+	ARRAY_INIT(&moves, PhiMove, 4);
+
 	for (u32 ir_instr_index = 0;
 			ir_instr_index < dest_instrs->size;
 			ir_instr_index++) {
@@ -457,6 +512,14 @@ static void handle_phi_nodes(AsmBuilder *builder, IrBlock *src_block,
 		if (instr->vreg_number == -1) {
 			instr->vreg_number = new_vreg(builder);
 		}
+	}
+
+	for (u32 ir_instr_index = 0;
+			ir_instr_index < dest_instrs->size;
+			ir_instr_index++) {
+		IrInstr *instr = *ARRAY_REF(dest_instrs, IrInstr *, ir_instr_index);
+		if (instr->op != OP_PHI)
+			break;
 
 		bool encountered_src_block = false;
 		for (u32 phi_param_index = 0;
@@ -464,9 +527,15 @@ static void handle_phi_nodes(AsmBuilder *builder, IrBlock *src_block,
 				phi_param_index++) {
 			IrPhiParam *param = instr->u.phi.params + phi_param_index;
 			if (param->block == src_block) {
-				emit_instr2(builder, MOV,
-						asm_vreg(instr->vreg_number, size_of_ir_type(instr->type) * 8),
-						asm_value(builder, param->value));
+				AsmValue src = asm_value(builder, param->value);
+				if (src.t != ASM_VALUE_REGISTER
+						|| !references_vreg(src, instr->vreg_number)) {
+					*ARRAY_APPEND(&moves, PhiMove) = (PhiMove) {
+						.dest = asm_vreg(instr->vreg_number,
+								size_of_ir_type(instr->type) * 8),
+						.src = src,
+					};
+				}
 
 				encountered_src_block = true;
 				break;
@@ -474,6 +543,48 @@ static void handle_phi_nodes(AsmBuilder *builder, IrBlock *src_block,
 		}
 		assert(encountered_src_block);
 	}
+
+	while (moves.size != 0) {
+		bool emitted = false;
+		for (u32 i = 0; i < moves.size; i++) {
+			PhiMove *move = ARRAY_REF(&moves, PhiMove, i);
+			u32 dest_vreg = move->dest.u.reg.u.vreg_number;
+
+			bool dest_is_read = false;
+			for (u32 j = 0; j < moves.size; j++) {
+				PhiMove *other = ARRAY_REF(&moves, PhiMove, j);
+				if (j != i && references_vreg(other->src, dest_vreg)) {
+					dest_is_read = true;
+					break;
+				}
+			}
+			if (dest_is_read)
+				continue;
+
+			emit_instr2(builder, MOV, move->dest, move->src);
+			ARRAY_REMOVE(&moves, PhiMove, i);
+			emitted = true;
+			break;
+		}
+		if (emitted)
+			continue;
+
+		// Every pending destination is read by another pending move, so we
+		// have a cycle. Save one destination in a temporary and redirect its
+		// readers, which frees it up to be written.
+		PhiMove *move = ARRAY_REF(&moves, PhiMove, 0);
+		u32 dest_vreg = move->dest.u.reg.u.vreg_number;
+		u32 temp_vreg = new_vreg(builder);
+		emit_instr2(builder, MOV, asm_vreg(temp_vreg, 64), asm_vreg(dest_vreg, 64));
+		for (u32 j = 0; j < moves.size; j++) {
+			PhiMove *other = ARRAY_REF(&moves, PhiMove, j);
+			Register *reg = arg_reg(&other->src);
+			if (reg != NULL && reg->t == V_REG && reg->u.vreg_number == dest_vreg)
+				reg->u.vreg_number = temp_vreg;
+		}
+	}
+
+	array_free(&moves);
 }
 
 static RegClass argument_registers[] = {
@@ -671,16 +782,37 @@ static bool asm_gen_cond_of_cmp(AsmBuilder *builder, IrInstr *cond)
 	case CMP_ULTE: jcc = JBE; break;
 	}
 
+	u32 width = size_of_ir_type(arg1.type) * 8;
 	AsmValue arg2_value = maybe_move_const_to_reg(builder,
-			asm_value(builder, arg2), size_of_ir_type(arg1.type) * 8, true);
+			asm_value(builder, arg2), width, true);
+	AsmValue arg1_value = move_to_reg(builder, asm_value(builder, arg1), width);
 
-	emit_instr2(builder, CMP, asm_value(builder, arg1), arg2_value);
+	emit_instr2(builder, CMP, arg1_value, arg2_value);
 	emit_instr1(builder, jcc, asm_symbol(cond->u.cond.then_block->label));
 	// The "else" case is handled by the caller.
 
 	return true;
 }
 
+static void asm_gen_extended_const(AsmBuilder *builder, IrInstr *instr,
+		bool sext)
+{
+	u32 from_width = instr->u.arg.type.u.bit_width;
+	u32 to_width = instr->type.u.bit_width;
+	u64 value = instr->u.arg.u.constant;
+	if (from_width < 64) {
+		value &= (1ULL << from_width) - 1;
+		if (sext && (value & (1ULL << (from_width - 1))) != 0)
+			value |= ~((1ULL << from_width) - 1);
+	}
+	if (to_width < 64)
+		value &= (1ULL << to_width) - 1;
+
+	AsmValue vreg = asm_vreg(new_vreg(builder), 64);
+	assign_vreg(instr, vreg);
+	emit_instr2(builder, MOV, vreg, asm_imm(value));
+}
+
 static void asm_gen_instr(
 		AsmBuilder *builder, IrGlobal *ir_global, IrBlock *curr_block, IrInstr *instr)
 {
@@ -750,7 +882,10 @@ static void asm_gen_instr(
 
 			// @TODO: Special case isel for OP_NOT as well.
 			if (!asm_gen_cond_of_cmp(builder, instr)) {
-				emit_instr2(builder, CMP, asm_value(builder, condition), asm_imm(0));
+				AsmValue condition_value = move_to_reg(builder,
+						asm_value(builder, condition),
+						size_of_ir_type(condition.type) * 8);
+				emit_instr2(builder, CMP, condition_value, asm_imm(0));
 				emit_instr1(builder, JNE, asm_symbol(instr->u.cond.then_block->label));
 			}
 
@@ -759,6 +894,72 @@ static void asm_gen_instr(
 		}
 		break;
 	}
+	case OP_JUMP_TABLE: {
+		AsmModule *asm_module = &builder->asm_module;
+		u32 num_targets = instr->u.jump_table.num_targets;
+
+		AsmSymbol *table = pool_alloc(&asm_module->pool, sizeof *table);
+		*table = (AsmSymbol) {
+			.name = "jump_table",
+			.section = DATA_SECTION,
+			.defined = true,
+			.linkage = ASM_LOCAL_LINKAGE,
+			.offset = asm_module->data.size,
+			.size = num_targets * 8,
+		};
+		*ARRAY_APPEND(&asm_module->symbols, AsmSymbol *) = table;
+
+		AsmSymbol **targets = pool_alloc(&asm_module->pool,
+				num_targets * sizeof *targets);
+		for (u32 i = 0; i < num_targets; i++) {
+			IrBlock *target = instr->u.jump_table.targets[i];
+
+			// There's nowhere to put phi moves for a particular target, so
+			// ir_opt splits these edges.
+			assert(target->instrs.size == 0
+					|| (*ARRAY_REF(&target->instrs, IrInstr *, 0))->op != OP_PHI);
+
+			// The entries are relocated against the targets' labels, so they
+			// need to be in the symbol table. symtab_index isn't assigned
+			// until assemble, so until then we use it to mark the labels
+			// we've already added.
+			AsmSymbol *label = target->label;
+			if (label->symtab_index == 0) {
+				label->symtab_index = 1;
+				*ARRAY_APPEND(&asm_module->symbols, AsmSymbol *) = label;
+			}
+			targets[i] = label;
+
+			Fixup *fixup = pool_alloc(&asm_module->pool, sizeof *fixup);
+			*ARRAY_APPEND(&asm_module->fixups, Fixup *) = fixup;
+			*fixup = (Fixup) {
+				.type = FIXUP_ABSOLUTE,
+				.section = DATA_SECTION,
+				.offset = asm_module->data.size,
+				// @PORT: Hardcoded pointer size.
+				.size_bytes = 8,
+				.symbol = label,
+			};
+			for (u32 j = 0; j < 8; j++)
+				*ARRAY_APPEND(&asm_module->data, u8) = 0;
+		}
+
+		AsmValue entry = asm_vreg(new_vreg(builder), 64);
+		AsmValue offset = asm_vreg(new_vreg(builder), 64);
+		emit_instr2(builder, MOV, entry, asm_symbol(table));
+		emit_instr2(builder, MOV, offset,
+				asm_value(builder, instr->u.jump_table.index));
+		emit_instr2(builder, SHL, offset, asm_imm(3));
+		emit_instr2(builder, ADD, entry, offset);
+		emit_instr1(builder, JMP, asm_deref(entry));
+
+		*ARRAY_APPEND(&builder->jump_tables, AsmJumpTable) = (AsmJumpTable) {
+			.jump_instr = builder->current_block->size - 1,
+			.num_targets = num_targets,
+			.targets = targets,
+		};
+		break;
+	}
 	case OP_PHI: {
 		// Phi nodes are handled by asm_gen for the incoming branches, and
 		// require no codegen in their containing block. All we need to do is
@@ -850,7 +1051,9 @@ static void asm_gen_instr(
 		assert(instr->type.t == IR_INT);
 		assert(instr->u.arg.type.t == IR_INT);
 
-		if (instr->type.u.bit_width == 64
+		if (instr->u.arg.t == IR_VALUE_CONST) {
+			asm_gen_extended_const(builder, instr, false);
+		} else if (instr->type.u.bit_width == 64
 				&& instr->u.arg.type.u.bit_width == 32) {
 			AsmValue vreg = asm_vreg(new_vreg(builder), 32);
 			assign_vreg(instr, vreg);
@@ -869,6 +1072,11 @@ static void asm_gen_instr(
 		assert(instr->type.t == IR_INT);
 		assert(instr->u.arg.type.t == IR_INT);
 
+		if (instr->u.arg.t == IR_VALUE_CONST) {
+			asm_gen_extended_const(builder, instr, true);
+			break;
+		}
+
 		AsmValue vreg = asm_vreg(new_vreg(builder), instr->type.u.bit_width);
 		assign_vreg(instr, vreg);
 		emit_instr2(builder, MOVSX, vreg, asm_value(builder, instr->u.arg));
@@ -886,7 +1094,9 @@ static void asm_gen_instr(
 			assert(value.u.reg.t == V_REG);
 			instr->vreg_number = value.u.reg.u.vreg_number;
 		} else {
-			UNIMPLEMENTED;
+			AsmValue vreg = asm_vreg(new_vreg(builder), 64);
+			assign_vreg(instr, vreg);
+			emit_instr2(builder, MOV, vreg, value);
 		}
 
 		break;
@@ -1203,16 +1413,18 @@ static void asm_gen_instr(
 				const_arg = arg2;
 				non_const_arg = arg1;
 			}
-			assert(non_const_arg.t != ASM_VALUE_CONST);
+			non_const_arg = move_to_reg(builder, non_const_arg, width);
 
-			emit_instr3(builder, IMUL, vreg, non_const_arg, const_arg);
+			emit_instr3(builder, IMUL, vreg, non_const_arg,
+					maybe_move_const_to_reg(builder, const_arg, width, true));
 		}
 
 		break;
 	}
-	case OP_DIV: case OP_MOD: {
+	case OP_DIV: case OP_MOD: case OP_UDIV: case OP_UMOD: {
 		assert(instr->type.t == IR_INT);
 		u8 width = instr->type.u.bit_width;
+		bool is_signed = instr->op == OP_DIV || instr->op == OP_MOD;
 
 		AsmValue arg1 = asm_value(builder, instr->u.binary_op.arg1);
 		AsmValue arg2 = asm_value(builder, instr->u.binary_op.arg2);
@@ -1228,21 +1440,28 @@ static void asm_gen_instr(
 		AsmValue remainder = pre_alloced_vreg(builder, REG_CLASS_D, width);
 		emit_instr2(builder, MOV, quotient, arg1);
 
-		AsmOp sign_extend_op;
-		switch (width) {
-		case 32: sign_extend_op = CDQ; break;
-		case 64: sign_extend_op = CQO; break;
-		}
+		// The dividend is rdx:rax, so the high half is either the sign of the
+		// low half or zero.
+		if (is_signed) {
+			AsmOp sign_extend_op;
+			switch (width) {
+			case 32: sign_extend_op = CDQ; break;
+			case 64: sign_extend_op = CQO; break;
+			}
 
-		AsmInstr *sign_extend = emit_instr0(builder, sign_extend_op);
-		add_dep(sign_extend, quotient);
-		add_dep(sign_extend, remainder);
+			AsmInstr *sign_extend = emit_instr0(builder, sign_extend_op);
+			add_dep(sign_extend, quotient);
+			add_dep(sign_extend, remainder);
+		} else {
+			emit_instr2(builder, MOV, remainder, asm_imm(0));
+		}
 
-		AsmInstr *idiv = emit_instr1(builder, IDIV, reg_arg2);
-		add_dep(idiv, quotient);
-		add_dep(idiv, remainder);
+		AsmInstr *div = emit_instr1(builder, is_signed ? IDIV : DIV, reg_arg2);
+		add_dep(div, quotient);
+		add_dep(div, remainder);
 
-		AsmValue result = instr->op == OP_DIV ? quotient : remainder;
+		bool is_quotient = instr->op == OP_DIV || instr->op == OP_UDIV;
+		AsmValue result = is_quotient ? quotient : remainder;
 		AsmValue vreg = asm_vreg(new_vreg(builder), width);
 		emit_instr2(builder, MOV, vreg, result);
 		assign_vreg(instr, vreg);
@@ -1323,32 +1542,23 @@ static void asm_gen_instr(
 	}
 }
 
-static Register *arg_reg(AsmValue *arg)
-{
-	if (arg->t == ASM_VALUE_REGISTER)
-		return &arg->u.reg;
-	if (arg->t == ASM_VALUE_OFFSET_REGISTER)
-		return &arg->u.offset_register.reg;
-	return NULL;
-}
-
-// Reserved for spills and fills.
-#define SPILL_REGISTER REG_CLASS_R12
+// Reserved for spills and fills. An instruction references at most two
+// distinct vregs, so two registers are always enough.
+static RegClass spill_registers[] = { REG_CLASS_R12, REG_CLASS_R11 };
 
 #define ALLOCATION_ORDER \
 	X(0,  REG_CLASS_R13), \
 	X(1,  REG_CLASS_R14), \
 	X(2,  REG_CLASS_R15), \
 	X(3,  REG_CLASS_B), \
-	X(4,  REG_CLASS_R11), \
-	X(5,  REG_CLASS_R10), \
-	X(6,  REG_CLASS_R9), \
-	X(7,  REG_CLASS_R8), \
-	X(8,  REG_CLASS_C), \
-	X(9,  REG_CLASS_D), \
-	X(10, REG_CLASS_SI), \
-	X(11, REG_CLASS_DI), \
-	X(12, REG_CLASS_A),
+	X(4,  REG_CLASS_R10), \
+	X(5,  REG_CLASS_R9), \
+	X(6,  REG_CLASS_R8), \
+	X(7,  REG_CLASS_C), \
+	X(8,  REG_CLASS_D), \
+	X(9,  REG_CLASS_SI), \
+	X(10, REG_CLASS_DI), \
+	X(11, REG_CLASS_A),
 
 #define X(i, x) [i] = x
 static RegClass alloc_index_to_reg[] = {
@@ -1384,14 +1594,6 @@ static bool is_callee_save(RegClass reg)
 	 (1 << REG_CLASS_D) | (1 << REG_CLASS_C) | (1 << REG_CLASS_R8) | \
 	 (1 << REG_CLASS_R9) | (1 << REG_CLASS_R10) | (1 << REG_CLASS_R11))
 
-typedef struct Pred
-{
-	u32 dest_offset;
-	u32 src_offset;
-
-	struct Pred *next;
-} Pred;
-
 bool references_vreg(AsmValue value, u32 vreg)
 {
 	Register reg;
@@ -1438,211 +1640,600 @@ bool is_def(AsmInstr *instr, u32 vreg_num, VReg *vreg)
 		return references_vreg(instr->args[0], vreg_num)
 			&& references_vreg(instr->args[1], vreg_num);
 
+	// A store through a vreg (e.g.: "mov [v], x") uses it rather than
+	// defining it.
 	case MOV: case MOVSX: case MOVZX:
 	case POP:
 	case IMUL:
 	case SETE: case SETNE: case SETG: case SETGE: case SETL: case SETLE:
-		return references_vreg(instr->args[0], vreg_num);
+		return !instr->args[0].is_deref
+			&& references_vreg(instr->args[0], vreg_num);
 
 	default: return false;
 	}
 }
 
+typedef struct LivenessBlock
+{
+	u32 first_instr;
+	u32 last_instr;
+	i32 succs[2];
+	// Successors of an indirect jump, in addition to those in succs.
+	AsmJumpTable *jump_table;
+
+	// Vregs used before being defined in the block, and vregs defined in the
+	// block, respectively.
+	BitSet gen;
+	BitSet kill;
+
+	BitSet live_in;
+	BitSet live_out;
+} LivenessBlock;
+
+static bool is_jump(AsmOp op)
+{
+	switch (op) {
+	case JMP: case JE: case JNE: case JG: case JGE: case JL: case JLE:
+	case JA: case JAE: case JB: case JBE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static AsmSymbol *jump_target(AsmInstr *instr)
+{
+	assert(instr->args[0].t == ASM_VALUE_CONST);
+	AsmConst c = instr->args[0].u.constant;
+	assert(c.t == ASM_CONST_SYMBOL);
+
+	return c.u.symbol;
+}
+
+// This is used in two ways. If kill is non-NULL, we're walking forwards over
+// a block accumulating its gen and kill sets. Otherwise we're walking
+// backwards, and gen is the set of vregs live after instr, which we update to
+// the set live before it.
+//
+// Calls for functions that return a value define RAX, but the pre-alloced
+// vreg for the result isn't an operand of the call. So as well as anything
+// is_def returns true for, calls define all vregs in call_defs.
+static void liveness_transfer(AsmBuilder *builder, AsmInstr *instr,
+		BitSet *call_defs, BitSet *gen, BitSet *kill)
+{
+	for (u32 i = 0; i < instr->arity + instr->num_deps; i++) {
+		u32 vreg_num;
+		if (i < instr->arity) {
+			Register *reg = arg_reg(instr->args + i);
+			if (reg == NULL || reg->t != V_REG)
+				continue;
+			vreg_num = reg->u.vreg_number;
+		} else {
+			vreg_num = instr->vreg_deps[i - instr->arity];
+		}
+
+		VReg *vreg = ARRAY_REF(&builder->virtual_registers, VReg, vreg_num);
+		if (is_def(instr, vreg_num, vreg)) {
+			if (kill != NULL)
+				bit_set_set_bit(kill, vreg_num, true);
+			else
+				bit_set_set_bit(gen, vreg_num, false);
+		} else if (kill == NULL || !bit_set_get_bit(kill, vreg_num)) {
+			bit_set_set_bit(gen, vreg_num, true);
+		}
+	}
+
+	if (instr->op == CALL) {
+		for (u32 i = 0; i < SIZE_IN_U64S(call_defs); i++) {
+			if (kill != NULL)
+				kill->bits[i] |= call_defs->bits[i];
+			else
+				gen->bits[i] &= ~call_defs->bits[i];
+		}
+	}
+}
+
+// Like is_def, but also true for instructions that modify the vreg in place,
+// e.g.: "add". Coalescing needs to know about every write to a register, not
+// just the ones that start a new value.
+static bool writes_vreg(AsmInstr *instr, u32 vreg_num, VReg *vreg)
+{
+	if (is_def(instr, vreg_num, vreg))
+		return true;
+
+	switch (instr->op) {
+	case CMP: case TEST: case PUSH: case CALL: case RET:
+	case IDIV: case DIV:
+	case JMP: case JE: case JNE: case JG: case JGE: case JL: case JLE:
+	case JA: case JAE: case JB: case JBE:
+		return false;
+	default:
+		return instr->arity != 0
+			&& instr->args[0].t == ASM_VALUE_REGISTER
+			&& !instr->args[0].is_deref
+			&& references_vreg(instr->args[0], vreg_num);
+	}
+}
+
+// Returns whether instr is a register to register copy between two vregs that
+// the allocator is free to place anywhere.
+static bool is_coalescable_copy(AsmBuilder *builder, AsmInstr *instr)
+{
+	if (instr->op != MOV)
+		return false;
+
+	AsmValue *dest = instr->args;
+	AsmValue *src = instr->args + 1;
+	if (dest->t != ASM_VALUE_REGISTER || src->t != ASM_VALUE_REGISTER
+			|| dest->is_deref || src->is_deref
+			|| dest->u.reg.t != V_REG || src->u.reg.t != V_REG
+			|| dest->u.reg.width != src->u.reg.width
+			|| dest->u.reg.u.vreg_number == src->u.reg.u.vreg_number) {
+		return false;
+	}
+
+	for (u32 i = 0; i < 2; i++) {
+		VReg *vreg = ARRAY_REF(&builder->virtual_registers, VReg,
+				instr->args[i].u.reg.u.vreg_number);
+		if (vreg->pre_alloced || vreg->live_range_start != -1
+				|| vreg->live_range_end != -1) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static u32 find_coalesced(u32 *coalesced_with, u32 vreg)
+{
+	while (coalesced_with[vreg] != vreg) {
+		coalesced_with[vreg] = coalesced_with[coalesced_with[vreg]];
+		vreg = coalesced_with[vreg];
+	}
+
+	return vreg;
+}
+
+// We won't build an interference matrix bigger than this many candidates
+// squared. Functions with more copy-related vregs than this just don't get
+// coalesced.
+#define MAX_COALESCING_CANDIDATES 4096
+
+// Conservative copy coalescing: merge the source and destination vregs of a
+// MOV whenever no member of one vreg's class is written while a member of the
+// other is live (other than by a copy between them, which leaves both with the
+// same value). The merged vreg then gets a single register, and the MOV
+// becomes a self-move that the peephole pass deletes.
+//
+// This runs on the output of handle_phi_nodes, whose moves are already
+// sequenced correctly for parallel copies, and uses precise per-instruction
+// liveness, so it can merge the vregs of a loop phi with the values flowing
+// into it even though their live range hulls overlap.
+//
+// Writing a 32-bit register zeroes the upper half of the 64-bit register, so
+// narrow copies are only coalesced if nothing in the destination's class is
+// ever read at a wider width.
+//
+// The live sets in blocks are updated to refer to the merged vregs.
+static void coalesce_copies(AsmBuilder *builder, LivenessBlock *blocks,
+		u32 num_blocks, BitSet *call_defs)
+{
+	Array(AsmInstr) *body = builder->current_block;
+	Array(VReg) *vregs = &builder->virtual_registers;
+	u32 num_vregs = vregs->size;
+
+	i32 *candidate_index = malloc(num_vregs * sizeof *candidate_index);
+	for (u32 i = 0; i < num_vregs; i++)
+		candidate_index[i] = -1;
+	u32 num_candidates = 0;
+	for (u32 i = 0; i < body->size; i++) {
+		AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
+		if (!is_coalescable_copy(builder, instr))
+			continue;
+
+		for (u32 j = 0; j < 2; j++) {
+			u32 vreg_num = instr->args[j].u.reg.u.vreg_number;
+			if (candidate_index[vreg_num] == -1)
+				candidate_index[vreg_num] = num_candidates++;
+		}
+	}
+	if (num_candidates == 0 || num_candidates > MAX_COALESCING_CANDIDATES) {
+		free(candidate_index);
+		return;
+	}
+
+	u8 *max_width = calloc(num_vregs, sizeof *max_width);
+	for (u32 i = 0; i < body->size; i++) {
+		AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
+		for (u32 j = 0; j < instr->arity; j++) {
+			AsmValue *arg = instr->args + j;
+			Register *reg = arg_reg(arg);
+			if (reg == NULL || reg->t != V_REG)
+				continue;
+
+			// Registers used for addressing are always read in full.
+			u8 width = arg->t == ASM_VALUE_REGISTER && !arg->is_deref
+				? reg->width : 64;
+			if (width > max_width[reg->u.vreg_number])
+				max_width[reg->u.vreg_number] = width;
+		}
+		for (u32 j = 0; j < instr->num_deps; j++)
+			max_width[instr->vreg_deps[j]] = 64;
+	}
+
+	BitSet *interferes = malloc(num_candidates * sizeof *interferes);
+	for (u32 i = 0; i < num_candidates; i++) {
+		bit_set_init(interferes + i, num_candidates);
+		bit_set_clear_all(interferes + i);
+	}
+
+	BitSet live;
+	bit_set_init(&live, num_vregs);
+	for (u32 i = 0; i < num_blocks; i++) {
+		LivenessBlock *block = blocks + i;
+		bit_set_copy(&live, &block->live_out);
+
+		for (i32 pc = block->last_instr; pc >= (i32)block->first_instr; pc--) {
+			AsmInstr *instr = ARRAY_REF(body, AsmInstr, pc);
+
+			// A narrow copy that we don't end up removing still clears the
+			// upper half of the register, so it only leaves both vregs with
+			// the same value if neither is read at a wider width.
+			i32 copy_src = -1;
+			if (is_coalescable_copy(builder, instr)) {
+				u32 dest = instr->args[0].u.reg.u.vreg_number;
+				u32 src = instr->args[1].u.reg.u.vreg_number;
+				u8 width = instr->args[0].u.reg.width;
+				if (width == 64
+						|| (max_width[dest] <= width && max_width[src] <= width)) {
+					copy_src = src;
+				}
+			}
+
+			for (u32 j = 0; j < instr->arity; j++) {
+				Register *reg = arg_reg(instr->args + j);
+				if (reg == NULL || reg->t != V_REG)
+					continue;
+
+				u32 def = reg->u.vreg_number;
+				i32 def_index = candidate_index[def];
+				if (def_index == -1
+						|| !writes_vreg(instr, def, ARRAY_REF(vregs, VReg, def))) {
+					continue;
+				}
+
+				for (u32 k = 0; k < SIZE_IN_U64S(&live); k++) {
+					u64 bits = live.bits[k];
+					while (bits != 0) {
+						u32 other = 64 * k + lowest_set_bit(bits);
+						bits &= bits - 1;
+
+						i32 other_index = candidate_index[other];
+						if (other_index == -1 || other == def
+								|| (i32)other == copy_src) {
+							continue;
+						}
+
+						bit_set_set_bit(interferes + def_index, other_index, true);
+						bit_set_set_bit(interferes + other_index, def_index, true);
+					}
+				}
+			}
+
+			liveness_transfer(builder, instr, call_defs, &live, NULL);
+		}
+	}
+	bit_set_free(&live);
+
+	// Union-find over vreg numbers, plus a linked list of the members of each
+	// class so we can check every pair for interference when merging.
+	u32 *coalesced_with = malloc(num_vregs * sizeof *coalesced_with);
+	i32 *next_member = malloc(num_vregs * sizeof *next_member);
+	for (u32 i = 0; i < num_vregs; i++) {
+		coalesced_with[i] = i;
+		next_member[i] = -1;
+	}
+
+	bool *remove_copy = calloc(body->size, sizeof *remove_copy);
+	for (u32 i = 0; i < body->size; i++) {
+		AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
+		if (!is_coalescable_copy(builder, instr))
+			continue;
+
+		u32 dest = find_coalesced(coalesced_with, instr->args[0].u.reg.u.vreg_number);
+		u32 src = find_coalesced(coalesced_with, instr->args[1].u.reg.u.vreg_number);
+		u8 width = instr->args[0].u.reg.width;
+		if (width != 64 && max_width[dest] > width)
+			continue;
+
+		if (dest == src) {
+			remove_copy[i] = true;
+			continue;
+		}
+
+		bool interference = false;
+		for (i32 x = dest; x != -1 && !interference; x = next_member[x]) {
+			for (i32 y = src; y != -1; y = next_member[y]) {
+				if (bit_set_get_bit(interferes + candidate_index[x],
+							candidate_index[y])) {
+					interference = true;
+					break;
+				}
+			}
+		}
+		if (interference)
+			continue;
+
+		// Merge dest's class into src's, keeping src as the representative.
+		i32 last = src;
+		while (next_member[last] != -1)
+			last = next_member[last];
+		next_member[last] = dest;
+		coalesced_with[dest] = src;
+		if (max_width[dest] > max_width[src])
+			max_width[src] = max_width[dest];
+
+		remove_copy[i] = true;
+	}
+
+	for (u32 i = 0; i < body->size; i++) {
+		AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
+		for (u32 j = 0; j < instr->arity; j++) {
+			Register *reg = arg_reg(instr->args + j);
+			if (reg != NULL && reg->t == V_REG)
+				reg->u.vreg_number = find_coalesced(coalesced_with, reg->u.vreg_number);
+		}
+		for (u32 j = 0; j < instr->num_deps; j++)
+			instr->vreg_deps[j] = find_coalesced(coalesced_with, instr->vreg_deps[j]);
+
+		// A full-width self-move is a no-op, so the peephole pass can remove
+		// it. That's not the case for a narrower one that we couldn't
+		// coalesce, but which ended up in the same class anyway.
+		if (remove_copy[i]) {
+			instr->args[0].u.reg.width = 64;
+			instr->args[1].u.reg.width = 64;
+		}
+	}
+
+	for (u32 i = 0; i < num_vregs; i++) {
+		u32 target = find_coalesced(coalesced_with, i);
+		if (target == i)
+			continue;
+
+		for (u32 j = 0; j < num_blocks; j++) {
+			LivenessBlock *block = blocks + j;
+			if (bit_set_get_bit(&block->live_in, i)) {
+				bit_set_set_bit(&block->live_in, i, false);
+				bit_set_set_bit(&block->live_in, target, true);
+			}
+			if (bit_set_get_bit(&block->live_out, i)) {
+				bit_set_set_bit(&block->live_out, i, false);
+				bit_set_set_bit(&block->live_out, target, true);
+			}
+		}
+	}
+
+	for (u32 i = 0; i < num_candidates; i++)
+		bit_set_free(interferes + i);
+	free(interferes);
+	free(remove_copy);
+	free(next_member);
+	free(coalesced_with);
+	free(max_width);
+	free(candidate_index);
+}
+
+static void extend_live_range(i32 *starts, i32 *ends, u32 vreg_num, u32 pc)
+{
+	if (starts[vreg_num] == -1 || (u32)starts[vreg_num] > pc)
+		starts[vreg_num] = pc;
+	if (ends[vreg_num] == -1 || (u32)ends[vreg_num] < pc)
+		ends[vreg_num] = pc;
+}
+
+// Standard iterative backwards dataflow over basic blocks, computing liveness
+// for all vregs at once. We then turn this into a single interval per vreg by
+// taking the hull of every point where it is live. Within a block a vreg is
+// only live between references, or between a reference and one end of the
+// block, so it's enough to look at references and block boundaries, plus the
+// implicit defs of RAX by calls.
 static void compute_live_ranges(AsmBuilder *builder)
 {
 	Array(AsmInstr) *body = builder->current_block;
+	u32 num_vregs = builder->virtual_registers.size;
 
-	// Liveness is a backwards analysis, so we need access to predecessors for
-	// each instruction. These are stored intrusively on AsmSymbol.
-	//
 	// @NOTE: I'm not sure if this will still work correctly if we add
 	// fallthrough, i.e.: eliminating redundant jumps like:
 	//     jmp a
 	// a:  ...
-	Pool preds_pool;
-	pool_init(&preds_pool, 512);
+	u32 num_blocks = 0;
 	for (u32 i = 0; i < body->size; i++) {
 		AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
-		switch (instr->op) {
-		case JMP: case JE: case JNE: case JG: case JGE: case JL: case JLE:
-		case JA: case JAE: case JB: case JBE:
-			break;
-		default: continue;
+		if (i == 0 || instr->label != NULL
+				|| is_jump(ARRAY_REF(body, AsmInstr, i - 1)->op)) {
+			num_blocks++;
 		}
+	}
 
-		assert(instr->args[0].t == ASM_VALUE_CONST);
-		AsmConst c = instr->args[0].u.constant;
-		assert(c.t == ASM_CONST_SYMBOL);
-		AsmSymbol *target = c.u.symbol;
+	LivenessBlock *blocks = malloc(num_blocks * sizeof *blocks);
+	u32 *block_of_instr = malloc(body->size * sizeof *block_of_instr);
+	i32 curr_block = -1;
+	for (u32 i = 0; i < body->size; i++) {
+		AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
+		if (i == 0 || instr->label != NULL
+				|| is_jump(ARRAY_REF(body, AsmInstr, i - 1)->op)) {
+			curr_block++;
+			blocks[curr_block].first_instr = i;
+		}
 
-		if (target != builder->ret_label) {
-			assert(target->offset < body->size);
+		blocks[curr_block].last_instr = i;
+		block_of_instr[i] = curr_block;
+	}
 
-			Pred **location = &target->pred;
-			Pred *pred = target->pred;
-			while (pred != NULL && pred->next != NULL) {
-				pred = pred->next;
-				location = &pred->next;
+	BitSet call_defs;
+	bit_set_init(&call_defs, num_vregs);
+	bit_set_clear_all(&call_defs);
+	for (u32 i = 0; i < num_vregs; i++) {
+		VReg *vreg = ARRAY_REF(&builder->virtual_registers, VReg, i);
+		if (vreg->pre_alloced && vreg->u.assigned_register == REG_CLASS_A)
+			bit_set_set_bit(&call_defs, i, true);
+	}
+
+	for (u32 i = 0; i < num_blocks; i++) {
+		LivenessBlock *block = blocks + i;
+		AsmInstr *last = ARRAY_REF(body, AsmInstr, block->last_instr);
+
+		block->succs[0] = -1;
+		block->succs[1] = -1;
+		block->jump_table = NULL;
+		u32 num_succs = 0;
+		if (is_jump(last->op) && last->args[0].t == ASM_VALUE_CONST) {
+			AsmSymbol *target = jump_target(last);
+			if (target != builder->ret_label) {
+				assert(target->offset < body->size);
+				block->succs[num_succs++] = block_of_instr[target->offset];
 			}
+		}
+		if (last->op != JMP && i + 1 != num_blocks)
+			block->succs[num_succs++] = i + 1;
 
-			Pred *new_pred = pool_alloc(&preds_pool, sizeof *pred);
-			new_pred->src_offset = i;
-			new_pred->dest_offset = target->offset;
-			new_pred->next = NULL;
+		bit_set_init(&block->gen, num_vregs);
+		bit_set_clear_all(&block->gen);
+		bit_set_init(&block->kill, num_vregs);
+		bit_set_clear_all(&block->kill);
+		bit_set_init(&block->live_in, num_vregs);
+		bit_set_clear_all(&block->live_in);
+		bit_set_init(&block->live_out, num_vregs);
+		bit_set_clear_all(&block->live_out);
 
-			*location = new_pred;
+		for (u32 j = block->first_instr; j <= block->last_instr; j++) {
+			liveness_transfer(builder, ARRAY_REF(body, AsmInstr, j),
+					&call_defs, &block->gen, &block->kill);
 		}
 	}
 
-	// This implements the algorithm described in Mohnen 2002, "A Graph-Free
-	// Approach to Data-Flow Analysis". As the name suggests, we do without
-	// constructing an explicit CFG. See Section 4 in the paper for details.
-	// Note the paragraph at the end of Section 4 - in this case the analysis
-	// is backwards and existential, so both of the adaptations in this
-	// paragraph are applied to the algorithm in Figure 5. The preprocessing to
-	// connect jumps to jump targets is done just above.
+	for (u32 i = 0; i < builder->jump_tables.size; i++) {
+		AsmJumpTable *jump_table =
+			ARRAY_REF(&builder->jump_tables, AsmJumpTable, i);
+		LivenessBlock *block = blocks + block_of_instr[jump_table->jump_instr];
+		assert(block->last_instr == jump_table->jump_instr);
 
-	BitSet liveness;
-	bit_set_init(&liveness, body->size);
-	BitSet working_set;
-	bit_set_init(&working_set, body->size);
-
-	for (u32 vreg_num = 0;
-			vreg_num < builder->virtual_registers.size;
-			vreg_num++) {
-		VReg *vreg = ARRAY_REF(&builder->virtual_registers, VReg, vreg_num);
-		if (vreg->live_range_start != -1 && vreg->live_range_end != -1)
-			continue;
-
-		bit_set_clear_all(&liveness);
-		bit_set_set_all(&working_set);
-		u32 largest_working_set_elem = body->size - 1;
-
-		while (!bit_set_is_empty(&working_set)) {
-			u32 pc = largest_working_set_elem;
-
-			for (;;) {
-				bit_set_set_bit(&working_set, pc, false);
-				if (pc == largest_working_set_elem) {
-					for (i32 i = pc / 64; i >= 0; i--) {
-						u64 bits = working_set.bits[i];
-						if (bits != 0) {
-							largest_working_set_elem =
-								64 * i + highest_set_bit(bits);
-							break;
-						}
-					}
-				}
+		block->jump_table = jump_table;
+	}
 
-				// We shouldn't be re-examining points that are already live.
-				// If we've shown a vreg to be live at pc the analysis below
-				// will add nothing.
-				assert(!bit_set_get_bit(&liveness, pc));
-
-				// @TODO: We might be able to simplify this somewhat based on
-				// the fact that (I think) our instruction selection always
-				// produces SSA form for vregs.
-
-				AsmInstr *instr = ARRAY_REF(body, AsmInstr, pc);
-				i32 succ0 = -1, succ1 = -1;
-				switch (instr->op) {
-				case JE: case JNE: case JG: case JGE: case JL: case JLE:
-				case JA: case JAE: case JB: case JBE:
-					succ1 = pc + 1;
-					// fallthrough.
-				case JMP: {
-					assert(instr->args[0].t == ASM_VALUE_CONST);
-					AsmConst c = instr->args[0].u.constant;
-					assert(c.t == ASM_CONST_SYMBOL);
-					AsmSymbol *target = c.u.symbol;
-
-					if (target != builder->ret_label) {
-						assert(target->offset < body->size);
-						succ0 = target->offset;
-					}
-					break;
-				}
-				default:
-					if (pc != body->size - 1)
-						succ0 = pc + 1;
-					break;
+	// Iterate to a fixed point. Visiting blocks in reverse order means we
+	// propagate along forward edges in a single pass, so the number of passes
+	// depends only on the loop nesting depth.
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (i32 i = num_blocks - 1; i >= 0; i--) {
+			LivenessBlock *block = blocks + i;
+			for (u32 j = 0; j < STATIC_ARRAY_LENGTH(block->succs); j++) {
+				if (block->succs[j] != -1)
+					bit_set_union(&block->live_out, &blocks[block->succs[j]].live_in);
+			}
+			if (block->jump_table != NULL) {
+				AsmJumpTable *jump_table = block->jump_table;
+				for (u32 j = 0; j < jump_table->num_targets; j++) {
+					u32 target = jump_table->targets[j]->offset;
+					assert(target < body->size);
+					bit_set_union(&block->live_out,
+							&blocks[block_of_instr[target]].live_in);
 				}
+			}
 
-				bool new;
-				if (is_use(instr, vreg_num)) {
-					new = true;
-				} else if (!((succ0 != -1 && (
-									bit_set_get_bit(&liveness, succ0) && !is_def(
-										ARRAY_REF(body, AsmInstr, succ0), vreg_num, vreg)))
-							|| (succ1 != -1 && (
-									bit_set_get_bit(&liveness, succ1) && !is_def(
-										ARRAY_REF(body, AsmInstr, succ1), vreg_num, vreg))))) {
-					// The big hairy condition above checks if all of our
-					// successors are either not live or a def. If so then
-					// we're not live.
-					new = false;
-				} else {
-					// Otherwise, we have a successor that is live and not a
-					// def, hence we're live.
-					new = true;
+			for (u32 j = 0; j < SIZE_IN_U64S(&block->live_in); j++) {
+				u64 new_live_in = block->gen.bits[j]
+					| (block->live_out.bits[j] & ~block->kill.bits[j]);
+				if (new_live_in != block->live_in.bits[j]) {
+					block->live_in.bits[j] = new_live_in;
+					changed = true;
 				}
-				bit_set_set_bit(&liveness, pc, new);
+			}
+		}
+	}
 
-				u32 prev;
-				Pred *pred = NULL;
-				if (instr->label != NULL)
-					pred = instr->label->pred;
+	coalesce_copies(builder, blocks, num_blocks, &call_defs);
 
-				if (pred != NULL && pred->dest_offset == pc) {
-					prev = pred->src_offset;
-				} else if (pc == 0) {
-					break;
-				} else {
-					prev = pc - 1;
-				}
+	i32 *starts = malloc(num_vregs * sizeof *starts);
+	i32 *ends = malloc(num_vregs * sizeof *ends);
+	for (u32 i = 0; i < num_vregs; i++) {
+		starts[i] = -1;
+		ends[i] = -1;
+	}
 
-				// Check if we need to add stuff to the working set to deal
-				// with multiple predecessors. We only bother adding
-				// predecessors to the working set if we've refined. If !new
-				// then we definitely haven't, and we can skip the whole loop.
-				// The second half of the refinement check is the liveness
-				// check before adding to working_set below.
-				if (new && pred != NULL) {
-					pred = pred->next;
-					while (pred != NULL) {
-						u32 src = pred->src_offset;
-						u32 dest = pred->dest_offset;
-
-						if (dest != pc)
-							break;
+	BitSet live;
+	bit_set_init(&live, num_vregs);
+	for (u32 i = 0; i < num_blocks; i++) {
+		LivenessBlock *block = blocks + i;
+		for (u32 j = 0; j < SIZE_IN_U64S(&block->live_in); j++) {
+			u64 in = block->live_in.bits[j];
+			while (in != 0) {
+				u32 bit = lowest_set_bit(in);
+				in &= in - 1;
+				extend_live_range(starts, ends, 64 * j + bit, block->first_instr);
+			}
+			u64 out = block->live_out.bits[j];
+			while (out != 0) {
+				u32 bit = lowest_set_bit(out);
+				out &= out - 1;
+				extend_live_range(starts, ends, 64 * j + bit, block->last_instr);
+			}
+		}
 
-						if (!bit_set_get_bit(&liveness, src)) {
-							bit_set_set_bit(&working_set, src, true);
-							if (src > largest_working_set_elem)
-								largest_working_set_elem = src;
-						}
+		bit_set_copy(&live, &block->live_out);
+		for (i32 pc = block->last_instr; pc >= (i32)block->first_instr; pc--) {
+			AsmInstr *instr = ARRAY_REF(body, AsmInstr, pc);
+			if (instr->op == CALL) {
+				for (u32 j = 0; j < SIZE_IN_U64S(&live); j++) {
+					u64 defined = live.bits[j] & call_defs.bits[j];
+					while (defined != 0) {
+						u32 bit = lowest_set_bit(defined);
+						defined &= defined - 1;
+						extend_live_range(starts, ends, 64 * j + bit, pc);
 					}
 				}
+			}
 
-				if (!(new && !bit_set_get_bit(&liveness, prev)))
-					break;
-
-				pc = prev;
+			for (u32 j = 0; j < instr->arity; j++) {
+				Register *reg = arg_reg(instr->args + j);
+				if (reg != NULL && reg->t == V_REG)
+					extend_live_range(starts, ends, reg->u.vreg_number, pc);
 			}
+			for (u32 j = 0; j < instr->num_deps; j++)
+				extend_live_range(starts, ends, instr->vreg_deps[j], pc);
+
+			liveness_transfer(builder, instr, &call_defs, &live, NULL);
 		}
+	}
+	bit_set_free(&live);
 
-		i32 lowest = bit_set_lowest_set_bit(&liveness);
+	for (u32 i = 0; i < num_vregs; i++) {
+		VReg *vreg = ARRAY_REF(&builder->virtual_registers, VReg, i);
+		if (vreg->live_range_start != -1 && vreg->live_range_end != -1)
+			continue;
+
+		i32 lowest = starts[i];
 		if (vreg->live_range_start == -1 || vreg->live_range_start > lowest)
 			vreg->live_range_start = lowest;
 
-		i32 highest = bit_set_highest_set_bit(&liveness);
+		i32 highest = ends[i];
 		if (vreg->live_range_end == -1 || (highest != -1 && vreg->live_range_end < highest))
 			vreg->live_range_end = highest;
 	}
 
-	pool_free(&preds_pool);
-	bit_set_free(&liveness);
-	bit_set_free(&working_set);
+	free(starts);
+	free(ends);
+	for (u32 i = 0; i < num_blocks; i++) {
+		bit_set_free(&blocks[i].gen);
+		bit_set_free(&blocks[i].kill);
+		bit_set_free(&blocks[i].live_in);
+		bit_set_free(&blocks[i].live_out);
+	}
+	free(blocks);
+	free(block_of_instr);
+	bit_set_free(&call_defs);
 
 	if (flag_dump_live_ranges) {
 		printf("%s:\n", builder->current_function->name);
@@ -1799,72 +2390,39 @@ static void allocate_registers(AsmBuilder *builder)
 		}
 		*ARRAY_INSERT(&active_vregs, VReg *, insertion_point) = vreg;
 	}
-	free(live_ranges);
+	array_free(&active_vregs);
 
-	array_clear(&active_vregs);
-	u32 vreg_index = 0;
+	// Spill anything in a caller save register that is live across a call.
+	// live_ranges is sorted by start, so for each call we only need to look
+	// at the prefix that starts before it.
+	// Pre-alloced vregs aren't counted. Otherwise we'd think we need to spill
+	// registers we just used to pass arguments.
+	// @TODO: Perhaps this is too weak of a condition? It'd be nice if we could
+	// still catch errors, where we accidentally pre-allocated a caller-save
+	// register across a callsite.
 	for (u32 i = 0; i < body->size; i++) {
-		while (active_vregs.size != 0) {
-			VReg *active_vreg = *ARRAY_REF(&active_vregs, VReg *, 0);
-			if (active_vreg->live_range_end == -1)
-				continue;
-			if ((u32)active_vreg->live_range_end >= i)
-				break;
-			assert(active_vreg->t == IN_REG);
+		AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
+		if (instr->op != CALL)
+			continue;
 
-			// @TODO: Remove all the invalidated vregs at once instead of
-			// repeatedly shifting down.
-			ARRAY_REMOVE(&active_vregs, VReg *, 0);
-		}
-		if (vreg_index != builder->virtual_registers.size) {
-			VReg *next_vreg =
-				ARRAY_REF(&builder->virtual_registers, VReg, vreg_index);
-			// Pre-alloced vregs aren't counted. Otherwise we'd think we need
-			// to spill registers we just used to pass arguments.
-			// @TODO: Perhaps this is too weak of a condition? It'd be nice if
-			// we could still catch errors, where we accidentally pre-allocated
-			// a caller-save register across a callsite.
-			if (next_vreg->t == IN_REG
-					&& !next_vreg->pre_alloced
-					&& (u32)next_vreg->live_range_start == i) {
-				u32 insertion_point = active_vregs.size;
-				for (u32 j = 0; j < active_vregs.size; j++) {
-					VReg *active_vreg = *ARRAY_REF(&active_vregs, VReg *, j);
-					if (active_vreg->live_range_end == -1)
-						continue;
-					if ((u32)active_vreg->live_range_end < i) {
-						insertion_point = j;
-						break;
-					}
-				}
-				*ARRAY_INSERT(&active_vregs, VReg *, insertion_point) = next_vreg;
+		for (u32 j = 0; j < num_live_ranges; j++) {
+			VReg *vreg = live_ranges[j];
+			if ((u32)vreg->live_range_start >= i)
+				break;
+			if (vreg->t != IN_REG || vreg->pre_alloced
+					|| (u32)vreg->live_range_end <= i)
+				continue;
 
-				vreg_index++;
-			}
-		}
+			RegClass reg = vreg->u.assigned_register;
+			if (((1 << reg) & CALLER_SAVE_REGS_BITMASK) == 0)
+				continue;
 
-		AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
-		if (instr->op == CALL) {
-			for (u32 j = 0; j < active_vregs.size; j++) {
-				VReg *vreg = *ARRAY_REF(&active_vregs, VReg *, j);
-				if (vreg->t == IN_REG) {
-					RegClass reg = vreg->u.assigned_register;
-					if (((1 << reg) & CALLER_SAVE_REGS_BITMASK) == 0)
-						continue;
-
-					vreg->t = ON_STACK;
-					vreg->u.assigned_stack_slot = builder->local_stack_usage;
-					builder->local_stack_usage += 8;
-
-					// @TODO: Remove all the spilled vregs at once instead of
-					// repeatedly shifting down.
-					ARRAY_REMOVE(&active_vregs, VReg *, j);
-					j--;
-				}
-			}
+			vreg->t = ON_STACK;
+			vreg->u.assigned_stack_slot = builder->local_stack_usage;
+			builder->local_stack_usage += 8;
 		}
 	}
-	array_free(&active_vregs);
+	free(live_ranges);
 
 	// @TODO: Move register dumping stuff we we can dump the name here rather
 	// than just a number
@@ -1880,68 +2438,528 @@ static void allocate_registers(AsmBuilder *builder)
 		}
 	}
 
+	// Rewrite into a fresh array rather than inserting fills and write-backs
+	// in place, since shifting the rest of the body along for every spill is
+	// quadratic in function size.
+	Array(AsmInstr) new_body;
+	ARRAY_INIT(&new_body, AsmInstr, body->size);
 	u32 curr_sp_diff = 0;
 	for (u32 i = 0; i < body->size; i++) {
 		AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
 
-		if (instr->op == SUB && instr->args[0].t == ASM_VALUE_REGISTER
+		if ((instr->op == SUB || instr->op == ADD)
+				&& instr->args[0].t == ASM_VALUE_REGISTER
 				&& instr->args[0].u.reg.t == PHYS_REG
 				&& instr->args[0].u.reg.u.class == REG_CLASS_SP) {
 			assert(instr->args[1].t == ASM_VALUE_CONST);
 
 			AsmConst c = instr->args[1].u.constant;
 			assert(c.t == ASM_CONST_IMMEDIATE);
-			curr_sp_diff += c.u.immediate;
+			if (instr->op == SUB)
+				curr_sp_diff += c.u.immediate;
+			else
+				curr_sp_diff -= c.u.immediate;
 		}
 
+		u32 spilled_vregs[STATIC_ARRAY_LENGTH(spill_registers)];
+		u32 num_spilled_vregs = 0;
 		for (u32 j = 0; j < instr->arity; j++) {
 			AsmValue *arg = instr->args + j;
 			Register *reg = arg_reg(arg);
-			if (reg == NULL)
+			if (reg == NULL || reg->t != V_REG)
 				continue;
 
-			if (reg->t == V_REG) {
-				u32 vreg_number = reg->u.vreg_number;
-				VReg *vreg = ARRAY_REF(&builder->virtual_registers,
-						VReg, vreg_number);
+			u32 vreg_number = reg->u.vreg_number;
+			VReg *vreg = ARRAY_REF(&builder->virtual_registers,
+					VReg, vreg_number);
 
-				switch (vreg->t) {
-				case IN_REG:
-					reg->t = PHYS_REG;
-					reg->u.class = vreg->u.assigned_register;
-					break;
-				case ON_STACK:
-					reg->t = PHYS_REG;
-					reg->u.class = SPILL_REGISTER;
-					// @TODO: Insert all at once, rather than shifting along
-					// every time.
-					// @TODO: Elide this when we just write to the register and
-					// don't use the previous value
-					*ARRAY_INSERT(body, AsmInstr, i) = (AsmInstr) {
-						.op = MOV,
-						.arity = 2,
-						.args[0] = asm_phys_reg(SPILL_REGISTER, 64),
-						.args[1] = asm_deref(asm_offset_reg(REG_CLASS_SP, 64,
-								asm_const_imm(vreg->u.assigned_stack_slot + curr_sp_diff))),
-					};
-					// @TODO: Elide this when we just read the register and
-					// don't write anything back.
-					*ARRAY_INSERT(body, AsmInstr, i + 2) = (AsmInstr) {
-						.op = MOV,
-						.arity = 2,
-						.args[0] = asm_deref(asm_offset_reg(REG_CLASS_SP, 64,
-								asm_const_imm(vreg->u.assigned_stack_slot + curr_sp_diff))),
-						.args[1] = asm_phys_reg(SPILL_REGISTER, 64),
-					};
-					break;
-				case UNASSIGNED:
-					UNREACHABLE;
+			switch (vreg->t) {
+			case IN_REG:
+				reg->t = PHYS_REG;
+				reg->u.class = vreg->u.assigned_register;
+				break;
+			case ON_STACK: {
+				u32 spill_index = 0;
+				while (spill_index < num_spilled_vregs
+						&& spilled_vregs[spill_index] != vreg_number) {
+					spill_index++;
+				}
+				if (spill_index == num_spilled_vregs) {
+					assert(num_spilled_vregs < STATIC_ARRAY_LENGTH(spilled_vregs));
+					spilled_vregs[num_spilled_vregs++] = vreg_number;
+				}
+
+				reg->t = PHYS_REG;
+				reg->u.class = spill_registers[spill_index];
+				break;
+			}
+			case UNASSIGNED:
+				UNREACHABLE;
+			}
+		}
+
+		if (num_spilled_vregs == 0) {
+			*ARRAY_APPEND(&new_body, AsmInstr) = *instr;
+			continue;
+		}
+
+		// Fill the spill registers before the instruction and write them back
+		// afterwards. If the instruction is a jump target the label has to
+		// move to the first fill, so that we don't jump past it.
+		// @TODO: Elide the fill when we just write to the register, and the
+		// write-back when we just read it.
+		AsmValue slots[STATIC_ARRAY_LENGTH(spill_registers)];
+		for (u32 j = 0; j < num_spilled_vregs; j++) {
+			VReg *vreg = ARRAY_REF(&builder->virtual_registers,
+					VReg, spilled_vregs[j]);
+			slots[j] = asm_deref(asm_offset_reg(REG_CLASS_SP, 64,
+						asm_const_imm(vreg->u.assigned_stack_slot + curr_sp_diff)));
+
+			*ARRAY_APPEND(&new_body, AsmInstr) = (AsmInstr) {
+				.op = MOV,
+				.arity = 2,
+				.args[0] = asm_phys_reg(spill_registers[j], 64),
+				.args[1] = slots[j],
+				.label = j == 0 ? instr->label : NULL,
+			};
+		}
+
+		instr->label = NULL;
+		*ARRAY_APPEND(&new_body, AsmInstr) = *instr;
+
+		for (u32 j = 0; j < num_spilled_vregs; j++) {
+			*ARRAY_APPEND(&new_body, AsmInstr) = (AsmInstr) {
+				.op = MOV,
+				.arity = 2,
+				.args[0] = slots[j],
+				.args[1] = asm_phys_reg(spill_registers[j], 64),
+			};
+		}
+	}
+
+	array_free(body);
+	*body = new_body;
+}
+
+typedef struct PeepholeStats
+{
+	u32 self_moves;
+	u32 round_trip_moves;
+	u32 forwarded_loads;
+	u32 zero_adds;
+	u32 jumps_to_next;
+	u32 inverted_branches;
+	u32 redundant_compares;
+	u32 folded_setcc_branches;
+} PeepholeStats;
+
+static bool is_phys_reg(AsmValue *value)
+{
+	return value->t == ASM_VALUE_REGISTER && !value->is_deref
+		&& value->u.reg.t == PHYS_REG;
+}
+
+static bool same_phys_reg(AsmValue *a, AsmValue *b)
+{
+	return is_phys_reg(a) && is_phys_reg(b)
+		&& a->u.reg.u.class == b->u.reg.u.class
+		&& a->u.reg.width == b->u.reg.width;
+}
+
+static bool asm_consts_equal(AsmConst *a, AsmConst *b)
+{
+	if (a->t != b->t)
+		return false;
+
+	switch (a->t) {
+	case ASM_CONST_IMMEDIATE:
+		return a->u.immediate == b->u.immediate;
+	case ASM_CONST_FIXED_IMMEDIATE:
+		return a->u.fixed_immediate.value == b->u.fixed_immediate.value
+			&& a->u.fixed_immediate.width == b->u.fixed_immediate.width;
+	case ASM_CONST_SYMBOL:
+		return a->u.symbol == b->u.symbol;
+	}
+
+	UNREACHABLE;
+}
+
+static bool same_memory_operand(AsmValue *a, AsmValue *b)
+{
+	if (!a->is_deref || !b->is_deref || a->t != b->t)
+		return false;
+
+	switch (a->t) {
+	case ASM_VALUE_REGISTER:
+		return a->u.reg.t == PHYS_REG && b->u.reg.t == PHYS_REG
+			&& a->u.reg.u.class == b->u.reg.u.class;
+	case ASM_VALUE_OFFSET_REGISTER: {
+		Register *a_reg = &a->u.offset_register.reg;
+		Register *b_reg = &b->u.offset_register.reg;
+		return a_reg->t == PHYS_REG && b_reg->t == PHYS_REG
+			&& a_reg->u.class == b_reg->u.class
+			&& asm_consts_equal(&a->u.offset_register.offset,
+					&b->u.offset_register.offset);
+	}
+	case ASM_VALUE_CONST:
+		return false;
+	}
+
+	UNREACHABLE;
+}
+
+static bool reads_flags(AsmOp op)
+{
+	switch (op) {
+	case JE: case JNE: case JG: case JGE: case JL: case JLE:
+	case JA: case JAE: case JB: case JBE:
+	case SETE: case SETNE: case SETG: case SETGE: case SETL: case SETLE:
+	case SETA: case SETAE: case SETB: case SETBE:
+	case ADC: case SBB:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Only the instructions that set every flag a Jcc or SETcc can read. Shifts
+// leave the flags alone when the count is zero, so they aren't included.
+static bool writes_flags(AsmOp op)
+{
+	switch (op) {
+	case ADD: case SUB: case CMP: case TEST: case AND: case OR: case XOR:
+	case NEG:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static AsmOp setcc_to_jcc(AsmOp op)
+{
+	switch (op) {
+	case SETE: return JE;
+	case SETNE: return JNE;
+	case SETG: return JG;
+	case SETGE: return JGE;
+	case SETL: return JL;
+	case SETLE: return JLE;
+	case SETA: return JA;
+	case SETAE: return JAE;
+	case SETB: return JB;
+	case SETBE: return JBE;
+	default: UNREACHABLE;
+	}
+}
+
+static AsmOp invert_jcc(AsmOp op)
+{
+	switch (op) {
+	case JE: return JNE;
+	case JNE: return JE;
+	case JG: return JLE;
+	case JGE: return JL;
+	case JL: return JGE;
+	case JLE: return JG;
+	case JA: return JBE;
+	case JAE: return JB;
+	case JB: return JAE;
+	case JBE: return JA;
+	default: UNREACHABLE;
+	}
+}
+
+static i32 next_live_instr(Array(AsmInstr) *body, bool *deleted, i32 i)
+{
+	for (i32 j = i + 1; j < (i32)body->size; j++) {
+		if (!deleted[j])
+			return j;
+	}
+
+	return -1;
+}
+
+// Whether the flags set by the instruction at index i are overwritten (or
+// clobbered by a call) before anything could read them. We give up at
+// labels and jumps rather than following control flow.
+static bool flags_dead_after(Array(AsmInstr) *body, bool *deleted, i32 i)
+{
+	for (i32 j = next_live_instr(body, deleted, i); j != -1;
+			j = next_live_instr(body, deleted, j)) {
+		AsmInstr *instr = ARRAY_REF(body, AsmInstr, j);
+		if (instr->label != NULL || reads_flags(instr->op) || instr->op == JMP)
+			return false;
+		if (writes_flags(instr->op) || instr->op == CALL || instr->op == RET)
+			return true;
+	}
+
+	// The epilogue comes next, and nothing after a function returns can
+	// depend on its flags.
+	return true;
+}
+
+static bool is_jump_to_label_at(AsmBuilder *builder, AsmInstr *jump,
+		Array(AsmInstr) *body, i32 target_index)
+{
+	if (jump->args[0].t != ASM_VALUE_CONST)
+		return false;
+
+	AsmSymbol *target = jump_target(jump);
+	if (target_index == -1)
+		return target == builder->ret_label;
+
+	return ARRAY_REF(body, AsmInstr, target_index)->label == target;
+}
+
+// Deleting an instruction that has a label means the label has to move to
+// the next one, which we can only do if that doesn't already have a label.
+static bool delete_instr(Array(AsmInstr) *body, bool *deleted, i32 i)
+{
+	AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
+	if (instr->label != NULL) {
+		i32 next = next_live_instr(body, deleted, i);
+		if (next == -1 || ARRAY_REF(body, AsmInstr, next)->label != NULL)
+			return false;
+
+		ARRAY_REF(body, AsmInstr, next)->label = instr->label;
+		instr->label = NULL;
+	}
+
+	deleted[i] = true;
+	return true;
+}
+
+// Tries each pattern on the instruction at index i, returning whether any of
+// them fired. Patterns that delete an instruction after i only fire if it has
+// no label, as otherwise something else might jump to it.
+//
+// @NOTE: Writing to a 32-bit register zeroes the upper half of the 64-bit
+// register, so we leave 32-bit moves alone where removing them would skip
+// that.
+static bool peephole_at(AsmBuilder *builder, Array(AsmInstr) *body,
+		bool *deleted, i32 i, PeepholeStats *stats)
+{
+	AsmInstr *instr = ARRAY_REF(body, AsmInstr, i);
+	i32 next_index = next_live_instr(body, deleted, i);
+	AsmInstr *next = next_index == -1
+		? NULL : ARRAY_REF(body, AsmInstr, next_index);
+
+	switch (instr->op) {
+	case MOV:
+		// mov rax, rax
+		if (same_phys_reg(instr->args, instr->args + 1)
+				&& instr->args[0].u.reg.width != 32) {
+			if (delete_instr(body, deleted, i)) {
+				stats->self_moves++;
+				return true;
+			}
+			return false;
+		}
+		if (next == NULL || next->op != MOV || next->label != NULL)
+			return false;
+
+		// mov rax, rbx
+		// mov rbx, rax
+		if (is_phys_reg(instr->args) && is_phys_reg(instr->args + 1)
+				&& same_phys_reg(instr->args, next->args + 1)
+				&& same_phys_reg(instr->args + 1, next->args)
+				&& instr->args[0].u.reg.width != 32) {
+			deleted[next_index] = true;
+			stats->round_trip_moves++;
+			return true;
+		}
+
+		// mov [rsp + 8], eax
+		// mov ebx, [rsp + 8]
+		if (is_phys_reg(instr->args + 1) && is_phys_reg(next->args)
+				&& instr->args[1].u.reg.width == next->args[0].u.reg.width
+				&& same_memory_operand(instr->args, next->args + 1)) {
+			next->args[1] = instr->args[1];
+			stats->forwarded_loads++;
+			return true;
+		}
+
+		return false;
+	case ADD: case SUB:
+		// add rsp, 0
+		// This still sets the flags, so it can only go if nothing reads them.
+		if (is_phys_reg(instr->args) && instr->args[0].u.reg.width == 64
+				&& instr->args[0].u.reg.u.class == REG_CLASS_SP
+				&& instr->args[1].t == ASM_VALUE_CONST
+				&& instr->args[1].u.constant.t == ASM_CONST_IMMEDIATE
+				&& instr->args[1].u.constant.u.immediate == 0
+				&& flags_dead_after(body, deleted, i)) {
+			if (delete_instr(body, deleted, i)) {
+				stats->zero_adds++;
+				return true;
+			}
+		}
+
+		return false;
+	case JMP:
+		//     jmp a
+		// a:
+		if (is_jump_to_label_at(builder, instr, body, next_index)
+				&& delete_instr(body, deleted, i)) {
+			stats->jumps_to_next++;
+			return true;
+		}
+
+		return false;
+	case JE: case JNE: case JG: case JGE: case JL: case JLE:
+	case JA: case JAE: case JB: case JBE: {
+		//     jl a
+		//     jmp b
+		// a:
+		if (next == NULL || next->op != JMP || next->label != NULL
+				|| next->args[0].t != ASM_VALUE_CONST)
+			return false;
+
+		i32 after_index = next_live_instr(body, deleted, next_index);
+		if (!is_jump_to_label_at(builder, instr, body, after_index))
+			return false;
+
+		instr->op = invert_jcc(instr->op);
+		instr->args[0] = next->args[0];
+		deleted[next_index] = true;
+		stats->inverted_branches++;
+
+		return true;
+	}
+	case SETE: case SETNE: case SETG: case SETGE: case SETL: case SETLE:
+	case SETA: case SETAE: case SETB: case SETBE: {
+		//     setl al
+		//     cmp al, 0
+		//     jne a
+		// Branching on a comparison that was also stored as a value comes out
+		// like this. The flags from the SETcc's own comparison are still
+		// there, so we can branch on them directly and drop the CMP. We keep
+		// the SETcc, as we don't know if anything else uses its result.
+		// Instruction selection always emits a CMP right before each Jcc,
+		// so no other block depends on the flags the dropped CMP would set.
+		if (next == NULL || next->op != CMP || next->label != NULL
+				|| !same_phys_reg(instr->args, next->args)
+				|| next->args[1].t != ASM_VALUE_CONST
+				|| next->args[1].u.constant.t != ASM_CONST_IMMEDIATE
+				|| next->args[1].u.constant.u.immediate != 0)
+			return false;
+
+		i32 jcc_index = next_live_instr(body, deleted, next_index);
+		if (jcc_index == -1)
+			return false;
+		AsmInstr *jcc = ARRAY_REF(body, AsmInstr, jcc_index);
+		if (jcc->label != NULL || (jcc->op != JE && jcc->op != JNE))
+			return false;
+
+		AsmOp op = setcc_to_jcc(instr->op);
+		jcc->op = jcc->op == JNE ? op : invert_jcc(op);
+		deleted[next_index] = true;
+		stats->folded_setcc_branches++;
+
+		return true;
+	}
+	case CMP: {
+		//     cmp eax, ebx
+		//     setl cl
+		//     mov [rip + x], ecx
+		//     cmp eax, ebx
+		//     jl a
+		// Comparisons whose result is used both as a value and for a branch
+		// come out like this. None of the instructions in between touch the
+		// flags or the registers being compared, so the second CMP is
+		// redundant.
+		for (u32 j = 0; j < instr->arity; j++) {
+			AsmValue *arg = instr->args + j;
+			if (arg->is_deref || (arg->t != ASM_VALUE_CONST && !is_phys_reg(arg)))
+				return false;
+		}
+
+		i32 j = next_index;
+		while (j != -1) {
+			AsmInstr *between = ARRAY_REF(body, AsmInstr, j);
+			if (between->label != NULL)
+				return false;
+			if (between->op == CMP)
+				break;
+
+			switch (between->op) {
+			case MOV: case MOVZX: case MOVSX:
+			case SETE: case SETNE: case SETG: case SETGE: case SETL: case SETLE:
+			case SETA: case SETAE: case SETB: case SETBE:
+				break;
+			default:
+				return false;
+			}
+
+			AsmValue *dest = between->args;
+			if (is_phys_reg(dest)) {
+				for (u32 k = 0; k < instr->arity; k++) {
+					if (is_phys_reg(instr->args + k)
+							&& instr->args[k].u.reg.u.class == dest->u.reg.u.class)
+						return false;
 				}
 			}
+
+			j = next_live_instr(body, deleted, j);
+		}
+		if (j == -1)
+			return false;
+
+		AsmInstr *cmp = ARRAY_REF(body, AsmInstr, j);
+		for (u32 k = 0; k < instr->arity; k++) {
+			AsmValue *a = instr->args + k;
+			AsmValue *b = cmp->args + k;
+			bool equal = a->t == ASM_VALUE_CONST
+				? (b->t == ASM_VALUE_CONST
+						&& asm_consts_equal(&a->u.constant, &b->u.constant))
+				: same_phys_reg(a, b);
+			if (!equal)
+				return false;
 		}
+
+		deleted[j] = true;
+		stats->redundant_compares++;
+
+		return true;
+	}
+	default:
+		return false;
 	}
 }
 
+// Cleans up some obviously redundant instruction sequences left over after
+// instruction selection and register allocation. This works on physical
+// registers, without any liveness information, so every pattern has to be
+// valid regardless of what comes afterwards.
+static void peephole_optimise(AsmBuilder *builder, PeepholeStats *stats)
+{
+	Array(AsmInstr) *body = builder->current_block;
+	bool *deleted = malloc(body->size * sizeof *deleted);
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (u32 i = 0; i < body->size; i++)
+			deleted[i] = false;
+
+		for (u32 i = 0; i < body->size; i++) {
+			if (!deleted[i] && peephole_at(builder, body, deleted, i, stats))
+				changed = true;
+		}
+
+		u32 out = 0;
+		for (u32 i = 0; i < body->size; i++) {
+			if (!deleted[i]) {
+				*ARRAY_REF(body, AsmInstr, out++) =
+					*ARRAY_REF(body, AsmInstr, i);
+			}
+		}
+		body->size = out;
+	}
+
+	free(deleted);
+}
+
 void asm_gen_function(AsmBuilder *builder, IrGlobal *ir_global)
 {
 	assert(ir_global->type.t == IR_FUNCTION);
@@ -1961,6 +2979,7 @@ void asm_gen_function(AsmBuilder *builder, IrGlobal *ir_global)
 	builder->current_block = &body;
 
 	builder->local_stack_usage = 0;
+	array_clear(&builder->jump_tables);
 
 	AsmSymbol *ret_label = pool_alloc(&builder->asm_module.pool, sizeof *ret_label);
 	*ret_label = (AsmSymbol) {
@@ -1968,7 +2987,6 @@ void asm_gen_function(AsmBuilder *builder, IrGlobal *ir_global)
 		.section = TEXT_SECTION,
 		.defined = true,
 		.linkage = ASM_LOCAL_LINKAGE,
-		.pred = NULL,
 	};
 	builder->ret_label = ret_label;
 
@@ -1990,7 +3008,6 @@ void asm_gen_function(AsmBuilder *builder, IrGlobal *ir_global)
 			.section = TEXT_SECTION,
 			.defined = true,
 			.linkage = ASM_LOCAL_LINKAGE,
-			.pred = NULL,
 		};
 	}
 
@@ -2049,6 +3066,21 @@ void asm_gen_function(AsmBuilder *builder, IrGlobal *ir_global)
 
 	allocate_registers(builder);
 
+	PeepholeStats peephole_stats;
+	ZERO_STRUCT(&peephole_stats);
+	peephole_optimise(builder, &peephole_stats);
+	if (flag_print_peephole_stats) {
+		printf("%s: %u self moves, %u round trip moves, %u forwarded loads, "
+				"%u zero adds, %u jumps to next, %u inverted branches, "
+				"%u redundant compares, %u folded setcc branches\n",
+				ir_global->name, peephole_stats.self_moves,
+				peephole_stats.round_trip_moves,
+				peephole_stats.forwarded_loads, peephole_stats.zero_adds,
+				peephole_stats.jumps_to_next, peephole_stats.inverted_branches,
+				peephole_stats.redundant_compares,
+				peephole_stats.folded_setcc_branches);
+	}
+
 	u32 used_callee_save_regs_bitset = 0;
 	for (u32 i = 0; i < builder->current_block->size; i++) {
 		AsmInstr *instr = ARRAY_REF(builder->current_block, AsmInstr, i);
@@ -2067,6 +3099,7 @@ void asm_gen_function(AsmBuilder *builder, IrGlobal *ir_global)
 	builder->current_block = &builder->asm_module.text.instrs;
 
 	AsmSymbol *entry_label = ir_global->asm_symbol;
+	u32 function_start = builder->current_block->size;
 
 	AsmInstr *prologue_first_instr =
 		emit_instr1(builder, PUSH, asm_phys_reg(REG_CLASS_BP, 64));
@@ -2156,6 +3189,8 @@ void asm_gen_function(AsmBuilder *builder, IrGlobal *ir_global)
 			AsmInstr, epilogue_start);
 	epilogue_first_instr->label = ret_label;
 
+	entry_label->size = builder->current_block->size - function_start;
+
 	array_free(&body);
 }
 
@@ -2254,7 +3289,7 @@ void generate_asm_module(AsmBuilder *builder, TransUnit *trans_unit)
 
 		Array(AsmSymbol *) *symbols = &asm_module->symbols;
 		AsmSymbolSection section;
-		if (ir_global->initializer == NULL) {
+		if (ir_global->initializer == NULL || ir_global->only_for_inlining) {
 			section = UNKNOWN_SECTION;
 		} else if (ir_global->type.t == IR_FUNCTION) {
 			section = TEXT_SECTION;
@@ -2275,10 +3310,9 @@ void generate_asm_module(AsmBuilder *builder, TransUnit *trans_unit)
 		name_copy[name_len] = '\0';
 
 		asm_symbol->name = name_copy;
-		asm_symbol->defined = ir_global->initializer != NULL;
+		asm_symbol->defined = section != UNKNOWN_SECTION;
 		asm_symbol->section = section;
 		asm_symbol->offset = 0;
-		asm_symbol->pred = NULL;
 
 		switch (ir_global->linkage) {
 		case IR_GLOBAL_LINKAGE: asm_symbol->linkage = ASM_GLOBAL_LINKAGE; break;
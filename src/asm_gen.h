@@ -24,6 +24,16 @@ typedef struct VReg
 	} u;
 } VReg;
 
+// An indirect jump through a table in .data, lowered from OP_JUMP_TABLE.
+// Liveness needs the targets, since they aren't operands of the jump itself.
+typedef struct AsmJumpTable
+{
+	// Index of the jump in the current function's body.
+	u32 jump_instr;
+	u32 num_targets;
+	AsmSymbol **targets;
+} AsmJumpTable;
+
 typedef struct AsmBuilder
 {
 	AsmModule asm_module;
@@ -32,6 +42,9 @@ typedef struct AsmBuilder
 	AsmSymbol *ret_label;
 
 	Array(VReg) virtual_registers;
+	// Number of vregs created across all functions, for -ftime-report.
+	u32 total_vregs;
+	Array(AsmJumpTable) jump_tables;
 	u32 local_stack_usage;
 	u32 register_save_area_size;
 	u32 curr_sp_diff;
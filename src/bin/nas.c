@@ -358,5 +358,5 @@ int main(int argc, char *argv[])
 	}
 
 	assemble(&asm_module);
-	return !write_elf_object_file(output_filename, &asm_module);
+	return !write_elf_object_file(output_filename, &asm_module, false, false);
 }
@@ -2,12 +2,11 @@
 #define _POSIX_SOURCE
 #define _DEFAULT_SOURCE
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 
 // @PORT
-#include <errno.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -16,13 +15,18 @@
 #include "array.h"
 #include "asm.h"
 #include "asm_gen.h"
+#include "diagnostics.h"
 #include "elf.h"
 #include "file.h"
+#include "include_cache.h"
 #include "ir_gen.h"
+#include "ir_opt.h"
 #include "misc.h"
+#include "parallel.h"
 #include "tokenise.h"
 #include "parse.h"
 #include "preprocess.h"
+#include "time_report.h"
 #include "util.h"
 
 int __lsan_is_turned_off(void)
@@ -34,26 +38,62 @@ static bool flag_dump_tokens = false;
 static bool flag_dump_ast = false;
 static bool flag_dump_ir = false;
 static bool flag_dump_asm = false;
+static bool flag_optimise = true;
+static bool flag_time_report = false;
 bool flag_dump_live_ranges = false;
 bool flag_dump_register_assignments = false;
 bool flag_print_pre_regalloc_stats = false;
+bool flag_print_peephole_stats = false;
+u32 flag_inline_limit = 16;
+static bool flag_function_sections = false;
+static bool flag_data_sections = false;
+static u32 flag_jobs = 1;
+static LinkerOptions linker_options = {
+	.jobs = 1,
+	.gc_sections = false,
+	.icf = false,
+	.symbol_ordering_file = NULL,
+	.call_graph_ordering = false,
+};
+
+typedef struct CompileJob
+{
+	char *input_filename;
+	// NULL when linking, as we hand the module to the linker in memory
+	// instead of writing an object file.
+	char *object_filename;
+	AsmModule asm_module;
+	int result;
+
+	// Only used when compiling in parallel, so we can print diagnostics and
+	// time reports in input order after all jobs have finished.
+	Array(char) diagnostics;
+	TimeReport report;
+} CompileJob;
+
+typedef struct CompileContext
+{
+	CompileJob *jobs;
+	bool in_parallel;
+	bool link_in_memory;
 
-static char *make_temp_file(void);
+	IncludeCache *include_cache;
+	bool syntax_only;
+	bool preprocess_only;
+} CompileContext;
+
+static void compile_job(void *context, u32 index);
 static int compile_file(char *input_filename, char *output_filename,
-		Array(char *) *include_dirs, bool syntax_only, bool preprocess_only);
+		AsmModule *output_module, IncludeCache *include_cache,
+		bool syntax_only, bool preprocess_only, TimeReport *report);
 static int make_file_executable(char *filename);
 
 int main(int argc, char *argv[])
 {
-	// @NOTE: We only use this for generating temp file names. We take extra
-	// precautions to make sure the names don't conflict, so it doesn't really
-	// matter how we seed this.
-	srand(time(NULL));
-
 	Array(char *) source_input_filenames;
-	Array(char *) linker_input_filenames;
+	Array(LinkerInputSource) linker_inputs;
 	ARRAY_INIT(&source_input_filenames, char *, 10);
-	ARRAY_INIT(&linker_input_filenames, char *, 10);
+	ARRAY_INIT(&linker_inputs, LinkerInputSource, 10);
 
 	Array(char *) include_dirs = EMPTY_ARRAY;
 
@@ -83,6 +123,30 @@ int main(int argc, char *argv[])
 				flag_dump_register_assignments = true;
 			} else if (streq(arg, "-print-pre-regalloc-stats")) {
 				flag_print_pre_regalloc_stats = true;
+			} else if (streq(arg, "-print-peephole-stats")) {
+				flag_print_peephole_stats = true;
+			} else if (streq(arg, "-ftime-report")) {
+				flag_time_report = true;
+			} else if (strneq(arg, "-O", 2)) {
+				flag_optimise = !streq(arg, "-O0");
+			} else if (strneq(arg, "-finline-limit=", 15)) {
+				char *limit = arg + 15;
+				if (*limit == '\0' || !isdigit(*limit)) {
+					fprintf(stderr, "Error: invalid inline limit '%s'\n", limit);
+					return 1;
+				}
+				flag_inline_limit = atol(limit);
+			} else if (strneq(arg, "-j", 2)) {
+				char *jobs = arg + 2;
+				if (*jobs == '\0' || !isdigit(*jobs) || atol(jobs) == 0) {
+					fprintf(stderr, "Error: invalid number of jobs '%s'\n", jobs);
+					return 1;
+				}
+				flag_jobs = atol(jobs);
+			} else if (streq(arg, "-ffunction-sections")) {
+				flag_function_sections = true;
+			} else if (streq(arg, "-fdata-sections")) {
+				flag_data_sections = true;
 			} else if (streq(arg, "-fsyntax-only")) {
 				syntax_only = true;
 			} else if (streq(arg, "-ffreestanding")) {
@@ -123,6 +187,39 @@ int main(int argc, char *argv[])
 					return 1;
 				}
 				naive_dir = argv[++i];
+			} else if (strneq(arg, "-Wl,", 4)) {
+				// Linker options are comma-separated, as with gcc.
+				char *option = arg + 4;
+				for (;;) {
+					u32 len = 0;
+					while (option[len] != ',' && option[len] != '\0')
+						len++;
+
+					char *linker_option = strndup(option, len);
+					if (streq(linker_option, "--gc-sections")) {
+						linker_options.gc_sections = true;
+					} else if (streq(linker_option, "--icf=all")) {
+						linker_options.icf = true;
+					} else if (streq(linker_option, "--icf=none")) {
+						linker_options.icf = false;
+					} else if (strneq(linker_option,
+								"--symbol-ordering-file=", 23)) {
+						// @LEAK
+						linker_options.symbol_ordering_file =
+							strdup(linker_option + 23);
+					} else if (streq(linker_option, "--call-graph-ordering")) {
+						linker_options.call_graph_ordering = true;
+					} else {
+						fprintf(stderr, "Error: Unknown linker option: %s\n",
+								linker_option);
+						return 1;
+					}
+					free(linker_option);
+
+					if (option[len] == '\0')
+						break;
+					option += len + 1;
+				}
 			} else if (strneq(arg, "-W", 2)) {
 				// Do nothing. We don't support any warnings, so for self-host
 				// purposes we'll just ignore these flags, as they shouldn't
@@ -155,7 +252,8 @@ int main(int argc, char *argv[])
 			FileType type = file_type(input_file);
 
 			if (type == ELF_FILE_TYPE || type == AR_FILE_TYPE) {
-				*ARRAY_APPEND(&linker_input_filenames, char *) = input_filename;
+				*ARRAY_APPEND(&linker_inputs, LinkerInputSource) =
+					(LinkerInputSource) { .filename = input_filename };
 			} else {
 				*ARRAY_APPEND(&source_input_filenames, char *) = input_filename;
 			}
@@ -164,7 +262,7 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (source_input_filenames.size == 0 && linker_input_filenames.size == 0) {
+	if (source_input_filenames.size == 0 && linker_inputs.size == 0) {
 		fputs("Error: no input files given\n", stderr);
 		return 2;
 	}
@@ -182,62 +280,115 @@ int main(int argc, char *argv[])
 	// @LEAK: concat
 	*ARRAY_INSERT(&include_dirs, char *, 0) = concat(naive_dir, "/freestanding/");
 
-	Array(char *) temp_filenames;
-	ARRAY_INIT(&temp_filenames, char *, do_link ? source_input_filenames.size : 0);
+	Array(CompileJob) compile_jobs;
+	ARRAY_INIT(&compile_jobs, CompileJob, source_input_filenames.size);
 
 	for (u32 i = 0; i < source_input_filenames.size; i++) {
 		char *source_input_filename = *ARRAY_REF(&source_input_filenames, char *, i);
 		char *object_filename = NULL;
-		if (!syntax_only && !preprocess_only) {
-			if (do_link) {
-				// In this mode we compile all given sources files to temporary
-				// object files, link the result with libc and any other object
-				// files passed on the command line, and then delete the
-				// temporary object files we created.
-				object_filename = make_temp_file();
-				*ARRAY_APPEND(&temp_filenames, char *) = object_filename;
-				*ARRAY_APPEND(&linker_input_filenames, char *) = object_filename;
+		// When linking, we compile all the given source files to modules in
+		// memory and link them directly with libc and any other object files
+		// passed on the command line. Otherwise, we compile all the given
+		// source files to object files, and leave it at that.
+		if (!syntax_only && !preprocess_only && !do_link) {
+			if (output_filename != NULL) {
+				object_filename = output_filename;
 			} else {
-				// In this mode we compile all the given source files to object
-				// files, and leave it at that.
-				if (output_filename != NULL) {
-					object_filename = output_filename;
-				} else {
-					u32 input_filename_length = strlen(source_input_filename);
-					object_filename = malloc(input_filename_length + 1); // @LEAK
-					memcpy(object_filename, source_input_filename,
-							input_filename_length + 1);
-					object_filename[input_filename_length - 1] = 'o';
-					object_filename[input_filename_length] = '\0';
-
-					u32 last_slash = input_filename_length - 1;
-					for (; last_slash != 0; last_slash--) {
-						if (object_filename[last_slash] == '/')
-							break;
-					}
+				u32 input_filename_length = strlen(source_input_filename);
+				object_filename = malloc(input_filename_length + 1); // @LEAK
+				memcpy(object_filename, source_input_filename,
+						input_filename_length + 1);
+				object_filename[input_filename_length - 1] = 'o';
+				object_filename[input_filename_length] = '\0';
+
+				u32 last_slash = input_filename_length - 1;
+				for (; last_slash != 0; last_slash--) {
+					if (object_filename[last_slash] == '/')
+						break;
+				}
 
-					if (last_slash != 0) {
-						object_filename[last_slash - 1] = '.';
-						object_filename += last_slash - 1;
-					}
+				if (last_slash != 0) {
+					object_filename[last_slash - 1] = '.';
+					object_filename += last_slash - 1;
 				}
 			}
 		}
 
-		int result = compile_file(source_input_filename, object_filename,
-				&include_dirs, syntax_only, preprocess_only);
-		if (result != 0)
-			return result;
+		CompileJob *job = ARRAY_APPEND(&compile_jobs, CompileJob);
+		ZERO_STRUCT(job);
+		job->input_filename = source_input_filename;
+		job->object_filename = object_filename;
+		job->result = 0;
+		job->diagnostics = EMPTY_ARRAY;
+	}
+
+	// Everything that writes to stdout while compiling has to run serially,
+	// as we only capture diagnostics.
+	bool writes_stdout = preprocess_only || flag_dump_tokens || flag_dump_ast
+		|| flag_dump_ir || flag_dump_asm || flag_dump_live_ranges
+		|| flag_dump_register_assignments || flag_print_pre_regalloc_stats
+		|| flag_print_peephole_stats;
+
+	// Shared by all translation units, so we only search for each header
+	// once. File names in SourceLoc's point into it, so it has to outlive
+	// the link.
+	IncludeCache include_cache;
+	include_cache_init(&include_cache, &include_dirs);
+
+	CompileContext compile_context = {
+		.jobs = (CompileJob *)compile_jobs.elements,
+		.in_parallel = flag_jobs > 1 && compile_jobs.size > 1 && !writes_stdout,
+		.include_cache = &include_cache,
+		.link_in_memory = do_link && !syntax_only && !preprocess_only,
+		.syntax_only = syntax_only,
+		.preprocess_only = preprocess_only,
+	};
+	if (compile_context.in_parallel) {
+		parallel_for(compile_jobs.size, flag_jobs, compile_job,
+				&compile_context);
+	}
+
+	// When compiling serially we stop at the first translation unit that
+	// fails. When compiling in parallel we have already compiled everything,
+	// but we only report up to the first failure, so the output is the same
+	// as it would be for a serial build.
+	for (u32 i = 0; i < compile_jobs.size; i++) {
+		CompileJob *job = ARRAY_REF(&compile_jobs, CompileJob, i);
+		if (!compile_context.in_parallel)
+			compile_job(&compile_context, i);
+
+		TimeReport *report_ptr = flag_time_report ? &job->report : NULL;
+		if (compile_context.in_parallel) {
+			fwrite(job->diagnostics.elements, 1, job->diagnostics.size, stderr);
+			array_free(&job->diagnostics);
+		}
+		if (job->result != 0)
+			return job->result;
+
+		time_report_print(report_ptr, stderr);
+		time_report_free(report_ptr);
+
+		if (compile_context.link_in_memory) {
+			*ARRAY_APPEND(&linker_inputs, LinkerInputSource) =
+				(LinkerInputSource) {
+					.asm_module = &job->asm_module,
+					.function_sections = flag_function_sections,
+					.data_sections = flag_data_sections,
+				};
+		}
 	}
 
 	array_free(&source_input_filenames);
 
-	if (do_link && !syntax_only && !preprocess_only) {
+	if (compile_context.link_in_memory) {
 		// Implicitly link in the standard library. We have to put this after
 		// the rest of the inputs because it's an archive.
 		if (!freestanding) {
-			*ARRAY_APPEND(&linker_input_filenames, char *)
-				= concat(naive_dir, "/libc.a");
+			*ARRAY_APPEND(&linker_inputs, LinkerInputSource) =
+				(LinkerInputSource) {
+					// @LEAK: concat
+					.filename = concat(naive_dir, "/libc.a"),
+				};
 		}
 
 		char *executable_filename;
@@ -248,75 +399,156 @@ int main(int argc, char *argv[])
 
 		// @NOTE: Needs to be changed if we support different object file
 		// formats.
-		if (!link_elf_executable(executable_filename, &linker_input_filenames)) {
+		TimeReport report;
+		TimeReport *report_ptr = flag_time_report ? &report : NULL;
+		time_report_init(report_ptr, executable_filename, true);
+
+		linker_options.jobs = flag_jobs;
+		if (!link_elf_executable(executable_filename, &linker_inputs,
+					&linker_options, report_ptr)) {
 			puts("Linker error, terminating");
 			return 10;
 		}
 
-		int result = 0;
-		for (u32 i = 0; i < temp_filenames.size; i++) {
-			char *temp_filename = *ARRAY_REF(&temp_filenames, char *, i);
-			int ret = remove(temp_filename);
-			if (ret != 0) {
-				perror("Failed to remove temporary object file");
-				result = 9;
-			}
-		}
+		time_report_print(report_ptr, stderr);
+		time_report_free(report_ptr);
 
-		if (result != 0)
-			return result;
+		for (u32 i = 0; i < compile_jobs.size; i++)
+			free_asm_module(&ARRAY_REF(&compile_jobs, CompileJob, i)->asm_module);
 
-		result = make_file_executable(executable_filename);
+		int result = make_file_executable(executable_filename);
 		if (result != 0)
 			return result;
 	}
 
-	array_free(&linker_input_filenames);
+	array_free(&compile_jobs);
+	array_free(&linker_inputs);
+	include_cache_free(&include_cache);
 
 	return 0;
 }
 
-static int compile_file(char *input_filename, char *output_filename,
-		Array(char *) *include_dirs, bool syntax_only, bool preprocess_only)
+static u64 count_ir_instrs(TransUnit *tu)
 {
-	Array(char) preprocessed;
-	Array(Adjustment) adjustments;
-	if (!preprocess(input_filename, include_dirs, &preprocessed, &adjustments))
-		return 13;
+	u64 count = 0;
+	for (u32 i = 0; i < tu->globals.size; i++) {
+		IrGlobal *global = *ARRAY_REF(&tu->globals, IrGlobal *, i);
+		if (global->type.t != IR_FUNCTION || global->initializer == NULL)
+			continue;
+
+		IrFunction *function = &global->initializer->u.function;
+		for (u32 j = 0; j < function->blocks.size; j++)
+			count += (*ARRAY_REF(&function->blocks, IrBlock *, j))->instrs.size;
+	}
 
-	if (preprocess_only) {
-		*ARRAY_APPEND(&preprocessed, char) = '\0';
-		fputs((char *)preprocessed.elements, stdout);
+	return count;
+}
+
+static void compile_job(void *context, u32 index)
+{
+	CompileContext *compile_context = context;
+	CompileJob *job = compile_context->jobs + index;
+
+	TimeReport *report_ptr = flag_time_report ? &job->report : NULL;
+	time_report_init(report_ptr, job->input_filename, false);
+
+	if (compile_context->in_parallel)
+		set_diagnostics_buffer(&job->diagnostics);
+	AsmModule *output_module =
+		compile_context->link_in_memory ? &job->asm_module : NULL;
+	job->result = compile_file(job->input_filename, job->object_filename,
+			output_module, compile_context->include_cache,
+			compile_context->syntax_only, compile_context->preprocess_only,
+			report_ptr);
+	if (compile_context->in_parallel)
+		set_diagnostics_buffer(NULL);
+}
+
+// Where compile_file sends the preprocessor's output, chunk by chunk.
+typedef struct PreprocessOutput
+{
+	Tokeniser tokeniser;
+	bool tokenised_ok;
+	u64 bytes;
+} PreprocessOutput;
+
+static bool write_preprocessed_chunk(void *context, Array(char) *chars,
+		Array(Adjustment) *adjustments)
+{
+	PreprocessOutput *output = context;
+	output->bytes += chars->size;
+	fwrite(chars->elements, 1, chars->size, stdout);
 
 #if 0
-		for (u32 i = 0; i < adjustments.size; i++) {
-			Adjustment *adjustment = ARRAY_REF(&adjustments, Adjustment, i);
-
-			char *type;
-			switch (adjustment->type) {
-			case NORMAL_ADJUSTMENT: type = "normal"; break;
-			case BEGIN_MACRO_ADJUSTMENT: type = "begin_macro"; break;
-			case END_MACRO_ADJUSTMENT: type = "end_macro"; break;
-			}
-			u32 location = adjustment->location;
-			char *filename = adjustment->new_source_loc.filename;
-			u32 line = adjustment->new_source_loc.line;
-			u32 column = adjustment->new_source_loc.column;
-			printf("%u, %s -> %s:%u:%u\n", location, type, filename, line, column);
+	for (u32 i = 0; i < adjustments->size; i++) {
+		Adjustment *adjustment = ARRAY_REF(adjustments, Adjustment, i);
+
+		char *type;
+		switch (adjustment->type) {
+		case NORMAL_ADJUSTMENT: type = "normal"; break;
+		case BEGIN_MACRO_ADJUSTMENT: type = "begin_macro"; break;
+		case END_MACRO_ADJUSTMENT: type = "end_macro"; break;
 		}
+		u32 location = adjustment->location;
+		char *filename = adjustment->new_source_loc.filename;
+		u32 line = adjustment->new_source_loc.line;
+		u32 column = adjustment->new_source_loc.column;
+		printf("%u, %s -> %s:%u:%u\n", location, type, filename, line, column);
+	}
+#else
+	IGNORE(adjustments);
 #endif
 
-		array_free(&preprocessed);
-		array_free(&adjustments);
+	return true;
+}
+
+static bool tokenise_preprocessed_chunk(void *context, Array(char) *chars,
+		Array(Adjustment) *adjustments)
+{
+	PreprocessOutput *output = context;
+	output->tokenised_ok =
+		tokenise_chunk(&output->tokeniser, chars, adjustments);
+
+	return output->tokenised_ok;
+}
+
+// Compiles input_filename to the object file output_filename, or, if
+// output_module is non-NULL, leaves the assembled module there instead.
+static int compile_file(char *input_filename, char *output_filename,
+		AsmModule *output_module, IncludeCache *include_cache,
+		bool syntax_only, bool preprocess_only, TimeReport *report)
+{
+	PreprocessOutput output = {
+		.tokenised_ok = true,
+		.bytes = 0,
+	};
+	if (preprocess_only) {
+		time_report_begin_phase(report, "preprocess");
+		bool preprocessed_ok = preprocess(input_filename, include_cache,
+				write_preprocessed_chunk, &output);
+		time_report_end_phase(report);
+		if (!preprocessed_ok)
+			return 13;
+		time_report_set_count(report, "bytes", output.bytes);
+
 		return 0;
 	}
 
+	// The preprocessor hands us its output a chunk at a time, which we
+	// tokenise straight away rather than building up the whole thing first.
 	Array(SourceToken) tokens;
-	if (!tokenise(&tokens, &preprocessed, &adjustments))
+	tokeniser_init(&output.tokeniser, &tokens);
+	time_report_begin_phase(report, "pp+tokenise");
+	bool preprocessed_ok = preprocess(input_filename, include_cache,
+			tokenise_preprocessed_chunk, &output);
+	if (preprocessed_ok)
+		tokeniser_finish(&output.tokeniser);
+	time_report_end_phase(report);
+	if (!output.tokenised_ok)
 		return 11;
-
-	array_free(&preprocessed);
-	array_free(&adjustments);
+	if (!preprocessed_ok)
+		return 13;
+	time_report_set_count(report, "tokens", tokens.size);
 
 	if (flag_dump_tokens) {
 		for (u32 i = 0; i < tokens.size; i++) {
@@ -333,7 +565,10 @@ static int compile_file(char *input_filename, char *output_filename,
 	Pool ast_pool;
 	pool_init(&ast_pool, 1024);
 	ASTToplevel *ast;
-	if (!parse_toplevel(&tokens, &ast_pool, &ast))
+	time_report_begin_phase(report, "parse");
+	bool parsed_ok = parse_toplevel(&tokens, &ast_pool, &ast);
+	time_report_end_phase(report);
+	if (!parsed_ok)
 		return 3;
 
 	if (flag_dump_ast) {
@@ -354,11 +589,23 @@ static int compile_file(char *input_filename, char *output_filename,
 	IrBuilder builder;
 	builder_init(&builder, &tu);
 
+	time_report_begin_phase(report, "ir_gen");
 	ir_gen_toplevel(&builder, ast);
+	time_report_end_phase(report);
+	if (report != NULL)
+		time_report_set_count(report, "IR instrs", count_ir_instrs(&tu));
 
 	array_free(&tokens);
 	pool_free(&ast_pool);
 
+	if (flag_optimise) {
+		time_report_begin_phase(report, "optimise");
+		optimise_trans_unit(&tu);
+		time_report_end_phase(report);
+		if (report != NULL)
+			time_report_set_count(report, "IR instrs", count_ir_instrs(&tu));
+	}
+
 	if (flag_dump_ir) {
 		if (flag_dump_tokens || flag_dump_ast)
 			puts("\n");
@@ -367,7 +614,10 @@ static int compile_file(char *input_filename, char *output_filename,
 
 	AsmBuilder asm_builder;
 	init_asm_builder(&asm_builder, input_filename);
-	generate_asm_module(&asm_builder, &tu); 
+	time_report_begin_phase(report, "asm_gen");
+	generate_asm_module(&asm_builder, &tu);
+	time_report_end_phase(report);
+	time_report_set_count(report, "vregs", asm_builder.total_vregs);
 
 	trans_unit_free(&tu);
 
@@ -377,41 +627,30 @@ static int compile_file(char *input_filename, char *output_filename,
 		dump_asm_module(&asm_builder.asm_module);
 	}
 
+	time_report_begin_phase(report, "assemble");
 	assemble(&asm_builder.asm_module);
-
-	if (!write_elf_object_file(output_filename, &asm_builder.asm_module))
-		return 4;
+	time_report_end_phase(report);
+
+	if (output_module != NULL) {
+		// The linker takes ownership of the module. We leave the builder an
+		// empty one so we can free everything else in it as normal.
+		*output_module = asm_builder.asm_module;
+		init_asm_module(&asm_builder.asm_module, input_filename);
+	} else {
+		time_report_begin_phase(report, "write_elf");
+		bool wrote_ok = write_elf_object_file(output_filename,
+				&asm_builder.asm_module, flag_function_sections,
+				flag_data_sections);
+		time_report_end_phase(report);
+		if (!wrote_ok)
+			return 4;
+	}
 
 	free_asm_builder(&asm_builder);
 
 	return 0;
 }
 
-// @PORT
-static char *make_temp_file()
-{
-	char fmt[] = "/tmp/ncc_temp_%x.o";
-
-	// - 2 adjusts down for the "%x" which isn't present in the output
-	// sizeof(int) * 2 is the max length of rand_suffix in hex
-	// + 1 for the null terminator
-	u32 filename_max_length = sizeof fmt - 2 + sizeof(int) * 2 + 1;
-	char *filename = calloc(filename_max_length, 1);
-
-	for (;;) {
-		int rand_suffix = rand();
-		snprintf(filename, filename_max_length, fmt, rand_suffix);
-
-		int fd = open(filename, O_CREAT | O_WRONLY | O_EXCL, 0600);
-		if (fd != -1) {
-			close(fd);
-			return filename;
-		} else {
-			assert(errno == EEXIST);
-		}
-	}
-}
-
 // @PORT
 static int make_file_executable(char *filename)
 {
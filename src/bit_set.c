@@ -42,6 +42,22 @@ void bit_set_clear_all(BitSet *bit_set)
 	}
 }
 
+void bit_set_copy(BitSet *dest, BitSet *src)
+{
+	assert(dest->size_in_bits == src->size_in_bits);
+	for (u32 i = 0; i < SIZE_IN_U64S(dest); i++) {
+		dest->bits[i] = src->bits[i];
+	}
+}
+
+void bit_set_union(BitSet *dest, BitSet *src)
+{
+	assert(dest->size_in_bits == src->size_in_bits);
+	for (u32 i = 0; i < SIZE_IN_U64S(dest); i++) {
+		dest->bits[i] |= src->bits[i];
+	}
+}
+
 extern inline bool bit_set_get_bit(BitSet *bit_set, u32 index);
 extern inline void bit_set_set_bit(BitSet *bit_set, u32 index, bool value);
 extern inline i32 bit_set_lowest_set_bit(BitSet *bit_set);
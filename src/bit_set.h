@@ -18,6 +18,8 @@ void bit_set_init(BitSet *bit_set, u32 size_in_bits);
 void bit_set_free(BitSet *bit_set);
 void bit_set_set_all(BitSet *bit_set);
 void bit_set_clear_all(BitSet *bit_set);
+void bit_set_copy(BitSet *dest, BitSet *src);
+void bit_set_union(BitSet *dest, BitSet *src);
 
 inline bool bit_set_get_bit(BitSet *bit_set, u32 index)
 {
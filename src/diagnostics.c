@@ -2,21 +2,44 @@
 #include <stdio.h>
 #include "diagnostics.h"
 
+static THREAD_LOCAL Array(char) *diagnostics_buffer = NULL;
+
+void set_diagnostics_buffer(Array(char) *buffer)
+{
+	diagnostics_buffer = buffer;
+}
+
 static void v_issue_diagnostic(ErrorLevel err_level,
 		SourceLoc *context, char *fmt, va_list varargs)
 {
-	fprintf(stderr, "%s:%d:%d: ", context->filename, context->line, context->column);
+	char *level = NULL;
 	switch (err_level) {
-	case WARNING:
-		fputs("Warning: ", stderr);
-		break;
-	case ERROR:
-		fputs("Error: ", stderr);
-		break;
+	case WARNING: level = "Warning"; break;
+	case ERROR: level = "Error"; break;
+	}
+
+	if (diagnostics_buffer == NULL) {
+		fprintf(stderr, "%s:%d:%d: %s: ",
+				context->filename, context->line, context->column, level);
+		vfprintf(stderr, fmt, varargs);
+		putc('\n', stderr);
+		return;
+	}
+
+	// We don't have va_copy, so we can't measure the message before
+	// formatting it. Diagnostics are short, so a fixed buffer will do.
+	char message[1024];
+	u32 length = snprintf(message, sizeof message, "%s:%d:%d: %s: ",
+			context->filename, context->line, context->column, level);
+	if (length < sizeof message) {
+		length += vsnprintf(message + length, sizeof message - length,
+				fmt, varargs);
 	}
+	if (length >= sizeof message)
+		length = sizeof message - 1;
 
-	vfprintf(stderr, fmt, varargs);
-	putc('\n', stderr);
+	ARRAY_APPEND_ELEMS(diagnostics_buffer, char, length, message);
+	*ARRAY_APPEND(diagnostics_buffer, char) = '\n';
 }
 
 void issue_diagnostic(ErrorLevel err_level, SourceLoc *context,
@@ -1,6 +1,7 @@
 #ifndef NAIVE_DIAGNOSTICS_H_
 #define NAIVE_DIAGNOSTICS_H_
 
+#include "array.h"
 #include "misc.h"
 
 typedef struct SourceLoc
@@ -20,4 +21,10 @@ void issue_diagnostic(ErrorLevel err_level, SourceLoc *context, char *fmt, ...);
 void issue_error(SourceLoc *context, char *fmt, ...);
 void issue_warning(SourceLoc *context, char *fmt, ...);
 
+// While a buffer is set, diagnostics issued on the calling thread are appended
+// to it instead of being printed. This lets translation units compiled in
+// parallel report their diagnostics in input order. Pass NULL to go back to
+// printing to stderr.
+void set_diagnostics_buffer(Array(char) *buffer);
+
 #endif
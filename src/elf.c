@@ -4,8 +4,13 @@
 #include <stdlib.h>
 
 #include "asm.h"
+#include "elf.h"
 #include "file.h"
+#include "hash_table.h"
 #include "misc.h"
+#include "parallel.h"
+#include "pool.h"
+#include "time_report.h"
 #include "util.h"
 
 typedef enum ELFIdentIndex
@@ -171,7 +176,7 @@ typedef enum ELF64RelocType
 // regarding the object files we want to create
 
 
-// We write the following sections (in this order):
+// Executables have the following sections (in this order):
 //   * .text
 //   * .rela.text
 //   * .bss
@@ -187,7 +192,11 @@ typedef enum ELF64RelocType
 // Note that we write out .rela.text, .bss, .data & .rela.data even if they are
 // empty. In this case we set the size to zero in the header and don't write
 // any data for it. This is simpler than having to handle it not being present,
-// and it costs only 64 bytes for each header.
+// and it costs only 64 bytes for each header. The relocation sections of an
+// executable are always empty.
+//
+// Object files are written by write_elf_object_file, which can split .text,
+// .bss and .data into a section per symbol.
 
 #define NUM_SECTIONS 9
 
@@ -222,9 +231,13 @@ typedef struct SectionInfo
 	u8 *contents;
 } SectionInfo;
 
+// We build the whole file in memory and write it out in one go at the end.
+// Our libc's stdio is unbuffered, so writing each header, symbol and
+// relocation with its own fwrite would be a syscall each.
 typedef struct ELFFile
 {
-	FILE *output_file;
+	Array(u8) image;
+	u32 position;
 	ELFFileType type;
 
 	i32 entry_point_virtual_address;
@@ -236,19 +249,66 @@ typedef struct ELFFile
 	SectionInfo section_info[NUM_SECTIONS];
 } ELFFile;
 
-static void init_elf_file(ELFFile *elf_file, FILE *output_file, ELFFileType type)
+static void init_elf_file(ELFFile *elf_file, ELFFileType type)
 {
 	ZERO_STRUCT(elf_file);
 	memset(elf_file->section_info, 0, sizeof elf_file->section_info);
 
-	elf_file->output_file = output_file;
+	ARRAY_INIT(&elf_file->image, u8, 4096);
+	elf_file->position = 0;
 	elf_file->type = type;
 	elf_file->next_string_index = 1;
 	elf_file->curr_symbol_index = 0;
 	elf_file->last_local_symbol_index = 0;
 }
 
-static void write_contents(ELFFile *elf_file, Array(Fixup) *fixups)
+// Writes size bytes at the current position, growing the image as necessary.
+// Any gap between the old end of the image and the position is zero-filled.
+static void image_write(ELFFile *elf_file, const void *data, u32 size)
+{
+	Array(u8) *image = &elf_file->image;
+	u32 end = elf_file->position + size;
+	if (end > image->size) {
+		u32 old_size = image->size;
+		ARRAY_ENSURE_ROOM(image, u8, end - old_size);
+		if (elf_file->position > old_size) {
+			memset(image->elements + old_size, 0,
+					elf_file->position - old_size);
+		}
+		image->size = end;
+	}
+
+	memcpy(image->elements + elf_file->position, data, size);
+	elf_file->position = end;
+}
+
+static bool write_image(ELFFile *elf_file, char *filename)
+{
+	bool ret = true;
+
+	FILE *output_file = fopen(filename, "wb");
+	if (output_file == NULL) {
+		perror("Unable to open output file");
+		return false;
+	}
+	if (fwrite(elf_file->image.elements, 1, elf_file->image.size, output_file)
+			!= elf_file->image.size) {
+		perror("Failed to write output file");
+		ret = false;
+	}
+	if (fclose(output_file) != 0) {
+		perror("Failed to write output file");
+		ret = false;
+	}
+
+	array_free(&elf_file->image);
+	return ret;
+}
+
+// Lays out the sections of an executable and writes their contents. The
+// relocation sections are always empty, as the linker applies relocations
+// directly.
+static void write_contents(ELFFile *elf_file)
 {
 	u32 pht_entries = elf_file->type == ET_EXEC ? 3 : 0;
 	u32 first_section_offset = sizeof(ELFHeader) +
@@ -258,56 +318,17 @@ static void write_contents(ELFFile *elf_file, Array(Fixup) *fixups)
 	SectionInfo *text_info = elf_file->section_info + TEXT_INDEX;
 	text_info->offset = first_section_offset;
 
-	checked_fseek(elf_file->output_file, first_section_offset, SEEK_SET);
+	elf_file->position = first_section_offset;
 
 	// @NOTE: In System V, file offsets and base virtual addresses for segments
 	// must be congruent modulo the page size.
 	text_info->virtual_address = 0x8000000 + text_info->offset; 
 	assert(text_info->size == 0 || text_info->contents != NULL);
-	checked_fwrite(text_info->contents, 1, text_info->size, elf_file->output_file);
-
-	for (u32 i = 0; i < fixups->size; i++) {
-		Fixup *fixup = *ARRAY_REF(fixups, Fixup *, i);
-		AsmSymbol *symbol = fixup->symbol;
-
-		if (fixup->section != TEXT_SECTION)
-			continue;
-		if (fixup->type == FIXUP_RELATIVE
-				&& symbol->defined
-				&& fixup->section == TEXT_SECTION
-				&& symbol->section == TEXT_SECTION) {
-			continue;
-		}
-
-		u32 symtab_index = symbol->symtab_index;
-		assert(symtab_index != 0);
-
-		ELF64RelocType reloc_type;
-		u32 addend;
-		switch (fixup->type) {
-		case FIXUP_RELATIVE:
-			reloc_type = R_X86_64_PC32;
-			addend = (i64)fixup->offset - (i64)fixup->next_instr_offset;
-			break;
-		case FIXUP_ABSOLUTE:
-			reloc_type = R_X86_64_64;
-			addend = 0;
-			break;
-		}
-		ELF64Rela rela = {
-			.section_offset = fixup->offset,
-			.type_and_symbol =
-				ELF64_RELA_TYPE_AND_SYMBOL(reloc_type, symtab_index),
-			.addend = addend,
-		};
-
-		checked_fwrite(&rela, sizeof rela, 1, elf_file->output_file);
-	}
+	image_write(elf_file, text_info->contents, text_info->size);
 
 	SectionInfo *rela_text_info = elf_file->section_info + RELA_TEXT_INDEX;
 	rela_text_info->offset = text_info->offset + text_info->size;
-	rela_text_info->size =
-		checked_ftell(elf_file->output_file) - rela_text_info->offset;
+	rela_text_info->size = 0;
 
 	SectionInfo *bss_info = elf_file->section_info + BSS_INDEX;
 	bss_info->offset = rela_text_info->offset + rela_text_info->size;
@@ -319,50 +340,24 @@ static void write_contents(ELFFile *elf_file, Array(Fixup) *fixups)
 	data_info->virtual_address =
 		align_to(elf_file->section_info[BSS_INDEX].virtual_address, 0x1000000)
 		+ data_info->offset;
-	assert(data_info->contents != NULL);
-	checked_fwrite(data_info->contents, 1, data_info->size, elf_file->output_file);
-
-	// @TODO: Combine with the similar code above for .rela.text?
-	for (u32 i = 0; i < fixups->size; i++) {
-		Fixup *fixup = *ARRAY_REF(fixups, Fixup *, i);
-		if (fixup->section != DATA_SECTION)
-			continue;
-
-		assert(fixup->type = FIXUP_ABSOLUTE);
-
-		AsmSymbol *symbol = fixup->symbol;
-		u32 symtab_index = symbol->symtab_index;
-		assert(symtab_index != 0);
-
-		// @PORT: Hardcoded pointer size.
-		ELF64RelocType reloc_type = R_X86_64_64;
-		u32 addend = 0;
-		ELF64Rela rela = {
-			.section_offset = fixup->offset,
-			.type_and_symbol =
-				ELF64_RELA_TYPE_AND_SYMBOL(reloc_type, symtab_index),
-			.addend = addend,
-		};
-
-		checked_fwrite(&rela, sizeof rela, 1, elf_file->output_file);
-	}
+	assert(data_info->size == 0 || data_info->contents != NULL);
+	image_write(elf_file, data_info->contents, data_info->size);
 
 	SectionInfo *rela_data_info = elf_file->section_info + RELA_DATA_INDEX;
 	rela_data_info->offset = data_info->offset + data_info->size;
-	rela_data_info->size =
-		checked_ftell(elf_file->output_file) - rela_data_info->offset;
+	rela_data_info->size = 0;
 
 	SectionInfo *shstrtab_info = elf_file->section_info + SHSTRTAB_INDEX;
 	shstrtab_info->offset = rela_data_info->offset + rela_data_info->size;
 	shstrtab_info->size = sizeof SHSTRTAB_CONTENTS;
-	checked_fwrite(SHSTRTAB_CONTENTS, sizeof SHSTRTAB_CONTENTS, 1, elf_file->output_file);
+	image_write(elf_file, SHSTRTAB_CONTENTS, sizeof SHSTRTAB_CONTENTS);
 
 	elf_file->section_info[SYMTAB_INDEX].offset =
 		shstrtab_info->offset + shstrtab_info->size;
 
 	ELF64Symbol undef_symbol;
 	ZERO_STRUCT(&undef_symbol);
-	checked_fwrite(&undef_symbol, sizeof undef_symbol, 1, elf_file->output_file);
+	image_write(elf_file, &undef_symbol, sizeof undef_symbol);
 	elf_file->curr_symbol_index++;
 }
 
@@ -388,32 +383,29 @@ static void add_symbol(ELFFile *elf_file, ELFSymbolType type,
 	elf_file->next_string_index += strlen(name) + 1;
 	elf_file->curr_symbol_index++;
 
-	checked_fwrite(&symbol, sizeof symbol, 1, elf_file->output_file);
+	image_write(elf_file, &symbol, sizeof symbol);
 }
 
 static void finish_symtab_section(ELFFile *elf_file)
 {
 	SectionInfo *symtab_info = elf_file->section_info + SYMTAB_INDEX;
-	symtab_info->size = checked_ftell(elf_file->output_file) - symtab_info->offset;
+	symtab_info->size = elf_file->position - symtab_info->offset;
 	elf_file->section_info[STRTAB_INDEX].offset =
 		symtab_info->offset + symtab_info->size;
 
 	// The string table has to start with a 0 byte.
-	fputc('\0', elf_file->output_file);
+	image_write(elf_file, "", 1);
 }
 
 static void add_string(ELFFile *elf_file, char *string)
 {
-	fputs(string, elf_file->output_file);
-	fputc('\0', elf_file->output_file);
+	image_write(elf_file, string, strlen(string) + 1);
 }
 
 static void finish_strtab_section(ELFFile *elf_file)
 {
-	FILE *output_file = elf_file->output_file;
-
 	SectionInfo *strtab_info = elf_file->section_info + STRTAB_INDEX;
-	strtab_info->size = checked_ftell(output_file) - strtab_info->offset;
+	strtab_info->size = elf_file->position - strtab_info->offset;
 
 
 	// .strtab is the last section, so now we write out all the headers and
@@ -428,7 +420,7 @@ static void finish_strtab_section(ELFFile *elf_file)
 		header.pht_entries = 3;
 		header.pht_location =
 			sizeof(ELFHeader) + sizeof(ELFSectionHeader) * NUM_SECTIONS;
-		checked_fseek(output_file, header.pht_location, SEEK_SET);
+		elf_file->position = header.pht_location;
 
 		// Text segment
 		{
@@ -445,10 +437,8 @@ static void finish_strtab_section(ELFFile *elf_file)
 			executable_segment_header.flags = PF_R | PF_X;
 			executable_segment_header.alignment = 0x1000;
 
-			checked_fwrite(&executable_segment_header,
-					sizeof executable_segment_header,
-					1,
-					output_file);
+			image_write(elf_file, &executable_segment_header,
+					sizeof executable_segment_header);
 		}
 
 		// Zeroed data segment
@@ -464,10 +454,8 @@ static void finish_strtab_section(ELFFile *elf_file)
 			bss_segment_header.flags = PF_R | PF_W;
 			bss_segment_header.alignment = 0x1000;
 
-			checked_fwrite(&bss_segment_header,
-					sizeof bss_segment_header,
-					1,
-					output_file);
+			image_write(elf_file, &bss_segment_header,
+					sizeof bss_segment_header);
 		}
 
 		// Initialized data segment
@@ -483,17 +471,15 @@ static void finish_strtab_section(ELFFile *elf_file)
 			data_segment_header.flags = PF_R | PF_W;
 			data_segment_header.alignment = 0x1000;
 
-			checked_fwrite(&data_segment_header,
-					sizeof data_segment_header,
-					1,
-					output_file);
+			image_write(elf_file, &data_segment_header,
+					sizeof data_segment_header);
 		}
 	} else {
 		header.pht_entries = 0;
 		header.pht_location = 0;
 	}
 
-	checked_fseek(output_file, 0, SEEK_SET);
+	elf_file->position = 0;
 
 	header.identifier[ELF_IDENT_MAGIC0] = 0x7F;
 	header.identifier[ELF_IDENT_MAGIC1] = 'E';
@@ -517,17 +503,17 @@ static void finish_strtab_section(ELFFile *elf_file)
 	header.sht_entries = NUM_SECTIONS;
 	header.shstrtab_index = SHSTRTAB_INDEX;
 
-	assert(checked_ftell(output_file) == 0);
-	checked_fwrite(&header, sizeof header, 1, output_file);
+	assert(elf_file->position == 0);
+	image_write(elf_file, &header, sizeof header);
 
-	checked_fseek(output_file, header.sht_location, SEEK_SET);
+	elf_file->position = header.sht_location;
 
 	// NULL header
 	{
 		ELFSectionHeader null_header;
 		ZERO_STRUCT(&null_header);
 		null_header.type = SHT_NULL;
-		checked_fwrite(&null_header, sizeof null_header, 1, output_file);
+		image_write(elf_file, &null_header, sizeof null_header);
 	}
 
 	// .text
@@ -541,7 +527,7 @@ static void finish_strtab_section(ELFFile *elf_file)
 			elf_file->section_info[TEXT_INDEX].virtual_address;
 		text_header.section_location = elf_file->section_info[TEXT_INDEX].offset;
 		text_header.section_size = elf_file->section_info[TEXT_INDEX].size;
-		checked_fwrite(&text_header, sizeof text_header, 1, output_file);
+		image_write(elf_file, &text_header, sizeof text_header);
 	}
 
 	// .rela.text
@@ -555,7 +541,7 @@ static void finish_strtab_section(ELFFile *elf_file)
 		rela_text_header.section_location = elf_file->section_info[RELA_TEXT_INDEX].offset;
 		rela_text_header.section_size = elf_file->section_info[RELA_TEXT_INDEX].size;
 		rela_text_header.entry_size = sizeof(ELF64Rela);
-		checked_fwrite(&rela_text_header, sizeof rela_text_header, 1, output_file);
+		image_write(elf_file, &rela_text_header, sizeof rela_text_header);
 	}
 
 	// .bss
@@ -569,7 +555,7 @@ static void finish_strtab_section(ELFFile *elf_file)
 			elf_file->section_info[BSS_INDEX].virtual_address;
 		bss_header.section_location = elf_file->section_info[BSS_INDEX].offset;
 		bss_header.section_size = elf_file->section_info[BSS_INDEX].size;
-		checked_fwrite(&bss_header, sizeof bss_header, 1, output_file);
+		image_write(elf_file, &bss_header, sizeof bss_header);
 	}
 
 	// .data
@@ -583,7 +569,7 @@ static void finish_strtab_section(ELFFile *elf_file)
 			elf_file->section_info[DATA_INDEX].virtual_address;
 		data_header.section_location = elf_file->section_info[DATA_INDEX].offset;
 		data_header.section_size = elf_file->section_info[DATA_INDEX].size;
-		checked_fwrite(&data_header, sizeof data_header, 1, output_file);
+		image_write(elf_file, &data_header, sizeof data_header);
 	}
 
 	// .rela.data
@@ -597,7 +583,7 @@ static void finish_strtab_section(ELFFile *elf_file)
 		rela_data_header.section_location = elf_file->section_info[RELA_DATA_INDEX].offset;
 		rela_data_header.section_size = elf_file->section_info[RELA_DATA_INDEX].size;
 		rela_data_header.entry_size = sizeof(ELF64Rela);
-		checked_fwrite(&rela_data_header, sizeof rela_data_header, 1, output_file);
+		image_write(elf_file, &rela_data_header, sizeof rela_data_header);
 	}
 
 	// .shstrtab
@@ -608,7 +594,7 @@ static void finish_strtab_section(ELFFile *elf_file)
 		shstrtab_header.type = SHT_STRTAB;
 		shstrtab_header.section_location = elf_file->section_info[SHSTRTAB_INDEX].offset;
 		shstrtab_header.section_size = elf_file->section_info[SHSTRTAB_INDEX].size;
-		checked_fwrite(&shstrtab_header, sizeof shstrtab_header, 1, output_file);
+		image_write(elf_file, &shstrtab_header, sizeof shstrtab_header);
 	}
 
 	// .symtab
@@ -618,15 +604,17 @@ static void finish_strtab_section(ELFFile *elf_file)
 		symtab_header.shstrtab_index_for_name = SYMTAB_NAME;
 		symtab_header.type = SHT_SYMTAB;
 		// For symbol tables, this field contains 1 + the index of the last
-		// local symbol. We should at least have the STT_FILE symbol (which is
-		// local), so this should never be zero.
-		assert(elf_file->last_local_symbol_index != 0);
+		// local symbol. Object files should at least have the STT_FILE symbol
+		// (which is local), so this should never be zero for them. An
+		// executable might have no locals other than the null symbol.
+		assert(elf_file->type == ET_EXEC
+				|| elf_file->last_local_symbol_index != 0);
 		symtab_header.misc_info = elf_file->last_local_symbol_index + 1;
 		symtab_header.linked_section = STRTAB_INDEX;
 		symtab_header.section_location = elf_file->section_info[SYMTAB_INDEX].offset;
 		symtab_header.section_size = elf_file->section_info[SYMTAB_INDEX].size;
 		symtab_header.entry_size = sizeof(ELF64Symbol);
-		checked_fwrite(&symtab_header, sizeof symtab_header, 1, output_file);
+		image_write(elf_file, &symtab_header, sizeof symtab_header);
 	}
 
 	// .strtab
@@ -637,46 +625,325 @@ static void finish_strtab_section(ELFFile *elf_file)
 		strtab_header.type = SHT_STRTAB;
 		strtab_header.section_location = elf_file->section_info[STRTAB_INDEX].offset;
 		strtab_header.section_size = elf_file->section_info[STRTAB_INDEX].size;
-		checked_fwrite(&strtab_header, sizeof strtab_header, 1, output_file);
+		image_write(elf_file, &strtab_header, sizeof strtab_header);
 	}
 }
 
-bool write_elf_object_file(char *output_file_name, AsmModule *asm_module)
+// A contiguous piece of .text, .bss or .data that becomes its own section in
+// an object file. Without -ffunction-sections or -fdata-sections there's one
+// chunk per section kind.
+typedef struct Chunk
 {
-	FILE *output_file = fopen(output_file_name, "wb");
-	if (output_file == NULL) {
-		perror("Unable to open output file");
-		return false;
+	AsmSymbolSection section;
+	u32 start;
+	u32 end;
+	// The symbol the chunk is named after, or NULL for the plain section.
+	AsmSymbol *symbol;
+	Array(ELF64Rela) relas;
+
+	// Filled in as we write the object file.
+	u32 header_index;
+	u32 name;
+	u32 location;
+	u32 rela_name;
+	u32 rela_location;
+} Chunk;
+
+static int compare_symbol_offsets(const void *a, const void *b)
+{
+	AsmSymbol *symbol_a = *(AsmSymbol **)a;
+	AsmSymbol *symbol_b = *(AsmSymbol **)b;
+	if (symbol_a->offset < symbol_b->offset)
+		return -1;
+	if (symbol_a->offset > symbol_b->offset)
+		return 1;
+	return 0;
+}
+
+// Splits one kind of section into chunks. If split is set, every defined
+// symbol with a size starts a new chunk, so each function or variable can be
+// kept or discarded by the linker independently.
+static void add_chunks(Array(Chunk) *chunks, AsmModule *asm_module,
+		AsmSymbolSection section, u32 section_size, bool split)
+{
+	Array(AsmSymbol *) starts = EMPTY_ARRAY;
+	if (split) {
+		ARRAY_INIT(&starts, AsmSymbol *, 16);
+		for (u32 i = 0; i < asm_module->symbols.size; i++) {
+			AsmSymbol *symbol = *ARRAY_REF(&asm_module->symbols, AsmSymbol *, i);
+			if (symbol->defined && symbol->section == section
+					&& symbol->size != 0) {
+				*ARRAY_APPEND(&starts, AsmSymbol *) = symbol;
+			}
+		}
+		qsort(starts.elements, starts.size, sizeof(AsmSymbol *),
+				compare_symbol_offsets);
+	}
+
+	// Anything before the first symbol, or the whole section if we aren't
+	// splitting it, goes in a chunk named after the section itself. We
+	// always emit this if there are no other chunks, as the linker expects
+	// every object file to have a .text section.
+	u32 first_start = starts.size == 0
+		? section_size
+		: (*ARRAY_REF(&starts, AsmSymbol *, 0))->offset;
+	if (first_start != 0 || starts.size == 0) {
+		Chunk *chunk = ARRAY_APPEND(chunks, Chunk);
+		ZERO_STRUCT(chunk);
+		chunk->section = section;
+		chunk->start = 0;
+		chunk->end = first_start;
+		chunk->symbol = NULL;
+	}
+
+	for (u32 i = 0; i < starts.size; i++) {
+		AsmSymbol *symbol = *ARRAY_REF(&starts, AsmSymbol *, i);
+		u32 end = i == starts.size - 1
+			? section_size
+			: (*ARRAY_REF(&starts, AsmSymbol *, i + 1))->offset;
+
+		// Symbols can share an offset, e.g.: zero-sized variables. Only the
+		// first one gets a chunk.
+		if (end == symbol->offset)
+			continue;
+
+		Chunk *chunk = ARRAY_APPEND(chunks, Chunk);
+		ZERO_STRUCT(chunk);
+		chunk->section = section;
+		chunk->start = symbol->offset;
+		chunk->end = end;
+		chunk->symbol = symbol;
+	}
+
+	if (ARRAY_IS_VALID(&starts))
+		array_free(&starts);
+}
+
+// Returns the chunk containing offset in the given kind of section. Chunks
+// are sorted by section and then offset, so we can binary search.
+static Chunk *find_chunk(Array(Chunk) *chunks, AsmSymbolSection section,
+		u32 offset)
+{
+	Chunk *found = NULL;
+	u32 low = 0;
+	u32 high = chunks->size;
+	while (low < high) {
+		u32 mid = low + (high - low) / 2;
+		Chunk *chunk = ARRAY_REF(chunks, Chunk, mid);
+		if (chunk->section < section
+				|| (chunk->section == section && chunk->start <= offset)) {
+			if (chunk->section == section)
+				found = chunk;
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	assert(found != NULL);
+	return found;
+}
+
+static u32 add_section_name(Array(char) *shstrtab, char *prefix, char *name)
+{
+	u32 index = shstrtab->size;
+	ARRAY_APPEND_ELEMS(shstrtab, char, strlen(prefix), prefix);
+	if (name != NULL) {
+		*ARRAY_APPEND(shstrtab, char) = '.';
+		ARRAY_APPEND_ELEMS(shstrtab, char, strlen(name), name);
+	}
+	*ARRAY_APPEND(shstrtab, char) = '\0';
+
+	return index;
+}
+
+static void write_section_header(ELFFile *elf_file, u32 name,
+		ELFSectionHeaderType type, u64 flags, u32 location, u32 size,
+		u32 linked_section, u32 misc_info, u32 entry_size)
+{
+	ELFSectionHeader header;
+	ZERO_STRUCT(&header);
+	header.shstrtab_index_for_name = name;
+	header.type = type;
+	header.flags = flags;
+	header.section_location = location;
+	header.section_size = size;
+	header.linked_section = linked_section;
+	header.misc_info = misc_info;
+	header.entry_size = entry_size;
+	image_write(elf_file, &header, sizeof header);
+}
+
+// Splits an assembled module into the chunks that become its sections, and
+// computes the relocations for each. Relocations refer to symbols by their
+// symtab_index, as in the object file's symbol table.
+static void build_chunks(Array(Chunk) *chunks, AsmModule *asm_module,
+		bool function_sections, bool data_sections)
+{
+	ARRAY_INIT(chunks, Chunk, 3);
+	add_chunks(chunks, asm_module, TEXT_SECTION,
+			asm_module->text.bytes.size, function_sections);
+	add_chunks(chunks, asm_module, DATA_SECTION,
+			asm_module->data.size, data_sections);
+	add_chunks(chunks, asm_module, BSS_SECTION,
+			asm_module->bss_size, data_sections);
+
+	for (u32 i = 0; i < chunks->size; i++)
+		ARRAY_INIT(&ARRAY_REF(chunks, Chunk, i)->relas, ELF64Rela, 0);
+
+	Array(Fixup) *fixups = &asm_module->fixups;
+	for (u32 i = 0; i < fixups->size; i++) {
+		Fixup *fixup = *ARRAY_REF(fixups, Fixup *, i);
+		AsmSymbol *symbol = fixup->symbol;
+		Chunk *chunk = find_chunk(chunks, fixup->section, fixup->offset);
+
+		// assemble has already resolved relative references within .text.
+		// We only need a relocation if they might end up moving relative to
+		// each other, i.e.: if they're in different sections.
+		if (fixup->type == FIXUP_RELATIVE
+				&& symbol->defined
+				&& fixup->section == TEXT_SECTION
+				&& symbol->section == TEXT_SECTION
+				&& find_chunk(chunks, TEXT_SECTION, symbol->offset) == chunk) {
+			continue;
+		}
+
+		u32 symtab_index = symbol->symtab_index;
+		assert(symtab_index != 0);
+
+		ELF64RelocType reloc_type;
+		i64 addend;
+		switch (fixup->type) {
+		case FIXUP_RELATIVE:
+			assert(fixup->section == TEXT_SECTION);
+			assert(fixup->size_bytes == 4);
+			reloc_type = R_X86_64_PC32;
+			addend = (i64)fixup->offset - (i64)fixup->next_instr_offset;
+			break;
+		case FIXUP_ABSOLUTE:
+			// Displacements and 32-bit immediates are sign-extended.
+			if (fixup->size_bytes == 8) {
+				reloc_type = R_X86_64_64;
+			} else {
+				assert(fixup->section == TEXT_SECTION);
+				assert(fixup->size_bytes == 4);
+				reloc_type = R_X86_64_32S;
+			}
+			addend = 0;
+			break;
+		}
+
+		*ARRAY_APPEND(&chunk->relas, ELF64Rela) = (ELF64Rela) {
+			.section_offset = fixup->offset - chunk->start,
+			.type_and_symbol =
+				ELF64_RELA_TYPE_AND_SYMBOL(reloc_type, symtab_index),
+			.addend = addend,
+		};
+	}
+}
+
+static void free_chunks(Array(Chunk) *chunks)
+{
+	for (u32 i = 0; i < chunks->size; i++)
+		array_free(&ARRAY_REF(chunks, Chunk, i)->relas);
+	array_free(chunks);
+}
+
+// Writes a relocatable object file. The sections are .text, .data and .bss,
+// with .rela.text and .rela.data for their relocations, followed by .shstrtab,
+// .symtab and .strtab. With function_sections or data_sections, .text or .data
+// and .bss respectively are split into a section per symbol, named e.g.:
+// ".text.main", each with its own relocation section.
+bool write_elf_object_file(char *output_file_name, AsmModule *asm_module,
+		bool function_sections, bool data_sections)
+{
+	Array(Chunk) chunks;
+	build_chunks(&chunks, asm_module, function_sections, data_sections);
+
+	// Assign section header indices. Each chunk is immediately followed by
+	// its relocations, if it has any.
+	u32 num_headers = 1;
+	for (u32 i = 0; i < chunks.size; i++) {
+		Chunk *chunk = ARRAY_REF(&chunks, Chunk, i);
+		chunk->header_index = num_headers++;
+		if (chunk->relas.size != 0)
+			num_headers++;
 	}
+	u32 shstrtab_index = num_headers++;
+	u32 symtab_index = num_headers++;
+	u32 strtab_index = num_headers++;
 
 	ELFFile _elf_file;
 	ELFFile *elf_file = &_elf_file;
-	init_elf_file(elf_file, output_file, ET_REL);
+	init_elf_file(elf_file, ET_REL);
+
+	// Section contents go after the header and the section header table,
+	// which we fill in last, once we know where everything is.
+	u32 sht_location = sizeof(ELFHeader);
+	elf_file->position = sht_location + num_headers * sizeof(ELFSectionHeader);
+
+	Array(char) shstrtab;
+	ARRAY_INIT(&shstrtab, char, 64);
+	*ARRAY_APPEND(&shstrtab, char) = '\0';
+
+	for (u32 i = 0; i < chunks.size; i++) {
+		Chunk *chunk = ARRAY_REF(&chunks, Chunk, i);
+		char *symbol_name = chunk->symbol == NULL ? NULL : chunk->symbol->name;
+
+		u8 *contents = NULL;
+		switch (chunk->section) {
+		case TEXT_SECTION:
+			chunk->name = add_section_name(&shstrtab, ".text", symbol_name);
+			chunk->rela_name =
+				add_section_name(&shstrtab, ".rela.text", symbol_name);
+			contents = asm_module->text.bytes.elements;
+			break;
+		case BSS_SECTION:
+			chunk->name = add_section_name(&shstrtab, ".bss", symbol_name);
+			break;
+		case DATA_SECTION:
+			chunk->name = add_section_name(&shstrtab, ".data", symbol_name);
+			chunk->rela_name =
+				add_section_name(&shstrtab, ".rela.data", symbol_name);
+			contents = asm_module->data.elements;
+			break;
+		case UNKNOWN_SECTION:
+			UNREACHABLE;
+		}
 
-	elf_file->section_info[TEXT_INDEX].size = asm_module->text.bytes.size;
-	elf_file->section_info[TEXT_INDEX].contents = asm_module->text.bytes.elements;
+		chunk->location = elf_file->position;
+		if (contents != NULL) {
+			image_write(elf_file, contents + chunk->start,
+					chunk->end - chunk->start);
+		}
 
-	elf_file->section_info[BSS_INDEX].size = asm_module->bss_size;
+		chunk->rela_location = elf_file->position;
+		image_write(elf_file, chunk->relas.elements,
+				chunk->relas.size * sizeof(ELF64Rela));
+	}
 
-	elf_file->section_info[DATA_INDEX].size = asm_module->data.size;
-	elf_file->section_info[DATA_INDEX].contents = asm_module->data.elements;
+	u32 shstrtab_location = elf_file->position;
+	u32 shstrtab_name = add_section_name(&shstrtab, ".shstrtab", NULL);
+	u32 symtab_name = add_section_name(&shstrtab, ".symtab", NULL);
+	u32 strtab_name = add_section_name(&shstrtab, ".strtab", NULL);
+	image_write(elf_file, shstrtab.elements, shstrtab.size);
 
-	write_contents(elf_file, &asm_module->fixups);
+	u32 symtab_location = elf_file->position;
+	ELF64Symbol undef_symbol;
+	ZERO_STRUCT(&undef_symbol);
+	image_write(elf_file, &undef_symbol, sizeof undef_symbol);
+	elf_file->curr_symbol_index++;
 
 	Array(AsmSymbol *) *symbols = &asm_module->symbols;
 	for (u32 i = 0; i < symbols->size; i++) {
 		AsmSymbol *symbol = *ARRAY_REF(symbols, AsmSymbol *, i);
 		u32 section = SHN_UNDEF;
+		u32 value = symbol->offset;
 		ELFSymbolBinding binding = STB_GLOBAL;
-		if (!symbol->defined) {
-			section = SHN_UNDEF;
-		} else {
-			switch (symbol->section) {
-			case UNKNOWN_SECTION: UNREACHABLE;
-			case TEXT_SECTION: section = TEXT_INDEX; break;
-			case BSS_SECTION: section = BSS_INDEX; break;
-			case DATA_SECTION: section = DATA_INDEX; break;
-			}
+		if (symbol->defined) {
+			Chunk *chunk = find_chunk(&chunks, symbol->section, symbol->offset);
+			section = chunk->header_index;
+			value -= chunk->start;
 
 			switch (symbol->linkage) {
 			case ASM_GLOBAL_LINKAGE: binding = STB_GLOBAL; break;
@@ -684,509 +951,1569 @@ bool write_elf_object_file(char *output_file_name, AsmModule *asm_module)
 			}
 		}
 		add_symbol(elf_file, STT_FUNC, binding, section, symbol->name,
-				symbol->offset, symbol->size);
+				value, symbol->size);
 	}
 	add_symbol(elf_file, STT_FILE, STB_LOCAL, SHN_ABS, asm_module->input_file_name, 0, 0);
-	finish_symtab_section(elf_file);
+	u32 symtab_size = elf_file->position - symtab_location;
 
+	u32 strtab_location = elf_file->position;
+	// The string table has to start with a 0 byte.
+	image_write(elf_file, "", 1);
 	for (u32 i = 0; i < symbols->size; i++) {
 		AsmSymbol *symbol = *ARRAY_REF(symbols, AsmSymbol *, i);
 		add_string(elf_file, symbol->name);
 	}
 	add_string(elf_file, asm_module->input_file_name);
-	finish_strtab_section(elf_file);
+	u32 strtab_size = elf_file->position - strtab_location;
 
-	fclose(output_file);
-	return true;
+	ELFHeader header;
+	ZERO_STRUCT(&header);
+	header.identifier[ELF_IDENT_MAGIC0] = 0x7F;
+	header.identifier[ELF_IDENT_MAGIC1] = 'E';
+	header.identifier[ELF_IDENT_MAGIC2] = 'L';
+	header.identifier[ELF_IDENT_MAGIC3] = 'F';
+	header.identifier[ELF_IDENT_FILE_CLASS] = ELFCLASS64;
+	header.identifier[ELF_IDENT_DATA_ENCODING] = ELFDATA2LSB;
+	header.identifier[ELF_IDENT_ELF_VERSION] = EV_CURRENT;
+	header.object_file_type = ET_REL;
+	header.target_architecture = EM_X86_64;
+	header.elf_version = EV_CURRENT;
+	header.header_size = sizeof(ELFHeader);
+	header.section_header_size = sizeof(ELFSectionHeader);
+	header.program_header_size = sizeof(ELFProgramHeader);
+	header.sht_location = sht_location;
+	header.sht_entries = num_headers;
+	header.shstrtab_index = shstrtab_index;
+
+	elf_file->position = 0;
+	image_write(elf_file, &header, sizeof header);
+
+	ELFSectionHeader null_header;
+	ZERO_STRUCT(&null_header);
+	image_write(elf_file, &null_header, sizeof null_header);
+
+	for (u32 i = 0; i < chunks.size; i++) {
+		Chunk *chunk = ARRAY_REF(&chunks, Chunk, i);
+		u32 size = chunk->end - chunk->start;
+
+		switch (chunk->section) {
+		case TEXT_SECTION:
+			write_section_header(elf_file, chunk->name, SHT_PROGBITS,
+					SHF_ALLOC | SHF_EXECINSTR, chunk->location, size, 0, 0, 0);
+			break;
+		case BSS_SECTION:
+			write_section_header(elf_file, chunk->name, SHT_NOBITS,
+					SHF_ALLOC | SHF_WRITE, chunk->location, size, 0, 0, 0);
+			break;
+		case DATA_SECTION:
+			write_section_header(elf_file, chunk->name, SHT_PROGBITS,
+					SHF_ALLOC | SHF_WRITE, chunk->location, size, 0, 0, 0);
+			break;
+		case UNKNOWN_SECTION:
+			UNREACHABLE;
+		}
+
+		if (chunk->relas.size != 0) {
+			write_section_header(elf_file, chunk->rela_name, SHT_RELA, 0,
+					chunk->rela_location,
+					chunk->relas.size * sizeof(ELF64Rela),
+					symtab_index, chunk->header_index, sizeof(ELF64Rela));
+		}
+	}
+
+	write_section_header(elf_file, shstrtab_name, SHT_STRTAB, 0,
+			shstrtab_location, shstrtab.size, 0, 0, 0);
+	// For symbol tables, misc_info contains 1 + the index of the last local
+	// symbol. We always add the STT_FILE symbol (which is local), so this is
+	// never zero.
+	assert(elf_file->last_local_symbol_index != 0);
+	write_section_header(elf_file, symtab_name, SHT_SYMTAB, 0,
+			symtab_location, symtab_size, strtab_index,
+			elf_file->last_local_symbol_index + 1, sizeof(ELF64Symbol));
+	write_section_header(elf_file, strtab_name, SHT_STRTAB, 0,
+			strtab_location, strtab_size, 0, 0, 0);
+
+	free_chunks(&chunks);
+	array_free(&shstrtab);
+
+	return write_image(elf_file, output_file_name);
 }
 
 typedef struct Relocation
 {
 	ELF64RelocType type;
-	u32 section_index;
-	u32 section_offset;
+	// The offset of the location to patch in the relocation's input section.
+	u32 offset;
+	u32 symbol_index;
 	i32 addend;
 } Relocation;
 
+// A section of an input object file. These are the units that --gc-sections
+// keeps or discards.
+typedef struct InputSection
+{
+	// TEXT_INDEX, BSS_INDEX or DATA_INDEX, i.e.: which output section the
+	// contents go in.
+	u32 output_index;
+	// Points into the input file, or NULL for .bss sections.
+	u8 *contents;
+	u32 size;
+
+	// The relocations to apply to this section are
+	// relocs[first_reloc, first_reloc + num_relocs).
+	u32 first_reloc;
+	u32 num_relocs;
+
+	bool live;
+	// Assigned during layout, for live sections only.
+	u32 output_offset;
+} InputSection;
+
 typedef struct Symbol
 {
 	bool defined;
 	char *name;
-	Array(Relocation) relocs;
+	ELFSymbolBinding binding;
 
 	// @NOTE: None of the following fields have well-defined values if defined
 	// is false.
 
-	// @NOTE: This doesn't tell you which object file the symbol table belongs
-	// to. This is just used for locating symbols from within the same object
-	// file when processing relocation entries.
-	u32 symtab_index;
-
-	ELFSymbolBinding binding;
-	u32 section_index;
-	u32 section_offset;
+	// The index of the input section the symbol is defined in, and its
+	// offset within it.
+	u32 section;
+	u32 value;
 	u32 size;
-	u8 *contents;
 } Symbol;
 
-void process_rela_section(ELFSectionHeader *rela_header, u32 *file_symbols,
-		Array(Symbol) *symbol_table, FILE *input_file, u32 initial_location,
-		u32 existing_section_size, u32 corresponding_section_index)
-{
-	if (rela_header != NULL) {
-		assert(rela_header->type == SHT_RELA);
-		assert(rela_header->entry_size == sizeof(ELF64Rela));
-
-		checked_fseek(input_file,
-				initial_location + rela_header->section_location,
-				SEEK_SET);
-		u32 rela_entries = rela_header->section_size / rela_header->entry_size;
-		for (u32 rela_index = 0; rela_index < rela_entries; rela_index++) {
-			ELF64Rela rela;
-			checked_fread(&rela, sizeof rela, 1, input_file);
-
-			ELF64RelocType type = ELF64_RELA_TYPE(rela.type_and_symbol);
-			u32 symtab_index = ELF64_RELA_SYMBOL(rela.type_and_symbol);
-			Symbol *corresponding_symbol =
-				ARRAY_REF(symbol_table, Symbol, file_symbols[symtab_index]);
-			assert(corresponding_symbol != NULL);
-
-			Relocation *reloc =
-				ARRAY_APPEND(&corresponding_symbol->relocs, Relocation);
-			reloc->type = type;
-			reloc->addend = rela.addend;
-			reloc->section_index = corresponding_section_index;
-			reloc->section_offset = existing_section_size + rela.section_offset;
-		}
-	}
+typedef struct SymbolTable
+{
+	Array(Symbol) symbols;
+	// Maps the names of global symbols to their index in symbols. Local
+	// symbols are only referred to by index, so they don't go in here.
+	HashTable globals;
+	// Symbol names are interned here, so each global name is stored once no
+	// matter how many object files refer to it.
+	Pool names;
+} SymbolTable;
+
+typedef struct Linker
+{
+	SymbolTable symbol_table;
+	Array(InputSection) sections;
+	Array(Relocation) relocs;
+} Linker;
+
+static void symbol_table_init(SymbolTable *symbol_table)
+{
+	ARRAY_INIT(&symbol_table->symbols, Symbol, 100);
+	hash_table_init(&symbol_table->globals, 100);
+	pool_init(&symbol_table->names, 4096);
 }
 
-// @TODO: Handle archives correctly. Currently we just treat them as a series
-// of object files, but archives have different semantics.
-// See http://eli.thegreenplace.net/2013/07/09/library-order-in-static-linking
-// for details.
-static bool process_elf_file(FILE *input_file, AsmModule *asm_module,
-		Array(Symbol) *symbol_table)
+static void symbol_table_free(SymbolTable *symbol_table)
 {
-	u32 initial_location = checked_ftell(input_file);
+	array_free(&symbol_table->symbols);
+	hash_table_free(&symbol_table->globals);
+	pool_free(&symbol_table->names);
+}
 
-	ELFHeader file_header;
+static i32 find_global(SymbolTable *symbol_table, char *name)
+{
+	u32 *index = hash_table_lookup(&symbol_table->globals, name, strlen(name));
+	return index == NULL ? -1 : (i32)*index;
+}
 
-	// We check this the first time to get nicer error handling if the file is
-	// unreadable. However, we assume that its unlikely for a file to become
-	// unreadable partway through reading, so for the rest we just use
-	// asserting functions.
-	if (fread(&file_header, sizeof file_header, 1, input_file) != 1) {
-		perror("Failed to read from ELF file");
-		return false;
+// Adds a new, undefined symbol, and returns its index.
+static u32 add_linker_symbol(SymbolTable *symbol_table, char *name,
+		ELFSymbolBinding binding)
+{
+	u32 name_length = strlen(name);
+	char *interned_name = pool_alloc(&symbol_table->names, name_length + 1);
+	memcpy(interned_name, name, name_length + 1);
+
+	u32 symbol_index = symbol_table->symbols.size;
+	Symbol *symbol = ARRAY_APPEND(&symbol_table->symbols, Symbol);
+	ZERO_STRUCT(symbol);
+	symbol->defined = false;
+	symbol->name = interned_name;
+	symbol->binding = binding;
+
+	if (binding == STB_GLOBAL) {
+		bool inserted;
+		*hash_table_insert(&symbol_table->globals,
+				interned_name, name_length, &inserted) = symbol_index;
+		assert(inserted);
 	}
-	assert(file_header.shstrtab_index < file_header.sht_entries);
 
-	// This should have been checked already
-	assert(strneq((char *)file_header.identifier, "\x7F" "ELF", 4));
+	return symbol_index;
+}
 
-	if (file_header.target_architecture != EM_X86_64) {
-		fprintf(stderr,
-				"Invalid architecture (%d given, %d expected)\n",
-				file_header.target_architecture, EM_X86_64);
-		return false;
-	}
-	assert(file_header.section_header_size == sizeof(ELFSectionHeader));
+// Whether the contents of a section lie within the file. Everything else we
+// read from a section is trusted once this has been checked.
+static bool section_in_bounds(ELFSectionHeader *header, u32 file_size)
+{
+	return header->section_location <= file_size
+		&& header->section_size <= file_size - header->section_location;
+}
 
-	u32 sht_offset = file_header.sht_location;
-	checked_fseek(input_file, initial_location + sht_offset, SEEK_SET);
+// Returns the section header table of the ELF file, or NULL if the file is
+// truncated.
+static ELFSectionHeader *section_headers(u8 *file, u32 file_size)
+{
+	if (file_size < sizeof(ELFHeader))
+		return NULL;
 
-	bool ret = true;
-	ELFSectionHeader *headers =
-		malloc(sizeof *headers * file_header.sht_entries);
-	checked_fread(headers, sizeof *headers, file_header.sht_entries, input_file);
+	ELFHeader *file_header = (ELFHeader *)file;
 
-	ELFSectionHeader *shstrtab_header = headers + file_header.shstrtab_index;
-	assert(shstrtab_header->type == SHT_STRTAB);
-	char *shstrtab = malloc(shstrtab_header->section_size);
-	checked_fseek(input_file,
-				initial_location + shstrtab_header->section_location,
-				SEEK_SET);
-	checked_fread(shstrtab, 1, shstrtab_header->section_size, input_file);
-
-	ELFSectionHeader *text_header = NULL;
-	u32 text_section_index = SHN_UNDEF;
-	ELFSectionHeader *symtab_header = NULL;
-	ELFSectionHeader *strtab_header = NULL;
-	ELFSectionHeader *rela_text_header = NULL;
-	u32 data_section_index = SHN_UNDEF;
-	ELFSectionHeader *data_header = NULL;
-	ELFSectionHeader *rela_data_header = NULL;
-	u32 bss_section_index = SHN_UNDEF;
-	ELFSectionHeader *bss_header = NULL;
-	for (u32 i = 0; i < file_header.sht_entries; i++) {
-		ELFSectionHeader *curr_header = headers + i;
-		char *section_name = shstrtab + curr_header->shstrtab_index_for_name;
+	// This should have been checked already
+	assert(strneq((char *)file_header->identifier, "\x7F" "ELF", 4));
+	assert(file_header->section_header_size == sizeof(ELFSectionHeader));
 
-		if (streq(section_name, ".text")) {
-			text_header = curr_header;
-			text_section_index = i;
-		} else if (streq(section_name, ".symtab")) {
-			symtab_header = curr_header;
-		} else if (streq(section_name, ".strtab")) {
-			strtab_header = curr_header;
-		} else if (strneq(section_name, ".rela", 5)) {
-			if (streq(section_name, ".rela.text")) {
-				rela_text_header = curr_header;
-			} else if (streq(section_name, ".rela.data")) {
-				rela_data_header = curr_header;
-			} else {
-				fprintf(stderr, "Relocations for that section are not"
-						" supported (found rela section %s)\n", section_name);
-				goto cleanup1;
-			}
-		} else if (streq(section_name, ".bss")) {
-			bss_header = curr_header;
-			bss_section_index = i;
-		} else if (streq(section_name, ".data")) {
-			data_header = curr_header;
-			data_section_index = i;
-		}
+	u64 sht_size = (u64)file_header->sht_entries * sizeof(ELFSectionHeader);
+	if (file_header->sht_location > file_size
+			|| sht_size > file_size - file_header->sht_location) {
+		return NULL;
 	}
 
-	if (text_header == NULL) {
-		fputs("Missing .text section\n", stderr);
-		ret = false;
-		goto cleanup1;
-	}
-	if (symtab_header == NULL) {
-		fputs("Missing .symtab section\n", stderr);
-		ret = false;
-		goto cleanup1;
-	}
-	if (strtab_header == NULL) {
-		fputs("Missing .strtab section\n", stderr);
-		ret = false;
-		goto cleanup1;
-	}
+	return (ELFSectionHeader *)(file + file_header->sht_location);
+}
 
-	assert(text_header->type == SHT_PROGBITS);
+// Matches e.g.: both ".text" and ".text.main" against ".text".
+static bool has_section_prefix(char *section_name, char *prefix)
+{
+	u32 length = strlen(prefix);
+	return strneq(section_name, prefix, length)
+		&& (section_name[length] == '\0' || section_name[length] == '.');
+}
 
-	assert(symtab_header->type == SHT_SYMTAB);
-	assert(symtab_header->entry_size == sizeof(ELF64Symbol));
+typedef struct ObjectSection
+{
+	// TEXT_INDEX, BSS_INDEX or DATA_INDEX.
+	u32 output_index;
+	// Points into the file, or NULL for .bss sections.
+	u8 *contents;
+	u32 size;
 
-	assert(strtab_header->type == SHT_STRTAB);
+	ELF64Rela *relas;
+	u32 num_relas;
+} ObjectSection;
 
-	char *strtab = malloc(strtab_header->section_size);
-	checked_fseek(input_file,
-				initial_location + strtab_header->section_location,
-				SEEK_SET);
-	checked_fread(strtab, 1, strtab_header->section_size, input_file);
+typedef struct ObjectSymbol
+{
+	// Symbols we don't link, e.g.: STT_FILE symbols, or section symbols for
+	// sections we don't keep.
+	bool ignored;
 
-	u32 existing_text_size = asm_module->text.bytes.size;
-	u32 existing_bss_size = asm_module->bss_size;
-	u32 existing_data_size = asm_module->data.size;
+	char *name;
+	u32 name_length;
+	u32 hash;
+	ELFSymbolBinding binding;
+	// An index into the object file's sections, or -1 if undefined.
+	i32 section;
+	u32 value;
+	u32 size;
+} ObjectSymbol;
 
-	u8 *temp_buffer = NULL;
+// An object file that has been parsed but not yet merged into the link.
+// Parsing only depends on the file itself, so we can parse many object files
+// at once, and then merge them serially in input order so the output doesn't
+// depend on how the parsing was scheduled.
+//
+// Section contents and names point into the file, so it must stay mapped
+// until the link is finished.
+typedef struct ObjectFile
+{
+	// The .text, .bss and .data sections, including any split out by
+	// -ffunction-sections or -fdata-sections, in file order.
+	ObjectSection *sections;
+	u32 num_sections;
 
-	if (text_header != NULL && text_header->section_size != 0) {
-		checked_fseek(input_file,
-				initial_location + text_header->section_location,
-				SEEK_SET);
-		temp_buffer = realloc(temp_buffer, text_header->section_size);
-		checked_fread(temp_buffer, text_header->section_size, 1, input_file);
-		ARRAY_APPEND_ELEMS(&asm_module->text.bytes, u8, text_header->section_size, temp_buffer);
-	}
+	// Indexed by the symbol's index in the object file's symtab.
+	ObjectSymbol *symbols;
+	u32 symbol_count;
 
-	if (data_header != NULL && data_header->section_size != 0) {
-		checked_fseek(input_file,
-				initial_location + data_header->section_location,
-				SEEK_SET);
-		temp_buffer = realloc(temp_buffer, data_header->section_size);
-		checked_fread(temp_buffer, data_header->section_size, 1, input_file);
-		ARRAY_APPEND_ELEMS(&asm_module->data, u8, data_header->section_size, temp_buffer);
-	}
+	// For object files built from an AsmModule, the relocations of every
+	// section, which we allocate as there's no file for them to point into.
+	ELF64Rela *owned_relas;
 
-	free(temp_buffer);
+	// We don't print errors while parsing, so that errors from inputs parsed
+	// in parallel come out in input order.
+	char error[128];
+} ObjectFile;
 
-	if (bss_header != NULL)
-		asm_module->bss_size += bss_header->section_size;
+static void free_object_file(ObjectFile *object)
+{
+	free(object->sections);
+	object->sections = NULL;
+	free(object->symbols);
+	object->symbols = NULL;
+	free(object->owned_relas);
+	object->owned_relas = NULL;
+}
+
+// Parses an object file without touching any state shared with the rest of
+// the link, so this is safe to call on many files at once. On failure, the
+// reason is stored in object->error.
+static bool parse_elf_file(u8 *file, u32 file_size, ObjectFile *object)
+{
+	ZERO_STRUCT(object);
+
+	ELFSectionHeader *headers = section_headers(file, file_size);
+	if (headers == NULL) {
+		snprintf(object->error, sizeof object->error, "Truncated ELF file");
+		return false;
+	}
+
+	ELFHeader *file_header = (ELFHeader *)file;
+	u32 sht_entries = file_header->sht_entries;
+	assert(file_header->shstrtab_index < sht_entries);
+
+	if (file_header->target_architecture != EM_X86_64) {
+		snprintf(object->error, sizeof object->error,
+				"Invalid architecture (%d given, %d expected)",
+				file_header->target_architecture, EM_X86_64);
+		return false;
+	}
+
+	for (u32 i = 0; i < sht_entries; i++) {
+		if (headers[i].type != SHT_NOBITS
+				&& !section_in_bounds(headers + i, file_size)) {
+			snprintf(object->error, sizeof object->error,
+					"Truncated ELF file");
+			return false;
+		}
+	}
+
+	ELFSectionHeader *shstrtab_header = headers + file_header->shstrtab_index;
+	assert(shstrtab_header->type == SHT_STRTAB);
+	char *shstrtab = (char *)file + shstrtab_header->section_location;
+
+	bool ret = true;
+
+	// Maps section header indices to indices in object->sections, or -1 for
+	// sections we don't link.
+	i32 *section_map = malloc(sizeof *section_map * sht_entries);
+	object->sections = malloc(sizeof *object->sections * sht_entries);
+	object->num_sections = 0;
+
+	ELFSectionHeader *symtab_header = NULL;
+	ELFSectionHeader *strtab_header = NULL;
+	for (u32 i = 0; i < sht_entries; i++) {
+		ELFSectionHeader *curr_header = headers + i;
+		char *section_name = shstrtab + curr_header->shstrtab_index_for_name;
+		section_map[i] = -1;
+
+		u32 output_index;
+		if (has_section_prefix(section_name, ".text")) {
+			assert(curr_header->type == SHT_PROGBITS);
+			output_index = TEXT_INDEX;
+		} else if (has_section_prefix(section_name, ".bss")) {
+			output_index = BSS_INDEX;
+		} else if (has_section_prefix(section_name, ".data")) {
+			output_index = DATA_INDEX;
+		} else {
+			if (streq(section_name, ".symtab"))
+				symtab_header = curr_header;
+			else if (streq(section_name, ".strtab"))
+				strtab_header = curr_header;
+			continue;
+		}
+
+		section_map[i] = object->num_sections;
+		ObjectSection *section = object->sections + object->num_sections++;
+		ZERO_STRUCT(section);
+		section->output_index = output_index;
+		section->size = curr_header->section_size;
+		if (output_index != BSS_INDEX)
+			section->contents = file + curr_header->section_location;
+	}
+
+	// Relocation sections can come before or after the sections they apply
+	// to, so we find them in a second pass.
+	for (u32 i = 0; i < sht_entries; i++) {
+		ELFSectionHeader *curr_header = headers + i;
+		char *section_name = shstrtab + curr_header->shstrtab_index_for_name;
+		if (!strneq(section_name, ".rela", 5))
+			continue;
+
+		u32 target = curr_header->misc_info;
+		if (curr_header->type != SHT_RELA || target >= sht_entries
+				|| section_map[target] == -1
+				|| object->sections[section_map[target]].output_index
+					== BSS_INDEX) {
+			snprintf(object->error, sizeof object->error,
+					"Relocations for that section are not supported"
+					" (found rela section %s)", section_name);
+			ret = false;
+			goto cleanup;
+		}
+		if (curr_header->entry_size != sizeof(ELF64Rela)) {
+			snprintf(object->error, sizeof object->error,
+					"Malformed relocation section %s", section_name);
+			ret = false;
+			goto cleanup;
+		}
+
+		ObjectSection *section = object->sections + section_map[target];
+		section->relas = (ELF64Rela *)(file + curr_header->section_location);
+		section->num_relas = curr_header->section_size / sizeof(ELF64Rela);
+	}
+
+	if (symtab_header == NULL) {
+		snprintf(object->error, sizeof object->error, "Missing .symtab section");
+		ret = false;
+		goto cleanup;
+	}
+	if (strtab_header == NULL) {
+		snprintf(object->error, sizeof object->error, "Missing .strtab section");
+		ret = false;
+		goto cleanup;
+	}
+
+	assert(symtab_header->type == SHT_SYMTAB);
+	assert(symtab_header->entry_size == sizeof(ELF64Symbol));
+
+	assert(strtab_header->type == SHT_STRTAB);
+
+	char *strtab = (char *)file + strtab_header->section_location;
 
 	u32 symbols_in_symtab = symtab_header->section_size / symtab_header->entry_size;
-	checked_fseek(input_file,
-			initial_location + symtab_header->section_location,
-			SEEK_SET);
+	ELF64Symbol *symtab =
+		(ELF64Symbol *)(file + symtab_header->section_location);
 
-	u32 *file_symbols = calloc(sizeof(*file_symbols) * symbols_in_symtab, 1);
+	object->symbol_count = symbols_in_symtab;
+	object->symbols = malloc(sizeof *object->symbols * symbols_in_symtab);
 
-	// @TODO: We can iterate across this more efficiently by using the
-	// information in the header about the last local symbol. We can also use
-	// this to allocate fewer symbols.
 	for (u32 symtab_index = 0; symtab_index < symbols_in_symtab; symtab_index++) {
-		ELF64Symbol symtab_symbol;
-		checked_fread(&symtab_symbol, sizeof symtab_symbol, 1, input_file);
+		ELF64Symbol *symtab_symbol = symtab + symtab_index;
+		ObjectSymbol *symbol = object->symbols + symtab_index;
+		ZERO_STRUCT(symbol);
 
-		char *symbol_name = strtab + symtab_symbol.strtab_index_for_name;
-		ELFSymbolType type = ELF64_SYMBOL_TYPE(symtab_symbol.type_and_binding);
-		ELFSymbolBinding binding = ELF64_SYMBOL_BINDING(symtab_symbol.type_and_binding);
+		ELFSymbolType type = ELF64_SYMBOL_TYPE(symtab_symbol->type_and_binding);
+		u32 section = symtab_symbol->section;
+		bool known_section = section < sht_entries && section_map[section] != -1;
 
 		if (symtab_index == 0 || type == STT_FILE
-				|| (type == STT_SECTION
-					&& symtab_symbol.section != text_section_index
-					&& symtab_symbol.section != bss_section_index
-					&& symtab_symbol.section != data_section_index)) {
+				|| (type == STT_SECTION && !known_section)) {
+			symbol->ignored = true;
 			continue;
 		}
 
-		i32 found_symbol_index = -1;
-		if (binding == STB_GLOBAL) {
-			for (u32 symbol_index = 0;
-					symbol_index < symbol_table->size;
-					symbol_index++) {
-				Symbol *symbol = ARRAY_REF(symbol_table, Symbol, symbol_index);
-				if (symbol->binding == STB_GLOBAL
-						&& streq(symbol->name, symbol_name)) {
-					found_symbol_index = symbol_index;
-					break;
-				}
-			}
+		symbol->name = strtab + symtab_symbol->strtab_index_for_name;
+		if (section == SHN_UNDEF) {
+			symbol->section = -1;
+		} else if (known_section) {
+			symbol->section = section_map[section];
+		} else {
+			snprintf(object->error, sizeof object->error,
+					"Symbol '%s' is in an unsupported section", symbol->name);
+			ret = false;
+			goto cleanup;
 		}
 
-		if (symtab_symbol.section == SHN_UNDEF) {
-			u32 symbol_index;
+		symbol->name_length = strlen(symbol->name);
+		symbol->binding = ELF64_SYMBOL_BINDING(symtab_symbol->type_and_binding);
+		if (symbol->binding == STB_GLOBAL)
+			symbol->hash = hash_string(symbol->name, symbol->name_length);
+		symbol->value = symtab_symbol->value;
+		symbol->size = symtab_symbol->size;
+	}
 
-			if (found_symbol_index == -1) {
-				symbol_index = symbol_table->size;
+cleanup:
+	free(section_map);
+	return ret;
+}
 
-				Symbol *symbol = ARRAY_APPEND(symbol_table, Symbol);
-				symbol->defined = false;
-				symbol->name = strdup(symbol_name);
-				symbol->binding = binding;
-				symbol->contents = NULL;
-				ARRAY_INIT(&symbol->relocs, Relocation, 5);
-			} else {
-				symbol_index = found_symbol_index;
-			}
+// Builds the same object file that parse_elf_file would return for the output
+// of write_elf_object_file, but straight from the AsmModule, so that we don't
+// have to encode it and parse it again. Section contents and symbol names
+// point into asm_module, so it must outlive the link. Like parse_elf_file,
+// this is safe to call on many modules at once.
+static void object_file_from_asm_module(AsmModule *asm_module,
+		bool function_sections, bool data_sections, ObjectFile *object)
+{
+	ZERO_STRUCT(object);
+
+	Array(Chunk) chunks;
+	build_chunks(&chunks, asm_module, function_sections, data_sections);
+
+	u32 num_relas = 0;
+	for (u32 i = 0; i < chunks.size; i++)
+		num_relas += ARRAY_REF(&chunks, Chunk, i)->relas.size;
+	object->owned_relas = malloc(sizeof *object->owned_relas * num_relas);
+
+	object->num_sections = chunks.size;
+	object->sections = malloc(sizeof *object->sections * chunks.size);
+
+	ELF64Rela *next_relas = object->owned_relas;
+	for (u32 i = 0; i < chunks.size; i++) {
+		Chunk *chunk = ARRAY_REF(&chunks, Chunk, i);
+		ObjectSection *section = object->sections + i;
+		ZERO_STRUCT(section);
+		section->size = chunk->end - chunk->start;
+
+		switch (chunk->section) {
+		case TEXT_SECTION:
+			section->output_index = TEXT_INDEX;
+			section->contents = asm_module->text.bytes.elements + chunk->start;
+			break;
+		case BSS_SECTION:
+			section->output_index = BSS_INDEX;
+			break;
+		case DATA_SECTION:
+			section->output_index = DATA_INDEX;
+			section->contents = asm_module->data.elements + chunk->start;
+			break;
+		case UNKNOWN_SECTION:
+			UNREACHABLE;
+		}
 
-			file_symbols[symtab_index] = symbol_index;
-		} else if (symtab_symbol.section == text_section_index
-				|| symtab_symbol.section == bss_section_index
-				|| symtab_symbol.section == data_section_index) {
-			Symbol *symbol;
-			u32 symbol_index;
-			if (found_symbol_index == -1) {
-				symbol_index = symbol_table->size;
-
-				symbol = ARRAY_APPEND(symbol_table, Symbol);
-				ZERO_STRUCT(symbol);
-				ARRAY_INIT(&symbol->relocs, Relocation, 5);
-			} else {
-				symbol_index = found_symbol_index;
-				symbol = ARRAY_REF(symbol_table, Symbol, found_symbol_index);
-				if (symbol->defined) {
-					fprintf(stderr,
-							"Multiple definitions of symbol '%s'\n",
-							symbol_name);
-					goto cleanup2;
-				}
-			}
+		if (chunk->relas.size != 0) {
+			memcpy(next_relas, chunk->relas.elements,
+					chunk->relas.size * sizeof(ELF64Rela));
+			section->relas = next_relas;
+			section->num_relas = chunk->relas.size;
+			next_relas += chunk->relas.size;
+		}
+	}
 
-			if (symtab_symbol.section == text_section_index) {
-				symbol->section_index = TEXT_INDEX;
-				symbol->section_offset = existing_text_size + symtab_symbol.value;
-			} else if (symtab_symbol.section == bss_section_index) {
-				symbol->section_index = BSS_INDEX;
-				symbol->section_offset = existing_bss_size + symtab_symbol.value;
-			} else if (symtab_symbol.section == data_section_index) {
-				symbol->section_index = DATA_INDEX;
-				symbol->section_offset = existing_data_size + symtab_symbol.value;
-			} else {
-				UNREACHABLE;
+	// As in the object file, symbol i of the module has symtab index i + 1,
+	// and index 0 is the null symbol. We leave out the STT_FILE symbol, which
+	// the linker would ignore anyway.
+	Array(AsmSymbol *) *symbols = &asm_module->symbols;
+	object->symbol_count = symbols->size + 1;
+	object->symbols = malloc(sizeof *object->symbols * object->symbol_count);
+	ZERO_STRUCT(object->symbols);
+	object->symbols[0].ignored = true;
+
+	for (u32 i = 0; i < symbols->size; i++) {
+		AsmSymbol *asm_symbol = *ARRAY_REF(symbols, AsmSymbol *, i);
+		assert(asm_symbol->symtab_index == i + 1);
+
+		ObjectSymbol *symbol = object->symbols + i + 1;
+		ZERO_STRUCT(symbol);
+		symbol->name = asm_symbol->name;
+		symbol->name_length = strlen(symbol->name);
+		symbol->binding = STB_GLOBAL;
+		symbol->section = -1;
+		symbol->value = asm_symbol->offset;
+		symbol->size = asm_symbol->size;
+
+		if (asm_symbol->defined) {
+			Chunk *chunk = find_chunk(&chunks,
+					asm_symbol->section, asm_symbol->offset);
+			symbol->section = chunk - (Chunk *)chunks.elements;
+			symbol->value -= chunk->start;
+
+			switch (asm_symbol->linkage) {
+			case ASM_GLOBAL_LINKAGE: symbol->binding = STB_GLOBAL; break;
+			case ASM_LOCAL_LINKAGE: symbol->binding = STB_LOCAL; break;
 			}
+		}
+
+		if (symbol->binding == STB_GLOBAL)
+			symbol->hash = hash_string(symbol->name, symbol->name_length);
+	}
+
+	free_chunks(&chunks);
+}
+
+// Adds a parsed object file to the link. Nothing is copied out of the file
+// until layout, as with --gc-sections we don't know which sections we'll keep
+// until every input has been merged.
+static bool merge_object_file(ObjectFile *object, Linker *linker)
+{
+	SymbolTable *symbol_table = &linker->symbol_table;
+
+	u32 first_section = linker->sections.size;
+	for (u32 i = 0; i < object->num_sections; i++) {
+		ObjectSection *object_section = object->sections + i;
+		InputSection *section = ARRAY_APPEND(&linker->sections, InputSection);
+		ZERO_STRUCT(section);
+		section->output_index = object_section->output_index;
+		section->contents = object_section->contents;
+		section->size = object_section->size;
+	}
+
+	bool ret = true;
+	u32 *file_symbols = calloc(sizeof(*file_symbols) * object->symbol_count, 1);
+
+	// @TODO: We can iterate across this more efficiently by using the
+	// information in the header about the last local symbol. We can also use
+	// this to allocate fewer symbols.
+	for (u32 symtab_index = 0; symtab_index < object->symbol_count; symtab_index++) {
+		ObjectSymbol *object_symbol = object->symbols + symtab_index;
+		if (object_symbol->ignored)
+			continue;
 
-			symbol->defined = true;
-			symbol->name = strdup(symbol_name);
-			symbol->binding = binding;
-			symbol->size = symtab_symbol.size;
-			symbol->contents = NULL;
+		i32 found_symbol_index = -1;
+		if (object_symbol->binding == STB_GLOBAL) {
+			u32 *index = hash_table_lookup_hashed(&symbol_table->globals,
+					object_symbol->name, object_symbol->name_length,
+					object_symbol->hash);
+			if (index != NULL)
+				found_symbol_index = *index;
+		}
 
-			file_symbols[symtab_index] = symbol_index;
+		u32 symbol_index;
+		if (found_symbol_index == -1) {
+			symbol_index = add_linker_symbol(symbol_table,
+					object_symbol->name, object_symbol->binding);
 		} else {
-			UNREACHABLE;
+			symbol_index = found_symbol_index;
 		}
-	}
+		file_symbols[symtab_index] = symbol_index;
+
+		if (object_symbol->section == -1)
+			continue;
 
-	process_rela_section(rela_text_header, file_symbols, symbol_table,
-			input_file, initial_location, existing_text_size, TEXT_INDEX);
-	process_rela_section(rela_data_header, file_symbols, symbol_table,
-			input_file, initial_location, existing_data_size, DATA_INDEX);
+		Symbol *symbol =
+			ARRAY_REF(&symbol_table->symbols, Symbol, symbol_index);
+		if (found_symbol_index != -1) {
+			if (symbol->defined) {
+				fprintf(stderr,
+						"Multiple definitions of symbol '%s'\n",
+						object_symbol->name);
+				ret = false;
+				goto cleanup;
+			}
+		}
+
+		symbol->defined = true;
+		symbol->section = first_section + object_symbol->section;
+		symbol->value = object_symbol->value;
+		symbol->size = object_symbol->size;
+	}
 
+	for (u32 i = 0; i < object->num_sections; i++) {
+		ObjectSection *object_section = object->sections + i;
+		InputSection *section =
+			ARRAY_REF(&linker->sections, InputSection, first_section + i);
+		section->first_reloc = linker->relocs.size;
+		section->num_relocs = object_section->num_relas;
+
+		for (u32 j = 0; j < object_section->num_relas; j++) {
+			ELF64Rela *rela = object_section->relas + j;
+			u32 symtab_index = ELF64_RELA_SYMBOL(rela->type_and_symbol);
+			assert(symtab_index < object->symbol_count);
+
+			Relocation *reloc = ARRAY_APPEND(&linker->relocs, Relocation);
+			reloc->type = ELF64_RELA_TYPE(rela->type_and_symbol);
+			reloc->offset = rela->section_offset;
+			reloc->symbol_index = file_symbols[symtab_index];
+			reloc->addend = rela->addend;
+		}
+	}
 
-cleanup2:
+cleanup:
 	free(file_symbols);
-	free(strtab);
-cleanup1:
-	free(shstrtab);
-	free(headers);
 	return ret;
 }
 
-// @TODO: Add .note.GNU-STACK section header to prevent executable stack.
-bool link_elf_executable(char *executable_file_name, Array(char *) *linker_input_filenames)
+static bool process_elf_file(u8 *file, u32 file_size, Linker *linker)
 {
-	bool ret = true;
+	ObjectFile object;
+	bool ret = parse_elf_file(file, file_size, &object);
+	if (ret)
+		ret = merge_object_file(&object, linker);
+	else
+		fprintf(stderr, "%s\n", object.error);
+
+	free_object_file(&object);
+	return ret;
+}
 
-	FILE *output_file = fopen(executable_file_name, "wb");
-	if (output_file == NULL) {
-		perror("Failed to open linker output");
+// Reads the names of the global symbols defined by an object file, without
+// linking any of it in. The names point into the file's contents.
+static bool read_defined_globals(u8 *file, u32 file_size,
+		Array(char *) *defined_globals)
+{
+	if (file_size < sizeof(ELFHeader)
+			|| !strneq((char *)file, "\x7F" "ELF", 4)) {
+		fputs("Archive member is not an ELF file\n", stderr);
 		return false;
 	}
 
-	AsmModule asm_module;
-	init_asm_module(&asm_module, "");
-	// @TODO: Merge with AsmSymbol so we can just use Binary?
-	Array(Symbol) symbol_table;
-	ARRAY_INIT(&symbol_table, Symbol, 100);
+	ELFSectionHeader *headers = section_headers(file, file_size);
+	if (headers == NULL) {
+		fputs("Truncated ELF file\n", stderr);
+		return false;
+	}
 
-	for (u32 i = 0; i < linker_input_filenames->size; i++) {
-		char *input_filename = *ARRAY_REF(linker_input_filenames, char *, i);
-		FILE *input_file = fopen(input_filename, "rb");
-		if (input_file == NULL) {
-			perror("Failed to open linker input");
+	ELFHeader *file_header = (ELFHeader *)file;
+	ELFSectionHeader *symtab_header = NULL;
+	for (u32 i = 0; i < file_header->sht_entries; i++) {
+		if (headers[i].type == SHT_SYMTAB) {
+			symtab_header = headers + i;
+			break;
+		}
+	}
+	if (symtab_header == NULL) {
+		fputs("Missing .symtab section\n", stderr);
+		return false;
+	}
+	assert(symtab_header->entry_size == sizeof(ELF64Symbol));
+	assert(symtab_header->linked_section < file_header->sht_entries);
+
+	ELFSectionHeader *strtab_header = headers + symtab_header->linked_section;
+	assert(strtab_header->type == SHT_STRTAB);
+	if (!section_in_bounds(symtab_header, file_size)
+			|| !section_in_bounds(strtab_header, file_size)) {
+		fputs("Truncated ELF file\n", stderr);
+		return false;
+	}
+	char *strtab = (char *)file + strtab_header->section_location;
+
+	// @NOTE: We can't skip the local symbols using the symtab header, as nas
+	// doesn't always put them first.
+	u32 symbols_in_symtab = symtab_header->section_size / symtab_header->entry_size;
+	ELF64Symbol *symtab =
+		(ELF64Symbol *)(file + symtab_header->section_location);
+	for (u32 i = 0; i < symbols_in_symtab; i++) {
+		ELF64Symbol *symtab_symbol = symtab + i;
+
+		ELFSymbolBinding binding =
+			ELF64_SYMBOL_BINDING(symtab_symbol->type_and_binding);
+		if (binding == STB_GLOBAL && symtab_symbol->section != SHN_UNDEF) {
+			*ARRAY_APPEND(defined_globals, char *) =
+				strtab + symtab_symbol->strtab_index_for_name;
+		}
+	}
+
+	return true;
+}
+
+typedef struct ArchiveMember
+{
+	u32 file_start;
+	u32 size;
+	Array(char *) defined_globals;
+	bool linked;
+} ArchiveMember;
+
+static bool is_undefined(SymbolTable *symbol_table, char *name)
+{
+	i32 symbol_index = find_global(symbol_table, name);
+	if (symbol_index == -1)
+		return false;
+
+	return !ARRAY_REF(&symbol_table->symbols, Symbol, symbol_index)->defined;
+}
+
+// Links in the members of an archive that define symbols which are undefined
+// at this point in the link, including any symbols that become undefined as a
+// result of linking other members in. As with other linkers, this means
+// archives should come after the object files that depend on them.
+static bool process_archive(u8 *archive, u32 archive_size, Linker *linker)
+{
+	bool ret = true;
+
+	Array(ArchiveMember) members;
+	ARRAY_INIT(&members, ArchiveMember, 32);
+
+	u32 position = sizeof AR_GLOBAL_HEADER - 1;
+	for (;;) {
+		// File headers are aligned to even byte boundaries.
+		if (position % 2 == 1)
+			position++;
+
+		if (position >= archive_size || archive_size - position < sizeof(ArFileHeader))
+			break;
+
+		ArFileHeader *header = (ArFileHeader *)(archive + position);
+		u32 file_start = position + sizeof *header;
+
+		assert(header->magic[0] == 0x60 && header->magic[1] == 0x0A);
+
+		char filename[sizeof header->name + 1];
+		memcpy(filename, header->name, sizeof header->name);
+		for (i32 i = sizeof header->name - 1; i >= 0; i--) {
+			if (header->name[i] != ' ') {
+				filename[i + 1] = '\0';
+				break;
+			}
+		}
+
+		char file_size_bytes_decimal[sizeof header->size_bytes_decimal + 1];
+		memcpy(file_size_bytes_decimal, header->size_bytes_decimal,
+				sizeof header->size_bytes_decimal);
+		file_size_bytes_decimal[sizeof file_size_bytes_decimal - 1] = '\0';
+		long file_size_bytes = atol(file_size_bytes_decimal);
+		if (file_size_bytes < 0 || file_size_bytes > archive_size - file_start) {
+			fprintf(stderr, "Truncated archive member '%s'\n", filename);
 			ret = false;
 			goto cleanup;
 		}
 
-		FileType type = file_type(input_file);
-		switch (type) {
-		case ELF_FILE_TYPE:
-			if (!process_elf_file(input_file, &asm_module, &symbol_table)) {
+		// The file named "/" is a special file, used to store a symbol index
+		// in System V ar. nar doesn't write one, so we build our own index
+		// from the members' symbol tables instead.
+		//
+		// The file named "//" is used to store filenames longer than 16
+		// bytes. We only care about the name so that we can avoid reading
+		// special files, so we don't care about it.
+		if (!streq(filename, "/") && !streq(filename, "//")) {
+			ArchiveMember *member = ARRAY_APPEND(&members, ArchiveMember);
+			member->file_start = file_start;
+			member->size = file_size_bytes;
+			member->linked = false;
+			ARRAY_INIT(&member->defined_globals, char *, 4);
+
+			if (!read_defined_globals(archive + file_start, file_size_bytes,
+						&member->defined_globals)) {
 				ret = false;
 				goto cleanup;
 			}
-			break;
-		case AR_FILE_TYPE: {
-			u32 global_header_length = sizeof AR_GLOBAL_HEADER - 1;
-			checked_fseek(input_file, global_header_length, SEEK_SET);
-
-			for (;;) {
-				// File headers are aligned to even byte boundaries.
-				if (checked_ftell(input_file) % 2 == 1)
-					checked_fseek(input_file, 1, SEEK_CUR);
-
-				ArFileHeader header;
-				int result = fread(&header, sizeof header, 1, input_file);
-				if (result == 0) {
-					assert(feof(input_file));
+		}
+
+		position = file_start + file_size_bytes;
+	}
+
+	// Linking in a member can introduce new undefined symbols, which may be
+	// defined by members we've already passed over, so keep going until
+	// nothing changes.
+	bool changed = true;
+	while (changed) {
+		changed = false;
+
+		for (u32 i = 0; i < members.size; i++) {
+			ArchiveMember *member = ARRAY_REF(&members, ArchiveMember, i);
+			if (member->linked)
+				continue;
+
+			bool needed = false;
+			for (u32 j = 0; j < member->defined_globals.size; j++) {
+				char *name = *ARRAY_REF(&member->defined_globals, char *, j);
+				if (is_undefined(&linker->symbol_table, name)) {
+					needed = true;
 					break;
 				}
-				long file_start = checked_ftell(input_file);
+			}
+			if (!needed)
+				continue;
 
-				assert(header.magic[0] == 0x60 && header.magic[1] == 0x0A);
+			member->linked = true;
+			changed = true;
+			if (!process_elf_file(archive + member->file_start, member->size,
+						linker)) {
+				ret = false;
+				goto cleanup;
+			}
+		}
+	}
 
-				char filename[sizeof header.name + 1];
-				memcpy(filename, header.name, sizeof header.name);
-				for (i32 i = sizeof header.name - 1; i >= 0; i--) {
-					if (header.name[i] != ' ') {
-						filename[i + 1] = '\0';
-						break;
-					}
-				}
+cleanup:
+	for (u32 i = 0; i < members.size; i++) {
+		ArchiveMember *member = ARRAY_REF(&members, ArchiveMember, i);
+		array_free(&member->defined_globals);
+	}
+	array_free(&members);
 
-				char file_size_bytes_decimal[sizeof header.size_bytes_decimal + 1];
-				memcpy(file_size_bytes_decimal, header.size_bytes_decimal,
-						sizeof header.size_bytes_decimal);
-				file_size_bytes_decimal[sizeof file_size_bytes_decimal - 1] = '\0';
-				long file_size_bytes = atol(file_size_bytes_decimal);
-
-				// The file named "/" is a special file, used to store a symbol
-				// index in System V ar. We don't care about it for now.
-				//
-				// The file named "//" is used to store filenames longer than
-				// 16 bytes. We only care about the name so that we can avoid
-				// reading special files, so we don't care about it.
-				if (!streq(filename, "/") &&
-						!streq(filename, "//") &&
-						!process_elf_file(input_file, &asm_module, &symbol_table)) {
-					ret = false;
-					goto cleanup;
+	return ret;
+}
+
+// @TODO: Add .note.GNU-STACK section header to prevent executable stack.
+typedef struct LinkerInput
+{
+	LinkerInputSource *source;
+	// Empty for modules compiled in this process.
+	String contents;
+	FileType type;
+
+	// Only used for object files. Archives are processed serially, as which
+	// members we link depends on the symbols defined before them.
+	bool parsed;
+	ObjectFile object;
+} LinkerInput;
+
+static void parse_linker_input(void *context, u32 index)
+{
+	LinkerInput *input = (LinkerInput *)context + index;
+	AsmModule *asm_module = input->source->asm_module;
+	if (asm_module != NULL) {
+		object_file_from_asm_module(asm_module,
+				input->source->function_sections,
+				input->source->data_sections, &input->object);
+		input->parsed = true;
+	} else if (input->type == ELF_FILE_TYPE) {
+		input->parsed = parse_elf_file((u8 *)input->contents.chars,
+				input->contents.len, &input->object);
+	}
+}
+
+static void free_linker_input(LinkerInput *input)
+{
+	if (input->type == ELF_FILE_TYPE)
+		free_object_file(&input->object);
+	if (input->contents.len != 0)
+		unmap_file(input->contents);
+	input->contents = EMPTY_STRING;
+}
+
+// Marks the sections reachable from the entry point through relocations, and
+// returns how many there are. Everything else is discarded by layout.
+static u32 mark_live_sections(Linker *linker, Symbol *entry_symbol)
+{
+	Array(u32) worklist;
+	ARRAY_INIT(&worklist, u32, 64);
+
+	u32 num_live = 1;
+	ARRAY_REF(&linker->sections, InputSection, entry_symbol->section)->live = true;
+	*ARRAY_APPEND(&worklist, u32) = entry_symbol->section;
+
+	while (worklist.size != 0) {
+		u32 section_index = *ARRAY_POP(&worklist, u32);
+		InputSection *section =
+			ARRAY_REF(&linker->sections, InputSection, section_index);
+
+		for (u32 i = 0; i < section->num_relocs; i++) {
+			Relocation *reloc = ARRAY_REF(&linker->relocs, Relocation,
+					section->first_reloc + i);
+			Symbol *symbol = ARRAY_REF(&linker->symbol_table.symbols, Symbol,
+					reloc->symbol_index);
+
+			// Undefined symbols are reported when we apply relocations.
+			if (!symbol->defined)
+				continue;
+
+			InputSection *target =
+				ARRAY_REF(&linker->sections, InputSection, symbol->section);
+			if (!target->live) {
+				target->live = true;
+				num_live++;
+				*ARRAY_APPEND(&worklist, u32) = symbol->section;
+			}
+		}
+	}
+
+	array_free(&worklist);
+
+	return num_live;
+}
+
+static void append_key_u32(Array(u8) *keys, u32 value)
+{
+	ARRAY_APPEND_ELEMS(keys, u8, sizeof value, &value);
+}
+
+static bool can_fold(InputSection *section)
+{
+	return section->live && section->output_index == TEXT_INDEX
+		&& section->size != 0;
+}
+
+// Folds identical .text sections into one, and returns how many sections
+// were discarded. Two sections are identical if they have the same contents,
+// and their relocations have the same types, offsets and addends and refer to
+// the same offsets in identical sections.
+//
+// The last part is recursive, e.g.: for mutually recursive functions. So we
+// start by assuming that all sections with the same contents are identical,
+// and then repeatedly split each class of sections according to the classes
+// of the sections their relocations refer to, until no class is split.
+//
+// @NOTE: Like --icf=all in other linkers, we don't check whether a function's
+// address is taken, so pointers to different functions can compare equal.
+static u32 fold_identical_sections(Linker *linker)
+{
+	u32 num_sections = linker->sections.size;
+	SymbolTable *symbol_table = &linker->symbol_table;
+
+	// Identical sections must be the same size, and most sections have a
+	// size no other section has. Filtering those out first means we don't
+	// have to hash the contents of most sections below.
+	HashTable sizes;
+	hash_table_init(&sizes, num_sections);
+	for (u32 i = 0; i < num_sections; i++) {
+		InputSection *section = ARRAY_REF(&linker->sections, InputSection, i);
+		if (!can_fold(section))
+			continue;
+
+		bool inserted;
+		(*hash_table_insert(&sizes, (char *)&section->size,
+				sizeof section->size, &inserted))++;
+	}
+
+	// Sections that can't be folded get a class of their own, numbered from
+	// num_sections so they don't collide with the classes we assign below.
+	u32 *classes = malloc(sizeof *classes * num_sections);
+	u32 *new_classes = malloc(sizeof *new_classes * num_sections);
+	u32 num_candidates = 0;
+	for (u32 i = 0; i < num_sections; i++) {
+		InputSection *section = ARRAY_REF(&linker->sections, InputSection, i);
+		if (can_fold(section) && *hash_table_lookup(&sizes,
+					(char *)&section->size, sizeof section->size) > 1) {
+			classes[i] = 0;
+			num_candidates++;
+		} else {
+			classes[i] = num_sections + i;
+		}
+	}
+	hash_table_free(&sizes);
+
+	// The hash table doesn't copy keys, so we build every key for a round
+	// before inserting any of them.
+	u32 *key_starts = malloc(sizeof *key_starts * num_sections);
+	u32 *key_lengths = malloc(sizeof *key_lengths * num_sections);
+	Array(u8) keys;
+	ARRAY_INIT(&keys, u8, 1024);
+
+	u32 num_classes = 0;
+	for (u32 round = 0; ; round++) {
+		keys.size = 0;
+		for (u32 i = 0; i < num_sections; i++) {
+			if (classes[i] >= num_sections)
+				continue;
+
+			InputSection *section = ARRAY_REF(&linker->sections, InputSection, i);
+
+			// After the first round, the class implies the contents and
+			// everything about the relocations except the classes of
+			// sections we're still folding. So later keys only need those.
+			key_starts[i] = keys.size;
+			if (round == 0)
+				ARRAY_APPEND_ELEMS(&keys, u8, section->size, section->contents);
+			else
+				append_key_u32(&keys, classes[i]);
+
+			for (u32 j = 0; j < section->num_relocs; j++) {
+				Relocation *reloc = ARRAY_REF(&linker->relocs, Relocation,
+						section->first_reloc + j);
+				Symbol *symbol = ARRAY_REF(&symbol_table->symbols, Symbol,
+						reloc->symbol_index);
+				bool folding_target =
+					symbol->defined && classes[symbol->section] < num_sections;
+
+				if (round == 0) {
+					append_key_u32(&keys, reloc->type);
+					append_key_u32(&keys, reloc->offset);
+					append_key_u32(&keys, reloc->addend);
+				} else if (!folding_target) {
+					continue;
 				}
 
-				checked_fseek(input_file, file_start + file_size_bytes, SEEK_SET);
+				if (symbol->defined) {
+					append_key_u32(&keys, classes[symbol->section]);
+					append_key_u32(&keys, symbol->value);
+				} else {
+					append_key_u32(&keys, ~0u);
+					append_key_u32(&keys, reloc->symbol_index);
+				}
 			}
+			key_lengths[i] = keys.size - key_starts[i];
+		}
+
+		HashTable table;
+		hash_table_init(&table, num_candidates);
+		for (u32 i = 0; i < num_sections; i++) {
+			if (classes[i] >= num_sections)
+				continue;
+
+			bool inserted;
+			u32 *class = hash_table_insert(&table,
+					(char *)keys.elements + key_starts[i], key_lengths[i],
+					&inserted);
+			if (inserted)
+				*class = table.size - 1;
+			new_classes[i] = *class;
+		}
+		u32 new_num_classes = table.size;
+		hash_table_free(&table);
+
+		for (u32 i = 0; i < num_sections; i++) {
+			if (classes[i] < num_sections)
+				classes[i] = new_classes[i];
+		}
 
+		// Each round's key includes the previous class, so classes only ever
+		// get split. If none were, we're done.
+		if (new_num_classes == num_classes)
 			break;
+		num_classes = new_num_classes;
+	}
+
+	// The first section in each class survives, and the rest are discarded.
+	u32 *survivors = malloc(sizeof *survivors * num_classes);
+	for (u32 i = 0; i < num_classes; i++)
+		survivors[i] = ~0u;
+
+	u32 num_folded = 0;
+	for (u32 i = 0; i < num_sections; i++) {
+		if (classes[i] >= num_sections)
+			continue;
+
+		if (survivors[classes[i]] == ~0u) {
+			survivors[classes[i]] = i;
+		} else {
+			ARRAY_REF(&linker->sections, InputSection, i)->live = false;
+			num_folded++;
 		}
-		// We should have checked it was an object file or archive before
-		// putting it on the linker input list.
-		case UNKNOWN_FILE_TYPE:
-			UNREACHABLE;
+	}
+
+	// Symbols in discarded sections now refer to the same offset in the
+	// survivor, which has the same contents.
+	for (u32 i = 0; i < symbol_table->symbols.size; i++) {
+		Symbol *symbol = ARRAY_REF(&symbol_table->symbols, Symbol, i);
+		if (symbol->defined && classes[symbol->section] < num_sections)
+			symbol->section = survivors[classes[symbol->section]];
+	}
+
+	free(survivors);
+	array_free(&keys);
+	free(key_lengths);
+	free(key_starts);
+	free(new_classes);
+	free(classes);
+
+	return num_folded;
+}
+
+// Places the .text sections defining the functions named in the file, one
+// per line, in the order they're named. Blank lines and lines starting with
+// '#' are ignored, as are names we don't have a live function for, so that
+// the same file can be used as the program changes.
+static bool order_by_symbol_file(Linker *linker, char *filename, bool *placed,
+		Array(u32) *order)
+{
+	String contents = map_file_into_memory(filename);
+	if (!is_valid(contents)) {
+		perror("Failed to open symbol ordering file");
+		return false;
+	}
+
+	SymbolTable *symbol_table = &linker->symbol_table;
+	u32 position = 0;
+	while (position < contents.len) {
+		char *line = contents.chars + position;
+		u32 line_length = 0;
+		while (position + line_length < contents.len
+				&& line[line_length] != '\n') {
+			line_length++;
+		}
+		position += line_length + 1;
+
+		while (line_length != 0 && (line[line_length - 1] == '\r'
+					|| line[line_length - 1] == ' '
+					|| line[line_length - 1] == '\t')) {
+			line_length--;
 		}
+		if (line_length == 0 || line[0] == '#')
+			continue;
+
+		u32 *symbol_index =
+			hash_table_lookup(&symbol_table->globals, line, line_length);
+		if (symbol_index == NULL)
+			continue;
+		Symbol *symbol =
+			ARRAY_REF(&symbol_table->symbols, Symbol, *symbol_index);
+		if (!symbol->defined || placed[symbol->section])
+			continue;
+		InputSection *section =
+			ARRAY_REF(&linker->sections, InputSection, symbol->section);
+		if (!section->live || section->output_index != TEXT_INDEX)
+			continue;
 
-		fclose(input_file);
+		placed[symbol->section] = true;
+		*ARRAY_APPEND(order, u32) = symbol->section;
 	}
 
-	ELFFile _elf_file;
-	ELFFile *elf_file = &_elf_file;
-	init_elf_file(elf_file, output_file, ET_EXEC);
+	if (contents.len != 0)
+		unmap_file(contents);
 
+	return true;
+}
 
-	elf_file->section_info[TEXT_INDEX].size = asm_module.text.bytes.size;
-	elf_file->section_info[TEXT_INDEX].contents = asm_module.text.bytes.elements;
-	Array(Fixup) empty_array = EMPTY_ARRAY;
+typedef struct CallGraphEdge
+{
+	u32 caller;
+	u32 callee;
+	// The number of relocations in the caller referring to the callee.
+	u32 weight;
+} CallGraphEdge;
 
-	elf_file->section_info[BSS_INDEX].size = asm_module.bss_size;
+static int compare_edge_sections(const void *a, const void *b)
+{
+	CallGraphEdge *edge_a = (CallGraphEdge *)a;
+	CallGraphEdge *edge_b = (CallGraphEdge *)b;
+	if (edge_a->caller != edge_b->caller)
+		return edge_a->caller < edge_b->caller ? -1 : 1;
+	if (edge_a->callee != edge_b->callee)
+		return edge_a->callee < edge_b->callee ? -1 : 1;
+	return 0;
+}
 
-	elf_file->section_info[DATA_INDEX].size = asm_module.data.size;
-	elf_file->section_info[DATA_INDEX].contents = asm_module.data.elements;
+// Heaviest first. Ties are broken by section so the order is deterministic,
+// as qsort isn't stable.
+static int compare_edge_weights(const void *a, const void *b)
+{
+	CallGraphEdge *edge_a = (CallGraphEdge *)a;
+	CallGraphEdge *edge_b = (CallGraphEdge *)b;
+	if (edge_a->weight != edge_b->weight)
+		return edge_a->weight > edge_b->weight ? -1 : 1;
+	return compare_edge_sections(a, b);
+}
 
-	write_contents(elf_file, &empty_array);
+static u32 find_cluster(u32 *parents, u32 section)
+{
+	while (parents[section] != section) {
+		parents[section] = parents[parents[section]];
+		section = parents[section];
+	}
 
-	for (u32 i = 0; i < symbol_table.size; i++) {
-		Symbol *symbol = ARRAY_REF(&symbol_table, Symbol, i);
+	return section;
+}
 
-		if (!symbol->defined) {
-			if (symbol->relocs.size != 0) {
-				fprintf(stderr, "Undefined symbol '%s'\n", symbol->name);
-				ret = false;
-				goto cleanup;
+// We stop growing a cluster once it would no longer fit in a page, as
+// beyond that keeping callees near their callers doesn't save any iTLB
+// entries.
+#define MAX_CLUSTER_SIZE 4096
+
+// Places the .text sections that haven't been placed yet so that functions
+// tend to follow the functions that call them. We don't have a profile, so
+// we weight each edge of the call graph by the number of relocations from
+// the caller to the callee. Then, heaviest edge first, we append the
+// callee's cluster to the caller's. Clusters are placed in the order of
+// their first section in the input, so unrelated code stays in input order.
+static void order_by_call_graph(Linker *linker, bool *placed, Array(u32) *order)
+{
+	u32 num_sections = linker->sections.size;
+	SymbolTable *symbol_table = &linker->symbol_table;
+
+	Array(CallGraphEdge) edges;
+	ARRAY_INIT(&edges, CallGraphEdge, 64);
+	for (u32 i = 0; i < num_sections; i++) {
+		InputSection *section = ARRAY_REF(&linker->sections, InputSection, i);
+		if (!section->live || section->output_index != TEXT_INDEX || placed[i])
+			continue;
+
+		for (u32 j = 0; j < section->num_relocs; j++) {
+			Relocation *reloc = ARRAY_REF(&linker->relocs, Relocation,
+					section->first_reloc + j);
+			Symbol *symbol = ARRAY_REF(&symbol_table->symbols, Symbol,
+					reloc->symbol_index);
+			if (!symbol->defined || symbol->section == i
+					|| placed[symbol->section]) {
+				continue;
 			}
+			InputSection *target =
+				ARRAY_REF(&linker->sections, InputSection, symbol->section);
+			if (!target->live || target->output_index != TEXT_INDEX)
+				continue;
 
-			// Declared but never defined... but nothing references it. Just
-			// ignore the symbol.
+			*ARRAY_APPEND(&edges, CallGraphEdge) = (CallGraphEdge) {
+				.caller = i, .callee = symbol->section, .weight = 1,
+			};
+		}
+	}
+
+	// Combine edges between the same sections.
+	qsort(edges.elements, edges.size, sizeof(CallGraphEdge),
+			compare_edge_sections);
+	u32 num_edges = 0;
+	for (u32 i = 0; i < edges.size; i++) {
+		CallGraphEdge *edge = ARRAY_REF(&edges, CallGraphEdge, i);
+		CallGraphEdge *last = num_edges == 0
+			? NULL
+			: ARRAY_REF(&edges, CallGraphEdge, num_edges - 1);
+		if (last != NULL && compare_edge_sections(last, edge) == 0)
+			last->weight += edge->weight;
+		else
+			*ARRAY_REF(&edges, CallGraphEdge, num_edges++) = *edge;
+	}
+	edges.size = num_edges;
+	qsort(edges.elements, edges.size, sizeof(CallGraphEdge),
+			compare_edge_weights);
+
+	// Each cluster is a linked list of sections, through next. The head of
+	// the list is also the root of the union-find tree through parents.
+	u32 *parents = malloc(sizeof *parents * num_sections);
+	u32 *next = malloc(sizeof *next * num_sections);
+	u32 *tails = malloc(sizeof *tails * num_sections);
+	u32 *cluster_sizes = malloc(sizeof *cluster_sizes * num_sections);
+	for (u32 i = 0; i < num_sections; i++) {
+		parents[i] = i;
+		next[i] = ~0u;
+		tails[i] = i;
+		cluster_sizes[i] = ARRAY_REF(&linker->sections, InputSection, i)->size;
+	}
+
+	for (u32 i = 0; i < edges.size; i++) {
+		CallGraphEdge *edge = ARRAY_REF(&edges, CallGraphEdge, i);
+		u32 caller_cluster = find_cluster(parents, edge->caller);
+		u32 callee_cluster = find_cluster(parents, edge->callee);
+		if (caller_cluster == callee_cluster
+				|| cluster_sizes[caller_cluster] + cluster_sizes[callee_cluster]
+					> MAX_CLUSTER_SIZE) {
 			continue;
 		}
 
-		SectionInfo *symbol_section_info =
-			elf_file->section_info + symbol->section_index;
+		next[tails[caller_cluster]] = callee_cluster;
+		tails[caller_cluster] = tails[callee_cluster];
+		cluster_sizes[caller_cluster] += cluster_sizes[callee_cluster];
+		parents[callee_cluster] = caller_cluster;
+	}
 
-		// Since this is an executable, the symbol value is the location of the
-		// symbol in memory once loaded, not an offset into the corresponding
-		// section.
-		u32 symbol_mem_location =
-			symbol_section_info->virtual_address + symbol->section_offset;
+	for (u32 i = 0; i < num_sections; i++) {
+		InputSection *section = ARRAY_REF(&linker->sections, InputSection, i);
+		if (!section->live || section->output_index != TEXT_INDEX || placed[i])
+			continue;
 
-		ELFSymbolType type;
-		switch (symbol->section_index) {
-		case TEXT_INDEX: type = STT_FUNC; break;
-		case BSS_INDEX: case DATA_INDEX: type = STT_OBJECT; break;
-		default: UNREACHABLE;
+		for (u32 member = find_cluster(parents, i); member != ~0u;
+				member = next[member]) {
+			placed[member] = true;
+			*ARRAY_APPEND(order, u32) = member;
 		}
+	}
+
+	free(cluster_sizes);
+	free(tails);
+	free(next);
+	free(parents);
+	array_free(&edges);
+}
+
+// Returns the order to lay out the live .text sections in: first those named
+// in the symbol ordering file, then the rest, in input order unless we're
+// ordering by the call graph.
+static bool order_text_sections(Linker *linker, LinkerOptions *options,
+		Array(u32) *order)
+{
+	u32 num_sections = linker->sections.size;
+	bool *placed = calloc(num_sections, sizeof *placed);
+	bool ret = true;
+
+	if (options->symbol_ordering_file != NULL) {
+		ret = order_by_symbol_file(linker, options->symbol_ordering_file,
+				placed, order);
+		if (!ret)
+			goto cleanup;
+	}
+
+	if (options->call_graph_ordering)
+		order_by_call_graph(linker, placed, order);
+
+	for (u32 i = 0; i < num_sections; i++) {
+		InputSection *section = ARRAY_REF(&linker->sections, InputSection, i);
+		if (section->live && section->output_index == TEXT_INDEX && !placed[i])
+			*ARRAY_APPEND(order, u32) = i;
+	}
+
+cleanup:
+	free(placed);
+	return ret;
+}
+
+// Returns the address of the symbol once the executable is loaded.
+static u32 symbol_address(ELFFile *elf_file, Linker *linker, Symbol *symbol)
+{
+	InputSection *section =
+		ARRAY_REF(&linker->sections, InputSection, symbol->section);
+	assert(section->live);
+
+	return elf_file->section_info[section->output_index].virtual_address
+		+ section->output_offset + symbol->value;
+}
 
-		add_symbol(elf_file, type, symbol->binding, symbol->section_index,
-				symbol->name, symbol_mem_location, symbol->size);
+// @TODO: Add .note.GNU-STACK section header to prevent executable stack.
+bool link_elf_executable(char *executable_file_name,
+		Array(LinkerInputSource) *linker_inputs, LinkerOptions *options,
+		TimeReport *report)
+{
+	bool ret = true;
 
-		u32 prev_location = checked_ftell(output_file);
-		for (u32 i = 0; i < symbol->relocs.size; i++) {
-			Relocation *reloc = ARRAY_REF(&symbol->relocs, Relocation, i);
-			SectionInfo *reloc_section_info =
-				elf_file->section_info + reloc->section_index;
+	Linker linker;
+	symbol_table_init(&linker.symbol_table);
+	ARRAY_INIT(&linker.sections, InputSection, 100);
+	ARRAY_INIT(&linker.relocs, Relocation, 100);
+	SymbolTable *symbol_table = &linker.symbol_table;
+
+	Array(u8) text = EMPTY_ARRAY;
+	Array(u8) data = EMPTY_ARRAY;
+
+	// The entry point starts out undefined, so that the archive member
+	// defining it gets linked in.
+	u32 entry_symbol_index =
+		add_linker_symbol(symbol_table, "_start", STB_GLOBAL);
+
+	time_report_begin_phase(report, "read inputs");
+	u32 input_count = linker_inputs->size;
+	LinkerInput *inputs = calloc(input_count, sizeof *inputs);
+	for (u32 i = 0; i < input_count; i++) {
+		LinkerInput *input = inputs + i;
+		input->source = ARRAY_REF(linker_inputs, LinkerInputSource, i);
+		if (input->source->asm_module != NULL) {
+			input->contents = EMPTY_STRING;
+			input->type = ELF_FILE_TYPE;
+			continue;
+		}
+
+		input->contents = map_file_into_memory(input->source->filename);
+		if (!is_valid(input->contents)) {
+			perror("Failed to open linker input");
+			input->contents = EMPTY_STRING;
+			ret = false;
+			goto cleanup;
+		}
+
+		// We should have checked it was an object file or archive before
+		// putting it on the linker input list.
+		input->type =
+			file_type_of_bytes((u8 *)input->contents.chars, input->contents.len);
+		assert(input->type != UNKNOWN_FILE_TYPE);
+	}
+
+	parallel_for(input_count, options->jobs, parse_linker_input, inputs);
+
+	for (u32 i = 0; i < input_count; i++) {
+		LinkerInput *input = inputs + i;
+		bool processed = false;
+		switch (input->type) {
+		case ELF_FILE_TYPE:
+			if (input->parsed)
+				processed = merge_object_file(&input->object, &linker);
+			else
+				fprintf(stderr, "%s\n", input->object.error);
+			free_object_file(&input->object);
+			break;
+		case AR_FILE_TYPE:
+			processed = process_archive((u8 *)input->contents.chars,
+					input->contents.len, &linker);
+			break;
+		case UNKNOWN_FILE_TYPE:
+			UNREACHABLE;
+		}
+
+		if (!processed) {
+			ret = false;
+			goto cleanup;
+		}
+	}
+	time_report_end_phase(report);
+	time_report_set_count(report, "symbols", symbol_table->symbols.size);
+
+	Symbol *entry_symbol =
+		ARRAY_REF(&symbol_table->symbols, Symbol, entry_symbol_index);
+	if (!entry_symbol->defined) {
+		fputs("Undefined entry point '_start'\n", stderr);
+		ret = false;
+		goto cleanup;
+	}
+
+	if (options->gc_sections) {
+		time_report_begin_phase(report, "gc sections");
+		u32 num_live = mark_live_sections(&linker, entry_symbol);
+		time_report_end_phase(report);
+		time_report_set_count(report, "live sections", num_live);
+	} else {
+		for (u32 i = 0; i < linker.sections.size; i++)
+			ARRAY_REF(&linker.sections, InputSection, i)->live = true;
+	}
+
+	if (options->icf) {
+		time_report_begin_phase(report, "icf");
+		u32 num_folded = fold_identical_sections(&linker);
+		time_report_end_phase(report);
+		time_report_set_count(report, "folded sections", num_folded);
+	}
+
+	time_report_begin_phase(report, "layout");
+	Array(u32) text_order;
+	ARRAY_INIT(&text_order, u32, linker.sections.size);
+	if (!order_text_sections(&linker, options, &text_order)) {
+		array_free(&text_order);
+		ret = false;
+		goto cleanup;
+	}
+	for (u32 i = 0; i < text_order.size; i++) {
+		InputSection *section = ARRAY_REF(&linker.sections, InputSection,
+				*ARRAY_REF(&text_order, u32, i));
+		section->output_offset = text.size;
+		ARRAY_APPEND_ELEMS(&text, u8, section->size, section->contents);
+	}
+	array_free(&text_order);
+
+	u32 bss_size = 0;
+	for (u32 i = 0; i < linker.sections.size; i++) {
+		InputSection *section = ARRAY_REF(&linker.sections, InputSection, i);
+		if (!section->live)
+			continue;
+
+		switch (section->output_index) {
+		case TEXT_INDEX:
+			break;
+		case BSS_INDEX:
+			section->output_offset = bss_size;
+			bss_size += section->size;
+			break;
+		case DATA_INDEX:
+			section->output_offset = data.size;
+			ARRAY_APPEND_ELEMS(&data, u8, section->size, section->contents);
+			break;
+		default:
+			UNREACHABLE;
+		}
+	}
+
+	ELFFile _elf_file;
+	ELFFile *elf_file = &_elf_file;
+	init_elf_file(elf_file, ET_EXEC);
+
+	elf_file->section_info[TEXT_INDEX].size = text.size;
+	elf_file->section_info[TEXT_INDEX].contents = text.elements;
+	elf_file->section_info[BSS_INDEX].size = bss_size;
+	elf_file->section_info[DATA_INDEX].size = data.size;
+	elf_file->section_info[DATA_INDEX].contents = data.elements;
+
+	write_contents(elf_file);
+	time_report_end_phase(report);
+
+	time_report_begin_phase(report, "relocate");
+	u64 num_relocs = 0;
+	for (u32 i = 0; i < linker.sections.size; i++) {
+		InputSection *section = ARRAY_REF(&linker.sections, InputSection, i);
+		if (!section->live)
+			continue;
+
+		SectionInfo *reloc_section_info =
+			elf_file->section_info + section->output_index;
+
+		// The contents of every section are already in the image, so we
+		// patch relocations in place without touching the output file.
+		for (u32 j = 0; j < section->num_relocs; j++) {
+			Relocation *reloc = ARRAY_REF(&linker.relocs, Relocation,
+					section->first_reloc + j);
+			Symbol *symbol = ARRAY_REF(&symbol_table->symbols, Symbol,
+					reloc->symbol_index);
+			if (!symbol->defined) {
+				fprintf(stderr, "Undefined symbol '%s'\n", symbol->name);
+				array_free(&elf_file->image);
+				ret = false;
+				goto cleanup;
+			}
+
+			// Since this is an executable, the symbol value is the location of
+			// the symbol in memory once loaded, not an offset into the
+			// corresponding section.
+			u32 symbol_mem_location = symbol_address(elf_file, &linker, symbol);
+			u32 reloc_section_offset = section->output_offset + reloc->offset;
 			u32 reloc_mem_location =
-				reloc_section_info->virtual_address + reloc->section_offset;
+				reloc_section_info->virtual_address + reloc_section_offset;
 
-			u32 final_value;
+			u64 final_value;
+			u32 final_value_size;
 			switch (reloc->type) {
 			case R_X86_64_PC32:
-				final_value =
-					symbol_mem_location + reloc->addend - (i32)reloc_mem_location;
+				final_value = (u32)(symbol_mem_location + reloc->addend
+						- (i32)reloc_mem_location);
+				final_value_size = 4;
 				break;
-			case R_X86_64_64: case R_X86_64_32S: case R_X86_64_32:
-				final_value = symbol_mem_location + reloc->addend;
+			case R_X86_64_64:
+				final_value = (i64)symbol_mem_location + reloc->addend;
+				final_value_size = 8;
+				break;
+			case R_X86_64_32S: case R_X86_64_32:
+				final_value = (u32)(symbol_mem_location + reloc->addend);
+				final_value_size = 4;
 				break;
 			default:
 				fprintf(stderr, "Unsupported relocation type: %d\n",
@@ -1194,47 +2521,67 @@ bool link_elf_executable(char *executable_file_name, Array(char *) *linker_input
 				assert(false);
 			}
 
-			// @TODO: We should be writing different numbers of bytes for
-			// different relocation types, e.g.: R_X86_64_64 should be 8 bytes.
-			u8 final_value_bytes[] = {
-				final_value & 0xFF,
-				(final_value >> 8) & 0xFF,
-				(final_value >> 16) & 0xFF,
-				(final_value >> 24) & 0xFF,
-			};
+			u32 file_offset = reloc_section_info->offset + reloc_section_offset;
+			assert(file_offset + final_value_size <= elf_file->image.size);
+			u8 *bytes = elf_file->image.elements + file_offset;
+			for (u32 k = 0; k < final_value_size; k++)
+				bytes[k] = (final_value >> (k * 8)) & 0xFF;
+		}
 
-			u32 file_offset =
-				reloc_mem_location -
-				reloc_section_info->virtual_address +
-				reloc_section_info->offset;
-			checked_fseek(output_file, file_offset, SEEK_SET);
-			checked_fwrite(final_value_bytes,
-					1,
-					sizeof final_value_bytes,
-					output_file);
-#if 0
-			printf("Relocation %u for '%s': wrote 0x%x at offset 0x%x\n",
-					i, symbol->name, final_value, file_offset);
-			printf("rml = 0x%x, sml = 0x%x, add = %d, va = 0x%x, o = 0x%x\n",
-					reloc_mem_location, symbol_mem_location, reloc->addend,
-					reloc_section_info->virtual_address, reloc_section_info->offset);
-#endif
+		num_relocs += section->num_relocs;
+	}
+	time_report_end_phase(report);
+	time_report_set_count(report, "relocs", num_relocs);
+
+	time_report_begin_phase(report, "symtab");
+	// Symbols in discarded sections are left out, along with undefined
+	// symbols that nothing live refers to.
+	for (u32 i = 0; i < symbol_table->symbols.size; i++) {
+		Symbol *symbol = ARRAY_REF(&symbol_table->symbols, Symbol, i);
+		if (!symbol->defined
+				|| !ARRAY_REF(&linker.sections, InputSection, symbol->section)->live) {
+			continue;
 		}
-		checked_fseek(output_file, prev_location, SEEK_SET);
 
-		array_free(&symbol->relocs);
+		u32 output_index =
+			ARRAY_REF(&linker.sections, InputSection, symbol->section)->output_index;
+		ELFSymbolType type;
+		switch (output_index) {
+		case TEXT_INDEX: type = STT_FUNC; break;
+		case BSS_INDEX: case DATA_INDEX: type = STT_OBJECT; break;
+		default: UNREACHABLE;
+		}
+
+		add_symbol(elf_file, type, symbol->binding, output_index,
+				symbol->name, symbol_address(elf_file, &linker, symbol),
+				symbol->size);
 	}
 	finish_symtab_section(elf_file);
 
-	for (u32 i = 0; i < symbol_table.size; i++) {
-		Symbol *symbol = ARRAY_REF(&symbol_table, Symbol, i);
-		add_string(elf_file, symbol->name);
+	// This has to match the symbols we added above, as add_symbol assumes
+	// each name will be added in the same order.
+	for (u32 i = 0; i < symbol_table->symbols.size; i++) {
+		Symbol *symbol = ARRAY_REF(&symbol_table->symbols, Symbol, i);
+		if (symbol->defined
+				&& ARRAY_REF(&linker.sections, InputSection, symbol->section)->live) {
+			add_string(elf_file, symbol->name);
+		}
 	}
 	finish_strtab_section(elf_file);
+	time_report_end_phase(report);
+
+	time_report_begin_phase(report, "write");
+	ret = write_image(elf_file, executable_file_name);
+	time_report_end_phase(report);
 
 cleanup:
-	fclose(output_file);
-	array_free(&symbol_table);
-	free_asm_module(&asm_module);
+	for (u32 i = 0; i < input_count; i++)
+		free_linker_input(inputs + i);
+	free(inputs);
+	array_free(&text);
+	array_free(&data);
+	array_free(&linker.sections);
+	array_free(&linker.relocs);
+	symbol_table_free(symbol_table);
 	return ret;
 }
@@ -3,9 +3,48 @@
 
 #include "array.h"
 #include "asm.h"
+#include "time_report.h"
 
-bool write_elf_object_file(char *output_file_name, AsmModule *asm_module);
+// With function_sections or data_sections, each function or data item gets a
+// section of its own (e.g.: .text.main), so that the linker can discard the
+// ones that aren't used.
+bool write_elf_object_file(char *output_file_name, AsmModule *asm_module,
+		bool function_sections, bool data_sections);
 
-bool link_elf_executable(char *executable_filename, Array(char *) *linker_input_filenames);
+typedef struct LinkerOptions
+{
+	// Object files are parsed on up to this many threads. The output is the
+	// same regardless of the number of jobs.
+	u32 jobs;
+	// Discard input sections that aren't reachable from the entry point.
+	bool gc_sections;
+	// Fold identical functions into one. This only finds anything to fold if
+	// the inputs were compiled with -ffunction-sections.
+	bool icf;
+	// If non-NULL, a file of function names, one per line, to place first in
+	// .text in the given order.
+	char *symbol_ordering_file;
+	// Place functions after their callers, according to the call graph
+	// given by relocations.
+	bool call_graph_ordering;
+} LinkerOptions;
+
+// An input to the linker. This is either an object file or archive on disk,
+// or, if asm_module is non-NULL, a module assembled by this process. Modules
+// are linked as if written out with write_elf_object_file, but without the
+// round trip through a file.
+typedef struct LinkerInputSource
+{
+	char *filename;
+	AsmModule *asm_module;
+	bool function_sections;
+	bool data_sections;
+} LinkerInputSource;
+
+// If report is non-NULL, the time spent in each stage of linking is recorded
+// in it.
+bool link_elf_executable(char *executable_filename,
+		Array(LinkerInputSource) *linker_inputs, LinkerOptions *options,
+		TimeReport *report);
 
 #endif
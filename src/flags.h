@@ -6,5 +6,7 @@
 extern bool flag_dump_live_ranges;
 extern bool flag_dump_register_assignments;
 extern bool flag_print_pre_regalloc_stats;
+extern bool flag_print_peephole_stats;
+extern u32 flag_inline_limit;
 
 #endif
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash_table.h"
+
+// FNV-1a
+u32 hash_string(char *str, u32 length)
+{
+	u32 hash = 2166136261u;
+	for (u32 i = 0; i < length; i++) {
+		hash ^= (u8)str[i];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+void hash_table_init(HashTable *table, u32 initial_capacity)
+{
+	// The capacity must be a power of two, so we can mask rather than mod.
+	u32 capacity = 16;
+	while (capacity < initial_capacity)
+		capacity *= 2;
+
+	table->entries = calloc(capacity, sizeof *table->entries);
+	table->capacity = capacity;
+	table->size = 0;
+}
+
+void hash_table_free(HashTable *table)
+{
+	free(table->entries);
+	table->entries = NULL;
+}
+
+static HashTableEntry *find_entry(HashTableEntry *entries, u32 capacity,
+		char *key, u32 key_length, u32 hash)
+{
+	u32 mask = capacity - 1;
+	for (u32 i = hash & mask; ; i = (i + 1) & mask) {
+		HashTableEntry *entry = entries + i;
+		if (entry->key == NULL)
+			return entry;
+		if (entry->hash == hash && entry->key_length == key_length
+				&& memcmp(entry->key, key, key_length) == 0) {
+			return entry;
+		}
+	}
+}
+
+static void grow(HashTable *table)
+{
+	u32 new_capacity = table->capacity * 2;
+	HashTableEntry *new_entries = calloc(new_capacity, sizeof *new_entries);
+
+	for (u32 i = 0; i < table->capacity; i++) {
+		HashTableEntry *entry = table->entries + i;
+		if (entry->key == NULL)
+			continue;
+
+		*find_entry(new_entries, new_capacity,
+				entry->key, entry->key_length, entry->hash) = *entry;
+	}
+
+	free(table->entries);
+	table->entries = new_entries;
+	table->capacity = new_capacity;
+}
+
+u32 *hash_table_lookup(HashTable *table, char *key, u32 key_length)
+{
+	return hash_table_lookup_hashed(table, key, key_length,
+			hash_string(key, key_length));
+}
+
+u32 *hash_table_lookup_hashed(HashTable *table, char *key, u32 key_length,
+		u32 hash)
+{
+	HashTableEntry *entry =
+		find_entry(table->entries, table->capacity, key, key_length, hash);
+	if (entry->key == NULL)
+		return NULL;
+
+	return &entry->value;
+}
+
+u32 *hash_table_insert(HashTable *table, char *key, u32 key_length,
+		bool *inserted)
+{
+	// Keep the load factor at most 3/4, so probe sequences stay short.
+	if ((table->size + 1) * 4 > table->capacity * 3)
+		grow(table);
+
+	u32 hash = hash_string(key, key_length);
+	HashTableEntry *entry =
+		find_entry(table->entries, table->capacity, key, key_length, hash);
+	if (entry->key == NULL) {
+		entry->key = key;
+		entry->key_length = key_length;
+		entry->hash = hash;
+		entry->value = 0;
+		table->size++;
+
+		*inserted = true;
+	} else {
+		*inserted = false;
+	}
+
+	return &entry->value;
+}
@@ -0,0 +1,43 @@
+#ifndef NAIVE_HASH_TABLE_H_
+#define NAIVE_HASH_TABLE_H_
+
+#include "misc.h"
+
+// Maps strings to u32 values, which are usually indices into an Array owned
+// by the caller. Uses open addressing with linear probing.
+//
+// The table doesn't copy keys, so they must outlive it. Keys don't need to
+// be null-terminated, which lets us look up names in place in source text.
+
+typedef struct HashTableEntry
+{
+	char *key;
+	u32 key_length;
+	u32 hash;
+	u32 value;
+} HashTableEntry;
+
+typedef struct HashTable
+{
+	HashTableEntry *entries;
+	u32 capacity;
+	u32 size;
+} HashTable;
+
+u32 hash_string(char *str, u32 length);
+
+void hash_table_init(HashTable *table, u32 initial_capacity);
+void hash_table_free(HashTable *table);
+// Returns a pointer to the value for key, or NULL if it isn't present. The
+// pointer is invalidated by the next insertion.
+u32 *hash_table_lookup(HashTable *table, char *key, u32 key_length);
+// As above, but with the hash of key already computed by hash_string, e.g.:
+// on another thread.
+u32 *hash_table_lookup_hashed(HashTable *table, char *key, u32 key_length,
+		u32 hash);
+// Returns a pointer to the value for key, adding key with the value 0 if it
+// isn't present. *inserted is set to whether key was added.
+u32 *hash_table_insert(HashTable *table, char *key, u32 key_length,
+		bool *inserted);
+
+#endif
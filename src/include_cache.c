@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// @PORT
+#include <dirent.h>
+
+#include "include_cache.h"
+#include "util.h"
+
+void include_cache_init(IncludeCache *cache, Array(char *) *include_dirs)
+{
+	cache->include_dirs = include_dirs;
+	mutex_init(&cache->lock);
+	pool_init(&cache->pool, 4096);
+	hash_table_init(&cache->directory_indices, 16);
+	ARRAY_INIT(&cache->directories, HashTable *, 16);
+	hash_table_init(&cache->lookup_indices, 64);
+	ARRAY_INIT(&cache->resolved_paths, char *, 64);
+}
+
+void include_cache_free(IncludeCache *cache)
+{
+	for (u32 i = 0; i < cache->directories.size; i++)
+		hash_table_free(*ARRAY_REF(&cache->directories, HashTable *, i));
+
+	array_free(&cache->directories);
+	hash_table_free(&cache->directory_indices);
+	array_free(&cache->resolved_paths);
+	hash_table_free(&cache->lookup_indices);
+	pool_free(&cache->pool);
+	mutex_free(&cache->lock);
+}
+
+static char *pool_strndup(Pool *pool, char *str, u32 length)
+{
+	char *copy = pool_alloc(pool, length + 1);
+	memcpy(copy, str, length);
+	copy[length] = '\0';
+
+	return copy;
+}
+
+// Returns the names of the entries in the directory path[0..length), which
+// must end in '/'. If we can't read the directory, e.g.: because it doesn't
+// exist, we treat it as empty.
+static HashTable *directory_entries(IncludeCache *cache, char *path,
+		u32 length)
+{
+	u32 *index = hash_table_lookup(&cache->directory_indices, path, length);
+	if (index != NULL)
+		return *ARRAY_REF(&cache->directories, HashTable *, *index);
+
+	HashTable *entries = pool_alloc(&cache->pool, sizeof *entries);
+	hash_table_init(entries, 64);
+
+	char *dir_path = pool_strndup(&cache->pool, path, length);
+	// @PORT
+	DIR *dir = opendir(dir_path);
+	if (dir != NULL) {
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL) {
+			u32 name_length = strlen(entry->d_name);
+			char *name = pool_strndup(&cache->pool, entry->d_name, name_length);
+
+			bool inserted;
+			hash_table_insert(entries, name, name_length, &inserted);
+		}
+
+		closedir(dir);
+	}
+
+	bool inserted;
+	*hash_table_insert(&cache->directory_indices, dir_path, length, &inserted) =
+		cache->directories.size;
+	*ARRAY_APPEND(&cache->directories, HashTable *) = entries;
+
+	return entries;
+}
+
+static bool file_exists(IncludeCache *cache, char *path)
+{
+	u32 length = strlen(path);
+	i32 i = length - 1;
+	for (; i >= 0 && path[i] != '/'; i--)
+		;
+
+	// We only look up paths built from a directory ending in '/'.
+	assert(i != -1);
+
+	u32 dir_length = i + 1;
+	HashTable *entries = directory_entries(cache, path, dir_length);
+	return hash_table_lookup(entries, path + dir_length, length - dir_length)
+		!= NULL;
+}
+
+// Returns base_path followed by include_path if that names a file, or NULL.
+static char *try_path(IncludeCache *cache, char *base_path, u32 base_length,
+		char *include_path, u32 include_path_length)
+{
+	char *potential_path =
+		nconcat(base_path, base_length, include_path, include_path_length);
+
+	char *path = NULL;
+	if (file_exists(cache, potential_path)) {
+		path = pool_strndup(&cache->pool, potential_path,
+				base_length + include_path_length);
+	}
+
+	free(potential_path);
+	return path;
+}
+
+static char *resolve_include(IncludeCache *cache, char *base_path,
+		u32 base_length, char *include_path)
+{
+	u32 include_path_length = strlen(include_path);
+
+	// If absolute, just try the exact path.
+	if (include_path[0] == '/')
+		return try_path(cache, "", 0, include_path, include_path_length);
+
+	// Try relative to the including file.
+	if (base_path != NULL) {
+		char *path = try_path(cache, base_path, base_length,
+				include_path, include_path_length);
+		if (path != NULL)
+			return path;
+	}
+
+	// Try include dirs
+	Array(char *) *include_dirs = cache->include_dirs;
+	for (u32 i = 0; i < include_dirs->size; i++) {
+		char *include_dir = *ARRAY_REF(include_dirs, char *, i);
+		char *path = try_path(cache, include_dir, strlen(include_dir),
+				include_path, include_path_length);
+		if (path != NULL)
+			return path;
+	}
+
+	return NULL;
+}
+
+char *include_cache_look_up(IncludeCache *cache, char *including_file,
+		char *include_path, bool angle_brackets)
+{
+	// Includes are looked up relative to the including file's directory,
+	// unless they're absolute or <> includes. We skip this for <> includes,
+	// so that e.g.: <time.h> included from <sys/stat.h> doesn't find
+	// <sys/time.h>.
+	char *base_path = NULL;
+	u32 base_length = 0;
+	if (!angle_brackets && include_path[0] != '/') {
+		u32 including_file_length = strlen(including_file);
+		i32 i = including_file_length - 1;
+		for (; i >= 0 && including_file[i] != '/'; i--)
+			;
+
+		// Path without any slashes
+		if (i == -1) {
+			base_path = "./";
+			base_length = 2;
+		} else {
+			base_path = including_file;
+			base_length = i + 1;
+		}
+	}
+
+	// The result only depends on the base path and include_path, so we use
+	// those, separated by a null byte, as the key. Includes that don't
+	// depend on the including file have no base path.
+	u32 include_path_length = strlen(include_path);
+	u32 key_length = base_length + 1 + include_path_length;
+	char *key = malloc(key_length);
+	if (base_path != NULL)
+		memcpy(key, base_path, base_length);
+	key[base_length] = '\0';
+	memcpy(key + base_length + 1, include_path, include_path_length);
+
+	mutex_lock(&cache->lock);
+
+	char *resolved_path;
+	u32 *index = hash_table_lookup(&cache->lookup_indices, key, key_length);
+	if (index != NULL) {
+		resolved_path = *ARRAY_REF(&cache->resolved_paths, char *, *index);
+	} else {
+		resolved_path =
+			resolve_include(cache, base_path, base_length, include_path);
+
+		char *pool_key = pool_alloc(&cache->pool, key_length);
+		memcpy(pool_key, key, key_length);
+
+		bool inserted;
+		*hash_table_insert(&cache->lookup_indices, pool_key, key_length,
+				&inserted) = cache->resolved_paths.size;
+		*ARRAY_APPEND(&cache->resolved_paths, char *) = resolved_path;
+	}
+
+	mutex_unlock(&cache->lock);
+
+	free(key);
+	return resolved_path;
+}
@@ -0,0 +1,45 @@
+#ifndef NAIVE_INCLUDE_CACHE_H_
+#define NAIVE_INCLUDE_CACHE_H_
+
+#include "array.h"
+#include "hash_table.h"
+#include "misc.h"
+#include "parallel.h"
+#include "pool.h"
+
+// Resolves #include paths to files, remembering the result of every lookup.
+// Rather than probing for a file with one syscall per candidate path, we
+// read each directory we search once, the first time we look in it.
+//
+// One cache can be shared between all translation units in a compilation,
+// including ones compiled in parallel.
+typedef struct IncludeCache
+{
+	Array(char *) *include_dirs;
+
+	Mutex lock;
+	// Keys, resolved paths, and directory entry names all live here.
+	Pool pool;
+
+	// Maps a directory path, ending in '/', to the index of a table of its
+	// entries in directories.
+	HashTable directory_indices;
+	Array(HashTable *) directories;
+
+	// Maps an #include, as identified by make_lookup_key, to an index in
+	// resolved_paths. Entries are NULL for includes we couldn't resolve.
+	HashTable lookup_indices;
+	Array(char *) resolved_paths;
+} IncludeCache;
+
+void include_cache_init(IncludeCache *cache, Array(char *) *include_dirs);
+void include_cache_free(IncludeCache *cache);
+
+// Returns the path of the file named by "#include <include_path>" if
+// angle_brackets is set, or "#include "include_path"" otherwise, in
+// including_file. Returns NULL if there's no such file. The returned path is
+// owned by the cache, and lives until include_cache_free.
+char *include_cache_look_up(IncludeCache *cache, char *including_file,
+		char *include_path, bool angle_brackets);
+
+#endif
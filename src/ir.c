@@ -302,6 +302,13 @@ static void dump_instr(IrInstr *instr)
 		fputs(", ", stdout);
 		dump_block_name(instr->u.cond.else_block);
 		break;
+	case OP_JUMP_TABLE:
+		dump_value(instr->u.jump_table.index);
+		for (u32 i = 0; i < instr->u.jump_table.num_targets; i++) {
+			fputs(", ", stdout);
+			dump_block_name(instr->u.jump_table.targets[i]);
+		}
+		break;
 	case OP_PHI:
 		for (u32 i = 0; i < instr->u.phi.arity; i++) {
 			IrPhiParam *param = instr->u.phi.params + i;
@@ -339,7 +346,8 @@ static void dump_instr(IrInstr *instr)
 		break;
 	}
 	case OP_BIT_XOR: case OP_BIT_AND: case OP_BIT_OR: case OP_SHL: case OP_SHR:
-	case OP_MUL: case OP_DIV: case OP_MOD: case OP_ADD: case OP_SUB:
+	case OP_MUL: case OP_DIV: case OP_MOD: case OP_UDIV: case OP_UMOD:
+	case OP_ADD: case OP_SUB:
 	case OP_STORE: case OP_BUILTIN_VA_ARG:
 		dump_value(instr->u.binary_op.arg1);
 		fputs(", ", stdout);
@@ -494,74 +502,203 @@ IrInstr *build_cond(IrBuilder *builder,
 	return instr;
 }
 
-static bool constant_foldable(IrOp op)
+IrInstr *build_jump_table(IrBuilder *builder,
+		IrValue index, u32 num_targets, IrBlock **targets)
 {
-	switch (op) {
-	case OP_LOCAL: case OP_FIELD: case OP_LOAD: case OP_STORE: case OP_CAST:
-	case OP_RET: case OP_BRANCH: case OP_COND: case OP_CALL: case OP_ZEXT:
-	case OP_SEXT: case OP_RET_VOID:
-		return false;
-	default:
-		return true;
+	assert(index.type.t == IR_INT && index.type.u.bit_width == 64);
+
+	IrInstr *instr = append_instr(builder);
+	instr->op = OP_JUMP_TABLE;
+	instr->type = (IrType) { .t = IR_VOID };
+	instr->u.jump_table.index = index;
+	instr->u.jump_table.num_targets = num_targets;
+	instr->u.jump_table.targets = targets;
+
+	return instr;
+}
+
+// @PORT: Hardcoded pointer size.
+static u8 const_width(IrType type)
+{
+	switch (type.t) {
+	case IR_INT: return type.u.bit_width;
+	case IR_POINTER: return 64;
+	default: UNREACHABLE;
 	}
 }
 
-static u64 constant_fold_unary_op(IrOp op, u64 arg)
+static bool is_foldable_const(IrValue value)
+{
+	return value.t == IR_VALUE_CONST
+		&& (value.type.t == IR_INT || value.type.t == IR_POINTER);
+}
+
+// Constants aren't always stored in a canonical form (e.g.: a negated 32-bit
+// constant has all of its upper bits set), so we normalise operands with
+// these before folding. Folded results are always zero-extended.
+static u64 zext_const(u64 value, u8 width)
+{
+	return width == 64 ? value : value & ((1ULL << width) - 1);
+}
+
+static i64 sext_const(u64 value, u8 width)
+{
+	u64 sign_bit = 1ULL << (width - 1);
+	return (i64)((zext_const(value, width) ^ sign_bit) - sign_bit);
+}
+
+static bool fold_unary_op(IrOp op, IrValue arg, IrValue *result)
 {
+	if (!is_foldable_const(arg))
+		return false;
+
+	u64 value;
 	switch (op) {
-	case OP_BIT_XOR: case OP_BIT_AND: case OP_BIT_OR: case OP_MUL: case OP_DIV:
-	case OP_ADD: case OP_SUB:
-		UNREACHABLE;
-	case OP_BIT_NOT:
-		return ~arg;
-	case OP_NEG:
-		return -arg;
-	default:
-		assert(constant_foldable(op));
-		UNIMPLEMENTED;
+	case OP_BIT_NOT: value = ~arg.u.constant; break;
+	case OP_NEG: value = -arg.u.constant; break;
+	default: return false;
 	}
+
+	*result = value_const(arg.type, zext_const(value, const_width(arg.type)));
+	return true;
 }
 
-static u64 constant_fold_binary_op(IrOp op, u64 arg1, u64 arg2)
+static bool fold_binary_op(IrOp op, IrValue arg1, IrValue arg2, IrValue *result)
 {
+	if (!is_foldable_const(arg1) || !is_foldable_const(arg2))
+		return false;
+
+	u8 width = const_width(arg1.type);
+	u64 a = zext_const(arg1.u.constant, width);
+	u64 b = zext_const(arg2.u.constant, width);
+	i64 signed_a = sext_const(a, width);
+	i64 signed_b = sext_const(b, width);
+
+	u64 value;
 	switch (op) {
-	case OP_BIT_NOT:
-		UNREACHABLE;
-	case OP_BIT_XOR: return arg1 ^ arg2;
-	case OP_BIT_AND: return arg1 & arg2;
-	case OP_BIT_OR: return arg1 | arg2;
-	case OP_SHL: return arg1 << arg2;
-	case OP_SHR: return arg1 >> arg2;
-	case OP_MUL: return arg1 * arg2;
-	case OP_DIV: return arg1 / arg2;
-	case OP_MOD: return (i64)arg1 % (i64)arg2;
-	case OP_ADD: return arg1 + arg2;
-	case OP_SUB: return arg1 - arg2;
+	case OP_BIT_XOR: value = a ^ b; break;
+	case OP_BIT_AND: value = a & b; break;
+	case OP_BIT_OR: value = a | b; break;
+	case OP_MUL: value = a * b; break;
+	case OP_ADD: value = a + b; break;
+	case OP_SUB: value = a - b; break;
+	// Shifts by the width or more don't have a consistent result, so we leave
+	// them for the hardware to decide.
+	case OP_SHL:
+		if (b >= width)
+			return false;
+		value = a << b;
+		break;
+	case OP_SHR:
+		if (b >= width)
+			return false;
+		value = a >> b;
+		break;
+	// Division by zero is left to trap at runtime. Dividing the most negative
+	// value by -1 would trap here, so we do that case with unsigned arithmetic
+	// instead.
+	case OP_DIV:
+		if (b == 0)
+			return false;
+		value = signed_b == -1 ? -a : (u64)(signed_a / signed_b);
+		break;
+	case OP_MOD:
+		if (b == 0)
+			return false;
+		value = signed_b == -1 ? 0 : (u64)(signed_a % signed_b);
+		break;
+	case OP_UDIV:
+		if (b == 0)
+			return false;
+		value = a / b;
+		break;
+	case OP_UMOD:
+		if (b == 0)
+			return false;
+		value = a % b;
+		break;
 	default:
-		assert(constant_foldable(op));
-		UNIMPLEMENTED;
+		return false;
 	}
+
+	*result = value_const(arg1.type, zext_const(value, width));
+	return true;
 }
 
-static u32 constant_fold_cmp(IrCmp cmp, u64 arg1, u64 arg2)
+static bool fold_cmp(IrCmp cmp, IrValue arg1, IrValue arg2, IrValue *result)
 {
+	if (!is_foldable_const(arg1) || !is_foldable_const(arg2))
+		return false;
+
+	u8 width = const_width(arg1.type);
+	u64 a = zext_const(arg1.u.constant, width);
+	u64 b = zext_const(arg2.u.constant, width);
+	i64 signed_a = sext_const(a, width);
+	i64 signed_b = sext_const(b, width);
+
+	bool value;
 	switch (cmp) {
-	case CMP_EQ: return arg1 == arg2;
-	case CMP_NEQ: return arg1 != arg2;
-	case CMP_SGT: return (i64)arg1 > (i64)arg2;
-	case CMP_SGTE: return (i64)arg1 >= (i64)arg2;
-	case CMP_SLT: return (i64)arg1 < (i64)arg2;
-	case CMP_SLTE: return (i64)arg1 <= (i64)arg2;
-	case CMP_UGT: return arg1 > arg2;
-	case CMP_UGTE: return arg1 >= arg2;
-	case CMP_ULT: return arg1 < arg2;
-	case CMP_ULTE: return arg1 <= arg2;
+	case CMP_EQ: value = a == b; break;
+	case CMP_NEQ: value = a != b; break;
+	case CMP_SGT: value = signed_a > signed_b; break;
+	case CMP_SGTE: value = signed_a >= signed_b; break;
+	case CMP_SLT: value = signed_a < signed_b; break;
+	case CMP_SLTE: value = signed_a <= signed_b; break;
+	case CMP_UGT: value = a > b; break;
+	case CMP_UGTE: value = a >= b; break;
+	case CMP_ULT: value = a < b; break;
+	case CMP_ULTE: value = a <= b; break;
+	default: UNREACHABLE;
 	}
 
-	UNREACHABLE;
+	*result = value_const((IrType) { .t = IR_INT, .u.bit_width = 32 }, value);
+	return true;
 }
 
-static IrValue value_instr(IrInstr *instr)
+static bool fold_type_instr(IrOp op, IrValue arg, IrType result_type,
+		IrValue *result)
+{
+	if (!is_foldable_const(arg)
+			|| (result_type.t != IR_INT && result_type.t != IR_POINTER)) {
+		return false;
+	}
+
+	u8 width = const_width(arg.type);
+	u64 value;
+	switch (op) {
+	case OP_SEXT: value = sext_const(arg.u.constant, width); break;
+	case OP_ZEXT: case OP_TRUNC: case OP_CAST:
+		value = zext_const(arg.u.constant, width);
+		break;
+	default: return false;
+	}
+
+	*result = value_const(result_type,
+			zext_const(value, const_width(result_type)));
+	return true;
+}
+
+bool fold_instr(IrInstr *instr, IrValue *result)
+{
+	switch (instr->op) {
+	case OP_BIT_NOT: case OP_NEG:
+		return fold_unary_op(instr->op, instr->u.arg, result);
+	case OP_BIT_XOR: case OP_BIT_OR: case OP_BIT_AND: case OP_SHL: case OP_SHR:
+	case OP_MUL: case OP_DIV: case OP_MOD: case OP_UDIV: case OP_UMOD:
+	case OP_ADD: case OP_SUB:
+		return fold_binary_op(instr->op,
+				instr->u.binary_op.arg1, instr->u.binary_op.arg2, result);
+	case OP_CMP:
+		return fold_cmp(instr->u.cmp.cmp,
+				instr->u.cmp.arg1, instr->u.cmp.arg2, result);
+	case OP_CAST: case OP_ZEXT: case OP_SEXT: case OP_TRUNC:
+		return fold_type_instr(instr->op, instr->u.arg, instr->type, result);
+	default:
+		return false;
+	}
+}
+
+IrValue value_instr(IrInstr *instr)
 {
 	return (IrValue) {
 		.t = IR_VALUE_INSTR,
@@ -631,11 +768,9 @@ IrValue build_nullary_instr(IrBuilder *builder, IrOp op, IrType type)
 
 IrValue build_unary_instr(IrBuilder *builder, IrOp op, IrValue arg)
 {
-	IrType type = arg.type;
-
-	if (arg.t == IR_VALUE_CONST && constant_foldable(op)) {
-		return value_const(type, constant_fold_unary_op(op, arg.u.constant));
-	}
+	IrValue folded;
+	if (fold_unary_op(op, arg, &folded))
+		return folded;
 
 	IrInstr *instr = append_instr(builder);
 	instr->op = op;
@@ -652,16 +787,14 @@ IrValue build_unary_instr(IrBuilder *builder, IrOp op, IrValue arg)
 IrValue build_binary_instr(IrBuilder *builder, IrOp op, IrValue arg1, IrValue arg2)
 {
 	assert(ir_type_eq(&arg1.type, &arg2.type));
-	IrType type = arg1.type;
 
-	if (arg1.t == IR_VALUE_CONST && arg2.t == IR_VALUE_CONST && constant_foldable(op)) {
-		return value_const(type,
-				constant_fold_binary_op(op, arg1.u.constant, arg2.u.constant));
-	}
+	IrValue folded;
+	if (fold_binary_op(op, arg1, arg2, &folded))
+		return folded;
 
 	IrInstr *instr = append_instr(builder);
 	instr->op = op;
-	instr->type = type;
+	instr->type = arg1.type;
 	instr->u.binary_op.arg1 = arg1;
 	instr->u.binary_op.arg2 = arg2;
 
@@ -671,16 +804,14 @@ IrValue build_binary_instr(IrBuilder *builder, IrOp op, IrValue arg1, IrValue ar
 IrValue build_cmp(IrBuilder *builder, IrCmp cmp, IrValue arg1, IrValue arg2)
 {
 	assert(ir_type_eq(&arg1.type, &arg2.type));
-	IrType type = (IrType) { .t = IR_INT, .u.bit_width = 32 };
 
-	if (arg1.t == IR_VALUE_CONST && arg2.t == IR_VALUE_CONST) {
-		return value_const(type,
-				constant_fold_cmp(cmp, arg1.u.constant, arg2.u.constant));
-	}
+	IrValue folded;
+	if (fold_cmp(cmp, arg1, arg2, &folded))
+		return folded;
 
 	IrInstr *instr = append_instr(builder);
 	instr->op = OP_CMP;
-	instr->type = type;
+	instr->type = (IrType) { .t = IR_INT, .u.bit_width = 32 };
 	instr->u.cmp.arg1 = arg1;
 	instr->u.cmp.arg2 = arg2;
 	instr->u.cmp.cmp = cmp;
@@ -707,9 +838,9 @@ IrValue build_type_instr(IrBuilder *builder, IrOp op, IrValue value, IrType resu
 	if (ir_type_eq(&value.type, &result_type))
 		return value;
 
-	if (value.t == IR_VALUE_CONST) {
-		return value_const(result_type, value.u.constant);
-	}
+	IrValue folded;
+	if (fold_type_instr(op, value, result_type, &folded))
+		return folded;
 
 	IrInstr *instr = append_instr(builder);
 	instr->op = op;
@@ -773,6 +904,53 @@ IrValue value_global(IrGlobal *global)
 	return value;
 }
 
+void instr_operands(IrInstr *instr, Array(IrValue *) *operands)
+{
+	array_clear(operands);
+
+	switch (instr->op) {
+	case OP_INVALID: UNREACHABLE;
+	case OP_LOCAL: case OP_RET_VOID: case OP_BRANCH:
+		break;
+	case OP_BIT_NOT: case OP_NEG: case OP_RET: case OP_CAST: case OP_ZEXT:
+	case OP_SEXT: case OP_TRUNC: case OP_BUILTIN_VA_START:
+		*ARRAY_APPEND(operands, IrValue *) = &instr->u.arg;
+		break;
+	case OP_BIT_XOR: case OP_BIT_OR: case OP_BIT_AND: case OP_SHL: case OP_SHR:
+	case OP_MUL: case OP_DIV: case OP_MOD: case OP_UDIV: case OP_UMOD:
+	case OP_ADD: case OP_SUB:
+	case OP_STORE: case OP_BUILTIN_VA_ARG:
+		*ARRAY_APPEND(operands, IrValue *) = &instr->u.binary_op.arg1;
+		*ARRAY_APPEND(operands, IrValue *) = &instr->u.binary_op.arg2;
+		break;
+	case OP_CMP:
+		*ARRAY_APPEND(operands, IrValue *) = &instr->u.cmp.arg1;
+		*ARRAY_APPEND(operands, IrValue *) = &instr->u.cmp.arg2;
+		break;
+	case OP_CALL:
+		*ARRAY_APPEND(operands, IrValue *) = &instr->u.call.callee;
+		for (u32 i = 0; i < instr->u.call.arity; i++)
+			*ARRAY_APPEND(operands, IrValue *) = instr->u.call.arg_array + i;
+		break;
+	case OP_FIELD:
+		*ARRAY_APPEND(operands, IrValue *) = &instr->u.field.ptr;
+		break;
+	case OP_LOAD:
+		*ARRAY_APPEND(operands, IrValue *) = &instr->u.load.pointer;
+		break;
+	case OP_COND:
+		*ARRAY_APPEND(operands, IrValue *) = &instr->u.cond.condition;
+		break;
+	case OP_JUMP_TABLE:
+		*ARRAY_APPEND(operands, IrValue *) = &instr->u.jump_table.index;
+		break;
+	case OP_PHI:
+		for (u32 i = 0; i < instr->u.phi.arity; i++)
+			*ARRAY_APPEND(operands, IrValue *) = &instr->u.phi.params[i].value;
+		break;
+	}
+}
+
 IrConst *add_int_const(IrBuilder *builder, IrType int_type, u64 value)
 {
 	IrConst *konst = pool_alloc(&builder->trans_unit->pool, sizeof *konst);
@@ -109,6 +109,17 @@ typedef struct IrGlobal
 	AsmSymbol *asm_symbol;
 	IrConst *initializer;
 
+	// Set for functions declared "inline", which the inliner considers even
+	// if they have external linkage.
+	bool is_inline;
+	// Set for C99 inline definitions with no extern declaration in this TU.
+	// The external definition is in some other TU, so the body is only here
+	// for the inliner, and we don't emit it.
+	bool only_for_inlining;
+
+	// used by ir_opt
+	bool referenced;
+
 	// @TODO: We should find a better place to put this. It only makes sense
 	// for functions, but we can't put it on IrFunction because we need it for
 	// undefined functions too, to call them.
@@ -160,6 +171,8 @@ typedef struct IrValue
 	X(OP_MUL), \
 	X(OP_DIV), \
 	X(OP_MOD), \
+	X(OP_UDIV), \
+	X(OP_UMOD), \
 	X(OP_ADD), \
 	X(OP_SUB), \
 	X(OP_CMP), \
@@ -176,6 +189,7 @@ typedef struct IrValue
 	X(OP_RET_VOID), \
 	X(OP_BRANCH), \
 	X(OP_COND), \
+	X(OP_JUMP_TABLE), \
 	X(OP_PHI), \
 \
 	X(OP_BUILTIN_VA_START), \
@@ -260,6 +274,14 @@ typedef struct IrInstr
 			IrBlock *else_block;
 		} cond;
 		IrBlock *target_block;
+		// Jumps to targets[index]. The index must already be known to be in
+		// range, and is always 64 bits wide.
+		struct
+		{
+			IrValue index;
+			u32 num_targets;
+			IrBlock **targets;
+		} jump_table;
 		struct
 		{
 			IrType type;
@@ -297,10 +319,21 @@ void builder_init(IrBuilder *builder, TransUnit *trans_unit);
 IrInstr *build_branch(IrBuilder *builder, IrBlock *block);
 IrInstr *build_cond(IrBuilder *builder,
 		IrValue condition, IrBlock *then_block, IrBlock *else_block);
+IrInstr *build_jump_table(IrBuilder *builder,
+		IrValue index, u32 num_targets, IrBlock **targets);
 
 IrValue value_const(IrType type, u64 constant);
 IrValue value_arg(u32 arg_index, IrType type);
 IrValue value_global(IrGlobal *global);
+IrValue value_instr(IrInstr *instr);
+
+// Fills "operands" with pointers to each IrValue used by "instr", so that
+// passes can inspect or rewrite them in place.
+void instr_operands(IrInstr *instr, Array(IrValue *) *operands);
+
+// If every operand of "instr" is constant and it can be evaluated at compile
+// time, sets "result" to its value and returns true.
+bool fold_instr(IrInstr *instr, IrValue *result);
 
 IrConst *add_int_const(IrBuilder *builder, IrType int_type, u64 value);
 IrConst *add_global_const(IrBuilder *builder, IrGlobal *global);
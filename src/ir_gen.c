@@ -1508,6 +1508,26 @@ void ir_gen_function(IrBuilder *builder, Env *env, IrGlobal *global,
 		build_nullary_instr(builder, OP_RET_VOID, (IrType) { .t = IR_VOID });
 	}
 
+	// Labels are scoped to the function, so we resolve gotos here rather than
+	// at the end of the TU, where a goto could find a label with the same
+	// name in a different function.
+	for (u32 i = 0; i < env->goto_fixups.size; i++) {
+		GotoFixup *fixup = ARRAY_REF(&env->goto_fixups, GotoFixup, i);
+		assert(fixup->instr->op == OP_BRANCH);
+		assert(fixup->instr->u.target_block == NULL);
+
+		for (u32 j = 0; j < env->goto_labels.size; j++) {
+			GotoLabel *label = ARRAY_REF(&env->goto_labels, GotoLabel, j);
+			if (streq(label->name, fixup->label_name)) {
+				fixup->instr->u.target_block = label->block;
+				break;
+			}
+		}
+		assert(fixup->instr->u.target_block != NULL);
+	}
+	env->goto_fixups.size = 0;
+	env->goto_labels.size = 0;
+
 	env->scope = env->scope->parent_scope;
 	array_free(param_bindings);
 }
@@ -1654,6 +1674,7 @@ void ir_gen_toplevel(IrBuilder *builder, ASTToplevel *toplevel)
 			global = ir_global_for_decl(builder, &env, decl_specifier_list,
 					declarator, NULL, &global_type);
 			global->linkage = linkage;
+			global->is_inline = is_inline;
 
 			Binding *binding = ARRAY_APPEND(global_bindings, Binding);
 			binding->name = global->name;
@@ -1661,7 +1682,10 @@ void ir_gen_toplevel(IrBuilder *builder, ASTToplevel *toplevel)
 			binding->term.ctype = global_type;
 			binding->term.value = value_global(global);
 
-			if (is_inline) {
+			// A static inline function is just a static function, but an
+			// inline definition with external linkage is only emitted if
+			// there's an extern declaration of it too.
+			if (is_inline && linkage == IR_GLOBAL_LINKAGE) {
 				*ARRAY_APPEND(&env.inline_functions, InlineFunction) =
 					(InlineFunction) {
 						.global = global,
@@ -1805,20 +1829,18 @@ void ir_gen_toplevel(IrBuilder *builder, ASTToplevel *toplevel)
 		toplevel = toplevel->next;
 	}
 
-	// @TODO: Do this once per function and reset size to 0 afterwards.
-	for (u32 i = 0; i < env.goto_fixups.size; i++) {
-		GotoFixup *fixup = ARRAY_REF(&env.goto_fixups, GotoFixup, i);
-		assert(fixup->instr->op == OP_BRANCH);
-		assert(fixup->instr->u.target_block == NULL);
+	// Inline definitions that were never declared extern still get a body,
+	// so that the inliner can use it.
+	for (u32 i = 0; i < env.inline_functions.size; i++) {
+		InlineFunction *inline_function =
+			ARRAY_REF(&env.inline_functions, InlineFunction, i);
+		IrGlobal *global = inline_function->global;
+		if (global->initializer != NULL)
+			continue;
 
-		for (u32 j = 0; j < env.goto_labels.size; j++) {
-			GotoLabel *label = ARRAY_REF(&env.goto_labels, GotoLabel, j);
-			if (streq(label->name, fixup->label_name)) {
-				fixup->instr->u.target_block = label->block;
-				break;
-			}
-		}
-		assert(fixup->instr->u.target_block != NULL);
+		ir_gen_function(builder, &env, global,
+				inline_function->function_type, &inline_function->function_def);
+		global->only_for_inlining = true;
 	}
 
 	IrGlobal *first_global =
@@ -1827,6 +1849,7 @@ void ir_gen_toplevel(IrBuilder *builder, ASTToplevel *toplevel)
 	ARRAY_REMOVE(&builder->trans_unit->globals, IrGlobal *, 0);
 
 	pool_free(&env.type_env.pool);
+	array_free(&env.inline_functions);
 	array_free(&env.goto_labels);
 	array_free(&env.goto_fixups);
 	array_free(&env.type_env.struct_types);
@@ -1909,6 +1932,179 @@ static void add_decl_to_scope(IrBuilder *builder, Env *env, ASTDecl *decl)
 	}
 }
 
+// Runs of at least this many cases are lowered to a jump table, as long as
+// at least 1 in MAX_JUMP_TABLE_SPARSENESS of the table's entries is a case
+// rather than the default.
+#define MIN_JUMP_TABLE_CASES 4
+#define MAX_JUMP_TABLE_SPARSENESS 3
+#define MAX_JUMP_TABLE_SIZE 4096
+
+// Below this many clusters we just test them in turn rather than splitting.
+#define MAX_LINEAR_SEARCH_CLUSTERS 3
+
+typedef struct SwitchKey
+{
+	// The case value, biased so that comparing keys as unsigned integers
+	// orders them the same way as comparing values in the switch's type.
+	// Differences between keys are the same as differences between values.
+	u64 key;
+	u64 value;
+	IrBlock *block;
+} SwitchKey;
+
+// Either a single case, or a run of cases that gets a jump table.
+typedef struct CaseCluster
+{
+	u32 first_key;
+	u32 num_keys;
+} CaseCluster;
+
+typedef struct SwitchLowering
+{
+	IrValue value;
+	bool is_signed;
+	IrBlock *default_block;
+
+	SwitchKey *keys;
+	Array(CaseCluster) clusters;
+	Array(IrBlock *) dispatch_blocks;
+} SwitchLowering;
+
+static int compare_switch_keys(const void *a, const void *b)
+{
+	u64 x = ((SwitchKey *)a)->key, y = ((SwitchKey *)b)->key;
+	if (x < y) return -1;
+	if (x == y) return 0;
+	return 1;
+}
+
+static IrBlock *add_dispatch_block(IrBuilder *builder,
+		SwitchLowering *lowering, char *name)
+{
+	IrBlock *block = pool_alloc(&builder->trans_unit->pool, sizeof *block);
+	block_init(block, name, builder->current_function->blocks.size
+			+ lowering->dispatch_blocks.size);
+	*ARRAY_APPEND(&lowering->dispatch_blocks, IrBlock *) = block;
+
+	return block;
+}
+
+// Greedily grows each cluster for as long as the table stays dense enough.
+// Clusters that end up too small for a jump table are split back into single
+// cases.
+static void find_case_clusters(SwitchLowering *lowering, u32 num_keys)
+{
+	SwitchKey *keys = lowering->keys;
+
+	u32 first = 0;
+	while (first < num_keys) {
+		u32 end = first + 1;
+		while (end < num_keys) {
+			u64 table_size = keys[end].key - keys[first].key + 1;
+			if (table_size > MAX_JUMP_TABLE_SIZE
+					|| table_size > MAX_JUMP_TABLE_SPARSENESS
+						* (u64)(end - first + 1)) {
+				break;
+			}
+
+			end++;
+		}
+
+		if (end - first >= MIN_JUMP_TABLE_CASES) {
+			CaseCluster *cluster = ARRAY_APPEND(&lowering->clusters, CaseCluster);
+			cluster->first_key = first;
+			cluster->num_keys = end - first;
+			first = end;
+		} else {
+			CaseCluster *cluster = ARRAY_APPEND(&lowering->clusters, CaseCluster);
+			cluster->first_key = first;
+			cluster->num_keys = 1;
+			first++;
+		}
+	}
+}
+
+// Jumps to the case in "cluster" that matches the switch value, or to
+// "fail_block" if the value is outside the cluster.
+static void ir_gen_case_cluster(IrBuilder *builder, SwitchLowering *lowering,
+		CaseCluster *cluster, IrBlock *fail_block)
+{
+	IrValue value = lowering->value;
+	SwitchKey *keys = lowering->keys + cluster->first_key;
+
+	if (cluster->num_keys == 1) {
+		IrValue cmp = build_cmp(builder, CMP_EQ, value,
+				value_const(value.type, keys[0].value));
+		build_cond(builder, cmp, keys[0].block, fail_block);
+		return;
+	}
+
+	// Values in the cluster's range without a case of their own go straight
+	// to the default, since no other cluster can match them either.
+	u64 last_entry = keys[cluster->num_keys - 1].key - keys[0].key;
+	IrValue index = build_binary_instr(builder, OP_SUB, value,
+			value_const(value.type, keys[0].value));
+	IrValue in_range = build_cmp(builder, CMP_ULTE, index,
+			value_const(value.type, last_entry));
+
+	IrBlock *table_block = add_dispatch_block(builder, lowering, "switch.table");
+	build_cond(builder, in_range, table_block, fail_block);
+	builder->current_block = table_block;
+
+	IrType index_type = { .t = IR_INT, .u.bit_width = 64 };
+	if (value.type.u.bit_width != 64)
+		index = build_type_instr(builder, OP_ZEXT, index, index_type);
+
+	u32 num_targets = last_entry + 1;
+	IrBlock **targets = pool_alloc(&builder->trans_unit->pool,
+			num_targets * sizeof *targets);
+	for (u32 i = 0; i < num_targets; i++)
+		targets[i] = lowering->default_block;
+	for (u32 i = 0; i < cluster->num_keys; i++)
+		targets[keys[i].key - keys[0].key] = keys[i].block;
+
+	build_jump_table(builder, index, num_targets, targets);
+}
+
+// Emits a balanced binary search over the clusters, so that dispatch costs
+// O(log n) compares rather than one per case.
+static void ir_gen_case_clusters(IrBuilder *builder, SwitchLowering *lowering,
+		u32 first_cluster, u32 num_clusters)
+{
+	CaseCluster *clusters =
+		ARRAY_REF(&lowering->clusters, CaseCluster, first_cluster);
+
+	if (num_clusters <= MAX_LINEAR_SEARCH_CLUSTERS) {
+		for (u32 i = 0; i < num_clusters; i++) {
+			IrBlock *next = i == num_clusters - 1
+				? lowering->default_block
+				: add_dispatch_block(builder, lowering, "switch.cmp");
+			ir_gen_case_cluster(builder, lowering, clusters + i, next);
+			builder->current_block = next;
+		}
+
+		return;
+	}
+
+	u32 half = num_clusters / 2;
+	SwitchKey *pivot = lowering->keys + clusters[half].first_key;
+	IrValue value = lowering->value;
+	IrValue less = build_cmp(builder,
+			lowering->is_signed ? CMP_SLT : CMP_ULT,
+			value,
+			value_const(value.type, pivot->value));
+
+	IrBlock *lower = add_dispatch_block(builder, lowering, "switch.lower");
+	IrBlock *upper = add_dispatch_block(builder, lowering, "switch.upper");
+	build_cond(builder, less, lower, upper);
+
+	builder->current_block = lower;
+	ir_gen_case_clusters(builder, lowering, first_cluster, half);
+	builder->current_block = upper;
+	ir_gen_case_clusters(builder, lowering,
+			first_cluster + half, num_clusters - half);
+}
+
 static void ir_gen_statement(IrBuilder *builder, Env *env, ASTStatement *statement)
 {
 	switch (statement->t) {
@@ -2040,40 +2236,70 @@ static void ir_gen_statement(IrBuilder *builder, Env *env, ASTStatement *stateme
 			ir_gen_expr(builder, env, statement->u.expr_and_statement.expr, RVALUE_CONTEXT);
 		assert(switch_value.ctype->t == INTEGER_TYPE);
 
-		i32 default_index = -1;
+		// The controlling expression undergoes the integer promotions.
+		if (rank(switch_value.ctype) < rank(&env->type_env.int_type)) {
+			switch_value = convert_type(builder, switch_value,
+					&env->type_env.int_type);
+		}
+
+		u32 bit_width = switch_value.value.type.u.bit_width;
+		u64 mask = bit_width == 64 ? ~0ULL : (1ULL << bit_width) - 1;
+		bool is_signed = switch_value.ctype->u.integer.is_signed;
 
+		SwitchLowering lowering;
+		lowering.value = switch_value.value;
+		lowering.is_signed = is_signed;
+		lowering.default_block = after;
+		lowering.keys = malloc(env->case_labels.size * sizeof *lowering.keys);
+		ARRAY_INIT(&lowering.clusters, CaseCluster, 8);
+		ARRAY_INIT(&lowering.dispatch_blocks, IrBlock *, 8);
+
+		u32 num_keys = 0;
 		for (u32 i = 0; i < env->case_labels.size; i++) {
 			SwitchCase *label = ARRAY_REF(&env->case_labels, SwitchCase, i);
 			if (label->is_default) {
-				default_index = i;
-			} else {
-				IrBlock *next =
-					pool_alloc(&builder->trans_unit->pool, sizeof *next);
-				block_init(next, "switch.cmp",
-						builder->current_function->blocks.size);
-
-				IrValue cmp = build_cmp(builder,
-						CMP_EQ,
-						switch_value.value,
-						value_const(switch_value.value.type,
-							label->value->u.integer));
-				build_cond(builder, cmp, label->block, next);
-				builder->current_block = next;
-
-				// @TODO: Shift them all down at once rather than one-by-one.
-				*ARRAY_INSERT(&builder->current_function->blocks,
-						IrBlock *, before_body) = next;
-				before_body++;
+				lowering.default_block = label->block;
+				continue;
+			}
+
+			SwitchKey *key = lowering.keys + num_keys++;
+			key->value = label->value->u.integer & mask;
+			key->block = label->block;
+
+			key->key = key->value;
+			if (is_signed) {
+				// Sign-extend to 64 bits, then flip the sign bit so that
+				// negative values come before positive ones.
+				if (bit_width != 64 && (key->key >> (bit_width - 1)) != 0)
+					key->key |= ~mask;
+				key->key ^= 1ULL << 63;
 			}
 		}
+		qsort(lowering.keys, num_keys, sizeof *lowering.keys, compare_switch_keys);
 
-		if (default_index == -1) {
-			build_branch(builder, after);
+		find_case_clusters(&lowering, num_keys);
+		if (lowering.clusters.size == 0) {
+			build_branch(builder, lowering.default_block);
 		} else {
-			SwitchCase *default_case =
-				ARRAY_REF(&env->case_labels, SwitchCase, default_index);
-			build_branch(builder, default_case->block);
+			ir_gen_case_clusters(builder, &lowering, 0, lowering.clusters.size);
 		}
+
+		// Put the dispatch blocks between the switch entry and the body.
+		Array(IrBlock *) *blocks = &builder->current_function->blocks;
+		u32 num_dispatch_blocks = lowering.dispatch_blocks.size;
+		ARRAY_ENSURE_ROOM(blocks, IrBlock *, num_dispatch_blocks);
+		memmove(ARRAY_REF(blocks, IrBlock *, before_body + num_dispatch_blocks),
+				ARRAY_REF(blocks, IrBlock *, before_body),
+				(blocks->size - before_body) * sizeof(IrBlock *));
+		memcpy(ARRAY_REF(blocks, IrBlock *, before_body),
+				lowering.dispatch_blocks.elements,
+				num_dispatch_blocks * sizeof(IrBlock *));
+		blocks->size += num_dispatch_blocks;
+
+		free(lowering.keys);
+		array_free(&lowering.clusters);
+		array_free(&lowering.dispatch_blocks);
+
 		builder->current_block = after;
 
 		env->break_target = prev_break_target;
@@ -2633,6 +2859,16 @@ static Term ir_gen_binary_operator(IrBuilder *builder, Env *env, Term left,
 
 	do_arithmetic_conversions(builder, &left, &right);
 
+	// Like ir_gen_cmp, callers always pass the signed ops, and we pick the
+	// unsigned ones based on the type after conversion.
+	if (left.ctype->t == INTEGER_TYPE && !left.ctype->u.integer.is_signed) {
+		switch (ir_op) {
+		case OP_DIV: ir_op = OP_UDIV; break;
+		case OP_MOD: ir_op = OP_UMOD; break;
+		default: break;
+		}
+	}
+
 	CType *result_type = left.ctype;
 	IrValue value = build_binary_instr(builder, ir_op, left.value, right.value);
 	return (Term) { .ctype = result_type, .value = value };
@@ -0,0 +1,1606 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "flags.h"
+#include "ir.h"
+#include "ir_opt.h"
+#include "misc.h"
+#include "pool.h"
+
+static bool is_terminator(IrInstr *instr)
+{
+	switch (instr->op) {
+	case OP_BRANCH: case OP_COND: case OP_JUMP_TABLE: case OP_RET:
+	case OP_RET_VOID:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static IrInstr *block_terminator(IrBlock *block)
+{
+	assert(block->instrs.size != 0);
+	IrInstr *terminator = *ARRAY_LAST(&block->instrs, IrInstr *);
+	assert(is_terminator(terminator));
+
+	return terminator;
+}
+
+// A jump table can list the same block more than once, so callers that care
+// about distinct edges have to skip duplicates themselves.
+static u32 num_successors(IrBlock *block)
+{
+	IrInstr *terminator = block_terminator(block);
+	switch (terminator->op) {
+	case OP_BRANCH: return 1;
+	case OP_COND: return 2;
+	case OP_JUMP_TABLE: return terminator->u.jump_table.num_targets;
+	default: return 0;
+	}
+}
+
+// Returns a pointer so that passes can redirect the edge in place.
+static IrBlock **successor(IrBlock *block, u32 index)
+{
+	IrInstr *terminator = block_terminator(block);
+	switch (terminator->op) {
+	case OP_BRANCH:
+		assert(index == 0);
+		return &terminator->u.target_block;
+	case OP_COND:
+		assert(index < 2);
+		return index == 0
+			? &terminator->u.cond.then_block
+			: &terminator->u.cond.else_block;
+	case OP_JUMP_TABLE:
+		assert(index < terminator->u.jump_table.num_targets);
+		return terminator->u.jump_table.targets + index;
+	default:
+		UNREACHABLE;
+	}
+}
+
+static bool block_has_phis(IrBlock *block)
+{
+	return block->instrs.size != 0
+		&& (*ARRAY_REF(&block->instrs, IrInstr *, 0))->op == OP_PHI;
+}
+
+typedef struct CfgNode
+{
+	Array(u32) preds;
+	u32 idom;
+	Array(u32) dom_children;
+	Array(u32) frontier;
+} CfgNode;
+
+// Blocks are referred to by index in function->blocks. This is only valid
+// after canonicalise_cfg, which makes each block's id equal to its index.
+typedef struct Cfg
+{
+	IrFunction *function;
+	u32 num_nodes;
+	CfgNode *nodes;
+} Cfg;
+
+typedef struct DfsFrame
+{
+	IrBlock *block;
+	u32 succs_left;
+} DfsFrame;
+
+// Puts the CFG of "function" into the shape that the passes in this file
+// expect:
+//  * Every OP_LOCAL is in the entry block. They don't generate any code, and
+//    ir_gen can put them in unreachable blocks (e.g. a declaration before the
+//    first case of a switch) even though they're used elsewhere.
+//  * Every block ends in exactly one terminator. ir_gen emits whatever
+//    follows a "return" or "break" into the same block, but it can never run.
+//  * Blocks that are unreachable from the entry block are removed.
+//  * Blocks are in reverse postorder, so every block comes after all of its
+//    dominators, and each block's id is its index in function->blocks.
+static void canonicalise_cfg(IrFunction *function)
+{
+	Array(IrBlock *) *blocks = &function->blocks;
+	u32 num_blocks = blocks->size;
+
+	IrBlock *entry = *ARRAY_REF(blocks, IrBlock *, 0);
+	Array(IrInstr *) entry_instrs;
+	ARRAY_INIT(&entry_instrs, IrInstr *, entry->instrs.size);
+	for (u32 i = 0; i < num_blocks; i++) {
+		Array(IrInstr *) *instrs = &(*ARRAY_REF(blocks, IrBlock *, i))->instrs;
+
+		u32 out_index = 0;
+		for (u32 j = 0; j < instrs->size; j++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, j);
+			if (instr->op == OP_LOCAL)
+				*ARRAY_APPEND(&entry_instrs, IrInstr *) = instr;
+			else
+				*ARRAY_REF(instrs, IrInstr *, out_index++) = instr;
+		}
+		instrs->size = out_index;
+	}
+	ARRAY_APPEND_ELEMS(&entry_instrs, IrInstr *,
+			entry->instrs.size, entry->instrs.elements);
+	array_free(&entry->instrs);
+	entry->instrs = entry_instrs;
+
+	for (u32 i = 0; i < num_blocks; i++) {
+		IrBlock *block = *ARRAY_REF(blocks, IrBlock *, i);
+		block->id = i;
+
+		Array(IrInstr *) *instrs = &block->instrs;
+		for (u32 j = 0; j < instrs->size; j++) {
+			if (is_terminator(*ARRAY_REF(instrs, IrInstr *, j))) {
+				instrs->size = j + 1;
+				break;
+			}
+		}
+
+		IrInstr *terminator = block_terminator(block);
+		if (terminator->op == OP_COND
+				&& terminator->u.cond.then_block == terminator->u.cond.else_block) {
+			IrBlock *target = terminator->u.cond.then_block;
+			terminator->op = OP_BRANCH;
+			terminator->u.target_block = target;
+		}
+	}
+
+	bool *visited = calloc(num_blocks, sizeof *visited);
+	Array(IrBlock *) postorder;
+	ARRAY_INIT(&postorder, IrBlock *, num_blocks);
+	Array(DfsFrame) stack;
+	ARRAY_INIT(&stack, DfsFrame, 16);
+
+	visited[entry->id] = true;
+	DfsFrame *entry_frame = ARRAY_APPEND(&stack, DfsFrame);
+	entry_frame->block = entry;
+	entry_frame->succs_left = num_successors(entry);
+
+	while (stack.size != 0) {
+		DfsFrame *top = ARRAY_LAST(&stack, DfsFrame);
+		if (top->succs_left == 0) {
+			*ARRAY_APPEND(&postorder, IrBlock *) = top->block;
+			stack.size--;
+			continue;
+		}
+
+		// We visit successors last to first so that, in reverse postorder,
+		// the "then" side of a conditional comes before the "else" side.
+		IrBlock *succ = *successor(top->block, --top->succs_left);
+		if (!visited[succ->id]) {
+			visited[succ->id] = true;
+			DfsFrame *frame = ARRAY_APPEND(&stack, DfsFrame);
+			frame->block = succ;
+			frame->succs_left = num_successors(succ);
+		}
+	}
+
+	for (u32 i = 0; i < num_blocks; i++) {
+		if (!visited[i])
+			array_free(&(*ARRAY_REF(blocks, IrBlock *, i))->instrs);
+	}
+
+	array_clear(blocks);
+	for (i32 i = postorder.size - 1; i >= 0; i--) {
+		IrBlock *block = *ARRAY_REF(&postorder, IrBlock *, i);
+		block->id = blocks->size;
+		*ARRAY_APPEND(blocks, IrBlock *) = block;
+	}
+
+	array_free(&stack);
+	array_free(&postorder);
+	free(visited);
+}
+
+static void build_cfg(IrFunction *function, Cfg *cfg)
+{
+	Array(IrBlock *) *blocks = &function->blocks;
+
+	cfg->function = function;
+	cfg->num_nodes = blocks->size;
+	cfg->nodes = malloc(cfg->num_nodes * sizeof *cfg->nodes);
+	for (u32 i = 0; i < cfg->num_nodes; i++) {
+		CfgNode *node = cfg->nodes + i;
+		ARRAY_INIT(&node->preds, u32, 2);
+		node->dom_children = EMPTY_ARRAY;
+		node->frontier = EMPTY_ARRAY;
+	}
+
+	for (u32 i = 0; i < cfg->num_nodes; i++) {
+		IrBlock *block = *ARRAY_REF(blocks, IrBlock *, i);
+		u32 num_succs = num_successors(block);
+		for (u32 j = 0; j < num_succs; j++) {
+			Array(u32) *preds = &cfg->nodes[(*successor(block, j))->id].preds;
+
+			// Any duplicate edge from this block would be the last pred added.
+			if (preds->size == 0 || *ARRAY_LAST(preds, u32) != i)
+				*ARRAY_APPEND(preds, u32) = i;
+		}
+	}
+
+	// ir_gen always starts a new block for loops and labels, so nothing can
+	// branch back to the entry block. This means it never needs phis.
+	assert(cfg->nodes[0].preds.size == 0);
+}
+
+static void free_cfg(Cfg *cfg)
+{
+	for (u32 i = 0; i < cfg->num_nodes; i++) {
+		CfgNode *node = cfg->nodes + i;
+		array_free(&node->preds);
+		if (ARRAY_IS_VALID(&node->dom_children))
+			array_free(&node->dom_children);
+		if (ARRAY_IS_VALID(&node->frontier))
+			array_free(&node->frontier);
+	}
+
+	free(cfg->nodes);
+}
+
+static IrBlock *cfg_block(Cfg *cfg, u32 index)
+{
+	return *ARRAY_REF(&cfg->function->blocks, IrBlock *, index);
+}
+
+static i32 pred_index(Cfg *cfg, u32 block, u32 pred)
+{
+	Array(u32) *preds = &cfg->nodes[block].preds;
+	for (u32 i = 0; i < preds->size; i++) {
+		if (*ARRAY_REF(preds, u32, i) == pred)
+			return i;
+	}
+
+	return -1;
+}
+
+// Removing blocks and edges can leave phis with params for blocks which are
+// no longer predecessors, so we drop those params here.
+static void remove_stale_phi_params(Cfg *cfg)
+{
+	for (u32 i = 0; i < cfg->num_nodes; i++) {
+		IrBlock *block = cfg_block(cfg, i);
+
+		Array(IrInstr *) *instrs = &block->instrs;
+		for (u32 j = 0; j < instrs->size; j++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, j);
+			if (instr->op != OP_PHI)
+				break;
+
+			u32 new_arity = 0;
+			for (u32 k = 0; k < instr->u.phi.arity; k++) {
+				IrPhiParam *param = instr->u.phi.params + k;
+
+				bool is_pred = false;
+				Array(u32) *preds = &cfg->nodes[i].preds;
+				for (u32 l = 0; l < preds->size; l++) {
+					if (cfg_block(cfg, *ARRAY_REF(preds, u32, l)) == param->block) {
+						is_pred = true;
+						break;
+					}
+				}
+
+				bool duplicate = false;
+				for (u32 l = 0; l < new_arity; l++) {
+					if (instr->u.phi.params[l].block == param->block) {
+						duplicate = true;
+						break;
+					}
+				}
+
+				if (is_pred && !duplicate)
+					instr->u.phi.params[new_arity++] = *param;
+			}
+
+			instr->u.phi.arity = new_arity;
+			assert(new_arity == cfg->nodes[i].preds.size);
+		}
+	}
+}
+
+static u32 intersect_doms(Cfg *cfg, u32 a, u32 b)
+{
+	while (a != b) {
+		while (a > b)
+			a = cfg->nodes[a].idom;
+		while (b > a)
+			b = cfg->nodes[b].idom;
+	}
+
+	return a;
+}
+
+// This uses the algorithm from Cooper, Harvey and Kennedy 2001, "A Simple,
+// Fast Dominance Algorithm". Since blocks are in reverse postorder we can
+// compare block indices directly instead of keeping separate postorder
+// numbers.
+static void compute_dominators(Cfg *cfg)
+{
+	u32 undefined = cfg->num_nodes;
+	cfg->nodes[0].idom = 0;
+	for (u32 i = 1; i < cfg->num_nodes; i++)
+		cfg->nodes[i].idom = undefined;
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+
+		for (u32 i = 1; i < cfg->num_nodes; i++) {
+			Array(u32) *preds = &cfg->nodes[i].preds;
+
+			u32 new_idom = undefined;
+			for (u32 j = 0; j < preds->size; j++) {
+				u32 pred = *ARRAY_REF(preds, u32, j);
+				if (cfg->nodes[pred].idom == undefined)
+					continue;
+
+				if (new_idom == undefined)
+					new_idom = pred;
+				else
+					new_idom = intersect_doms(cfg, pred, new_idom);
+			}
+
+			assert(new_idom != undefined);
+			if (cfg->nodes[i].idom != new_idom) {
+				cfg->nodes[i].idom = new_idom;
+				changed = true;
+			}
+		}
+	}
+
+	for (u32 i = 0; i < cfg->num_nodes; i++) {
+		CfgNode *node = cfg->nodes + i;
+		ARRAY_INIT(&node->dom_children, u32, 2);
+		ARRAY_INIT(&node->frontier, u32, 2);
+	}
+
+	for (u32 i = 1; i < cfg->num_nodes; i++)
+		*ARRAY_APPEND(&cfg->nodes[cfg->nodes[i].idom].dom_children, u32) = i;
+
+	for (u32 i = 0; i < cfg->num_nodes; i++) {
+		CfgNode *node = cfg->nodes + i;
+		if (node->preds.size < 2)
+			continue;
+
+		for (u32 j = 0; j < node->preds.size; j++) {
+			u32 runner = *ARRAY_REF(&node->preds, u32, j);
+			while (runner != node->idom) {
+				Array(u32) *frontier = &cfg->nodes[runner].frontier;
+
+				// We add to frontiers in increasing order of block index, so
+				// any duplicate would be the last element.
+				if (frontier->size == 0 || *ARRAY_LAST(frontier, u32) != i)
+					*ARRAY_APPEND(frontier, u32) = i;
+
+				runner = cfg->nodes[runner].idom;
+			}
+		}
+	}
+}
+
+static bool dominates(Cfg *cfg, u32 a, u32 b)
+{
+	while (b > a)
+		b = cfg->nodes[b].idom;
+
+	return a == b;
+}
+
+typedef struct PromotableLocal
+{
+	IrInstr *instr;
+	bool escapes;
+
+	// Blocks containing a store to the local, and blocks containing a load
+	// that isn't preceded by a store in the same block.
+	Array(u32) def_blocks;
+	Array(u32) upward_exposed_blocks;
+
+	// The current reaching definition is the last element. Only used while
+	// renaming.
+	Array(IrValue) values;
+} PromotableLocal;
+
+typedef struct InsertedPhi
+{
+	IrInstr *instr;
+	u32 local;
+} InsertedPhi;
+
+typedef struct Mem2Reg
+{
+	TransUnit *trans_unit;
+	Cfg *cfg;
+
+	Array(PromotableLocal) locals;
+	// Indexed by instr id. -1 for instrs that aren't promotable locals.
+	i32 *local_indices;
+	u32 num_instr_ids;
+	// Indexed by the instr id of the promoted loads.
+	IrValue *load_replacements;
+
+	// One Array(InsertedPhi) per block.
+	Array(InsertedPhi) *block_phis;
+	// The locals we pushed a new value for, so we can pop them once we've
+	// finished with a subtree of the dominator tree.
+	Array(u32) value_log;
+} Mem2Reg;
+
+static i32 promoted_local_index(Mem2Reg *m2r, IrValue value)
+{
+	if (value.t != IR_VALUE_INSTR || value.u.instr->id >= m2r->num_instr_ids)
+		return -1;
+
+	i32 index = m2r->local_indices[value.u.instr->id];
+	if (index == -1
+			|| ARRAY_REF(&m2r->locals, PromotableLocal, index)->escapes) {
+		return -1;
+	}
+
+	return index;
+}
+
+static bool is_promoted_load(Mem2Reg *m2r, IrInstr *instr)
+{
+	return instr->op == OP_LOAD
+		&& promoted_local_index(m2r, instr->u.load.pointer) != -1;
+}
+
+static bool is_promoted_store(Mem2Reg *m2r, IrInstr *instr)
+{
+	return instr->op == OP_STORE
+		&& promoted_local_index(m2r, instr->u.binary_op.arg1) != -1;
+}
+
+static IrValue resolve_value(Mem2Reg *m2r, IrValue value)
+{
+	if (value.t == IR_VALUE_INSTR && is_promoted_load(m2r, value.u.instr))
+		return m2r->load_replacements[value.u.instr->id];
+
+	return value;
+}
+
+static IrValue current_value(Mem2Reg *m2r, u32 local_index)
+{
+	PromotableLocal *local = ARRAY_REF(&m2r->locals, PromotableLocal, local_index);
+	if (local->values.size == 0) {
+		// Reading an uninitialised local is undefined behaviour, so any value
+		// is as good as any other.
+		return value_const(local->instr->u.local.type, 0);
+	}
+
+	return *ARRAY_LAST(&local->values, IrValue);
+}
+
+static void push_value(Mem2Reg *m2r, u32 local_index, IrValue value)
+{
+	PromotableLocal *local = ARRAY_REF(&m2r->locals, PromotableLocal, local_index);
+	*ARRAY_APPEND(&local->values, IrValue) = value;
+	*ARRAY_APPEND(&m2r->value_log, u32) = local_index;
+}
+
+static void rename_block(Mem2Reg *m2r, u32 block_index)
+{
+	Cfg *cfg = m2r->cfg;
+	IrBlock *block = cfg_block(cfg, block_index);
+	u32 value_log_start = m2r->value_log.size;
+
+	Array(InsertedPhi) *phis = m2r->block_phis + block_index;
+	for (u32 i = 0; i < phis->size; i++) {
+		InsertedPhi *phi = ARRAY_REF(phis, InsertedPhi, i);
+		push_value(m2r, phi->local, value_instr(phi->instr));
+	}
+
+	Array(IrInstr *) *instrs = &block->instrs;
+	u32 out_index = 0;
+	for (u32 i = 0; i < instrs->size; i++) {
+		IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, i);
+
+		if (instr->op == OP_LOCAL
+				&& promoted_local_index(m2r, value_instr(instr)) != -1) {
+			continue;
+		} else if (is_promoted_load(m2r, instr)) {
+			i32 local_index = promoted_local_index(m2r, instr->u.load.pointer);
+			m2r->load_replacements[instr->id] = current_value(m2r, local_index);
+			continue;
+		} else if (is_promoted_store(m2r, instr)) {
+			i32 local_index = promoted_local_index(m2r, instr->u.binary_op.arg1);
+			push_value(m2r, local_index,
+					resolve_value(m2r, instr->u.binary_op.arg2));
+			continue;
+		}
+
+		*ARRAY_REF(instrs, IrInstr *, out_index++) = instr;
+	}
+	instrs->size = out_index;
+
+	u32 num_succs = num_successors(block);
+	for (u32 i = 0; i < num_succs; i++) {
+		u32 succ = (*successor(block, i))->id;
+		i32 param_index = pred_index(cfg, succ, block_index);
+		assert(param_index != -1);
+
+		Array(InsertedPhi) *succ_phis = m2r->block_phis + succ;
+		for (u32 j = 0; j < succ_phis->size; j++) {
+			InsertedPhi *phi = ARRAY_REF(succ_phis, InsertedPhi, j);
+			IrPhiParam *param = phi->instr->u.phi.params + param_index;
+			param->block = block;
+			param->value = current_value(m2r, phi->local);
+		}
+	}
+
+	Array(u32) *children = &cfg->nodes[block_index].dom_children;
+	for (u32 i = 0; i < children->size; i++)
+		rename_block(m2r, *ARRAY_REF(children, u32, i));
+
+	while (m2r->value_log.size != value_log_start) {
+		u32 local_index = *ARRAY_POP(&m2r->value_log, u32);
+		PromotableLocal *local =
+			ARRAY_REF(&m2r->locals, PromotableLocal, local_index);
+		local->values.size--;
+	}
+}
+
+static void find_promotable_locals(Mem2Reg *m2r)
+{
+	Cfg *cfg = m2r->cfg;
+
+	for (u32 i = 0; i < cfg->num_nodes; i++) {
+		Array(IrInstr *) *instrs = &cfg_block(cfg, i)->instrs;
+		for (u32 j = 0; j < instrs->size; j++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, j);
+			if (instr->op != OP_LOCAL)
+				continue;
+
+			IrType type = instr->u.local.type;
+			if (type.t != IR_INT && type.t != IR_POINTER)
+				continue;
+
+			m2r->local_indices[instr->id] = m2r->locals.size;
+			PromotableLocal *local = ARRAY_APPEND(&m2r->locals, PromotableLocal);
+			local->instr = instr;
+			local->escapes = false;
+			ARRAY_INIT(&local->def_blocks, u32, 2);
+			ARRAY_INIT(&local->upward_exposed_blocks, u32, 2);
+			ARRAY_INIT(&local->values, IrValue, 4);
+		}
+	}
+
+	// Any use of a local other than as the address of a load or store of the
+	// local's own type means that its address might escape, so we have to
+	// leave it in memory.
+	Array(IrValue *) operands;
+	ARRAY_INIT(&operands, IrValue *, 4);
+	for (u32 i = 0; i < cfg->num_nodes; i++) {
+		Array(IrInstr *) *instrs = &cfg_block(cfg, i)->instrs;
+		for (u32 j = 0; j < instrs->size; j++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, j);
+
+			instr_operands(instr, &operands);
+			for (u32 k = 0; k < operands.size; k++) {
+				IrValue *operand = *ARRAY_REF(&operands, IrValue *, k);
+				i32 local_index = promoted_local_index(m2r, *operand);
+				if (local_index == -1)
+					continue;
+
+				PromotableLocal *local =
+					ARRAY_REF(&m2r->locals, PromotableLocal, local_index);
+				IrType *type = &local->instr->u.local.type;
+
+				bool ok = (instr->op == OP_LOAD
+						&& operand == &instr->u.load.pointer
+						&& ir_type_eq(&instr->u.load.type, type))
+					|| (instr->op == OP_STORE
+						&& operand == &instr->u.binary_op.arg1
+						&& ir_type_eq(&instr->u.binary_op.arg2.type, type));
+				if (!ok)
+					local->escapes = true;
+			}
+		}
+	}
+	array_free(&operands);
+
+	for (u32 i = 0; i < cfg->num_nodes; i++) {
+		Array(IrInstr *) *instrs = &cfg_block(cfg, i)->instrs;
+		for (u32 j = 0; j < instrs->size; j++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, j);
+
+			if (is_promoted_store(m2r, instr)) {
+				u32 local_index =
+					promoted_local_index(m2r, instr->u.binary_op.arg1);
+				PromotableLocal *local =
+					ARRAY_REF(&m2r->locals, PromotableLocal, local_index);
+
+				if (local->def_blocks.size == 0
+						|| *ARRAY_LAST(&local->def_blocks, u32) != i) {
+					*ARRAY_APPEND(&local->def_blocks, u32) = i;
+				}
+			} else if (is_promoted_load(m2r, instr)) {
+				u32 local_index =
+					promoted_local_index(m2r, instr->u.load.pointer);
+				PromotableLocal *local =
+					ARRAY_REF(&m2r->locals, PromotableLocal, local_index);
+
+				bool defined_earlier_in_block = local->def_blocks.size != 0
+					&& *ARRAY_LAST(&local->def_blocks, u32) == i;
+				bool already_recorded = local->upward_exposed_blocks.size != 0
+					&& *ARRAY_LAST(&local->upward_exposed_blocks, u32) == i;
+				if (!defined_earlier_in_block && !already_recorded)
+					*ARRAY_APPEND(&local->upward_exposed_blocks, u32) = i;
+			}
+		}
+	}
+}
+
+static IrInstr *insert_phi(Mem2Reg *m2r, u32 block_index, u32 local_index)
+{
+	IrFunction *function = m2r->cfg->function;
+	IrBlock *block = cfg_block(m2r->cfg, block_index);
+	Array(u32) *preds = &m2r->cfg->nodes[block_index].preds;
+	PromotableLocal *local = ARRAY_REF(&m2r->locals, PromotableLocal, local_index);
+
+	IrInstr *phi = pool_alloc(&m2r->trans_unit->pool, sizeof *phi);
+	phi->id = function->curr_instr_id++;
+	phi->op = OP_PHI;
+	phi->type = local->instr->u.local.type;
+	phi->vreg_number = -1;
+	phi->u.phi.arity = preds->size;
+	phi->u.phi.params = pool_alloc(&m2r->trans_unit->pool,
+			preds->size * sizeof *phi->u.phi.params);
+	for (u32 i = 0; i < preds->size; i++) {
+		IrPhiParam *param = phi->u.phi.params + i;
+		param->block = cfg_block(m2r->cfg, *ARRAY_REF(preds, u32, i));
+		param->value = value_const(phi->type, 0);
+	}
+
+	*ARRAY_INSERT(&block->instrs, IrInstr *, 0) = phi;
+
+	InsertedPhi *inserted = ARRAY_APPEND(m2r->block_phis + block_index, InsertedPhi);
+	inserted->instr = phi;
+	inserted->local = local_index;
+
+	return phi;
+}
+
+// Places phis using iterated dominance frontiers, as in Cytron et al. 1991,
+// "Efficiently Computing Static Single Assignment Form and the Control
+// Dependence Graph". We only place a phi where the local is live on entry to
+// the block (i.e. "pruned" SSA), which saves us from generating lots of phis
+// for locals that are scoped to a loop body.
+static void place_phis(Mem2Reg *m2r)
+{
+	Cfg *cfg = m2r->cfg;
+
+	// As in find_promotable_locals, these hold (local index + 1).
+	u32 *def_stamps = calloc(cfg->num_nodes, sizeof *def_stamps);
+	u32 *live_in_stamps = calloc(cfg->num_nodes, sizeof *live_in_stamps);
+	u32 *phi_stamps = calloc(cfg->num_nodes, sizeof *phi_stamps);
+	u32 *worklist_stamps = calloc(cfg->num_nodes, sizeof *worklist_stamps);
+	Array(u32) worklist;
+	ARRAY_INIT(&worklist, u32, 16);
+
+	for (u32 i = 0; i < m2r->locals.size; i++) {
+		PromotableLocal *local = ARRAY_REF(&m2r->locals, PromotableLocal, i);
+		if (local->escapes)
+			continue;
+
+		u32 stamp = i + 1;
+		for (u32 j = 0; j < local->def_blocks.size; j++)
+			def_stamps[*ARRAY_REF(&local->def_blocks, u32, j)] = stamp;
+
+		// Find the blocks where the local is live on entry, by walking
+		// backwards from each upward-exposed use until we hit a store.
+		array_clear(&worklist);
+		for (u32 j = 0; j < local->upward_exposed_blocks.size; j++) {
+			u32 block = *ARRAY_REF(&local->upward_exposed_blocks, u32, j);
+			live_in_stamps[block] = stamp;
+			*ARRAY_APPEND(&worklist, u32) = block;
+		}
+		while (worklist.size != 0) {
+			u32 block = *ARRAY_POP(&worklist, u32);
+			Array(u32) *preds = &cfg->nodes[block].preds;
+			for (u32 j = 0; j < preds->size; j++) {
+				u32 pred = *ARRAY_REF(preds, u32, j);
+				if (live_in_stamps[pred] != stamp && def_stamps[pred] != stamp) {
+					live_in_stamps[pred] = stamp;
+					*ARRAY_APPEND(&worklist, u32) = pred;
+				}
+			}
+		}
+
+		array_clear(&worklist);
+		for (u32 j = 0; j < local->def_blocks.size; j++) {
+			u32 block = *ARRAY_REF(&local->def_blocks, u32, j);
+			worklist_stamps[block] = stamp;
+			*ARRAY_APPEND(&worklist, u32) = block;
+		}
+		while (worklist.size != 0) {
+			u32 block = *ARRAY_POP(&worklist, u32);
+			Array(u32) *frontier = &cfg->nodes[block].frontier;
+			for (u32 j = 0; j < frontier->size; j++) {
+				u32 frontier_block = *ARRAY_REF(frontier, u32, j);
+				if (phi_stamps[frontier_block] == stamp
+						|| live_in_stamps[frontier_block] != stamp) {
+					continue;
+				}
+
+				insert_phi(m2r, frontier_block, i);
+				phi_stamps[frontier_block] = stamp;
+
+				if (worklist_stamps[frontier_block] != stamp) {
+					worklist_stamps[frontier_block] = stamp;
+					*ARRAY_APPEND(&worklist, u32) = frontier_block;
+				}
+			}
+		}
+	}
+
+	array_free(&worklist);
+	free(def_stamps);
+	free(live_in_stamps);
+	free(phi_stamps);
+	free(worklist_stamps);
+}
+
+// Inserts a block on the edge from "block" to "target", which just branches
+// to "target", and makes the phis in "target" refer to it instead of "block".
+// The caller is responsible for redirecting the edge itself.
+static IrBlock *split_edge(TransUnit *trans_unit, IrFunction *function,
+		IrBlock *block, IrBlock *target)
+{
+	IrBlock *edge_block = pool_alloc(&trans_unit->pool, sizeof *edge_block);
+	block_init(edge_block, target->name, 0);
+
+	IrInstr *branch = pool_alloc(&trans_unit->pool, sizeof *branch);
+	branch->id = function->curr_instr_id++;
+	branch->op = OP_BRANCH;
+	branch->type = (IrType) { .t = IR_VOID };
+	branch->vreg_number = -1;
+	branch->u.target_block = target;
+	*ARRAY_APPEND(&edge_block->instrs, IrInstr *) = branch;
+
+	Array(IrInstr *) *target_instrs = &target->instrs;
+	for (u32 i = 0; i < target_instrs->size; i++) {
+		IrInstr *phi = *ARRAY_REF(target_instrs, IrInstr *, i);
+		if (phi->op != OP_PHI)
+			break;
+
+		for (u32 j = 0; j < phi->u.phi.arity; j++) {
+			if (phi->u.phi.params[j].block == block)
+				phi->u.phi.params[j].block = edge_block;
+		}
+	}
+
+	return edge_block;
+}
+
+// Splits the edges that asm_gen can't attach phi moves to:
+//  * asm_gen emits the moves for phis in the "then" block of a conditional
+//    before the conditional jump, so they also run when we take the "else"
+//    branch. That's harmless unless the "then" block dominates the
+//    conditional, i.e. it's a loop header and we're at the loop latch: then
+//    the phi's old value may still be live on the "else" side, or used by
+//    the condition itself.
+//  * A jump table has nowhere to put per-target moves at all.
+// In both cases the moves get a block of their own.
+static void split_phi_edges(TransUnit *trans_unit, Cfg *cfg)
+{
+	IrFunction *function = cfg->function;
+	Array(IrBlock *) new_blocks;
+	ARRAY_INIT(&new_blocks, IrBlock *, cfg->num_nodes);
+
+	for (u32 i = 0; i < cfg->num_nodes; i++) {
+		IrBlock *block = cfg_block(cfg, i);
+		*ARRAY_APPEND(&new_blocks, IrBlock *) = block;
+
+		IrInstr *terminator = block_terminator(block);
+		if (terminator->op == OP_COND) {
+			IrBlock **targets[] = {
+				&terminator->u.cond.then_block,
+				&terminator->u.cond.else_block,
+			};
+			for (u32 j = 0; j < STATIC_ARRAY_LENGTH(targets); j++) {
+				IrBlock *target = *targets[j];
+				if (!block_has_phis(target) || !dominates(cfg, target->id, i))
+					continue;
+
+				IrBlock *edge_block = split_edge(trans_unit, function, block, target);
+				*targets[j] = edge_block;
+				*ARRAY_APPEND(&new_blocks, IrBlock *) = edge_block;
+			}
+		} else if (terminator->op == OP_JUMP_TABLE) {
+			u32 num_targets = terminator->u.jump_table.num_targets;
+			IrBlock **targets = terminator->u.jump_table.targets;
+			for (u32 j = 0; j < num_targets; j++) {
+				IrBlock *target = targets[j];
+				if (!block_has_phis(target))
+					continue;
+
+				IrBlock *edge_block = split_edge(trans_unit, function, block, target);
+				for (u32 k = j; k < num_targets; k++) {
+					if (targets[k] == target)
+						targets[k] = edge_block;
+				}
+				*ARRAY_APPEND(&new_blocks, IrBlock *) = edge_block;
+			}
+		}
+	}
+
+	array_free(&function->blocks);
+	function->blocks = new_blocks;
+	for (u32 i = 0; i < new_blocks.size; i++)
+		(*ARRAY_REF(&new_blocks, IrBlock *, i))->id = i;
+}
+
+// Promotes scalar locals whose address is never taken into SSA values. Loads
+// are replaced by the reaching store's value, with phis inserted where
+// multiple definitions meet, so that the values can live in registers rather
+// than being reloaded from the stack at every use.
+void promote_locals_to_registers(TransUnit *trans_unit, IrFunction *function)
+{
+	canonicalise_cfg(function);
+
+	Cfg cfg;
+	build_cfg(function, &cfg);
+	remove_stale_phi_params(&cfg);
+	compute_dominators(&cfg);
+
+	Mem2Reg m2r;
+	m2r.trans_unit = trans_unit;
+	m2r.cfg = &cfg;
+	ARRAY_INIT(&m2r.locals, PromotableLocal, 8);
+	m2r.num_instr_ids = function->curr_instr_id;
+	m2r.local_indices = malloc(m2r.num_instr_ids * sizeof *m2r.local_indices);
+	for (u32 i = 0; i < m2r.num_instr_ids; i++)
+		m2r.local_indices[i] = -1;
+	m2r.load_replacements =
+		malloc(m2r.num_instr_ids * sizeof *m2r.load_replacements);
+	m2r.block_phis = malloc(cfg.num_nodes * sizeof *m2r.block_phis);
+	for (u32 i = 0; i < cfg.num_nodes; i++)
+		ARRAY_INIT(m2r.block_phis + i, InsertedPhi, 1);
+	ARRAY_INIT(&m2r.value_log, u32, 16);
+
+	find_promotable_locals(&m2r);
+	place_phis(&m2r);
+	rename_block(&m2r, 0);
+
+	// Now that every promoted load has a replacement, rewrite the remaining
+	// uses of them.
+	Array(IrValue *) operands;
+	ARRAY_INIT(&operands, IrValue *, 4);
+	for (u32 i = 0; i < cfg.num_nodes; i++) {
+		Array(IrInstr *) *instrs = &cfg_block(&cfg, i)->instrs;
+		for (u32 j = 0; j < instrs->size; j++) {
+			instr_operands(*ARRAY_REF(instrs, IrInstr *, j), &operands);
+			for (u32 k = 0; k < operands.size; k++) {
+				IrValue *operand = *ARRAY_REF(&operands, IrValue *, k);
+				*operand = resolve_value(&m2r, *operand);
+			}
+		}
+	}
+	array_free(&operands);
+
+	split_phi_edges(trans_unit, &cfg);
+
+	for (u32 i = 0; i < m2r.locals.size; i++) {
+		PromotableLocal *local = ARRAY_REF(&m2r.locals, PromotableLocal, i);
+		array_free(&local->def_blocks);
+		array_free(&local->upward_exposed_blocks);
+		array_free(&local->values);
+	}
+	array_free(&m2r.locals);
+	for (u32 i = 0; i < cfg.num_nodes; i++)
+		array_free(m2r.block_phis + i);
+	free(m2r.block_phis);
+	array_free(&m2r.value_log);
+	free(m2r.local_indices);
+	free(m2r.load_replacements);
+	free_cfg(&cfg);
+}
+
+// Re-canonicalises the CFG after a pass has removed edges, dropping blocks
+// that became unreachable and phi params for edges that no longer exist.
+static void remove_dead_edges(IrFunction *function)
+{
+	canonicalise_cfg(function);
+
+	Cfg cfg;
+	build_cfg(function, &cfg);
+	remove_stale_phi_params(&cfg);
+	free_cfg(&cfg);
+}
+
+static bool ir_values_equal(IrValue a, IrValue b)
+{
+	if (a.t != b.t)
+		return false;
+
+	switch (a.t) {
+	case IR_VALUE_CONST: return a.u.constant == b.u.constant;
+	case IR_VALUE_ARG: return a.u.arg_index == b.u.arg_index;
+	case IR_VALUE_INSTR: return a.u.instr == b.u.instr;
+	case IR_VALUE_GLOBAL: return a.u.global == b.u.global;
+	}
+
+	UNREACHABLE;
+}
+
+// A phi whose params are all the same value (other than the phi itself, on a
+// loop that doesn't change it) is just that value. This is what makes
+// constants propagate around loops.
+static bool fold_phi(IrInstr *phi, IrValue *result)
+{
+	bool found_value = false;
+	IrValue value;
+	for (u32 i = 0; i < phi->u.phi.arity; i++) {
+		IrValue param = phi->u.phi.params[i].value;
+		if (param.t == IR_VALUE_INSTR && param.u.instr == phi)
+			continue;
+
+		if (!found_value) {
+			value = param;
+			found_value = true;
+		} else if (!ir_values_equal(value, param)) {
+			return false;
+		}
+	}
+
+	if (!found_value)
+		return false;
+
+	*result = value;
+	return true;
+}
+
+// Does one sweep over the function, replacing every instruction that can be
+// folded with its value and making branches on constants unconditional.
+// Returns whether anything changed.
+static bool fold_constants_sweep(IrFunction *function, IrValue *replacements,
+		bool *folded, bool *folded_branch)
+{
+	bool changed = false;
+	Array(IrValue *) operands;
+	ARRAY_INIT(&operands, IrValue *, 4);
+
+	for (u32 i = 0; i < function->blocks.size; i++) {
+		Array(IrInstr *) *instrs =
+			&(*ARRAY_REF(&function->blocks, IrBlock *, i))->instrs;
+
+		u32 out_index = 0;
+		for (u32 j = 0; j < instrs->size; j++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, j);
+
+			instr_operands(instr, &operands);
+			for (u32 k = 0; k < operands.size; k++) {
+				IrValue *operand = *ARRAY_REF(&operands, IrValue *, k);
+				if (operand->t == IR_VALUE_INSTR && folded[operand->u.instr->id])
+					*operand = replacements[operand->u.instr->id];
+			}
+
+			IrValue result;
+			bool foldable = instr->op == OP_PHI
+				? fold_phi(instr, &result)
+				: fold_instr(instr, &result);
+			if (foldable) {
+				replacements[instr->id] = result;
+				folded[instr->id] = true;
+				changed = true;
+				continue;
+			}
+
+			if (instr->op == OP_COND
+					&& instr->u.cond.condition.t == IR_VALUE_CONST) {
+				IrBlock *target = instr->u.cond.condition.u.constant != 0
+					? instr->u.cond.then_block
+					: instr->u.cond.else_block;
+				instr->op = OP_BRANCH;
+				instr->u.target_block = target;
+				*folded_branch = true;
+				changed = true;
+			} else if (instr->op == OP_JUMP_TABLE
+					&& instr->u.jump_table.index.t == IR_VALUE_CONST
+					// An out of range index is caught by the bounds check
+					// before the jump table, so this block is about to
+					// become unreachable once that check is folded.
+					&& instr->u.jump_table.index.u.constant
+						< instr->u.jump_table.num_targets) {
+				u64 index = instr->u.jump_table.index.u.constant;
+				IrBlock *target = instr->u.jump_table.targets[index];
+				instr->op = OP_BRANCH;
+				instr->u.target_block = target;
+				*folded_branch = true;
+				changed = true;
+			}
+
+			*ARRAY_REF(instrs, IrInstr *, out_index++) = instr;
+		}
+		instrs->size = out_index;
+	}
+
+	array_free(&operands);
+	return changed;
+}
+
+// Evaluates instructions whose operands are all constants, and propagates the
+// results to their uses. Conditional branches on constants become
+// unconditional, and any blocks that leaves unreachable are removed.
+void fold_constants(IrFunction *function)
+{
+	IrValue *replacements =
+		malloc(function->curr_instr_id * sizeof *replacements);
+	bool *folded = calloc(function->curr_instr_id, sizeof *folded);
+
+	// Blocks are in reverse postorder, so the only uses we can see before
+	// their definitions are phi params on back edges. Folding one of those
+	// definitions means the phi might be foldable now, so we keep sweeping
+	// until nothing changes. Removing edges can make phis foldable too, as
+	// they lose params.
+	for (;;) {
+		bool folded_branch = false;
+		while (fold_constants_sweep(function, replacements, folded, &folded_branch))
+			;
+		if (!folded_branch)
+			break;
+
+		remove_dead_edges(function);
+	}
+
+	free(replacements);
+	free(folded);
+}
+
+static bool has_side_effects(IrInstr *instr)
+{
+	switch (instr->op) {
+	case OP_STORE: case OP_CALL: case OP_RET: case OP_RET_VOID:
+	case OP_BRANCH: case OP_COND: case OP_JUMP_TABLE:
+	case OP_BUILTIN_VA_START: case OP_BUILTIN_VA_ARG:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Removes instructions whose results are never used and which have no side
+// effects. We mark everything reachable through operands from the
+// instructions with side effects, then sweep away the rest. Unlike removing
+// unused instructions one at a time, this also catches cycles of phis that
+// only use each other.
+void eliminate_dead_code(IrFunction *function)
+{
+	bool *live = calloc(function->curr_instr_id, sizeof *live);
+	Array(IrInstr *) worklist;
+	ARRAY_INIT(&worklist, IrInstr *, 32);
+	Array(IrValue *) operands;
+	ARRAY_INIT(&operands, IrValue *, 4);
+
+	for (u32 i = 0; i < function->blocks.size; i++) {
+		Array(IrInstr *) *instrs =
+			&(*ARRAY_REF(&function->blocks, IrBlock *, i))->instrs;
+		for (u32 j = 0; j < instrs->size; j++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, j);
+			if (has_side_effects(instr)) {
+				live[instr->id] = true;
+				*ARRAY_APPEND(&worklist, IrInstr *) = instr;
+			}
+		}
+	}
+
+	while (worklist.size != 0) {
+		IrInstr *instr = *ARRAY_POP(&worklist, IrInstr *);
+
+		instr_operands(instr, &operands);
+		for (u32 i = 0; i < operands.size; i++) {
+			IrValue *operand = *ARRAY_REF(&operands, IrValue *, i);
+			if (operand->t != IR_VALUE_INSTR || live[operand->u.instr->id])
+				continue;
+
+			live[operand->u.instr->id] = true;
+			*ARRAY_APPEND(&worklist, IrInstr *) = operand->u.instr;
+		}
+	}
+
+	for (u32 i = 0; i < function->blocks.size; i++) {
+		Array(IrInstr *) *instrs =
+			&(*ARRAY_REF(&function->blocks, IrBlock *, i))->instrs;
+
+		u32 out_index = 0;
+		for (u32 j = 0; j < instrs->size; j++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, j);
+			if (live[instr->id])
+				*ARRAY_REF(instrs, IrInstr *, out_index++) = instr;
+		}
+		instrs->size = out_index;
+	}
+
+	array_free(&operands);
+	array_free(&worklist);
+	free(live);
+}
+
+static bool is_scalar_type(IrType type)
+{
+	return type.t == IR_INT || type.t == IR_POINTER;
+}
+
+// Returns whether the function has at most "limit" instructions. We stop
+// counting once we're over, so that checking big functions stays cheap.
+static bool function_size_within(IrFunction *function, u32 limit)
+{
+	u32 size = 0;
+	for (u32 i = 0; i < function->blocks.size; i++) {
+		size += (*ARRAY_REF(&function->blocks, IrBlock *, i))->instrs.size;
+		if (size > limit)
+			return false;
+	}
+
+	return true;
+}
+
+static bool should_inline(IrGlobal *caller, IrInstr *call)
+{
+	IrValue callee_value = call->u.call.callee;
+	if (callee_value.t != IR_VALUE_GLOBAL)
+		return false;
+
+	IrGlobal *callee = callee_value.u.global;
+	if (callee == caller || callee->initializer == NULL)
+		return false;
+	if (callee->linkage != IR_LOCAL_LINKAGE && !callee->is_inline)
+		return false;
+
+	// We only handle arguments and return values that are passed in
+	// registers, so that we can substitute them directly.
+	IrType *type = &callee->type;
+	if (type->u.function.variable_arity
+			|| type->u.function.arity != call->u.call.arity)
+		return false;
+	IrType return_type = *type->u.function.return_type;
+	if (return_type.t != IR_VOID && !is_scalar_type(return_type))
+		return false;
+	for (u32 i = 0; i < call->u.call.arity; i++) {
+		IrType arg_type = type->u.function.arg_types[i];
+		if (!is_scalar_type(arg_type)
+				|| !ir_type_eq(&arg_type, &call->u.call.arg_array[i].type))
+			return false;
+	}
+
+	return function_size_within(&callee->initializer->u.function,
+			flag_inline_limit);
+}
+
+// Makes the phis in "block" that have params for "old_pred" refer to
+// "new_pred" instead.
+static void replace_phi_pred(IrBlock *block, IrBlock *old_pred,
+		IrBlock *new_pred)
+{
+	Array(IrInstr *) *instrs = &block->instrs;
+	for (u32 i = 0; i < instrs->size; i++) {
+		IrInstr *phi = *ARRAY_REF(instrs, IrInstr *, i);
+		if (phi->op != OP_PHI)
+			break;
+
+		for (u32 j = 0; j < phi->u.phi.arity; j++) {
+			if (phi->u.phi.params[j].block == old_pred)
+				phi->u.phi.params[j].block = new_pred;
+		}
+	}
+}
+
+static IrInstr *new_instr(TransUnit *trans_unit, IrFunction *function,
+		IrOp op, IrType type)
+{
+	IrInstr *instr = pool_alloc(&trans_unit->pool, sizeof *instr);
+	instr->id = function->curr_instr_id++;
+	instr->op = op;
+	instr->type = type;
+	instr->vreg_number = -1;
+
+	return instr;
+}
+
+// Replaces the call at "call_index" in "block" with a copy of the callee's
+// body. The instructions after the call are moved to a new block, which the
+// callee's returns branch to, and which is returned so that the caller can
+// look for more calls in it. "result" is set to the value the call returned.
+static IrBlock *inline_call(TransUnit *trans_unit, IrFunction *function,
+		IrBlock *block, u32 call_index, IrValue *result)
+{
+	Pool *pool = &trans_unit->pool;
+	IrInstr *call = *ARRAY_REF(&block->instrs, IrInstr *, call_index);
+	IrFunction *callee =
+		&call->u.call.callee.u.global->initializer->u.function;
+
+	IrBlock *after = pool_alloc(pool, sizeof *after);
+	block_init(after, "inline.after", 0);
+	u32 num_after = block->instrs.size - call_index - 1;
+	ARRAY_APPEND_ELEMS(&after->instrs, IrInstr *, num_after,
+			ARRAY_REF(&block->instrs, IrInstr *, call_index + 1));
+	block->instrs.size = call_index;
+
+	u32 num_succs = num_successors(after);
+	for (u32 i = 0; i < num_succs; i++)
+		replace_phi_pred(*successor(after, i), block, after);
+
+	u32 num_callee_blocks = callee->blocks.size;
+	IrBlock **block_map = malloc(num_callee_blocks * sizeof *block_map);
+	IrInstr **instr_map = malloc(callee->curr_instr_id * sizeof *instr_map);
+	for (u32 i = 0; i < num_callee_blocks; i++) {
+		IrBlock *callee_block = *ARRAY_REF(&callee->blocks, IrBlock *, i);
+		assert(callee_block->id == i);
+
+		IrBlock *clone = pool_alloc(pool, sizeof *clone);
+		block_init(clone, callee_block->name, 0);
+		block_map[i] = clone;
+
+		Array(IrInstr *) *instrs = &callee_block->instrs;
+		for (u32 j = 0; j < instrs->size; j++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, j);
+			IrInstr *instr_clone =
+				new_instr(trans_unit, function, instr->op, instr->type);
+			instr_clone->u = instr->u;
+			instr_map[instr->id] = instr_clone;
+			*ARRAY_APPEND(&clone->instrs, IrInstr *) = instr_clone;
+
+			// Make our own copies of anything the instruction points to
+			// that we're going to rewrite.
+			switch (instr->op) {
+			case OP_CALL: {
+				u32 size = instr->u.call.arity * sizeof(IrValue);
+				instr_clone->u.call.arg_array = pool_alloc(pool, size);
+				memcpy(instr_clone->u.call.arg_array,
+						instr->u.call.arg_array, size);
+				break;
+			}
+			case OP_PHI: {
+				u32 size = instr->u.phi.arity * sizeof(IrPhiParam);
+				instr_clone->u.phi.params = pool_alloc(pool, size);
+				memcpy(instr_clone->u.phi.params, instr->u.phi.params, size);
+				break;
+			}
+			case OP_JUMP_TABLE: {
+				u32 size = instr->u.jump_table.num_targets * sizeof(IrBlock *);
+				instr_clone->u.jump_table.targets = pool_alloc(pool, size);
+				memcpy(instr_clone->u.jump_table.targets,
+						instr->u.jump_table.targets, size);
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+
+	Array(IrPhiParam) returns;
+	ARRAY_INIT(&returns, IrPhiParam, 2);
+	Array(IrValue *) operands;
+	ARRAY_INIT(&operands, IrValue *, 4);
+	for (u32 i = 0; i < num_callee_blocks; i++) {
+		IrBlock *clone = block_map[i];
+		Array(IrInstr *) *instrs = &clone->instrs;
+		for (u32 j = 0; j < instrs->size; j++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, j);
+
+			instr_operands(instr, &operands);
+			for (u32 k = 0; k < operands.size; k++) {
+				IrValue *operand = *ARRAY_REF(&operands, IrValue *, k);
+				if (operand->t == IR_VALUE_INSTR) {
+					*operand = value_instr(instr_map[operand->u.instr->id]);
+				} else if (operand->t == IR_VALUE_ARG) {
+					*operand = call->u.call.arg_array[operand->u.arg_index];
+				}
+			}
+
+			if (instr->op == OP_PHI) {
+				for (u32 k = 0; k < instr->u.phi.arity; k++) {
+					IrPhiParam *param = instr->u.phi.params + k;
+					param->block = block_map[param->block->id];
+				}
+			}
+		}
+
+		IrInstr *terminator = *ARRAY_LAST(instrs, IrInstr *);
+		if (terminator->op == OP_RET || terminator->op == OP_RET_VOID) {
+			if (terminator->op == OP_RET) {
+				*ARRAY_APPEND(&returns, IrPhiParam) = (IrPhiParam) {
+					.block = clone,
+					.value = terminator->u.arg,
+				};
+			}
+
+			terminator->op = OP_BRANCH;
+			terminator->type = (IrType) { .t = IR_VOID };
+			terminator->u.target_block = after;
+		} else {
+			u32 num_succs = num_successors(clone);
+			for (u32 k = 0; k < num_succs; k++) {
+				IrBlock **succ = successor(clone, k);
+				*succ = block_map[(*succ)->id];
+			}
+		}
+	}
+	array_free(&operands);
+
+	IrType return_type = call->type;
+	if (returns.size == 1) {
+		*result = ARRAY_REF(&returns, IrPhiParam, 0)->value;
+	} else if (returns.size > 1) {
+		IrInstr *phi = new_instr(trans_unit, function, OP_PHI, return_type);
+		phi->u.phi.arity = returns.size;
+		phi->u.phi.params =
+			pool_alloc(pool, returns.size * sizeof *phi->u.phi.params);
+		memcpy(phi->u.phi.params, returns.elements,
+				returns.size * sizeof *phi->u.phi.params);
+		*ARRAY_INSERT(&after->instrs, IrInstr *, 0) = phi;
+
+		*result = value_instr(phi);
+	} else if (return_type.t != IR_VOID) {
+		// The callee never returns, so the result can't be used.
+		*result = value_const(return_type, 0);
+	}
+	array_free(&returns);
+
+	IrInstr *branch = new_instr(trans_unit, function, OP_BRANCH,
+			(IrType) { .t = IR_VOID });
+	branch->u.target_block = block_map[0];
+	*ARRAY_APPEND(&block->instrs, IrInstr *) = branch;
+
+	for (u32 i = 0; i < num_callee_blocks; i++)
+		*ARRAY_APPEND(&function->blocks, IrBlock *) = block_map[i];
+	*ARRAY_APPEND(&function->blocks, IrBlock *) = after;
+
+	free(block_map);
+	free(instr_map);
+
+	return after;
+}
+
+// Merges each block that ends in an unconditional branch with its target,
+// if it's the target's only predecessor. Inlining leaves lots of these
+// behind, as each call site gets split into the code before the call, the
+// callee's body, and the code after the call.
+static void merge_blocks(IrFunction *function)
+{
+	Array(IrBlock *) *blocks = &function->blocks;
+	u32 num_blocks = blocks->size;
+
+	// We count a jump table's edge to a block once for each entry, but that
+	// only ever overcounts, which just means we skip a merge.
+	u32 *num_preds = calloc(num_blocks, sizeof *num_preds);
+	for (u32 i = 0; i < num_blocks; i++) {
+		IrBlock *block = *ARRAY_REF(blocks, IrBlock *, i);
+		assert(block->id == i);
+
+		u32 num_succs = num_successors(block);
+		for (u32 j = 0; j < num_succs; j++)
+			num_preds[(*successor(block, j))->id]++;
+	}
+
+	bool *merged = calloc(num_blocks, sizeof *merged);
+	for (u32 i = 0; i < num_blocks; i++) {
+		if (merged[i])
+			continue;
+
+		IrBlock *block = *ARRAY_REF(blocks, IrBlock *, i);
+		for (;;) {
+			IrInstr *terminator = block_terminator(block);
+			if (terminator->op != OP_BRANCH)
+				break;
+
+			IrBlock *target = terminator->u.target_block;
+			if (target == block || num_preds[target->id] != 1
+					|| block_has_phis(target)) {
+				break;
+			}
+
+			block->instrs.size--;
+			ARRAY_APPEND_ELEMS(&block->instrs, IrInstr *,
+					target->instrs.size, target->instrs.elements);
+			u32 num_succs = num_successors(block);
+			for (u32 j = 0; j < num_succs; j++)
+				replace_phi_pred(*successor(block, j), target, block);
+
+			merged[target->id] = true;
+			array_free(&target->instrs);
+		}
+	}
+
+	u32 out_index = 0;
+	for (u32 i = 0; i < num_blocks; i++) {
+		if (merged[i])
+			continue;
+
+		IrBlock *block = *ARRAY_REF(blocks, IrBlock *, i);
+		block->id = out_index;
+		*ARRAY_REF(blocks, IrBlock *, out_index++) = block;
+	}
+	blocks->size = out_index;
+
+	free(num_preds);
+	free(merged);
+}
+
+// Inlines calls to small static and inline functions, so that we don't pay
+// for the call sequence and the caller's values can stay in registers across
+// it. The size limit is set with -finline-limit=. Returns whether anything
+// was inlined.
+static bool inline_calls(TransUnit *trans_unit, IrGlobal *global)
+{
+	IrFunction *function = &global->initializer->u.function;
+	u32 num_call_ids = function->curr_instr_id;
+	IrValue *results = malloc(num_call_ids * sizeof *results);
+	bool *inlined = calloc(num_call_ids, sizeof *inlined);
+	bool inlined_any = false;
+
+	// We don't look for calls in the code we've just inlined, so recursive
+	// functions can't make us inline forever. We do look in the blocks
+	// holding the rest of the code after each call.
+	Array(IrBlock *) worklist;
+	ARRAY_INIT(&worklist, IrBlock *, function->blocks.size);
+	ARRAY_APPEND_ELEMS(&worklist, IrBlock *,
+			function->blocks.size, function->blocks.elements);
+	while (worklist.size != 0) {
+		IrBlock *block = *ARRAY_POP(&worklist, IrBlock *);
+		Array(IrInstr *) *instrs = &block->instrs;
+		for (u32 i = 0; i < instrs->size; i++) {
+			IrInstr *instr = *ARRAY_REF(instrs, IrInstr *, i);
+			if (instr->op != OP_CALL || !should_inline(global, instr))
+				continue;
+
+			IrBlock *after = inline_call(trans_unit, function, block, i,
+					results + instr->id);
+			inlined[instr->id] = true;
+			inlined_any = true;
+			*ARRAY_APPEND(&worklist, IrBlock *) = after;
+			break;
+		}
+	}
+	array_free(&worklist);
+
+	if (inlined_any) {
+		Array(IrValue *) operands;
+		ARRAY_INIT(&operands, IrValue *, 4);
+		for (u32 i = 0; i < function->blocks.size; i++) {
+			Array(IrInstr *) *instrs =
+				&(*ARRAY_REF(&function->blocks, IrBlock *, i))->instrs;
+			for (u32 j = 0; j < instrs->size; j++) {
+				instr_operands(*ARRAY_REF(instrs, IrInstr *, j), &operands);
+				for (u32 k = 0; k < operands.size; k++) {
+					IrValue *operand = *ARRAY_REF(&operands, IrValue *, k);
+
+					// The result of one inlined call can be the result of
+					// another, e.g.: if the callee just returns its argument.
+					while (operand->t == IR_VALUE_INSTR
+							&& operand->u.instr->id < num_call_ids
+							&& inlined[operand->u.instr->id]) {
+						*operand = results[operand->u.instr->id];
+					}
+				}
+			}
+		}
+		array_free(&operands);
+
+		remove_dead_edges(function);
+	}
+
+	free(results);
+	free(inlined);
+
+	return inlined_any;
+}
+
+static void mark_const_references(IrConst *konst)
+{
+	switch (konst->type.t) {
+	case IR_POINTER:
+		if (konst->u.global_pointer != NULL)
+			konst->u.global_pointer->referenced = true;
+		break;
+	case IR_ARRAY:
+		for (u32 i = 0; i < konst->type.u.array.size; i++)
+			mark_const_references(konst->u.array_elems + i);
+		break;
+	case IR_STRUCT:
+		for (u32 i = 0; i < konst->type.u.strukt.num_fields; i++)
+			mark_const_references(konst->u.struct_fields + i);
+		break;
+	default:
+		break;
+	}
+}
+
+// Removes static functions that nothing refers to, which is often the case
+// once all of their calls have been inlined. Inline definitions that are
+// only here for the inliner aren't emitted anyway, but we drop their bodies
+// too.
+static void remove_unreferenced_functions(TransUnit *trans_unit)
+{
+	Array(IrGlobal *) *globals = &trans_unit->globals;
+	for (u32 i = 0; i < globals->size; i++)
+		(*ARRAY_REF(globals, IrGlobal *, i))->referenced = false;
+
+	Array(IrValue *) operands;
+	ARRAY_INIT(&operands, IrValue *, 4);
+	for (u32 i = 0; i < globals->size; i++) {
+		IrGlobal *global = *ARRAY_REF(globals, IrGlobal *, i);
+		if (global->initializer == NULL)
+			continue;
+		if (global->type.t != IR_FUNCTION) {
+			mark_const_references(global->initializer);
+			continue;
+		}
+
+		IrFunction *function = &global->initializer->u.function;
+		for (u32 j = 0; j < function->blocks.size; j++) {
+			Array(IrInstr *) *instrs =
+				&(*ARRAY_REF(&function->blocks, IrBlock *, j))->instrs;
+			for (u32 k = 0; k < instrs->size; k++) {
+				instr_operands(*ARRAY_REF(instrs, IrInstr *, k), &operands);
+				for (u32 l = 0; l < operands.size; l++) {
+					IrValue *operand = *ARRAY_REF(&operands, IrValue *, l);
+					if (operand->t == IR_VALUE_GLOBAL)
+						operand->u.global->referenced = true;
+				}
+			}
+		}
+	}
+	array_free(&operands);
+
+	u32 out_index = 0;
+	for (u32 i = 0; i < globals->size; i++) {
+		IrGlobal *global = *ARRAY_REF(globals, IrGlobal *, i);
+		bool removable = global->type.t == IR_FUNCTION
+			&& global->initializer != NULL
+			&& (global->linkage == IR_LOCAL_LINKAGE || global->only_for_inlining)
+			&& !global->referenced;
+		if (!removable) {
+			*ARRAY_REF(globals, IrGlobal *, out_index++) = global;
+			continue;
+		}
+
+		IrFunction *function = &global->initializer->u.function;
+		for (u32 j = 0; j < function->blocks.size; j++)
+			array_free(&(*ARRAY_REF(&function->blocks, IrBlock *, j))->instrs);
+		array_free(&function->blocks);
+	}
+	globals->size = out_index;
+}
+
+void optimise_trans_unit(TransUnit *trans_unit)
+{
+	Array(IrGlobal *) *globals = &trans_unit->globals;
+	for (u32 i = 0; i < globals->size; i++) {
+		IrGlobal *global = *ARRAY_REF(globals, IrGlobal *, i);
+		if (global->type.t != IR_FUNCTION || global->initializer == NULL)
+			continue;
+
+		IrFunction *function = &global->initializer->u.function;
+		promote_locals_to_registers(trans_unit, function);
+		fold_constants(function);
+		eliminate_dead_code(function);
+	}
+
+	// Every function has been simplified by now, so the sizes we compare
+	// against the inline limit are representative, and we don't inline code
+	// that we'd have deleted anyway. Inlining may expose more constants
+	// (e.g.: constant arguments), so we clean up again afterwards.
+	if (flag_inline_limit != 0) {
+		for (u32 i = 0; i < globals->size; i++) {
+			IrGlobal *global = *ARRAY_REF(globals, IrGlobal *, i);
+			if (global->type.t != IR_FUNCTION || global->initializer == NULL)
+				continue;
+
+			if (inline_calls(trans_unit, global)) {
+				IrFunction *function = &global->initializer->u.function;
+				fold_constants(function);
+				merge_blocks(function);
+				eliminate_dead_code(function);
+			}
+		}
+	}
+
+	remove_unreferenced_functions(trans_unit);
+}
@@ -0,0 +1,12 @@
+#ifndef NAIVE_IR_OPT_H_
+#define NAIVE_IR_OPT_H_
+
+#include "ir.h"
+
+void optimise_trans_unit(TransUnit *trans_unit);
+
+void promote_locals_to_registers(TransUnit *trans_unit, IrFunction *function);
+void fold_constants(IrFunction *function);
+void eliminate_dead_code(IrFunction *function);
+
+#endif
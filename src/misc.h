@@ -23,6 +23,15 @@ typedef  int64_t i64;
 #define UNREACHABLE assert(!"This should never be reached")
 #define UNIMPLEMENTED assert(!"Not implemented")
 
+// Only used for state that must be separate for each translation unit when
+// compiling several at once. Without thread support there's only one thread,
+// so plain globals are fine.
+#ifdef NAIVE_THREADS
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
 #define RUNNING_UNDER_SANITIZER 0
 #ifdef __has_feature
 #if __has_feature(memory_sanitizer) || __has_feature(address_sanitizer)
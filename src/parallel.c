@@ -0,0 +1,134 @@
+// @PORT
+#include <assert.h>
+#include <stdlib.h>
+
+#ifdef NAIVE_THREADS
+#include <pthread.h>
+#endif
+
+#include "parallel.h"
+
+#ifdef NAIVE_THREADS
+
+typedef struct ParallelWork
+{
+	ParallelFunction function;
+	void *context;
+	u32 count;
+
+	pthread_mutex_t lock;
+	u32 next_index;
+} ParallelWork;
+
+// Workers pull indices off a shared counter rather than taking fixed slices,
+// because the work per index can vary a lot, e.g.: a large archive vs. a
+// small object file.
+static void *parallel_worker(void *arg)
+{
+	ParallelWork *work = arg;
+	for (;;) {
+		pthread_mutex_lock(&work->lock);
+		u32 index = work->next_index;
+		if (index < work->count)
+			work->next_index++;
+		pthread_mutex_unlock(&work->lock);
+
+		if (index >= work->count)
+			break;
+
+		work->function(work->context, index);
+	}
+
+	return NULL;
+}
+
+void parallel_for(u32 count, u32 thread_count, ParallelFunction function,
+		void *context)
+{
+	if (thread_count > count)
+		thread_count = count;
+	if (thread_count <= 1) {
+		for (u32 i = 0; i < count; i++)
+			function(context, i);
+		return;
+	}
+
+	ParallelWork work;
+	work.function = function;
+	work.context = context;
+	work.count = count;
+	work.next_index = 0;
+	pthread_mutex_init(&work.lock, NULL);
+
+	// The calling thread does its share of the work too, so we only need
+	// thread_count - 1 extra threads.
+	pthread_t *threads = malloc(sizeof *threads * (thread_count - 1));
+	u32 started = 0;
+	for (; started < thread_count - 1; started++) {
+		if (pthread_create(threads + started, NULL, parallel_worker, &work) != 0)
+			break;
+	}
+
+	parallel_worker(&work);
+
+	for (u32 i = 0; i < started; i++) {
+		int ret = pthread_join(threads[i], NULL);
+		assert(ret == 0);
+	}
+
+	free(threads);
+	pthread_mutex_destroy(&work.lock);
+}
+
+void mutex_init(Mutex *mutex)
+{
+	pthread_mutex_init(&mutex->mutex, NULL);
+}
+
+void mutex_free(Mutex *mutex)
+{
+	pthread_mutex_destroy(&mutex->mutex);
+}
+
+void mutex_lock(Mutex *mutex)
+{
+	pthread_mutex_lock(&mutex->mutex);
+}
+
+void mutex_unlock(Mutex *mutex)
+{
+	pthread_mutex_unlock(&mutex->mutex);
+}
+
+#else
+
+void parallel_for(u32 count, u32 thread_count, ParallelFunction function,
+		void *context)
+{
+	IGNORE(thread_count);
+
+	for (u32 i = 0; i < count; i++)
+		function(context, i);
+}
+
+void mutex_init(Mutex *mutex)
+{
+	IGNORE(mutex);
+}
+
+void mutex_free(Mutex *mutex)
+{
+	IGNORE(mutex);
+}
+
+void mutex_lock(Mutex *mutex)
+{
+	IGNORE(mutex);
+}
+
+void mutex_unlock(Mutex *mutex)
+{
+	IGNORE(mutex);
+}
+
+#endif
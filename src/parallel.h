@@ -0,0 +1,37 @@
+#ifndef NAIVE_PARALLEL_H_
+#define NAIVE_PARALLEL_H_
+
+#include "misc.h"
+
+#ifdef NAIVE_THREADS
+#include <pthread.h>
+#endif
+
+typedef void (*ParallelFunction)(void *context, u32 index);
+
+// Calls function(context, i) for every i in [0, count), using up to
+// thread_count threads. Each index is processed exactly once, but in no
+// particular order, so function must only touch state belonging to its index.
+//
+// When ncc is built without thread support this runs everything on the
+// calling thread, in order.
+void parallel_for(u32 count, u32 thread_count, ParallelFunction function,
+		void *context);
+
+// A lock for state shared between the calls made by parallel_for. Without
+// thread support locking and unlocking do nothing.
+typedef struct Mutex
+{
+#ifdef NAIVE_THREADS
+	pthread_mutex_t mutex;
+#else
+	int unused;
+#endif
+} Mutex;
+
+void mutex_init(Mutex *mutex);
+void mutex_free(Mutex *mutex);
+void mutex_lock(Mutex *mutex);
+void mutex_unlock(Mutex *mutex);
+
+#endif
@@ -2,6 +2,8 @@
 
 #include "pool.h"
 
+THREAD_LOCAL u64 pool_bytes_allocated = 0;
+
 #if RUNNING_UNDER_SANITIZER
 
 void pool_init(Pool *pool, size_t block_size)
@@ -12,6 +14,7 @@ void pool_init(Pool *pool, size_t block_size)
 
 void *pool_alloc(Pool *pool, size_t size)
 {
+	pool_bytes_allocated += size;
 	void *new_ptr = malloc(size);
 	*ARRAY_APPEND(&pool->allocated_pointers, void *) = new_ptr;
 	return new_ptr;
@@ -32,6 +35,7 @@ static void block_init(PoolBlock *block, size_t size)
 {
 	block->used = 0;
 	block->memory = malloc(size);
+	pool_bytes_allocated += size;
 	block->next = NULL;
 }
 
@@ -32,6 +32,10 @@ typedef struct Pool
 
 #endif
 
+// Total bytes ever allocated for pool blocks by this thread, for
+// -ftime-report.
+extern THREAD_LOCAL u64 pool_bytes_allocated;
+
 void pool_init(Pool *pool, size_t block_size);
 void *pool_alloc(Pool *pool, size_t size);
 void pool_free(Pool *pool);
@@ -4,31 +4,191 @@
 #include <stddef.h>
 #include <stdlib.h>
 
+// @PORT
+#include <sys/stat.h>
+
 #include "array.h"
 #include "diagnostics.h"
+#include "hash_table.h"
+#include "include_cache.h"
+#include "pool.h"
+#include "preprocess.h"
 #include "reader.h"
 #include "util.h"
 
+typedef enum PPTokenType
+{
+	PP_TOKEN_IDENT,
+	PP_TOKEN_NUMBER,
+	// String and character literals
+	PP_TOKEN_LITERAL,
+	PP_TOKEN_PUNCT,
+	// A reference to a parameter in a function-like macro's replacement
+	// list. These only appear in macro bodies.
+	PP_TOKEN_PARAM,
+	// Stands in for an empty argument next to '##' while substituting. These
+	// are removed before the result of substitution is used.
+	PP_TOKEN_PLACEMARKER,
+	// Marks the end of the tokens to rescan from an expansion of the macro
+	// PPToken::macro.
+	PP_TOKEN_END_EXPANSION,
+} PPTokenType;
+
+typedef struct PPToken
+{
+	PPTokenType type;
+	// Points into the source for tokens read from a file, and into
+	// PP::expansion_text for tokens created by '#' and '##'.
+	String text;
+	u32 param_index;
+	struct Macro *macro;
+
+	bool whitespace_before;
+	// Set on tokens that are next to tokens from a different macro or
+	// argument, where we may need a space to stop them being read back as
+	// one token.
+	bool avoid_paste;
+	// Set on identifiers naming a macro that we found while rescanning that
+	// macro's expansion. These are never expanded (C99 6.10.3.4.2).
+	bool no_expand;
+} PPToken;
+
 typedef struct Macro
 {
 	String name;
-	char *value;
+	// False once the macro has been #undef'd.
+	bool defined;
+	// Set while we're rescanning an expansion of this macro, so that nested
+	// references to it aren't replaced. Together with PPToken::no_expand,
+	// this acts as the hide set of every token being rescanned, without
+	// needing to store sets on each token.
+	bool disabled;
+	bool function_like;
+	// Lexed once when the macro is defined, so expanding it doesn't need to
+	// read any text.
+	Array(PPToken) body;
 	Array(String) arg_names;
 } Macro;
 
-static Macro *look_up_macro(Array(Macro) *macro_env, String name)
+typedef struct MacroEnv
 {
-	for (u32 i = 0; i < macro_env->size; i++) {
-		Macro *m = ARRAY_REF(macro_env, Macro, i);
-		if (m->name.len == name.len
-				&& strneq(m->name.chars, name.chars, name.len)) {
-			return m;
-		}
+	Array(Macro) macros;
+	// Maps macro names to their index in macros. The hash table doesn't
+	// support removal, so #undef just marks the macro as undefined, and a
+	// later #define of the same name reuses it.
+	HashTable names;
+} MacroEnv;
+
+#define EMPTY_MACRO_ENV ((MacroEnv) { EMPTY_ARRAY, { NULL, 0, 0 } })
+
+static void macro_env_free(MacroEnv *env)
+{
+	if (env->names.entries == NULL)
+		return;
+
+	for (u32 i = 0; i < env->macros.size; i++) {
+		Macro *macro = ARRAY_REF(&env->macros, Macro, i);
+		if (ARRAY_IS_VALID(&macro->arg_names))
+			array_free(&macro->arg_names);
+		if (ARRAY_IS_VALID(&macro->body))
+			array_free(&macro->body);
 	}
+	array_free(&env->macros);
+	hash_table_free(&env->names);
+}
+
+static Macro *look_up_macro(MacroEnv *env, String name)
+{
+	if (env->names.entries == NULL)
+		return NULL;
+
+	u32 *index = hash_table_lookup(&env->names, name.chars, name.len);
+	if (index == NULL)
+		return NULL;
 
-	return NULL;
+	Macro *macro = ARRAY_REF(&env->macros, Macro, *index);
+	return macro->defined ? macro : NULL;
 }
 
+// Returns the macro for name, adding it if there isn't one. If the macro is
+// new or was #undef'd, its fields other than name are uninitialized and
+// defined is false. The table doesn't copy name, so it must outlive env.
+static Macro *add_macro(MacroEnv *env, String name)
+{
+	if (env->names.entries == NULL) {
+		ARRAY_INIT(&env->macros, Macro, 16);
+		hash_table_init(&env->names, 16);
+	}
+
+	bool inserted;
+	u32 *index = hash_table_insert(&env->names, name.chars, name.len, &inserted);
+	if (!inserted)
+		return ARRAY_REF(&env->macros, Macro, *index);
+
+	*index = env->macros.size;
+	Macro *macro = ARRAY_APPEND(&env->macros, Macro);
+	macro->name = name;
+	macro->defined = false;
+	macro->disabled = false;
+	macro->arg_names = EMPTY_ARRAY;
+	macro->body = EMPTY_ARRAY;
+	return macro;
+}
+
+// Identifies a file independently of the path used to reach it.
+typedef struct FileId
+{
+	u64 device;
+	u64 inode;
+} FileId;
+
+typedef struct IncludedFile
+{
+	FileId id;
+	bool pragma_once;
+	// The macro guarding the whole file, if the file is of the form
+	// "#ifndef X ... #endif" with nothing but whitespace and comments
+	// outside, or INVALID_STRING. Including the file again while this is
+	// defined would produce nothing, so we skip it without reading it.
+	String guard_macro;
+} IncludedFile;
+
+// Every file we've preprocessed, so we can skip files with #pragma once or
+// an include guard when they're included again.
+typedef struct IncludedFiles
+{
+	Array(IncludedFile *) files;
+	// Both map to indices in files. We look up paths first so that repeat
+	// includes through the same path don't need to stat the file.
+	HashTable by_path;
+	HashTable by_id;
+	Pool pool;
+} IncludedFiles;
+
+typedef enum GuardState
+{
+	// Nothing but whitespace and comments so far.
+	GUARD_START,
+	// Inside the "#ifndef X" that might be the guard.
+	GUARD_INSIDE,
+	// After its #endif, with nothing but whitespace and comments since.
+	GUARD_AFTER_ENDIF,
+	// The file isn't guarded.
+	GUARD_NONE,
+} GuardState;
+
+// The file currently being preprocessed, and what we've found out about
+// whether it has an include guard.
+typedef struct OpenFile
+{
+	IncludedFile *file;
+
+	GuardState guard_state;
+	String guard_macro;
+	// The depth of the conditional stack outside the guard's #ifndef.
+	u32 guard_depth;
+} OpenFile;
+
 typedef struct PPCondScope
 {
 	bool condition;
@@ -42,19 +202,103 @@ typedef struct PP
 	Array(char) out_chars;
 	Array(Adjustment) out_adjustments;
 	u32 macro_depth;
+	PreprocessOutputFunction output;
+	void *output_context;
 
 	Array(InputBuffer) mapped_files;
 
-	Array(char *) *include_dirs;
+	IncludeCache *include_cache;
 	Array(PPCondScope) pp_scope_stack;
-	Array(Macro) macro_env;
-	Array(Macro) curr_macro_params;
+	MacroEnv macro_env;
+	// Names of #define'd macros are copied here, so the keys in macro_env
+	// don't depend on where the #define was read from.
+	Pool macro_names;
+
+	// State for expanding macros, which only lives for a single top-level
+	// macro invocation or #if condition.
+	//
+	// The text of tokens created by '#' and '##'.
+	Pool expansion_text;
+	bool expansion_text_used;
+	// The tokens still to be rescanned, last first, and the fully expanded
+	// result.
+	Array(PPToken) pending_tokens;
+	Array(PPToken) expanded_tokens;
+
+	IncludedFiles included_files;
+	// The file we're currently reading.
+	OpenFile *open_file;
 } PP;
 
-static bool preprocess_string(PP *pp, char *string);
-static char *macroexpand(PP *pp, char *string);
+// Once we've built up this much output, we hand it off at the next line break.
+#define OUTPUT_CHUNK_SIZE (64 * 1024)
+
 static bool preprocess_aux(PP *pp);
 
+static void included_files_init(IncludedFiles *included_files)
+{
+	ARRAY_INIT(&included_files->files, IncludedFile *, 16);
+	hash_table_init(&included_files->by_path, 16);
+	hash_table_init(&included_files->by_id, 16);
+	pool_init(&included_files->pool, 1024);
+}
+
+static void included_files_free(IncludedFiles *included_files)
+{
+	array_free(&included_files->files);
+	hash_table_free(&included_files->by_path);
+	hash_table_free(&included_files->by_id);
+	pool_free(&included_files->pool);
+}
+
+// Returns the IncludedFile for path, adding it if we haven't seen the file
+// before, or NULL if we can't stat it. The table doesn't copy path, so it must
+// outlive included_files.
+static IncludedFile *look_up_included_file(IncludedFiles *included_files,
+		char *path)
+{
+	u32 path_length = strlen(path);
+	u32 *index = hash_table_lookup(&included_files->by_path, path, path_length);
+	if (index != NULL)
+		return *ARRAY_REF(&included_files->files, IncludedFile *, *index);
+
+	// @PORT
+	struct stat status;
+	if (stat(path, &status) != 0)
+		return NULL;
+
+	IncludedFile *file = pool_alloc(&included_files->pool, sizeof *file);
+	file->id = (FileId) { status.st_dev, status.st_ino };
+
+	bool inserted;
+	u32 *id_index = hash_table_insert(&included_files->by_id,
+			(char *)&file->id, sizeof file->id, &inserted);
+	if (inserted) {
+		*id_index = included_files->files.size;
+		*ARRAY_APPEND(&included_files->files, IncludedFile *) = file;
+		file->pragma_once = false;
+		file->guard_macro = INVALID_STRING;
+	} else {
+		// Another path to a file we've already seen. The record we just
+		// allocated is wasted, but this is rare enough not to matter.
+		file = *ARRAY_REF(&included_files->files, IncludedFile *, *id_index);
+	}
+
+	u32 file_index = *id_index;
+	*hash_table_insert(&included_files->by_path, path, path_length, &inserted) =
+		file_index;
+	return file;
+}
+
+// Called for anything in the file other than whitespace, comments, and the
+// directives that make up an include guard.
+static void guard_saw_token(PP *pp)
+{
+	OpenFile *open_file = pp->open_file;
+	if (open_file != NULL && open_file->guard_state != GUARD_INSIDE)
+		open_file->guard_state = GUARD_NONE;
+}
+
 static void start_pp_if(PP *pp, bool condition)
 {
 	Array(PPCondScope) *stack = &pp->pp_scope_stack;
@@ -139,21 +383,55 @@ static void add_adjustment(PP *pp, AdjustmentType type)
 	add_adjustment_to(pp, type, pp->reader.source_loc);
 }
 
-static void skip_whitespace_and_comments(PP *pp, bool skip_newline)
+// Hands the output so far to pp->output. This must only be called between
+// tokens, outside of any macro expansion.
+static bool flush_output(PP *pp)
 {
-	Reader *reader = &pp->reader;
+	Array(char) *out_chars = &pp->out_chars;
+	Array(Adjustment) *out_adjustments = &pp->out_adjustments;
+	assert(pp->macro_depth == 0);
+
+	// An adjustment right at the end applies to the first char of the next
+	// chunk. add_adjustment_to merges adjustments at the same location, so
+	// there's at most one of these.
+	bool carry_adjustment = false;
+	Adjustment carried;
+	if (out_adjustments->size != 0) {
+		Adjustment *last = ARRAY_LAST(out_adjustments, Adjustment);
+		if (last->location == out_chars->size) {
+			carry_adjustment = true;
+			carried = *last;
+			out_adjustments->size--;
+		}
+	}
+
+	bool ret = pp->output(pp->output_context, out_chars, out_adjustments);
+
+	out_chars->size = 0;
+	out_adjustments->size = 0;
+	if (carry_adjustment) {
+		carried.location = 0;
+		*ARRAY_APPEND(out_adjustments, Adjustment) = carried;
+	}
+
+	return ret;
+}
+
+// Returns whether we skipped anything. If out_newlines is non-NULL, any
+// newlines we skip are appended to it.
+static bool skip_whitespace_and_comments_in(Reader *reader,
+		Array(char) *out_newlines, bool skip_newline)
+{
+	u32 start_position = reader->position;
 	while (!at_end(reader)) {
 		switch (peek_char(reader)) {
 		case '\n':
 			if (!skip_newline)
-				return;
+				return reader->position != start_position;
 
 			advance(reader);
-
-			// Retain any newlines - we need them in the output so that the
-			// tokeniser can correctly track source location without needing
-			// an adjustment for every single line in the source.
-			*ARRAY_APPEND(&pp->out_chars, char) = '\n';
+			if (out_newlines != NULL)
+				*ARRAY_APPEND(out_newlines, char) = '\n';
 
 			break;
 		case ' ': case '\t':
@@ -184,19 +462,29 @@ static void skip_whitespace_and_comments(PP *pp, bool skip_newline)
 				break;
 			default:
 				back_up(reader);
-				return;
+				return reader->position != start_position;
 			}
 			break;
 		default:
-			return;
+			return reader->position != start_position;
 		}
 	}
+
+	return reader->position != start_position;
 }
 
-static bool append_string_or_char_literal(Reader *reader, char start_char,
-		Array(char) *out_chars)
+static void skip_whitespace_and_comments(PP *pp, bool skip_newline)
+{
+	// Retain any newlines - we need them in the output so that the
+	// tokeniser can correctly track source location without needing
+	// an adjustment for every single line in the source.
+	skip_whitespace_and_comments_in(&pp->reader, &pp->out_chars, skip_newline);
+}
+
+// Skips the rest of a string or character literal, whose opening quote
+// start_char has already been read.
+static bool skip_string_or_char_literal(Reader *reader, char start_char)
 {
-	u32 literal_start = reader->position - 1;
 	SourceLoc literal_start_source_loc = reader->source_loc;
 	while (peek_char(reader) != start_char) {
 		if (at_end(reader)) {
@@ -214,79 +502,705 @@ static bool append_string_or_char_literal(Reader *reader, char start_char,
 	}
 	advance(reader);
 
+	return true;
+}
+
+static bool append_string_or_char_literal(Reader *reader, char start_char,
+		Array(char) *out_chars)
+{
+	u32 literal_start = reader->position - 1;
+	if (!skip_string_or_char_literal(reader, start_char))
+		return false;
+
 	ARRAY_APPEND_ELEMS(out_chars, char,
 			reader->position - literal_start,
 			reader->buffer.chars + literal_start);
 	return true;
 }
 
-// @TODO: This is probably too conservative - fopen can fail for other reasons.
-static bool file_exists(char *path)
+// Punctuators longer than one character, longest first so that we take the
+// longest match (C99 6.4.6).
+static char *multi_char_punctuators[] = {
+	"...", "<<=", ">>=",
+	"->", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+	"*=", "/=", "%=", "+=", "-=", "&=", "^=", "|=", "##",
+};
+
+static bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// Reads a preprocessing token (C99 6.4) starting at the current position,
+// which must not be whitespace or the end of the buffer.
+static bool lex_pp_token(Reader *reader, PPToken *token)
+{
+	u32 start = reader->position;
+	char *chars = reader->buffer.chars;
+	u32 remaining = reader->buffer.len - start;
+	char c = read_char(reader);
+
+	PPTokenType type;
+	if (initial_ident_char(c)) {
+		type = PP_TOKEN_IDENT;
+		while (ident_char(peek_char(reader)))
+			advance(reader);
+	} else if (is_digit(c) || (c == '.' && remaining >= 2
+				&& is_digit(chars[start + 1]))) {
+		type = PP_TOKEN_NUMBER;
+		for (;;) {
+			char next = peek_char(reader);
+			if (next == 'e' || next == 'E' || next == 'p' || next == 'P') {
+				advance(reader);
+				next = peek_char(reader);
+				if (next == '+' || next == '-')
+					advance(reader);
+			} else if (ident_char(next) || next == '.') {
+				advance(reader);
+			} else {
+				break;
+			}
+		}
+	} else if (c == '"' || c == '\'') {
+		type = PP_TOKEN_LITERAL;
+		if (!skip_string_or_char_literal(reader, c))
+			return false;
+	} else {
+		type = PP_TOKEN_PUNCT;
+		for (u32 i = 0; i < STATIC_ARRAY_LENGTH(multi_char_punctuators); i++) {
+			char *punctuator = multi_char_punctuators[i];
+			u32 length = strlen(punctuator);
+			if (length <= remaining && strneq(chars + start, punctuator, length)) {
+				for (u32 j = 1; j < length; j++)
+					advance(reader);
+				break;
+			}
+		}
+	}
+
+	*token = (PPToken) {
+		.type = type,
+		.text = { chars + start, reader->position - start },
+		.param_index = 0,
+		.macro = NULL,
+		.whitespace_before = false,
+		.avoid_paste = false,
+		.no_expand = false,
+	};
+	return true;
+}
+
+static bool is_punct(PPToken *token, char *punctuator)
+{
+	u32 length = strlen(punctuator);
+	return token->type == PP_TOKEN_PUNCT && token->text.len == length
+		&& strneq(token->text.chars, punctuator, length);
+}
+
+// Returns whether the chars a and b, at the end of one token and the start
+// of the next, could be read back as part of the same token if there's no
+// whitespace between them. This is conservative, as an extra space never
+// changes the meaning of the output.
+static bool might_paste(char a, char b)
+{
+	if (a == ' ' || a == '\n' || a == '\t')
+		return false;
+	if (ident_char(a) || a == '.')
+		return ident_char(b) || b == '.' || b == '"' || b == '\'';
+
+	switch (a) {
+	case '(': case ')': case '[': case ']': case '{': case '}':
+	case ',': case ';': case '"': case '\'':
+		return false;
+	}
+	switch (b) {
+	case '(': case ')': case '[': case ']': case '{': case '}':
+	case ',': case ';': case '"': case '\'':
+		return false;
+	}
+
+	return !ident_char(b);
+}
+
+static char *alloc_expansion_text(PP *pp, u32 length)
+{
+	pp->expansion_text_used = true;
+	return pool_alloc(&pp->expansion_text, length);
+}
+
+// Resets everything that only lives for one top-level macro invocation.
+static void end_expansion(PP *pp)
+{
+	if (pp->expansion_text_used) {
+		pool_free(&pp->expansion_text);
+		pool_init(&pp->expansion_text, 1024);
+		pp->expansion_text_used = false;
+	}
+}
+
+// Pushes tokens onto pending so that they're rescanned next, in order.
+static void push_pending(Array(PPToken) *pending, PPToken *tokens, u32 count)
+{
+	ARRAY_ENSURE_ROOM(pending, PPToken, count);
+	for (u32 i = count; i != 0; i--)
+		*ARRAY_APPEND(pending, PPToken) = tokens[i - 1];
+}
+
+// Gets the next token to rescan: from pending if there are any left, and
+// otherwise from the file if read_file is set.
+static bool next_expansion_token(PP *pp, Array(PPToken) *pending,
+		bool read_file, PPToken *token)
+{
+	while (pending->size != 0) {
+		*token = *ARRAY_POP(pending, PPToken);
+		if (token->type != PP_TOKEN_END_EXPANSION) {
+			// A disabled macro's END_EXPANSION marker is still below this
+			// token, so it came from that macro's expansion, and must never
+			// be expanded, even if the marker is popped (e.g.: by reading
+			// arguments past it) before the token is rescanned.
+			if (token->type == PP_TOKEN_IDENT && !token->no_expand) {
+				Macro *macro = look_up_macro(&pp->macro_env, token->text);
+				if (macro != NULL && macro->disabled)
+					token->no_expand = true;
+			}
+
+			return true;
+		}
+
+		// The arguments to a macro can continue past the end of the
+		// expansion they started in.
+		token->macro->disabled = false;
+	}
+	if (!read_file)
+		return false;
+
+	// Macro arguments can span multiple lines.
+	Reader *reader = &pp->reader;
+	bool whitespace_before = skip_whitespace_and_comments_in(reader, NULL, true);
+	if (at_end(reader))
+		return false;
+
+	if (!lex_pp_token(reader, token))
+		return false;
+	token->whitespace_before = whitespace_before;
+	return true;
+}
+
+// Returns whether the next token to rescan is a '('. If it comes from the
+// file we don't consume anything unless it is.
+static bool next_is_lparen(PP *pp, Array(PPToken) *pending, bool read_file)
+{
+	for (u32 i = pending->size; i != 0; i--) {
+		PPToken *token = ARRAY_REF(pending, PPToken, i - 1);
+		if (token->type != PP_TOKEN_END_EXPANSION)
+			return is_punct(token, "(");
+	}
+	if (!read_file)
+		return false;
+
+	Reader *reader = &pp->reader;
+	Reader saved_reader = *reader;
+	skip_whitespace_and_comments_in(reader, NULL, true);
+	if (peek_char(reader) == '(')
+		return true;
+
+	*reader = saved_reader;
+	return false;
+}
+
+// Reads the arguments to an invocation of a function-like macro, after the
+// opening '('. Each argument is an Array(PPToken) in args.
+static bool read_macro_args(PP *pp, Macro *macro, Array(PPToken) *pending,
+		bool read_file, SourceLoc *invocation_source_loc,
+		Array(Array(PPToken)) *args)
 {
-	FILE *f = fopen(path, "r");
-	if (f != NULL)
-		fclose(f);
+	PPToken lparen;
+	bool got_lparen = next_expansion_token(pp, pending, read_file, &lparen);
+	assert(got_lparen && is_punct(&lparen, "("));
+	IGNORE(got_lparen);
+
+	Array(PPToken) *arg = ARRAY_APPEND(args, Array(PPToken));
+	ARRAY_INIT(arg, PPToken, 4);
+
+	u32 bracket_depth = 0;
+	PPToken token;
+	while (next_expansion_token(pp, pending, read_file, &token)) {
+		if (bracket_depth == 0 && is_punct(&token, ")")) {
+			u32 arg_count = args->size;
+			// An invocation with no arguments reads as one empty argument.
+			if (macro->arg_names.size == 0 && arg_count == 1
+					&& ARRAY_REF(args, Array(PPToken), 0)->size == 0) {
+				arg_count = 0;
+			}
+
+			if (arg_count > macro->arg_names.size) {
+				issue_error(&pp->reader.source_loc,
+						"Too many parameters to function-like macro"
+						" (expected %u)",
+						macro->arg_names.size);
+				return false;
+			}
+			if (arg_count < macro->arg_names.size) {
+				issue_error(&pp->reader.source_loc,
+						"Not enough parameters to function-like macro"
+						" (expected %u, got %u)",
+						macro->arg_names.size,
+						arg_count);
+				return false;
+			}
+
+			return true;
+		}
+
+		if (bracket_depth == 0 && is_punct(&token, ",")) {
+			arg = ARRAY_APPEND(args, Array(PPToken));
+			ARRAY_INIT(arg, PPToken, 4);
+			continue;
+		}
+
+		if (is_punct(&token, "("))
+			bracket_depth++;
+		else if (is_punct(&token, ")"))
+			bracket_depth--;
+
+		// Leading whitespace isn't part of the argument.
+		if (arg->size == 0)
+			token.whitespace_before = false;
+		*ARRAY_APPEND(arg, PPToken) = token;
+	}
+
+	issue_error(invocation_source_loc,
+			"Unterminated macro-like function invocation");
+	return false;
+}
 
-	return f != NULL;
+static void free_macro_args(Array(Array(PPToken)) *args)
+{
+	for (u32 i = 0; i < args->size; i++)
+		array_free(ARRAY_REF(args, Array(PPToken), i));
+	array_free(args);
 }
 
-static char *look_up_include_path(Array(char *) *include_dirs,
-		char *including_file, char *include_path)
+// Applies the '#' operator to arg (C99 6.10.3.2).
+static PPToken stringify(PP *pp, Array(PPToken) *arg)
 {
-	// If absolute, just try the exact path.
-	if (include_path[0] == '/') {
-		if (file_exists(include_path))
-			return include_path;
-		else
-			return NULL;
+	Array(char) chars;
+	ARRAY_INIT(&chars, char, 16);
+	*ARRAY_APPEND(&chars, char) = '"';
+	for (u32 i = 0; i < arg->size; i++) {
+		PPToken *token = ARRAY_REF(arg, PPToken, i);
+		if (i != 0 && token->whitespace_before)
+			*ARRAY_APPEND(&chars, char) = ' ';
+
+		for (u32 j = 0; j < token->text.len; j++) {
+			char c = token->text.chars[j];
+			if (token->type == PP_TOKEN_LITERAL && (c == '"' || c == '\\'))
+				*ARRAY_APPEND(&chars, char) = '\\';
+			*ARRAY_APPEND(&chars, char) = c;
+		}
 	}
+	*ARRAY_APPEND(&chars, char) = '"';
+
+	char *text = alloc_expansion_text(pp, chars.size);
+	memcpy(text, chars.elements, chars.size);
+	PPToken result = {
+		.type = PP_TOKEN_LITERAL,
+		.text = { text, chars.size },
+		.param_index = 0,
+		.macro = NULL,
+		.whitespace_before = false,
+		.avoid_paste = false,
+		.no_expand = false,
+	};
 
-	// Try relative to the including file
-	u32 including_file_length = strlen(including_file);
-	i32 i = including_file_length - 1;
-	for (; i >= 0 && including_file[i] != '/'; i--)
-		;
-
-	char *base_path;
-	u32 base_length;
-	// Path without any slashes
-	if (i == -1) {
-		base_path = "./";
-		base_length = 2;
+	array_free(&chars);
+	return result;
+}
+
+// Applies the '##' operator to left and right (C99 6.10.3.3).
+static PPToken paste_tokens(PP *pp, PPToken *left, PPToken *right)
+{
+	if (left->type == PP_TOKEN_PLACEMARKER) {
+		PPToken result = *right;
+		result.whitespace_before = left->whitespace_before;
+		return result;
+	}
+	if (right->type == PP_TOKEN_PLACEMARKER)
+		return *left;
+
+	u32 length = left->text.len + right->text.len;
+	char *text = alloc_expansion_text(pp, length);
+	memcpy(text, left->text.chars, left->text.len);
+	memcpy(text + left->text.len, right->text.chars, right->text.len);
+
+	PPTokenType type;
+	if (initial_ident_char(text[0])) {
+		type = PP_TOKEN_IDENT;
+		for (u32 i = 1; i < length; i++) {
+			if (!ident_char(text[i])) {
+				type = PP_TOKEN_PUNCT;
+				break;
+			}
+		}
+	} else if (is_digit(text[0]) || text[0] == '.') {
+		type = PP_TOKEN_NUMBER;
 	} else {
-		base_path = including_file;
-		base_length = i + 1;
+		type = PP_TOKEN_PUNCT;
 	}
 
-	u32 include_path_length = strlen(include_path);
-	char *potential_path = nconcat(
-			base_path, base_length, include_path, include_path_length);
-	if (file_exists(potential_path))
-		return potential_path;
-	free(potential_path);
-
-	// Try include dirs
-	for (u32 i = 0; i < include_dirs->size; i++) {
-		base_path = *ARRAY_REF(include_dirs, char *, i);
-		base_length = strlen(base_path);
-
-		include_path_length = strlen(include_path);
-		potential_path = nconcat(
-				base_path, base_length, include_path, include_path_length);
-		if (file_exists(potential_path))
-			return potential_path;
-		free(potential_path);
+	return (PPToken) {
+		.type = type,
+		.text = { text, length },
+		.param_index = 0,
+		.macro = NULL,
+		.whitespace_before = left->whitespace_before,
+		.avoid_paste = left->avoid_paste,
+		.no_expand = false,
+	};
+}
+
+static bool expand_tokens(PP *pp, Array(PPToken) *pending, bool read_file,
+		Array(PPToken) *output);
+
+// Appends the tokens of arg to output, marking the first one as coming from
+// a different place to whatever precedes it.
+static void append_arg(Array(PPToken) *output, Array(PPToken) *arg,
+		bool whitespace_before)
+{
+	u32 start = output->size;
+	ARRAY_APPEND_ELEMS(output, PPToken, arg->size, arg->elements);
+	if (output->size != start) {
+		PPToken *first = ARRAY_REF(output, PPToken, start);
+		first->whitespace_before = whitespace_before;
+		first->avoid_paste = true;
 	}
+}
 
-	// @TODO: Support -I flag.
+// Substitutes args into the body of macro (C99 6.10.3.1), and appends the
+// result to output.
+static bool substitute_macro_body(PP *pp, Macro *macro,
+		Array(Array(PPToken)) *args, Array(PPToken) *output)
+{
+	Array(PPToken) *body = &macro->body;
+	u32 start = output->size;
+
+	// Arguments are only fully macro-expanded when they're used other than
+	// as an operand of '#' or '##', and then at most once.
+	Array(Array(PPToken)) expanded_args;
+	ARRAY_INIT(&expanded_args, Array(PPToken), args->size);
+	for (u32 i = 0; i < args->size; i++)
+		*ARRAY_APPEND(&expanded_args, Array(PPToken)) = EMPTY_ARRAY;
+
+	bool ret = true;
+	bool after_arg = false;
+	for (u32 i = 0; i < body->size; i++) {
+		PPToken *token = ARRAY_REF(body, PPToken, i);
+		PPToken *next = i + 1 < body->size ? token + 1 : NULL;
+
+		if (macro->function_like && is_punct(token, "#")) {
+			// We checked when the macro was defined that a parameter
+			// follows.
+			Array(PPToken) *arg = ARRAY_REF(args, Array(PPToken), next->param_index);
+			PPToken stringified = stringify(pp, arg);
+			stringified.whitespace_before = token->whitespace_before;
+			*ARRAY_APPEND(output, PPToken) = stringified;
+			i++;
+			continue;
+		}
+
+		if (is_punct(token, "##")) {
+			// We checked when the macro was defined that this isn't at
+			// either end of the body, so the output isn't empty.
+			PPToken *left = ARRAY_LAST(output, PPToken);
+
+			Array(PPToken) right_tokens;
+			if (next->type == PP_TOKEN_PARAM) {
+				right_tokens = *ARRAY_REF(args, Array(PPToken), next->param_index);
+			} else {
+				right_tokens = (Array(PPToken)) {
+					(u8 *)next, 1, 1,
+				};
+			}
+
+			if (right_tokens.size != 0) {
+				PPToken *right = ARRAY_REF(&right_tokens, PPToken, 0);
+				*left = paste_tokens(pp, left, right);
+				ARRAY_APPEND_ELEMS(output, PPToken, right_tokens.size - 1,
+						ARRAY_REF(&right_tokens, PPToken, 1));
+			}
+
+			i++;
+			continue;
+		}
 
-	return NULL;
+		if (token->type == PP_TOKEN_PARAM) {
+			Array(PPToken) *arg = ARRAY_REF(args, Array(PPToken), token->param_index);
+			if (next != NULL && is_punct(next, "##")) {
+				if (arg->size == 0) {
+					*ARRAY_APPEND(output, PPToken) = (PPToken) {
+						.type = PP_TOKEN_PLACEMARKER,
+						.text = EMPTY_STRING,
+						.param_index = 0,
+						.macro = NULL,
+						.whitespace_before = token->whitespace_before,
+						.avoid_paste = true,
+						.no_expand = false,
+					};
+				} else {
+					append_arg(output, arg, token->whitespace_before);
+				}
+			} else {
+				Array(PPToken) *expanded =
+					ARRAY_REF(&expanded_args, Array(PPToken), token->param_index);
+				if (!ARRAY_IS_VALID(expanded)) {
+					Array(PPToken) arg_pending;
+					ARRAY_INIT(&arg_pending, PPToken, arg->size);
+					push_pending(&arg_pending, (PPToken *)arg->elements, arg->size);
+
+					ARRAY_INIT(expanded, PPToken, arg->size);
+					bool expanded_ok =
+						expand_tokens(pp, &arg_pending, false, expanded);
+					array_free(&arg_pending);
+					if (!expanded_ok) {
+						ret = false;
+						break;
+					}
+				}
+
+				append_arg(output, expanded, token->whitespace_before);
+			}
+
+			after_arg = true;
+			continue;
+		}
+
+		PPToken *copied = ARRAY_APPEND(output, PPToken);
+		*copied = *token;
+		if (after_arg)
+			copied->avoid_paste = true;
+		after_arg = false;
+	}
+
+	u32 out_index = start;
+	for (u32 i = start; ret && i < output->size; i++) {
+		PPToken *token = ARRAY_REF(output, PPToken, i);
+		if (token->type != PP_TOKEN_PLACEMARKER)
+			*ARRAY_REF(output, PPToken, out_index++) = *token;
+	}
+	output->size = out_index;
+
+	for (u32 i = 0; i < expanded_args.size; i++) {
+		Array(PPToken) *expanded = ARRAY_REF(&expanded_args, Array(PPToken), i);
+		if (ARRAY_IS_VALID(expanded))
+			array_free(expanded);
+	}
+	array_free(&expanded_args);
+
+	return ret;
+}
+
+// Rescans the tokens in pending, expanding any macros, until pending is
+// empty. Appends the result to output. If read_file is set, the arguments to
+// a function-like macro at the end of pending can continue into the file.
+static bool expand_tokens(PP *pp, Array(PPToken) *pending, bool read_file,
+		Array(PPToken) *output)
+{
+	Array(PPToken) substituted = EMPTY_ARRAY;
+	bool ret = true;
+
+	while (pending->size != 0) {
+		PPToken token = *ARRAY_POP(pending, PPToken);
+		if (token.type == PP_TOKEN_END_EXPANSION) {
+			token.macro->disabled = false;
+			continue;
+		}
+
+		Macro *macro = NULL;
+		if (token.type == PP_TOKEN_IDENT && !token.no_expand) {
+			macro = look_up_macro(&pp->macro_env, token.text);
+			if (macro != NULL && macro->disabled) {
+				token.no_expand = true;
+				macro = NULL;
+			}
+		}
+
+		// A function-like macro name not followed by '(' isn't an
+		// invocation, so we leave it as it is.
+		if (macro != NULL && macro->function_like
+				&& !next_is_lparen(pp, pending, read_file)) {
+			macro = NULL;
+		}
+
+		if (macro == NULL) {
+			*ARRAY_APPEND(output, PPToken) = token;
+			continue;
+		}
+
+		if (!ARRAY_IS_VALID(&substituted))
+			ARRAY_INIT(&substituted, PPToken, 16);
+		array_clear(&substituted);
+
+		Array(Array(PPToken)) args;
+		ARRAY_INIT(&args, Array(PPToken), macro->arg_names.size);
+		if (macro->function_like) {
+			SourceLoc invocation_source_loc = pp->reader.source_loc;
+			if (!read_macro_args(pp, macro, pending, read_file,
+						&invocation_source_loc, &args)) {
+				free_macro_args(&args);
+				ret = false;
+				break;
+			}
+		}
+
+		bool substituted_ok =
+			substitute_macro_body(pp, macro, &args, &substituted);
+		free_macro_args(&args);
+		if (!substituted_ok) {
+			ret = false;
+			break;
+		}
+
+		// Keep the result separate from whatever is either side of it.
+		if (pending->size != 0)
+			ARRAY_LAST(pending, PPToken)->avoid_paste = true;
+		if (substituted.size != 0) {
+			PPToken *first = ARRAY_REF(&substituted, PPToken, 0);
+			first->whitespace_before = token.whitespace_before;
+			first->avoid_paste = true;
+		}
+
+		// The macro stays disabled until we've rescanned everything in its
+		// expansion.
+		macro->disabled = true;
+		*ARRAY_APPEND(pending, PPToken) = (PPToken) {
+			.type = PP_TOKEN_END_EXPANSION,
+			.text = EMPTY_STRING,
+			.param_index = 0,
+			.macro = macro,
+			.whitespace_before = false,
+			.avoid_paste = false,
+			.no_expand = false,
+		};
+		push_pending(pending, (PPToken *)substituted.elements, substituted.size);
+	}
+
+	if (ARRAY_IS_VALID(&substituted))
+		array_free(&substituted);
+	return ret;
+}
+
+// Appends the text of tokens to the output, separated by spaces where
+// they were in the source, or where they might otherwise run together.
+static void emit_tokens(PP *pp, Array(PPToken) *tokens)
+{
+	Array(char) *out_chars = &pp->out_chars;
+	for (u32 i = 0; i < tokens->size; i++) {
+		PPToken *token = ARRAY_REF(tokens, PPToken, i);
+		if (token->text.len == 0)
+			continue;
+
+		if (out_chars->size != 0) {
+			char prev = *ARRAY_LAST(out_chars, char);
+			bool needs_space = i != 0 && token->whitespace_before;
+			if (!needs_space && (i == 0 || token->avoid_paste))
+				needs_space = might_paste(prev, token->text.chars[0]);
+			if (needs_space && prev != ' ' && prev != '\n')
+				*ARRAY_APPEND(out_chars, char) = ' ';
+		}
+
+		ARRAY_APPEND_ELEMS(out_chars, char, token->text.len, token->text.chars);
+	}
+}
+
+// Expands an invocation of the macro named by name_token, which we've just
+// read from the file, and appends the result to the output.
+static bool expand_macro_invocation(PP *pp, PPToken name_token,
+		SourceLoc start_source_loc)
+{
+	Array(PPToken) *pending = &pp->pending_tokens;
+	Array(PPToken) *expanded = &pp->expanded_tokens;
+	array_clear(pending);
+	array_clear(expanded);
+	*ARRAY_APPEND(pending, PPToken) = name_token;
+
+	add_adjustment_to(pp, BEGIN_MACRO_ADJUSTMENT, start_source_loc);
+
+	bool ret = expand_tokens(pp, pending, true, expanded);
+	if (ret) {
+		emit_tokens(pp, expanded);
+
+		// Add a space to separate tokens if necessary.
+		Array(char) *out_chars = &pp->out_chars;
+		if (out_chars->size != 0
+				&& might_paste(*ARRAY_LAST(out_chars, char),
+					peek_char(&pp->reader))) {
+			*ARRAY_APPEND(out_chars, char) = ' ';
+		}
+
+		add_adjustment(pp, END_MACRO_ADJUSTMENT);
+	}
+
+	end_expansion(pp);
+	return ret;
+}
+
+// Lexes the replacement list of a #define, up to the end of the line.
+static bool lex_macro_body(Reader *reader, bool function_like,
+		Array(String) *arg_names, Array(PPToken) *body, SourceLoc *define_source_loc)
+{
+	for (;;) {
+		bool whitespace_before =
+			skip_whitespace_and_comments_in(reader, NULL, false);
+		if (at_end(reader) || peek_char(reader) == '\n')
+			break;
+
+		PPToken *token = ARRAY_APPEND(body, PPToken);
+		if (!lex_pp_token(reader, token))
+			return false;
+
+		// Whitespace at the start of the replacement list isn't part of it.
+		token->whitespace_before = whitespace_before && body->size != 1;
+		if (token->type != PP_TOKEN_IDENT)
+			continue;
+
+		for (u32 i = 0; i < arg_names->size; i++) {
+			String *arg_name = ARRAY_REF(arg_names, String, i);
+			if (arg_name->len == token->text.len
+					&& strneq(arg_name->chars, token->text.chars, arg_name->len)) {
+				token->type = PP_TOKEN_PARAM;
+				token->param_index = i;
+				break;
+			}
+		}
+	}
+
+	for (u32 i = 0; i < body->size; i++) {
+		PPToken *token = ARRAY_REF(body, PPToken, i);
+		if (function_like && is_punct(token, "#")) {
+			if (i + 1 == body->size || (token + 1)->type != PP_TOKEN_PARAM) {
+				issue_error(define_source_loc,
+						"Argument to '#' does not name a macro parameter");
+				return false;
+			}
+		} else if (is_punct(token, "##")) {
+			if (i == 0 || i + 1 == body->size) {
+				issue_error(define_source_loc,
+						"'##' cannot appear at either end of a macro"
+						" replacement list");
+				return false;
+			}
+		}
+	}
+
+	return true;
 }
 
 static bool preprocess_file(PP *pp, char *input_filename,
 		SourceLoc blame_source_loc);
 
-static bool eval_pp_condition(PP *pp)
+// Evaluates the condition of an #if or #elif into *result. Returns false if
+// there was an error.
+static bool eval_pp_condition(PP *pp, bool *result)
 {
 	Reader *reader = &pp->reader;
 	skip_whitespace_and_comments(pp, false);
@@ -333,21 +1247,57 @@ static bool eval_pp_condition(PP *pp)
 		String macro_name = { condition_str + i, len };
 		cond = look_up_macro(&pp->macro_env, macro_name) != NULL;
 	} else {
-		condition_str = macroexpand(pp, condition_str);
+		Reader condition_reader;
+		reader_init(&condition_reader,
+				(String) { condition_str, condition_chars.size - 1 },
+				EMPTY_ARRAY, false, reader->source_loc.filename);
+
+		Array(PPToken) *pending = &pp->pending_tokens;
+		Array(PPToken) *expanded = &pp->expanded_tokens;
+		array_clear(pending);
+		array_clear(expanded);
+		for (;;) {
+			bool whitespace_before =
+				skip_whitespace_and_comments_in(&condition_reader, NULL, false);
+			if (at_end(&condition_reader))
+				break;
+
+			PPToken *token = ARRAY_APPEND(expanded, PPToken);
+			if (!lex_pp_token(&condition_reader, token)) {
+				array_free(&condition_chars);
+				end_expansion(pp);
+				return false;
+			}
+			token->whitespace_before = whitespace_before;
+		}
+
+		push_pending(pending, (PPToken *)expanded->elements, expanded->size);
+		array_clear(expanded);
+		if (!expand_tokens(pp, pending, false, expanded)) {
+			end_expansion(pp);
+			array_free(&condition_chars);
+			return false;
+		}
 
 		// For now we only handle #if 0, #if 1, and #if defined <...>
-		if (streq(condition_str, "0")) {
+		PPToken *token = ARRAY_REF(expanded, PPToken, 0);
+		if (expanded->size == 1 && token->type == PP_TOKEN_NUMBER
+				&& token->text.len == 1 && token->text.chars[0] == '0') {
 			cond = false;
-		} else if (streq(condition_str, "1")) {
+		} else if (expanded->size == 1 && token->type == PP_TOKEN_NUMBER
+				&& token->text.len == 1 && token->text.chars[0] == '1') {
 			cond = true;
 		} else {
 			UNIMPLEMENTED;
 		}
+
+		end_expansion(pp);
 	}
 
 	array_free(&condition_chars);
 
-	return cond;
+	*result = cond;
+	return true;
 }
 
 static bool handle_pp_directive(PP *pp)
@@ -370,6 +1320,10 @@ static bool handle_pp_directive(PP *pp)
 		return false;
 	}
 
+	bool is_ifndef = strneq(directive.chars, "ifndef", directive.len);
+	if (!is_ifndef)
+		guard_saw_token(pp);
+
 	// Process #if and friends even if we're currently ignoring tokens.
 	if (strneq(directive.chars, "if", directive.len)) {
 		// If we're in a false preprocessor conditional, don't bother trying to
@@ -381,8 +1335,8 @@ static bool handle_pp_directive(PP *pp)
 				advance(reader);
 			}
 			cond = false;
-		} else {
-			cond = eval_pp_condition(pp);
+		} else if (!eval_pp_condition(pp, &cond)) {
+			return false;
 		}
 
 		start_pp_if(pp, cond);
@@ -404,6 +1358,17 @@ static bool handle_pp_directive(PP *pp)
 			return false;
 		}
 
+		OpenFile *open_file = pp->open_file;
+		if (open_file != NULL) {
+			if (open_file->guard_state == GUARD_START) {
+				open_file->guard_state = GUARD_INSIDE;
+				open_file->guard_macro = macro_name;
+				open_file->guard_depth = pp->pp_scope_stack.size;
+			} else {
+				guard_saw_token(pp);
+			}
+		}
+
 		bool condition = look_up_macro(&pp->macro_env, macro_name) == NULL;
 		start_pp_if(pp, condition);
 	} else if (strneq(directive.chars, "elif", directive.len)) {
@@ -412,16 +1377,33 @@ static bool handle_pp_directive(PP *pp)
 			return false;
 		}
 
+		// The guard's #ifndef can't have any other branches.
+		OpenFile *open_file = pp->open_file;
+		if (open_file != NULL && open_file->guard_state == GUARD_INSIDE
+				&& pp->pp_scope_stack.size == open_file->guard_depth + 1) {
+			open_file->guard_state = GUARD_NONE;
+		}
+
 		PPCondScope *top_scope = ARRAY_LAST(&pp->pp_scope_stack, PPCondScope);
 		if (!top_scope->condition) {
-			if (top_scope->position == THEN && eval_pp_condition(pp)) {
-				ARRAY_LAST(&pp->pp_scope_stack, PPCondScope)->condition = true;
+			bool cond;
+			if (top_scope->position == THEN) {
+				if (!eval_pp_condition(pp, &cond))
+					return false;
+				if (cond)
+					top_scope->condition = true;
 			}
 		} else {
 			top_scope->position = ELSE;
 			top_scope->condition = false;
 		}
 	} else if (strneq(directive.chars, "else", directive.len)) {
+		OpenFile *open_file = pp->open_file;
+		if (open_file != NULL && open_file->guard_state == GUARD_INSIDE
+				&& pp->pp_scope_stack.size == open_file->guard_depth + 1) {
+			open_file->guard_state = GUARD_NONE;
+		}
+
 		PPCondScope *scope = ARRAY_LAST(&pp->pp_scope_stack, PPCondScope);
 		if (scope->position == ELSE) {
 			issue_error(&directive_start,
@@ -445,6 +1427,12 @@ static bool handle_pp_directive(PP *pp)
 			return false;
 		}
 		pp->pp_scope_stack.size--;
+
+		OpenFile *open_file = pp->open_file;
+		if (open_file != NULL && open_file->guard_state == GUARD_INSIDE
+				&& pp->pp_scope_stack.size == open_file->guard_depth) {
+			open_file->guard_state = GUARD_AFTER_ENDIF;
+		}
 	} else if (!ignoring_chars(pp)) {
 		if (strneq(directive.chars, "include", directive.len)) {
 			skip_whitespace_and_comments(pp, false);
@@ -473,25 +1461,22 @@ static bool handle_pp_directive(PP *pp)
 
 			char *include_path =
 				strndup(reader->buffer.chars + start_index, length);
-			char *includee_path = look_up_include_path(pp->include_dirs,
-					reader->source_loc.filename, include_path);
+			char *includee_path = include_cache_look_up(pp->include_cache,
+					reader->source_loc.filename, include_path, terminator == '>');
 
 			if (includee_path == NULL) {
 				issue_error(&include_path_source_loc,
 						"File not found: '%s'", include_path);
+				free(include_path);
 				return false;
 			}
 
-			// @LEAK: We leak includee_path because it gets attached to
-			// SourceLoc's on tokens created by tokenise_file. Given how little
-			// data this should take up in a given compilation this is probably
-			// fine.
-
+			// includee_path is owned by the include cache, which outlives the
+			// tokens whose SourceLoc's it gets attached to.
 			bool success =
 				preprocess_file(pp, includee_path, include_path_source_loc);
 
-			if (include_path != includee_path)
-				free(include_path);
+			free(include_path);
 
 			if (!success)
 				return false;
@@ -509,12 +1494,16 @@ static bool handle_pp_directive(PP *pp)
 
 			Array(String) arg_names;
 			ARRAY_INIT(&arg_names, String, 0);
-			if (peek_char(reader) == '(') {
+			bool function_like = peek_char(reader) == '(';
+			if (function_like) {
 				advance(reader);
 				for (;;) {
 					skip_whitespace_and_comments(pp, false);
 					char c = peek_char(reader);
-					if (c == '\n') {
+					if (c == ')' && arg_names.size == 0) {
+						advance(reader);
+						break;
+					} else if (c == '\n') {
 						issue_error(&reader->source_loc,
 								"Unexpected newline in macro definition argument list");
 						return false;
@@ -541,26 +1530,34 @@ static bool handle_pp_directive(PP *pp)
 				}
 			}
 
-			skip_whitespace_and_comments(pp, false);
-			Array(char) macro_value_chars;
-			ARRAY_INIT(&macro_value_chars, char, 10);
-			while (peek_char(reader) != '\n')
-				*ARRAY_APPEND(&macro_value_chars, char) = read_char(reader);
-
-			char *macro_value = strndup((char *)macro_value_chars.elements,
-					macro_value_chars.size);
-			array_free(&macro_value_chars);
+			Array(PPToken) body;
+			ARRAY_INIT(&body, PPToken, 8);
+			if (!lex_macro_body(reader, function_like, &arg_names, &body,
+						&directive_start)) {
+				array_free(&body);
+				array_free(&arg_names);
+				return false;
+			}
 
 			Macro *macro = look_up_macro(&pp->macro_env, macro_name);
 			if (macro != NULL) {
 				// @TODO: Proper checks as per C99 6.10.3.2
 				assert(macro->arg_names.size == arg_names.size);
 			} else {
-				macro = ARRAY_APPEND(&pp->macro_env, Macro);
+				char *interned_name =
+					pool_alloc(&pp->macro_names, macro_name.len);
+				memcpy(interned_name, macro_name.chars, macro_name.len);
+				macro = add_macro(&pp->macro_env,
+						(String) { interned_name, macro_name.len });
 			}
 
-			macro->name = macro_name;
-			macro->value = macro_value;
+			if (ARRAY_IS_VALID(&macro->arg_names))
+				array_free(&macro->arg_names);
+			if (ARRAY_IS_VALID(&macro->body))
+				array_free(&macro->body);
+			macro->defined = true;
+			macro->function_like = function_like;
+			macro->body = body;
 			macro->arg_names = arg_names;
 		} else if (strneq(directive.chars, "undef", directive.len)) {
 			skip_whitespace_and_comments(pp, false);
@@ -573,14 +1570,9 @@ static bool handle_pp_directive(PP *pp)
 			}
 
 			// @NOTE: #undef on an undefined macro is allowed (C99 6.10.3.5.2)
-			for (u32 i = 0; i < pp->macro_env.size; i++) {
-				Macro *m = ARRAY_REF(&pp->macro_env, Macro, i);
-				if (m->name.len == macro_name.len
-						&& strneq(m->name.chars, macro_name.chars, macro_name.len)) {
-					ARRAY_REMOVE(&pp->macro_env, Macro, i);
-					break;
-				}
-			}
+			Macro *macro = look_up_macro(&pp->macro_env, macro_name);
+			if (macro != NULL)
+				macro->defined = false;
 
 			skip_whitespace_and_comments(pp, false);
 		} else if (strneq(directive.chars, "line", directive.len)) {
@@ -597,7 +1589,18 @@ static bool handle_pp_directive(PP *pp)
 			issue_error(&directive_start, error);
 			return false;
 		} else if (strneq(directive.chars, "pragma", directive.len)) {
-			UNIMPLEMENTED;
+			skip_whitespace_and_comments(pp, false);
+			String pragma = read_symbol(reader);
+			if (is_valid(pragma) && pragma.len == 4
+					&& strneq(pragma.chars, "once", 4)) {
+				OpenFile *open_file = pp->open_file;
+				if (open_file != NULL && open_file->file != NULL)
+					open_file->file->pragma_once = true;
+			} else {
+				// Unknown pragmas are ignored (C99 6.10.6.1)
+				while (!at_end(reader) && peek_char(reader) != '\n')
+					advance(reader);
+			}
 		} else {
 			issue_error(&reader->source_loc,
 					"Invalid preprocessor directive: %s", directive);
@@ -621,102 +1624,20 @@ static bool handle_pp_directive(PP *pp)
 	return true;
 }
 
-static bool substitute_macro_params(PP *pp, Macro *macro)
+static bool preprocess_file(PP *pp, char *input_filename,
+		SourceLoc blame_source_loc)
 {
-	bool ret;
-	Reader *reader = &pp->reader;
-	SourceLoc start_source_loc = pp->reader.source_loc;
-
-	Array(Macro) new_macro_params = EMPTY_ARRAY;
-
-	Array(char) arg_chars;
-	ARRAY_INIT(&arg_chars, char, 20);
-	u32 args_processed = 0;
-	while (!at_end(reader)) {
-		char c = read_char(reader);
-		switch (c) {
-		case '(': {
-			u32 bracket_depth = 1;
-			*ARRAY_APPEND(&arg_chars, char) = c;
-
-			while (bracket_depth != 0) {
-				char c = read_char(reader);
-				switch (c) {
-				case '(': bracket_depth++; break;
-				case ')': bracket_depth--; break;
-				}
-
-				// @TODO: Append all at once with ARRAY_APPEND_ELEMS instead.
-				*ARRAY_APPEND(&arg_chars, char) = c;
-			}
-			break;
-		}
-		case '"': case '\'':
-			if (!append_string_or_char_literal(reader, c, &arg_chars))
-				return false;
-
-			break;
-		case ')': case ',': {
-			if (args_processed == macro->arg_names.size) {
-				issue_error(&reader->source_loc,
-						"Too many parameters to function-like macro"
-						" (expected %u)",
-						macro->arg_names.size);
-				ret = false;
-				goto cleanup;
-			}
-			Macro *arg_macro = ARRAY_APPEND(&new_macro_params, Macro);
-			arg_macro->name = *ARRAY_REF(&macro->arg_names, String, args_processed);
-
-			char *macro_value = strndup((char *)arg_chars.elements, arg_chars.size); 
-			arg_macro->value = macroexpand(pp, macro_value);
-			free(macro_value);
-
-			if (arg_macro->value == NULL) {
-				ret = false;
-				goto cleanup;
-			}
-
-			arg_macro->arg_names = EMPTY_ARRAY;
-			array_clear(&arg_chars);
-			args_processed++;
-
-			if (c == ')') {
-				ret = true;
-				if (args_processed != macro->arg_names.size) {
-					issue_error(&reader->source_loc,
-							"Not enough parameters to function-like macro"
-							" (expected %u, got %u)",
-							macro->arg_names.size,
-							args_processed);
-					ret = false;
-				}
-
-				goto cleanup;
-			} else {
-				skip_whitespace_and_comments(pp, false);
-			}
-			break;
-		}
-		default:
-			*ARRAY_APPEND(&arg_chars, char) = c;
+	IncludedFile *file =
+		look_up_included_file(&pp->included_files, input_filename);
+	if (file != NULL) {
+		if (file->pragma_once)
+			return true;
+		if (is_valid(file->guard_macro)
+				&& look_up_macro(&pp->macro_env, file->guard_macro) != NULL) {
+			return true;
 		}
 	}
 
-	issue_error(&start_source_loc, "Unterminated macro-like function invocation");
-	ret = false;
-
-cleanup:
-	if (ret)
-		pp->curr_macro_params = new_macro_params;
-
-	array_free(&arg_chars);
-	return ret;
-}
-
-static bool preprocess_file(PP *pp, char *input_filename,
-		SourceLoc blame_source_loc)
-{
 	String buffer = map_file_into_memory(input_filename);
 	if (!is_valid(buffer)) {
 		if (blame_source_loc.filename == NULL) {
@@ -730,58 +1651,30 @@ static bool preprocess_file(PP *pp, char *input_filename,
 	*ARRAY_APPEND(&pp->mapped_files, String) = buffer;
 
 	Reader old_reader = pp->reader;
+	OpenFile *old_open_file = pp->open_file;
+	OpenFile open_file = {
+		.file = file,
+		.guard_state = GUARD_START,
+		.guard_macro = INVALID_STRING,
+		.guard_depth = 0,
+	};
+	pp->open_file = &open_file;
 
 	reader_init(&pp->reader, buffer, EMPTY_ARRAY, true, input_filename);
 	add_adjustment(pp, NORMAL_ADJUSTMENT);
 
 	bool ret = preprocess_aux(pp);
 
-	pp->reader = old_reader;
-	return ret;
-}
-
-static bool preprocess_string(PP *pp, char *string)
-{
-	Reader old_reader = pp->reader;
-	Array(Adjustment) old_adjustments = pp->out_adjustments;
-	Array(PPCondScope) old_scope_stack = pp->pp_scope_stack;
-	pp->out_adjustments = EMPTY_ARRAY;
-	pp->pp_scope_stack = EMPTY_ARRAY;
-
-	reader_init(&pp->reader,
-			(String) { string, strlen(string) }, EMPTY_ARRAY, false, "??");
-
-	bool ret = preprocess_aux(pp);
+	// The guard macro's name points into the file's contents, which stay
+	// mapped until we're done preprocessing.
+	if (ret && file != NULL && open_file.guard_state == GUARD_AFTER_ENDIF)
+		file->guard_macro = open_file.guard_macro;
 
+	pp->open_file = old_open_file;
 	pp->reader = old_reader;
-	array_free(&pp->out_adjustments);
-	array_free(&pp->pp_scope_stack);
-	pp->out_adjustments = old_adjustments;
-	pp->pp_scope_stack = old_scope_stack;
-
 	return ret;
 }
 
-// Convenience wrapper around preprocess_string that doesn't append to the
-// existing buffer, but instead just returns the string.
-static char *macroexpand(PP *pp, char *string)
-{
-	Array(char) old_out_chars = pp->out_chars;
-	pp->out_chars = EMPTY_ARRAY;
-
-	if (!preprocess_string(pp, string)) {
-		array_free(&pp->out_chars);
-		return NULL;
-	}
-
-	*ARRAY_APPEND(&pp->out_chars, char) = '\0';
-
-	char *expanded = (char *)pp->out_chars.elements;
-	pp->out_chars = old_out_chars;
-
-	return expanded;
-}
-
 static void skip_to_next_directive(Reader *reader)
 {
 	// handle_pp_directive puts us at the beginning of the next line,
@@ -814,8 +1707,6 @@ static bool preprocess_aux(PP *pp)
 	Reader *reader = &pp->reader;
 	String *buffer = &pp->reader.buffer;
 
-	ARRAY_ENSURE_ROOM(&pp->out_chars, char, buffer->len);
-
 	while (!at_end(reader)) {
 		u32 start_input_position = reader->position;
 		u32 start_output_position = pp->out_chars.size;
@@ -850,10 +1741,21 @@ static bool preprocess_aux(PP *pp)
 			add_adjustment(pp, NORMAL_ADJUSTMENT);
 		}
 
+		// A line break in the output is always between tokens, so it's a
+		// safe place to end a chunk.
+		if (pp->out_chars.size >= OUTPUT_CHUNK_SIZE
+				&& *ARRAY_LAST(&pp->out_chars, char) == '\n') {
+			if (!flush_output(pp))
+				return false;
+		}
+
 		SourceLoc start_source_loc = reader->source_loc;
 		bool at_start_of_line = reader->at_start_of_line;
 
 		char c = read_char(reader);
+		if (c != EOF && !(c == '#' && at_start_of_line))
+			guard_saw_token(pp);
+
 		switch (c) {
 		// We need to handle string and character literals here so that we
 		// don't expand macros inside them.
@@ -864,73 +1766,17 @@ static bool preprocess_aux(PP *pp)
 			break;
 		}
 		case '#':
-			if (peek_char(reader) == '#') {
-				// Token pasting operator
-				// @TODO: Handle empty replacements properly.
-				// @TODO: Handle the case where '##' is formed out of pasting
-				// other tokens together. In this case it doesn't invoke the
-				// token pasting operator.
-				advance(reader);
-				if (pp->macro_depth == 0) {
-					issue_error(&start_source_loc,
-							"The '##' operator is only allowed in a macro definition");
-					return false;
-				}
-
-				// The only whitespace we should only ever be preceded by is at
-				// most one ' '. It's only valid in a macro definition, so it
-				// can't contain newlines, and skip_comments_and_whitespace
-				// will produce at most one space.
-				if (pp->out_chars.size >= 1) {
-					char prev_char = *ARRAY_LAST(&pp->out_chars, char);
-					if (prev_char == ' ') {
-						pp->out_chars.size--;
-					}
-				}
-
-				skip_whitespace_and_comments(pp, false);
-			} else if (at_start_of_line) {
+			if (at_start_of_line) {
 				if (!handle_pp_directive(pp))
 					return false;
-			} else if (pp->macro_depth == 0) {
+			} else if (peek_char(reader) == '#') {
 				issue_error(&start_source_loc,
-						"Unexpected preprocessor directive (not at start of line)");
+						"The '##' operator is only allowed in a macro definition");
 				return false;
 			} else {
-				// Stringification operator
-				// @TODO: Handle whitespace between preprocessing tokens.
-				// @TODO: Handle whitespace at the start or end of the
-				//        replacement text.
-				skip_whitespace_and_comments(pp, false);
-
-				SourceLoc expected_arg_name_source_loc = reader->source_loc;
-				String arg_name = read_symbol(reader);
-				
-				if (!is_valid(arg_name)) {
-					issue_error(&expected_arg_name_source_loc,
-							"Expected identifier after '#' operator");
-					return false;
-				}
-
-				Macro *macro = look_up_macro(&pp->curr_macro_params, arg_name);
-				if (macro == NULL) {
-					issue_error(&expected_arg_name_source_loc,
-							"Argument to '#' does not name a macro parameter");
-					return false;
-				}
-
-				u32 macro_value_len = strlen(macro->value);
-
-				*ARRAY_APPEND(&pp->out_chars, char) = '"';
-				for (u32 i = 0; i < macro_value_len; i++) {
-					char c = macro->value[i];
-					if (c == '"') {
-						*ARRAY_APPEND(&pp->out_chars, char) = '\\';
-					}
-
-					*ARRAY_APPEND(&pp->out_chars, char) = c;
-				}
-				*ARRAY_APPEND(&pp->out_chars, char) = '"';
+				issue_error(&start_source_loc,
+						"Unexpected preprocessor directive (not at start of line)");
+				return false;
 			}
 
 			break;
@@ -947,53 +1793,22 @@ static bool preprocess_aux(PP *pp)
 					reader->position - symbol_start,
 				};
 
-				Macro *macro = look_up_macro(&pp->curr_macro_params, symbol);
-				if (macro == NULL)
-					macro = look_up_macro(&pp->macro_env, symbol);
-
+				Macro *macro = look_up_macro(&pp->macro_env, symbol);
 				if (macro == NULL) {
 					ARRAY_APPEND_ELEMS(&pp->out_chars, char,
 							symbol.len, symbol.chars);
-				} else if (macro->arg_names.size == 0) {
-					Array(Macro) old_params = pp->curr_macro_params;
-					pp->curr_macro_params = EMPTY_ARRAY;
-					add_adjustment_to(pp, BEGIN_MACRO_ADJUSTMENT, start_source_loc);
-
-					if (!preprocess_string(pp, macro->value))
-						return false;
-					pp->curr_macro_params = old_params;
-
-					add_adjustment(pp, END_MACRO_ADJUSTMENT);
 				} else {
-					skip_whitespace_and_comments(pp, true);
-					if (peek_char(reader) != '(') {
-						// This identifier names a function-like macro, but it
-						// appears here without arguments. Therefore, we leave
-						// it as is.
-						ARRAY_APPEND_ELEMS(&pp->out_chars, char, symbol.len, symbol.chars);
-					} else {
-						read_char(reader);
-
-						Array(Macro) old_params = pp->curr_macro_params;
-						add_adjustment_to(pp, BEGIN_MACRO_ADJUSTMENT, start_source_loc);
-						if (!substitute_macro_params(pp, macro))
-							return false;
-
-						if (!preprocess_string(pp, macro->value))
-							return false;
-
-						array_free(&pp->curr_macro_params);
-						pp->curr_macro_params = old_params;
-
-						// Add a space to separate tokens if necessary.
-						char next_char = peek_char(reader);
-						if (next_char != ' ' && next_char != '\n'
-								&& next_char != EOF) {
-							*ARRAY_APPEND(&pp->out_chars, char) = ' ';
-						}
-
-						add_adjustment(pp, END_MACRO_ADJUSTMENT);
-					}
+					PPToken name_token = {
+						.type = PP_TOKEN_IDENT,
+						.text = symbol,
+						.param_index = 0,
+						.macro = NULL,
+						.whitespace_before = false,
+						.avoid_paste = false,
+						.no_expand = false,
+					};
+					if (!expand_macro_invocation(pp, name_token, start_source_loc))
+						return false;
 				}
 			} else {
 				*ARRAY_APPEND(&pp->out_chars, char) = c;
@@ -1006,21 +1821,32 @@ static bool preprocess_aux(PP *pp)
 	return true;
 }
 
-bool preprocess(char *input_filename, Array(char *) *include_dirs,
-		Array(char) *preprocessed, Array(Adjustment) *adjustments)
+bool preprocess(char *input_filename, IncludeCache *include_cache,
+		PreprocessOutputFunction output, void *output_context)
 {
 	PP pp = {
-		.out_chars = EMPTY_ARRAY,
-		.out_adjustments = EMPTY_ARRAY,
 		.macro_depth = 0,
+		.output = output,
+		.output_context = output_context,
 		.mapped_files = EMPTY_ARRAY,
-		.include_dirs = include_dirs,
+		.include_cache = include_cache,
 		.pp_scope_stack = EMPTY_ARRAY,
-		.macro_env = EMPTY_ARRAY,
-		.curr_macro_params = EMPTY_ARRAY,
+		.macro_env = EMPTY_MACRO_ENV,
+		.expansion_text_used = false,
+		.open_file = NULL,
 	};
+	// Leave some room for the line that takes us over the chunk size.
+	ARRAY_INIT(&pp.out_chars, char, OUTPUT_CHUNK_SIZE + 1024);
+	ARRAY_INIT(&pp.out_adjustments, Adjustment, 256);
+	pool_init(&pp.macro_names, 4096);
+	pool_init(&pp.expansion_text, 1024);
+	ARRAY_INIT(&pp.pending_tokens, PPToken, 16);
+	ARRAY_INIT(&pp.expanded_tokens, PPToken, 16);
+	included_files_init(&pp.included_files);
 
 	bool ret = preprocess_file(&pp, input_filename, (SourceLoc) { NULL, 0, 0 });
+	if (ret)
+		ret = output(output_context, &pp.out_chars, &pp.out_adjustments);
 
 	for (u32 i = 0; i < pp.mapped_files.size; i++) {
 		String *buffer = ARRAY_REF(&pp.mapped_files, String, i);
@@ -1028,15 +1854,14 @@ bool preprocess(char *input_filename, Array(char *) *include_dirs,
 	}
 	array_free(&pp.mapped_files);
 	array_free(&pp.pp_scope_stack);
-	for (u32 i = 0; i < pp.macro_env.size; i++) {
-		Macro *macro = ARRAY_REF(&pp.macro_env, Macro, i);
-		array_free(&macro->arg_names);
-	}
-	array_free(&pp.macro_env);
-	array_free(&pp.curr_macro_params);
-
-	*preprocessed = pp.out_chars;
-	*adjustments = pp.out_adjustments;
+	macro_env_free(&pp.macro_env);
+	pool_free(&pp.macro_names);
+	pool_free(&pp.expansion_text);
+	array_free(&pp.pending_tokens);
+	array_free(&pp.expanded_tokens);
+	included_files_free(&pp.included_files);
+	array_free(&pp.out_chars);
+	array_free(&pp.out_adjustments);
 
 	return ret;
 }
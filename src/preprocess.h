@@ -2,9 +2,17 @@
 #define NAIVE_PREPROCESS_H_
 
 #include "array.h"
+#include "include_cache.h"
 #include "reader.h"
 
-bool preprocess(char *input_filename, Array(char *) *include_dirs,
-		Array(char) *preprocessed, Array(Adjustment) *adjustments);
+// Called with each chunk of output as the preprocessor produces it, so that
+// the whole preprocessed file never has to be held in memory. Chunks always
+// end at a line break between tokens, and adjustment locations are relative
+// to the start of the chunk. Both arrays are reused once this returns.
+typedef bool (*PreprocessOutputFunction)(void *context, Array(char) *chars,
+		Array(Adjustment) *adjustments);
+
+bool preprocess(char *input_filename, IncludeCache *include_cache,
+		PreprocessOutputFunction output, void *output_context);
 
 #endif
@@ -0,0 +1,144 @@
+// @PORT
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "pool.h"
+#include "time_report.h"
+
+// @PORT
+static u64 clock_ns(clockid_t clock_id)
+{
+	struct timespec now;
+	int ret = clock_gettime(clock_id, &now);
+	assert(ret == 0);
+
+	return (u64)now.tv_sec * 1000000000 + (u64)now.tv_nsec;
+}
+
+static u64 cpu_clock_ns(TimeReport *report)
+{
+	return clock_ns(report->whole_process
+			? CLOCK_PROCESS_CPUTIME_ID
+			: CLOCK_THREAD_CPUTIME_ID);
+}
+
+// @PORT
+static u64 max_rss_kb(void)
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+	return usage.ru_maxrss;
+}
+
+void time_report_init(TimeReport *report, char *title, bool whole_process)
+{
+	if (report == NULL)
+		return;
+
+	report->title = title;
+	report->whole_process = whole_process;
+	ARRAY_INIT(&report->phases, TimeReportPhase, 10);
+	report->current_phase = NULL;
+}
+
+void time_report_begin_phase(TimeReport *report, char *name)
+{
+	if (report == NULL)
+		return;
+
+	assert(report->current_phase == NULL);
+	report->current_phase = name;
+	report->start_pool_bytes = pool_bytes_allocated;
+	report->start_array_bytes = array_bytes_allocated;
+	report->start_cpu_ns = cpu_clock_ns(report);
+	report->start_wall_ns = clock_ns(CLOCK_MONOTONIC);
+}
+
+void time_report_end_phase(TimeReport *report)
+{
+	if (report == NULL)
+		return;
+
+	u64 end_wall_ns = clock_ns(CLOCK_MONOTONIC);
+	u64 end_cpu_ns = cpu_clock_ns(report);
+
+	assert(report->current_phase != NULL);
+	*ARRAY_APPEND(&report->phases, TimeReportPhase) = (TimeReportPhase) {
+		.name = report->current_phase,
+		.wall_ns = end_wall_ns - report->start_wall_ns,
+		.cpu_ns = end_cpu_ns - report->start_cpu_ns,
+		.pool_bytes = pool_bytes_allocated - report->start_pool_bytes,
+		.array_bytes = array_bytes_allocated - report->start_array_bytes,
+		.max_rss_kb = max_rss_kb(),
+		.count_name = NULL,
+	};
+	report->current_phase = NULL;
+}
+
+void time_report_set_count(TimeReport *report, char *count_name, u64 count)
+{
+	if (report == NULL)
+		return;
+
+	assert(report->phases.size != 0);
+	TimeReportPhase *phase = ARRAY_LAST(&report->phases, TimeReportPhase);
+	phase->count_name = count_name;
+	phase->count = count;
+}
+
+static void print_padded(FILE *output, char *str, u32 width)
+{
+	fputs(str, output);
+	for (u32 i = strlen(str); i < width; i++)
+		fputc(' ', output);
+}
+
+static void print_phase(FILE *output, TimeReportPhase *phase)
+{
+	fputs("  ", output);
+	print_padded(output, phase->name, 12);
+	fprintf(output, "%lu us wall, %lu us cpu, %lu KB pools, %lu KB arrays, "
+			"%lu KB peak RSS",
+			(unsigned long)(phase->wall_ns / 1000),
+			(unsigned long)(phase->cpu_ns / 1000),
+			(unsigned long)(phase->pool_bytes / 1024),
+			(unsigned long)(phase->array_bytes / 1024),
+			(unsigned long)phase->max_rss_kb);
+	if (phase->count_name != NULL)
+		fprintf(output, ", %lu %s", (unsigned long)phase->count, phase->count_name);
+	fputc('\n', output);
+}
+
+void time_report_print(TimeReport *report, FILE *output)
+{
+	if (report == NULL)
+		return;
+
+	TimeReportPhase total = { .name = "total", .count_name = NULL };
+	fprintf(output, "Time report for %s:\n", report->title);
+	for (u32 i = 0; i < report->phases.size; i++) {
+		TimeReportPhase *phase = ARRAY_REF(&report->phases, TimeReportPhase, i);
+		print_phase(output, phase);
+
+		total.wall_ns += phase->wall_ns;
+		total.cpu_ns += phase->cpu_ns;
+		total.pool_bytes += phase->pool_bytes;
+		total.array_bytes += phase->array_bytes;
+		if (phase->max_rss_kb > total.max_rss_kb)
+			total.max_rss_kb = phase->max_rss_kb;
+	}
+	print_phase(output, &total);
+}
+
+void time_report_free(TimeReport *report)
+{
+	if (report == NULL)
+		return;
+
+	array_free(&report->phases);
+}
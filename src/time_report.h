@@ -0,0 +1,53 @@
+#ifndef NAIVE_TIME_REPORT_H_
+#define NAIVE_TIME_REPORT_H_
+
+#include <stdio.h>
+
+#include "array.h"
+#include "misc.h"
+
+typedef struct TimeReportPhase
+{
+	char *name;
+
+	u64 wall_ns;
+	u64 cpu_ns;
+	// Bytes allocated by pools and arrays during the phase. We don't track
+	// frees, so this is how much they grew rather than how much is live.
+	u64 pool_bytes;
+	u64 array_bytes;
+	// Peak resident set size of the process at the end of the phase.
+	u64 max_rss_kb;
+
+	// An optional count of whatever the phase produced, e.g.: "tokens".
+	char *count_name;
+	u64 count;
+} TimeReportPhase;
+
+typedef struct TimeReport
+{
+	char *title;
+	Array(TimeReportPhase) phases;
+	// Whether CPU time is for the whole process, rather than just the calling
+	// thread. Reports for a single TU shouldn't count time spent compiling
+	// other TUs on other threads.
+	bool whole_process;
+
+	char *current_phase;
+	u64 start_wall_ns;
+	u64 start_cpu_ns;
+	u64 start_pool_bytes;
+	u64 start_array_bytes;
+} TimeReport;
+
+// All of these do nothing if report is NULL, so that callers don't need to
+// check whether reporting is enabled.
+void time_report_init(TimeReport *report, char *title, bool whole_process);
+void time_report_begin_phase(TimeReport *report, char *name);
+void time_report_end_phase(TimeReport *report);
+// Attaches a count to the most recently ended phase.
+void time_report_set_count(TimeReport *report, char *count_name, u64 count);
+void time_report_print(TimeReport *report, FILE *output);
+void time_report_free(TimeReport *report);
+
+#endif
@@ -11,13 +11,6 @@
 #include "tokenise.h"
 #include "util.h"
 
-typedef struct Tokeniser
-{
-	Reader reader;
-	Array(SourceToken) *tokens;
-} Tokeniser;
-
-
 static Token *append_token(
 		Tokeniser *tokeniser, SourceLoc source_loc, TokenType type)
 {
@@ -28,32 +21,60 @@ static Token *append_token(
 	return (Token *)source_token;
 }
 
-static bool tokenise_aux(Tokeniser *tokeniser);
+static bool tokenise_aux(Tokeniser *tokeniser, Reader *reader);
 
-bool tokenise(Array(SourceToken) *tokens, Array(char) *text,
-		Array(Adjustment) *adjustments)
+void tokeniser_init(Tokeniser *tokeniser, Array(SourceToken) *tokens)
 {
 	ARRAY_INIT(tokens, SourceToken, 500);
 
-	Tokeniser tokeniser;
-	tokeniser.tokens = tokens;
-	reader_init(&tokeniser.reader,
-			(String) { (char *)text->elements, text->size },
+	tokeniser->tokens = tokens;
+	tokeniser->source_loc = (SourceLoc) { NULL, 0, 0 };
+}
+
+bool tokenise_chunk(Tokeniser *tokeniser, Array(char) *text,
+		Array(Adjustment) *adjustments)
+{
+	SourceLoc prev_chunk_end = tokeniser->source_loc;
+	Reader chunk_reader;
+	Reader *reader = &chunk_reader;
+	reader_init(reader, (String) { (char *)text->elements, text->size },
 			*adjustments, false, NULL);
 
 	// @TODO: It feels like there should be a nicer way of doing this such that
 	// we don't need a special case here. Maybe reader_init should do the
 	// requisite logic from advance to set source_loc properly, but not advance
 	// forward a character?
-	assert(adjustments->size != 0);
-	Adjustment *first = ARRAY_REF(adjustments, Adjustment, 0);
-	assert(first->location == 0);
-	assert(first->type == NORMAL_ADJUSTMENT);
+	Adjustment *first = NULL;
+	if (adjustments->size != 0)
+		first = ARRAY_REF(adjustments, Adjustment, 0);
+	if (prev_chunk_end.filename == NULL) {
+		assert(first != NULL);
+		assert(first->location == 0);
+		assert(first->type == NORMAL_ADJUSTMENT);
+	}
 
-	tokeniser.reader.source_loc = first->new_source_loc;
-	tokeniser.reader.next_adjustment++;
+	if (first != NULL && first->location == 0) {
+		reader->source_loc = first->new_source_loc;
+		reader->next_adjustment++;
+	} else {
+		// Carry on from where the previous chunk left off, the same as if
+		// we'd advanced onto this char within a single buffer.
+		reader->source_loc = prev_chunk_end;
+		if (peek_char(reader) == '\n') {
+			reader->source_loc.line++;
+			reader->source_loc.column = 0;
+		}
+	}
+
+	bool ret = tokenise_aux(tokeniser, reader);
+	tokeniser->source_loc = reader->source_loc;
 
-	bool ret = tokenise_aux(&tokeniser);
+	return ret;
+}
+
+void tokeniser_finish(Tokeniser *tokeniser)
+{
+	Array(SourceToken) *tokens = tokeniser->tokens;
 
 	// Concatentate adjacent string literals
 	u32 dest = 0;
@@ -91,8 +112,6 @@ bool tokenise(Array(SourceToken) *tokens, Array(char) *text,
 	}
 
 	tokens->size = dest;
-
-	return ret;
 }
 
 
@@ -229,9 +248,8 @@ i64 read_char_in_literal(Reader *reader, SourceLoc *start_source_loc) {
 	return value;
 }
 
-static bool tokenise_aux(Tokeniser *tokeniser)
+static bool tokenise_aux(Tokeniser *tokeniser, Reader *reader)
 {
-	Reader *reader = &tokeniser->reader;
 
 	while (!at_end(reader)) {
 		SourceLoc start_source_loc = reader->source_loc;
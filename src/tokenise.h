@@ -119,8 +119,21 @@ typedef struct SourceToken
 
 extern char *token_type_names[];
 
-bool tokenise(Array(SourceToken) *tokens, Array(char) *text,
+typedef struct Tokeniser
+{
+	Array(SourceToken) *tokens;
+	// Where the previous chunk left off.
+	SourceLoc source_loc;
+} Tokeniser;
+
+// The preprocessor's output is tokenised a chunk at a time, as it's produced.
+// Tokens must not span chunks, and adjustment locations are relative to the
+// start of each chunk. The first chunk must start with an adjustment.
+void tokeniser_init(Tokeniser *tokeniser, Array(SourceToken) *tokens);
+bool tokenise_chunk(Tokeniser *tokeniser, Array(char) *text,
 		Array(Adjustment) *adjustments);
+// Concatenates adjacent string literals, once all chunks have been read.
+void tokeniser_finish(Tokeniser *tokeniser);
 void dump_token(Token *token);
 
 #endif
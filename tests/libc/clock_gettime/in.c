@@ -0,0 +1,24 @@
+#include <assert.h>
+#include <sys/resource.h>
+#include <time.h>
+
+int main()
+{
+	struct timespec start;
+	assert(clock_gettime(CLOCK_MONOTONIC, &start) == 0);
+
+	struct timespec cpu;
+	assert(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu) == 0);
+	assert(cpu.tv_nsec >= 0 && cpu.tv_nsec < 1000000000);
+
+	struct timespec end;
+	assert(clock_gettime(CLOCK_MONOTONIC, &end) == 0);
+	assert(end.tv_sec > start.tv_sec
+			|| (end.tv_sec == start.tv_sec && end.tv_nsec >= start.tv_nsec));
+
+	struct rusage usage;
+	assert(getrusage(RUSAGE_SELF, &usage) == 0);
+	assert(usage.ru_maxrss > 0);
+
+	return 0;
+}
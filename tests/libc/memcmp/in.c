@@ -0,0 +1,15 @@
+#include <assert.h>
+#include <string.h>
+
+int main()
+{
+	assert(memcmp("abc", "abc", 3) == 0);
+	assert(memcmp("abc", "abd", 3) < 0);
+	assert(memcmp("abd", "abc", 3) > 0);
+	assert(memcmp("abc", "abd", 2) == 0);
+	assert(memcmp("a\0b", "a\0c", 3) < 0);
+	assert(memcmp("\xff", "\x01", 1) > 0);
+	assert(memcmp("x", "y", 0) == 0);
+
+	return 0;
+}
@@ -0,0 +1,31 @@
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+int main()
+{
+	assert(opendir("in.c") == NULL);
+	assert(opendir("non_existent") == NULL);
+
+	DIR *dir = opendir(".");
+	assert(dir != NULL);
+
+	int found_self = 0;
+	int found_parent = 0;
+	int found_source = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0)
+			found_self++;
+		else if (strcmp(entry->d_name, "..") == 0)
+			found_parent++;
+		else if (strcmp(entry->d_name, "in.c") == 0)
+			found_source++;
+	}
+
+	printf("%d %d %d\n", found_self, found_parent, found_source);
+
+	assert(closedir(dir) == 0);
+	return 0;
+}
@@ -0,0 +1,26 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int main()
+{
+	char buf[8];
+	memset(buf, 'x', sizeof buf);
+
+	assert(snprintf(buf, sizeof buf, "%d", 123) == 3);
+	assert(strcmp(buf, "123") == 0);
+
+	// Truncated output is still null-terminated, and we get the length it
+	// would have had.
+	assert(snprintf(buf, sizeof buf, "%s:%d", "abcdef", 42) == 9);
+	assert(strcmp(buf, "abcdef:") == 0);
+
+	assert(snprintf(buf, 0, "%d", 5) == 1);
+	assert(buf[0] == 'a');
+
+	char big[32];
+	assert(sprintf(big, "%s #%d", "item", 7) == 7);
+	assert(strcmp(big, "item #7") == 0);
+
+	return 0;
+}
@@ -0,0 +1,24 @@
+#include <assert.h>
+#include <sys/stat.h>
+
+// <sys/stat.h> includes <time.h>. Searching next to the including file first
+// would find <sys/time.h> instead, and its struct timeval would clash with
+// this one.
+struct timeval
+{
+	int seconds;
+};
+
+int main()
+{
+	struct timeval t;
+	t.seconds = 1;
+	assert(t.seconds == 1);
+
+	struct timespec now;
+	assert(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+	time_t seconds = now.tv_sec;
+	assert(seconds >= 0);
+
+	return 0;
+}
@@ -0,0 +1,18 @@
+#include <assert.h>
+#include <ctype.h>
+
+// libc.a also defines tolower. Only archive members that resolve undefined
+// symbols get linked in, so this definition takes precedence rather than
+// conflicting with it.
+int tolower(int c)
+{
+	return c + 1;
+}
+
+int main()
+{
+	assert(tolower('A') == 'B');
+	assert(isdigit('1'));
+
+	return 0;
+}
@@ -0,0 +1,67 @@
+#include <assert.h>
+
+int a;
+int b;
+int c;
+int d;
+
+// Short loop: both the backward and the forward branch fit in a rel8.
+int sum_to(int n)
+{
+	int total = 0;
+	for (int i = 0; i < n; i++)
+		total += i;
+
+	return total;
+}
+
+// The loop body is long enough that the branches around it need a rel32.
+int long_loop(int n)
+{
+	int total = 0;
+	for (int i = 0; i < n; i++) {
+		a = a + i; b = b + a; c = c + b; d = d + c;
+		a = a ^ d; b = b ^ a; c = c ^ b; d = d ^ c;
+		a = a + i; b = b + a; c = c + b; d = d + c;
+		a = a ^ d; b = b ^ a; c = c ^ b; d = d ^ c;
+		a = a + i; b = b + a; c = c + b; d = d + c;
+		a = a ^ d; b = b ^ a; c = c ^ b; d = d ^ c;
+		total += i;
+	}
+
+	return total;
+}
+
+// A mix of short branches nested inside a long one.
+int mixed(int n)
+{
+	int total = 0;
+	if (n > 0) {
+		for (int i = 0; i < n; i++) {
+			if (i & 1)
+				total += i;
+			else
+				total -= i;
+		}
+		a = a + n; b = b + a; c = c + b; d = d + c;
+		a = a ^ d; b = b ^ a; c = c ^ b; d = d ^ c;
+		a = a + n; b = b + a; c = c + b; d = d + c;
+		a = a ^ d; b = b ^ a; c = c ^ b; d = d ^ c;
+		a = a + n; b = b + a; c = c + b; d = d + c;
+		a = a ^ d; b = b ^ a; c = c ^ b; d = d ^ c;
+	} else {
+		total = -1;
+	}
+
+	return total;
+}
+
+int main()
+{
+	assert(sum_to(10) == 45);
+	assert(long_loop(10) == 45);
+	assert(mixed(10) == -5);
+	assert(mixed(0) == -1);
+
+	return 0;
+}
@@ -0,0 +1,36 @@
+// FLAGS: -ffunction-sections -Wl,--call-graph-ordering
+#include <assert.h>
+
+int callee(int x);
+
+int caller(int x)
+{
+	return callee(x) + callee(x + 1);
+}
+
+int unrelated(int x)
+{
+	return x * 2;
+}
+
+int callee(int x)
+{
+	return x + 1;
+}
+
+typedef int (*Function)(int);
+
+int main()
+{
+	assert(caller(1) == 5);
+	assert(unrelated(2) == 4);
+
+	// callee is placed straight after caller, rather than after unrelated.
+	Function caller_ptr = caller;
+	Function callee_ptr = callee;
+	Function unrelated_ptr = unrelated;
+	assert((char *)caller_ptr < (char *)callee_ptr);
+	assert((char *)callee_ptr < (char *)unrelated_ptr);
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+#include <assert.h>
+
+#define FLAG_A 1
+#define FLAG_B 0
+#define MODE (FLAG_A * 4 + FLAG_B * 2)
+
+int count_if_enabled(int n)
+{
+	int total = 0;
+	int enabled = MODE > 2;
+	for (int i = 0; i < n; i++) {
+		if (enabled)
+			total += MODE;
+		else
+			total -= 1;
+	}
+
+	return total;
+}
+
+// Dense enough to be lowered to a jump table. When this is inlined with a
+// constant argument outside the table, the index folds to a constant that
+// the bounds check rules out.
+static int lookup(int x)
+{
+	switch (x) {
+	case 0: return 1;
+	case 1: return 2;
+	case 2: return 3;
+	case 3: return 4;
+	case 4: return 5;
+	case 5: return 6;
+	case 6: return 7;
+	case 7: return 8;
+	default: return 0;
+	}
+}
+
+int constant_out_of_table()
+{
+	int x = 1000;
+	switch (x) {
+	case 0: return 1;
+	case 1: return 2;
+	case 2: return 3;
+	case 3: return 4;
+	case 4: return 5;
+	case 5: return 6;
+	default: return 9;
+	}
+}
+
+unsigned divide(unsigned a, unsigned b)
+{
+	return a / b;
+}
+
+int main()
+{
+	unsigned long a = (unsigned long)(unsigned)-1;
+	assert(a == 0xFFFFFFFF);
+
+	long b = -6 / 2;
+	assert(b == -3);
+	int c = -7 / 2;
+	assert(c == -3);
+	int d = -7 % 2;
+	assert(d == -1);
+
+	assert(0xFFFFFFFFu / 3 == 1431655765);
+	assert(4294967295u % 10 == 5);
+	assert((unsigned long)-1 / 3 == 6148914691236517205ul);
+	assert((unsigned long)-1 % 10 == 5);
+	assert(divide(0xFFFFFFFF, 16) == 0xFFFFFFF);
+	unsigned e = 0xFFFFFFF0;
+	e /= 16;
+	assert(e == 0xFFFFFFF);
+
+	assert(lookup(3) == 4);
+	assert(lookup(100) == 0);
+	assert(lookup(-1) == 0);
+	assert(constant_out_of_table() == 9);
+
+	assert((int)0x80000000 < 0);
+	assert((unsigned)-1 > 5u);
+	assert(0xFFFFFFFFu + 2u == 1);
+	assert((long)(int)0xFFFFFFFF == -1);
+	assert((unsigned char)300 == 44);
+	assert((signed char)200 == -56);
+	assert(0xFFFFFFFFu >> 4 == 0xFFFFFFF);
+	assert((1 << 31) < 0);
+
+	int x = 3;
+	int y = x * 4 + 1;
+	if (y != 13)
+		assert(0);
+	assert(count_if_enabled(5) == 20);
+
+	return 0;
+}
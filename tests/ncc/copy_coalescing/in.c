@@ -0,0 +1,84 @@
+#include <assert.h>
+
+// Loop phis whose incoming values are computed from them.
+int triangle(int n)
+{
+	int total = 0;
+	for (int i = 0; i < n; i++)
+		total += i;
+
+	return total;
+}
+
+// The phis swap each iteration, so their moves form a cycle and the vregs
+// interfere.
+int fib(int n)
+{
+	int a = 0;
+	int b = 1;
+	for (int i = 0; i < n; i++) {
+		int next = a + b;
+		a = b;
+		b = next;
+	}
+
+	return a;
+}
+
+void swap_loop(long *out_a, long *out_b, int n)
+{
+	long a = 1;
+	long b = 2;
+	for (int i = 0; i < n; i++) {
+		long t = a;
+		a = b;
+		b = t;
+	}
+
+	*out_a = a;
+	*out_b = b;
+}
+
+// Widening a 32-bit value relies on the MOV clearing the upper half of the
+// register, so the copy has to stay.
+unsigned long widen(unsigned int x, int n)
+{
+	unsigned long total = 0;
+	for (int i = 0; i < n; i++) {
+		unsigned long wide = x;
+		total += wide;
+		x = x - 1;
+	}
+
+	return total;
+}
+
+// The source is still live after the copy, and both are modified.
+int copy_then_modify(int x)
+{
+	int y = x;
+	for (int i = 0; i < 3; i++) {
+		y = y * 2;
+		x = x + 1;
+	}
+
+	return y - x;
+}
+
+int main()
+{
+	assert(triangle(10) == 45);
+	assert(fib(10) == 55);
+
+	long a;
+	long b;
+	swap_loop(&a, &b, 3);
+	assert(a == 2 && b == 1);
+	swap_loop(&a, &b, 4);
+	assert(a == 1 && b == 2);
+
+	assert(widen(0xFFFFFFFF, 2) == 0x1FFFFFFFDUL);
+	assert(copy_then_modify(5) == 32);
+
+	return 0;
+}
@@ -0,0 +1,35 @@
+#include <assert.h>
+
+static int calls = 0;
+
+int side_effect(int x)
+{
+	calls++;
+	return x * 2;
+}
+
+int f(int *out, int n)
+{
+	int unused = side_effect(n);
+	int also_unused = n * 7 + 3;
+	long widened = (long)n;
+	int cycle = 0;
+	for (int i = 0; i < n; i++)
+		cycle = cycle + i;
+
+	*out = n + 1;
+	if (0)
+		return -1;
+
+	return n;
+}
+
+int main()
+{
+	int out = 0;
+	assert(f(&out, 4) == 4);
+	assert(out == 5);
+	assert(calls == 1);
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+// FLAGS: -ffunction-sections -fdata-sections -Wl,--gc-sections
+#include <assert.h>
+#include <string.h>
+
+// Nothing calls this, so it should be discarded along with its reference to
+// a symbol that isn't defined anywhere.
+void not_defined_anywhere(void);
+void unused(void)
+{
+	not_defined_anywhere();
+}
+
+static int counter;
+int unused_data[100] = { 1 };
+
+static int add_one(int x)
+{
+	return x + 1;
+}
+
+static int add_two(int x)
+{
+	return x + 2;
+}
+
+typedef int (*AddFunction)(int);
+static AddFunction adders[] = { add_one, add_two };
+
+static char *names[] = { "one", "two" };
+
+int pick(int n)
+{
+	switch (n) {
+	case 0: return 10;
+	case 1: return 11;
+	case 2: return 12;
+	case 3: return 13;
+	case 4: return 14;
+	default: return -1;
+	}
+}
+
+int main()
+{
+	assert(adders[0](1) == 2);
+	assert(adders[1](1) == 3);
+	assert(strcmp(names[1], "two") == 0);
+
+	counter++;
+	assert(counter == 1);
+
+	assert(pick(0) == 10);
+	assert(pick(3) == 13);
+	assert(pick(7) == -1);
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+#include <assert.h>
+
+int first(int x)
+{
+	int ret = 1;
+	if (x == 0) {
+		ret = 2;
+		goto done;
+	}
+	ret = 3;
+
+done:
+	return ret;
+}
+
+// Uses the same label name as first, but must branch to its own label.
+int second(int x)
+{
+	int ret = 10;
+	if (x == 0) {
+		ret = 20;
+		goto done;
+	}
+	ret = 30;
+
+done:
+	return ret + 1;
+}
+
+int main()
+{
+	assert(first(0) == 2);
+	assert(first(1) == 3);
+	assert(second(0) == 21);
+	assert(second(1) == 31);
+
+	return 0;
+}
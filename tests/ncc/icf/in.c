@@ -0,0 +1,79 @@
+// FLAGS: -ffunction-sections -Wl,--icf=all
+#include <assert.h>
+
+int add_one(int x)
+{
+	return x + 1;
+}
+
+int also_add_one(int x)
+{
+	return x + 1;
+}
+
+int add_two(int x)
+{
+	return x + 2;
+}
+
+// These only become foldable once we know is_even and other_is_even are
+// identical, and vice versa.
+int is_odd(int x);
+int is_even(int x)
+{
+	return x == 0 ? 1 : is_odd(x - 1);
+}
+
+int is_odd(int x)
+{
+	return x == 0 ? 0 : is_even(x - 1);
+}
+
+int other_is_odd(int x);
+int other_is_even(int x)
+{
+	return x == 0 ? 1 : other_is_odd(x - 1);
+}
+
+int other_is_odd(int x)
+{
+	return x == 0 ? 0 : other_is_even(x - 1);
+}
+
+int call_add_one(int x)
+{
+	return add_one(x);
+}
+
+int call_add_two(int x)
+{
+	return add_two(x);
+}
+
+typedef int (*Function)(int);
+
+int main()
+{
+	assert(add_one(1) == 2);
+	assert(also_add_one(1) == 2);
+	assert(add_two(1) == 3);
+	assert(is_even(4) && !is_even(5));
+	assert(other_is_odd(5) && !other_is_odd(4));
+	assert(call_add_one(1) == 2);
+	assert(call_add_two(1) == 3);
+
+	Function add_one_ptr = add_one;
+	Function also_add_one_ptr = also_add_one;
+	Function add_two_ptr = add_two;
+	Function is_even_ptr = is_even;
+	Function other_is_even_ptr = other_is_even;
+	Function call_add_one_ptr = call_add_one;
+	Function call_add_two_ptr = call_add_two;
+
+	assert(add_one_ptr == also_add_one_ptr);
+	assert(add_one_ptr != add_two_ptr);
+	assert(is_even_ptr == other_is_even_ptr);
+	assert(call_add_one_ptr != call_add_two_ptr);
+
+	return 0;
+}
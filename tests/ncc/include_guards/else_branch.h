@@ -0,0 +1,5 @@
+#ifndef ELSE_BRANCH_H
+#define ELSE_BRANCH_H
+#else
+count++;
+#endif
@@ -0,0 +1,9 @@
+// Comments and whitespace around the guard are fine.
+#ifndef GUARDED_H
+#define GUARDED_H
+#ifdef NESTED
+#else
+#endif
+count++;
+#endif
+
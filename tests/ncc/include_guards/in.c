@@ -0,0 +1,35 @@
+#include <assert.h>
+
+#pragma unknown pragmas are ignored
+
+int main()
+{
+	int count = 0;
+#include "guarded.h"
+#include "guarded.h"
+#include "./guarded.h"
+	assert(count == 1);
+
+#undef GUARDED_H
+#include "guarded.h"
+	assert(count == 2);
+
+	count = 0;
+#include "not_guarded.h"
+#include "not_guarded.h"
+	assert(count == 2);
+
+	count = 0;
+#include "else_branch.h"
+#include "else_branch.h"
+#include "else_branch.h"
+	assert(count == 2);
+
+	count = 0;
+#include "once.h"
+#include "once.h"
+#include "./once.h"
+	assert(count == 1);
+
+	return 0;
+}
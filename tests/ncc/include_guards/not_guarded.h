@@ -0,0 +1,4 @@
+#ifndef NOT_GUARDED_H
+#define NOT_GUARDED_H
+#endif
+count++;
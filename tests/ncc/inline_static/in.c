@@ -0,0 +1,76 @@
+#include <assert.h>
+
+typedef struct Vec
+{
+	int x;
+	int y;
+} Vec;
+
+static int get_x(Vec *v)
+{
+	return v->x;
+}
+
+static int clamp(int value, int low, int high)
+{
+	if (value < low)
+		return low;
+	if (value > high)
+		return high;
+	return value;
+}
+
+static int identity(int x)
+{
+	return x;
+}
+
+static void store_twice(int *p, int value)
+{
+	*p = value * 2;
+}
+
+static int count_down(int n)
+{
+	if (n <= 0)
+		return 0;
+	return 1 + count_down(n - 1);
+}
+
+static int loops(int n)
+{
+	int total = 0;
+	for (int i = 0; i < n; i++)
+		total += i;
+	return total;
+}
+
+inline int twice(int x)
+{
+	return x * 2;
+}
+
+static int (*fn_ptr)(int) = identity;
+
+int main()
+{
+	Vec v = { 3, 4 };
+	int sum = 0;
+	for (int i = 0; i < 10; i++)
+		sum += get_x(&v) + clamp(i, 2, 7);
+	assert(sum == 30 + 2 + 2 + 2 + 3 + 4 + 5 + 6 + 7 + 7 + 7);
+
+	assert(identity(identity(5)) == 5);
+	assert(clamp(identity(-3), identity(0), 10) == 0);
+
+	int out = 0;
+	store_twice(&out, 21);
+	assert(out == 42);
+
+	assert(count_down(5) == 5);
+	assert(loops(5) == 10);
+	assert(twice(4) == 8);
+	assert(fn_ptr(9) == 9);
+
+	return 0;
+}
@@ -0,0 +1,5 @@
+inline int twice(int x)
+{
+	return x * 2;
+}
+extern inline int twice(int x);
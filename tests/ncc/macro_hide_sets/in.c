@@ -0,0 +1,39 @@
+// FLAGS: -E
+
+// Names that reappear after their expansion has been rescanned through a
+// function-like macro argument must stay unexpanded, as with hide sets.
+
+#define f(x) x
+#define g f(g
+case1: g)
+
+#define A() B
+#define B A
+case2: A()() ()
+
+#define obj(x) x obj
+#define id(x) x
+case3: id(obj(1))(2)
+
+#define h(x) x h
+case4: id(h)(1)
+
+#define k(x) k x
+case5: k(k)(2)
+
+#define LP (
+#define m(x) x m LP 3 )
+case6: m(1)
+
+#define n(x) id(n)(x)
+case7: n(1)
+
+#define p() q
+#define q() p
+case8: p()()()()
+
+#define r(x) x(r)
+case9: r(r)
+case10: id(id)(id)(5)
+#define s f(s)
+case11: s
@@ -0,0 +1,31 @@
+// FLAGS: -E
+
+#define foo foo + 1
+#define a b
+#define b a
+#define f g
+#define g(x) x * 2
+#define h() 42
+#define NEG -1
+#define neg(x) -x
+#define S(x) #x
+#define CAT(x, y) x ## y
+#define EMPTY
+
+foo
+a b
+f(3) f
+(4)
+h()
+-NEG neg(-1)
+S("a\n" 'b' c)
+CAT(, y) CAT(x, ) CAT(EMPTY, 1)
+
+#define x 3
+#define ff(a) ff(x * (a))
+#undef x
+#define x 2
+#define gg ff
+#define z z[0]
+#define t(a) a
+ff(y+1) + ff(ff(z)) % t(t(gg)(0) + t)(1);
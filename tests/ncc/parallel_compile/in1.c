@@ -0,0 +1,8 @@
+// FLAGS: -j3
+int twice(int x);
+int square(int x);
+
+int main(void)
+{
+	return twice(3) + square(2) - 10;
+}
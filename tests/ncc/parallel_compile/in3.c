@@ -0,0 +1,5 @@
+#error only this TU fails
+int square(int x)
+{
+	return x * x;
+}
@@ -0,0 +1,23 @@
+// FLAGS: -j4
+#include <assert.h>
+
+extern int counter;
+extern int *counter_ptr;
+int add_two(int x);
+int add_three(int x);
+
+int add_one(int x)
+{
+	return x + 1;
+}
+
+int main()
+{
+	assert(add_three(1) == 4);
+	assert(add_two(1) == 3);
+
+	counter = 5;
+	assert(*counter_ptr == 5);
+
+	return 0;
+}
@@ -0,0 +1,9 @@
+int add_one(int x);
+
+int counter;
+int *counter_ptr = &counter;
+
+int add_two(int x)
+{
+	return add_one(add_one(x));
+}
@@ -0,0 +1,7 @@
+int add_one(int x);
+int add_two(int x);
+
+int add_three(int x)
+{
+	return add_two(add_one(x));
+}
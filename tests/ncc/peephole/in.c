@@ -0,0 +1,84 @@
+#include <assert.h>
+
+int flag;
+
+int less_and_record(int a, int b)
+{
+	int less = a < b;
+	flag = less;
+	if (less)
+		return 1;
+
+	return 2;
+}
+
+unsigned below_and_record(unsigned a, unsigned b)
+{
+	int below = a < b;
+	flag = below;
+	if (below)
+		return 3;
+
+	return 4;
+}
+
+int bool_branch(int a, int b)
+{
+	_Bool differ = a != b;
+	if (differ)
+		return 5;
+
+	return 6;
+}
+
+int unsigned_bool_branch(unsigned a, unsigned b)
+{
+	_Bool above = a > b;
+	if (above)
+		return 8;
+
+	return 7;
+}
+
+long through_memory(long x)
+{
+	long y = x;
+	long *p = &y;
+	*p = *p + 1;
+	return *p;
+}
+
+int branches(int n)
+{
+	int total = 0;
+	for (int i = 0; i < n; i++) {
+		if (i == 3)
+			continue;
+		if (i > 6)
+			break;
+		total += i;
+	}
+
+	return total;
+}
+
+int main()
+{
+	assert(less_and_record(1, 2) == 1);
+	assert(flag == 1);
+	assert(less_and_record(2, 1) == 2);
+	assert(flag == 0);
+	assert(below_and_record(1, 0xFFFFFFFF) == 3);
+	assert(flag == 1);
+	assert(below_and_record(0xFFFFFFFF, 1) == 4);
+	assert(flag == 0);
+	assert(bool_branch(1, 2) == 5);
+	assert(bool_branch(2, 2) == 6);
+	assert(unsigned_bool_branch(0xFFFFFFFF, 1) == 8);
+	assert(unsigned_bool_branch(1, 0xFFFFFFFF) == 7);
+	assert(unsigned_bool_branch(1, 1) == 7);
+	assert(through_memory(41) == 42);
+	assert(branches(10) == 18);
+
+	return 0;
+}
@@ -0,0 +1,69 @@
+#include <assert.h>
+
+static int fib(int n)
+{
+	int a = 0, b = 1;
+	for (int i = 0; i < n; i++) {
+		int t = a + b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static int swaps(int n)
+{
+	int x = 1, y = 2;
+	while (n-- > 0) {
+		int t = x;
+		x = y;
+		y = t;
+	}
+
+	return x * 10 + y;
+}
+
+static int maybe_uninit(int c)
+{
+	int x;
+	if (c)
+		x = 5;
+	else
+		return 0;
+
+	return x;
+}
+
+static int count_down(int n)
+{
+	int steps = 0;
+	do {
+		steps++;
+	} while (--n > 0);
+
+	return steps;
+}
+
+static int address_taken(void)
+{
+	int x = 1;
+	int *p = &x;
+	*p = 7;
+
+	return x;
+}
+
+int main()
+{
+	assert(fib(10) == 55);
+	assert(swaps(3) == 21);
+	assert(swaps(4) == 12);
+	assert(maybe_uninit(1) == 5);
+	assert(maybe_uninit(0) == 0);
+	assert(count_down(5) == 5);
+	assert(count_down(0) == 1);
+	assert(address_taken() == 7);
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+#define VALUE(x) ((x) + 1)
+#define OTHER 3
+#undef VALUE
+#define VALUE 42
+#undef OTHER
+
+#ifdef OTHER
+#error OTHER shouldn't be defined here!
+#endif
+
+int main()
+{
+	return VALUE == 42 ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+#include <assert.h>
+
+int dense(int x)
+{
+	switch (x) {
+	case 0: return 10;
+	case 1: return 11;
+	case 2: return 12;
+	case 4: return 14;
+	case 5: return 15;
+	case 6:
+	case 7: return 17;
+	default: return -1;
+	}
+}
+
+int sparse(int x)
+{
+	switch (x) {
+	case -1000: return 1;
+	case 3: return 2;
+	case 70: return 3;
+	case 1000: return 4;
+	case 123456: return 5;
+	case 2147483647: return 6;
+	default: return 0;
+	}
+}
+
+int mixed(long x)
+{
+	int a = 0;
+	switch (x) {
+	case -3: a += 1;
+	case -2: a += 2;
+	case -1: a += 4;
+	case 0: a += 8;
+		break;
+	default: a = 100;
+		break;
+	case 50: a = 50;
+		break;
+	case 1000: case 1001: case 1002: case 1003: case 1004:
+		a = 1000;
+		break;
+	}
+
+	return a;
+}
+
+unsigned big_unsigned(unsigned x)
+{
+	switch (x) {
+	case 0xFFFFFFFC: return 1;
+	case 0xFFFFFFFD: return 2;
+	case 0xFFFFFFFE: return 3;
+	case 0xFFFFFFFF: return 4;
+	case 0: return 5;
+	default: return 0;
+	}
+}
+
+int chars(char c)
+{
+	switch (c) {
+	case 'a': return 1;
+	case 'b': return 2;
+	case 'c': return 3;
+	case 'd': return 4;
+	case 'z': return 26;
+	default: return 0;
+	}
+}
+
+int in_loop(int n)
+{
+	int total = 0;
+	for (int i = 0; i < n; i++) {
+		switch (i % 6) {
+		case 0: total += 1; break;
+		case 1: total += 2; break;
+		case 2: total += 3;
+		case 3: total += 4; break;
+		case 4: continue;
+		default: total *= 2; break;
+		}
+		total++;
+	}
+
+	return total;
+}
+
+int main()
+{
+	assert(dense(0) == 10);
+	assert(dense(2) == 12);
+	assert(dense(3) == -1);
+	assert(dense(6) == 17);
+	assert(dense(7) == 17);
+	assert(dense(8) == -1);
+	assert(dense(-1) == -1);
+
+	assert(sparse(-1000) == 1);
+	assert(sparse(3) == 2);
+	assert(sparse(70) == 3);
+	assert(sparse(1000) == 4);
+	assert(sparse(123456) == 5);
+	assert(sparse(2147483647) == 6);
+	assert(sparse(4) == 0);
+	assert(sparse(-2147483647 - 1) == 0);
+
+	assert(mixed(-3) == 15);
+	assert(mixed(-2) == 14);
+	assert(mixed(-1) == 12);
+	assert(mixed(0) == 8);
+	assert(mixed(-4) == 100);
+	assert(mixed(1) == 100);
+	assert(mixed(50) == 50);
+	assert(mixed(1003) == 1000);
+	assert(mixed(1005) == 100);
+
+	assert(big_unsigned(0xFFFFFFFC) == 1);
+	assert(big_unsigned(0xFFFFFFFF) == 4);
+	assert(big_unsigned(0) == 5);
+	assert(big_unsigned(1) == 0);
+	assert(big_unsigned(0xFFFFFFFB) == 0);
+
+	assert(chars('a') == 1);
+	assert(chars('d') == 4);
+	assert(chars('e') == 0);
+	assert(chars('z') == 26);
+	assert(chars(-1) == 0);
+
+	assert(in_loop(12) == 111);
+
+	return 0;
+}
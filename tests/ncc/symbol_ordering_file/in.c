@@ -0,0 +1,33 @@
+// FLAGS: -ffunction-sections -Wl,--symbol-ordering-file=order.txt
+#include <assert.h>
+
+int first(void)
+{
+	return 1;
+}
+
+int second(void)
+{
+	return 2;
+}
+
+int third(void)
+{
+	return 3;
+}
+
+typedef int (*Function)(void);
+
+int main()
+{
+	assert(first() + second() + third() == 6);
+
+	// order.txt names these in reverse.
+	Function first_ptr = first;
+	Function second_ptr = second;
+	Function third_ptr = third;
+	assert((char *)third_ptr < (char *)second_ptr);
+	assert((char *)second_ptr < (char *)first_ptr);
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+# Argument handling and ncc invocation shared by the tools/bench_*.py scripts.
+#
+# Every benchmark takes an optional path to ncc (defaulting to ./ncc), any
+# number of numeric arguments giving the sizes to run, and, for some
+# benchmarks, extra flags starting with '-'.
+
+import os
+import subprocess
+import sys
+import time
+
+def parse_args():
+    """Returns (absolute path to ncc, numeric arguments, flags)."""
+    ncc = './ncc'
+    numbers = []
+    flags = []
+    for arg in sys.argv[1:]:
+        if arg.isdigit():
+            numbers.append(int(arg))
+        elif arg.startswith('-'):
+            flags.append(arg)
+        else:
+            ncc = arg
+    return os.path.abspath(ncc), numbers, flags
+
+def number_arg(numbers, index, default):
+    return numbers[index] if len(numbers) > index else default
+
+def run_ncc(ncc, args):
+    """Runs ncc with the given arguments, discarding its output, and returns
+    how long it took in seconds."""
+    start = time.time()
+    subprocess.check_call([ncc] + args, stdout=subprocess.DEVNULL)
+    return time.time() - start
@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+
+# Measures how preprocessing time scales with the number of include
+# directories. Generates the given number of -I directories, each holding a
+# few headers, and a source file that includes every header from the last
+# directory searched, the given number of times in total. The headers have no
+# include guards, so every #include has to be resolved and read. Only the
+# preprocessor is run (ncc -E).
+#
+# Usage: tools/bench_include_paths.py [path to ncc] [num dirs] [num includes]
+
+import os
+import tempfile
+
+from bench_common import number_arg, parse_args, run_ncc
+
+HEADERS_PER_DIR = 4
+
+def main():
+    ncc, numbers, _ = parse_args()
+    num_dirs = number_arg(numbers, 0, 100)
+    num_includes = number_arg(numbers, 1, 10000)
+
+    with tempfile.TemporaryDirectory() as tmp:
+        include_flags = []
+        for i in range(num_dirs):
+            include_dir = os.path.join(tmp, 'dir_%d' % i)
+            os.mkdir(include_dir)
+            include_flags.append('-I' + include_dir)
+            for j in range(HEADERS_PER_DIR):
+                with open(os.path.join(include_dir, 'h_%d_%d.h' % (i, j)), 'w') as f:
+                    f.write('int x_%d_%d;\n' % (i, j))
+
+        lines = []
+        for i in range(num_includes):
+            lines.append('#include <h_%d_%d.h>'
+                    % (num_dirs - 1, i % HEADERS_PER_DIR))
+        src = os.path.join(tmp, 'bench.c')
+        with open(src, 'w') as f:
+            f.write('\n'.join(lines) + '\n')
+
+        elapsed = run_ncc(ncc, ['-E', src] + include_flags)
+
+    print('%10s %12s %10s' % ('dirs', 'includes', 'seconds'))
+    print('%10d %12d %10.3f' % (num_dirs, num_includes, elapsed))
+
+if __name__ == '__main__':
+    main()
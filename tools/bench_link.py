@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+
+# Measures how link time scales with the number of global symbols. Generates
+# a program with the given number of functions spread across many object
+# files, where each function calls one defined in a different object file, so
+# that every symbol is both defined and referenced from elsewhere.
+#
+# Each link is run with every given number of linker jobs, and the resulting
+# executables are checked to be byte-identical.
+#
+# Usage: tools/bench_link.py [path to ncc] [-jN...] [num functions...]
+
+import filecmp
+import multiprocessing
+import os
+import subprocess
+import sys
+import tempfile
+
+from bench_common import parse_args, run_ncc
+
+FUNCTIONS_PER_OBJECT = 1000
+
+def generate(object_index, num_objects):
+    lines = []
+    next_object = (object_index + 1) % num_objects
+    for i in range(FUNCTIONS_PER_OBJECT):
+        lines.append('int f_%d_%d(int x);' % (next_object, i))
+    for i in range(FUNCTIONS_PER_OBJECT):
+        lines += [
+            'int f_%d_%d(int x)' % (object_index, i),
+            '{',
+            '\tif (x <= 0)',
+            '\t\treturn 0;',
+            '\treturn f_%d_%d(x - 1) + 1;' % (next_object, i),
+            '}',
+        ]
+    if object_index == 0:
+        lines += [
+            'int main(void)',
+            '{',
+            '\treturn f_0_0(%d) != %d;' % (num_objects, num_objects),
+            '}',
+        ]
+    return '\n'.join(lines) + '\n'
+
+def compile_object(args):
+    ncc, src, obj = args
+    run_ncc(ncc, ['-c', src, '-o', obj])
+
+def main():
+    ncc, sizes, flags = parse_args()
+    job_counts = [int(flag[2:]) for flag in flags
+            if flag.startswith('-j') and flag[2:].isdigit()]
+    if len(sizes) == 0:
+        sizes = [10000, 25000, 50000, 100000]
+    if len(job_counts) == 0:
+        job_counts = [1]
+
+    print('%10s %8s %5s %10s' % ('functions', 'objects', 'jobs', 'seconds'))
+    with tempfile.TemporaryDirectory() as tmp:
+        for size in sizes:
+            num_objects = max(1, size // FUNCTIONS_PER_OBJECT)
+            compile_jobs = []
+            objs = []
+            for i in range(num_objects):
+                src = os.path.join(tmp, 'bench_%d.c' % i)
+                obj = os.path.join(tmp, 'bench_%d.o' % i)
+                with open(src, 'w') as f:
+                    f.write(generate(i, num_objects))
+                compile_jobs.append((ncc, src, obj))
+                objs.append(obj)
+
+            with multiprocessing.Pool() as pool:
+                pool.map(compile_object, compile_jobs)
+
+            first_exe = None
+            for jobs in job_counts:
+                exe = os.path.join(tmp, 'bench_j%d' % jobs)
+                elapsed = run_ncc(ncc, ['-j%d' % jobs, '-o', exe] + objs)
+
+                subprocess.check_call([exe])
+                print('%10d %8d %5d %10.3f' % (num_objects * FUNCTIONS_PER_OBJECT,
+                    num_objects, jobs, elapsed))
+
+                if first_exe is None:
+                    first_exe = exe
+                elif not filecmp.cmp(first_exe, exe, shallow=False):
+                    print('Output with %d jobs differs from %d jobs'
+                            % (jobs, job_counts[0]))
+                    sys.exit(1)
+
+if __name__ == '__main__':
+    main()
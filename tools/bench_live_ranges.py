@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+
+# Measures how compile time scales with function size, using the kind of code
+# that stresses liveness analysis: a single large switch-based state machine,
+# where every case is a separate block and the locals are live throughout.
+#
+# Usage: tools/bench_live_ranges.py [path to ncc] [num cases...]
+
+import os
+import subprocess
+import tempfile
+
+from bench_common import parse_args, run_ncc
+
+def generate(num_cases):
+    lines = [
+        'int run(int state, int x)',
+        '{',
+        '\tint a = 0, b = 1, c = 2, d = 3;',
+        '\tfor (;;) {',
+        '\t\tswitch (state) {',
+    ]
+    for i in range(num_cases):
+        lines += [
+            '\t\tcase %d:' % i,
+            '\t\t\ta += x + %d;' % i,
+            '\t\t\tb ^= a;',
+            '\t\t\tc = c * 3 + b;',
+            '\t\t\tif (c > d) d = c - a;',
+            '\t\t\tstate = %d;' % ((i * 7 + 1) % num_cases),
+            '\t\t\tbreak;',
+        ]
+    lines += [
+        '\t\tdefault:',
+        '\t\t\treturn a + b + c + d;',
+        '\t\t}',
+        '\t}',
+        '}',
+    ]
+    return '\n'.join(lines) + '\n'
+
+def main():
+    ncc, sizes, _ = parse_args()
+    if len(sizes) == 0:
+        sizes = [250, 500, 1000, 2000, 4000]
+
+    print('%8s %10s %10s' % ('cases', 'instrs', 'seconds'))
+    with tempfile.TemporaryDirectory() as tmp:
+        src = os.path.join(tmp, 'bench.c')
+        obj = os.path.join(tmp, 'bench.o')
+        for size in sizes:
+            with open(src, 'w') as f:
+                f.write(generate(size))
+
+            elapsed = run_ncc(ncc, ['-c', src, '-o', obj])
+
+            asm = subprocess.check_output([ncc, '-dump-asm', '-c', src, '-o', obj])
+            num_instrs = sum(1 for line in asm.splitlines()
+                    if line.startswith(b'\t'))
+
+            print('%8d %10d %10.3f' % (size, num_instrs, elapsed))
+
+if __name__ == '__main__':
+    main()
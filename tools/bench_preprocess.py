@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+
+# Measures how preprocessing time scales with the number of macros defined.
+# Generates a header defining the given number of object-like macros, and a
+# source file that refers to them, along with identifiers that aren't macros,
+# the given number of times in total. Only the preprocessor is run (ncc -E).
+#
+# Usage: tools/bench_preprocess.py [path to ncc] [num macros] [num references]
+
+import os
+import tempfile
+
+from bench_common import number_arg, parse_args, run_ncc
+
+REFERENCES_PER_LINE = 10
+
+def generate_header(num_macros):
+    lines = ['#ifndef BENCH_MACROS_H', '#define BENCH_MACROS_H']
+    for i in range(num_macros):
+        lines.append('#define MACRO_%d %d' % (i, i))
+    lines.append('#endif')
+    return '\n'.join(lines) + '\n'
+
+def generate_source(num_macros, num_references):
+    lines = ['#include "macros.h"', 'int values[] = {']
+    for i in range(0, num_references, REFERENCES_PER_LINE):
+        # Every other reference is to a plain identifier, which still has to
+        # be looked up to find out that it isn't a macro.
+        refs = []
+        for j in range(i, min(i + REFERENCES_PER_LINE, num_references)):
+            if j % 2 == 0:
+                refs.append('MACRO_%d' % ((j * 7919) % num_macros))
+            else:
+                refs.append('ident_%d' % (j % num_macros))
+        lines.append('\t' + ', '.join(refs) + ',')
+    lines.append('};')
+    return '\n'.join(lines) + '\n'
+
+def main():
+    ncc, numbers, _ = parse_args()
+    num_macros = number_arg(numbers, 0, 10000)
+    num_references = number_arg(numbers, 1, 1000000)
+
+    with tempfile.TemporaryDirectory() as tmp:
+        with open(os.path.join(tmp, 'macros.h'), 'w') as f:
+            f.write(generate_header(num_macros))
+        src = os.path.join(tmp, 'bench.c')
+        with open(src, 'w') as f:
+            f.write(generate_source(num_macros, num_references))
+
+        elapsed = run_ncc(ncc, ['-E', src])
+
+    print('%10s %12s %10s' % ('macros', 'references', 'seconds'))
+    print('%10d %12d %10.3f' % (num_macros, num_references, elapsed))
+
+if __name__ == '__main__':
+    main()